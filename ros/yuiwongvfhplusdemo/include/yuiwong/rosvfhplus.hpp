@@ -22,27 +22,72 @@
 #include <tf/transform_datatypes.h>
 #include <tf/transform_listener.h>
 #include <tf/transform_broadcaster.h>
+#include <atomic>
+#include <thread>
 #include "yuiwong/vfhplus.hpp"
+#include "yuiwong/vfhlog.hpp"
+#include "yuiwong/vfhtrace.hpp"
+#include "yuiwong/vfhmailbox.hpp"
+#include "yuiwong/vfhstats.hpp"
 namespace yuiwong {
 struct VfhPlusNode {
 	VfhPlusNode(ros::NodeHandle nh, ros::NodeHandle pnh);
 	~VfhPlusNode();
-	void update(double const desiredAngle);
+	/**
+	 * @brief plan and publish a command, on the worker thread
+	 * @param stamp the scan header stamp, in seconds
+	 * @param desiredAngle the desired direction, in radian
+	 * @param receivedTicks VfhTicks() when the scan came in
+	 */
+	void update(
+		double const stamp,
+		double const desiredAngle,
+		uint64_t const receivedTicks);
 private:
+	/* a scan handed to the worker */
+	struct ScanFrame {
+		sensor_msgs::LaserScanConstPtr scan;
+		uint64_t receivedTicks;/* VfhTicks() in scanCallback */
+	};
+	/* what the worker needs of the odometry */
+	struct OdomFrame {
+		double linearX;/* meter/s */
+		double desiredAngle;/* ::atan2(angularzVelocity, linearxVelocity) */
+		double desiredStamp;
+	};
 	boost::shared_ptr<VfhPlus> vfh;
-	double robotLinearX;/* meter/s */
 	std::array<double, 361> laserRanges;
 	ros::NodeHandle nh;
 	ros::NodeHandle pnh;
 	ros::Subscriber scanSubscriber;
 	ros::Subscriber odomSubscriber;
 	ros::Publisher velPublisher;
+	/* scan/decision log, open when ~log_path is set */
+	VfhLogWriter log;
+	/* span tracer, set when ~trace_path is set */
+	std::unique_ptr<VfhTracer> tracer;
+	/*
+	 * the callbacks only hand scans and odometry over, latest wins, the
+	 * worker thread plans and publishes: a slow update neither delays
+	 * the odometry nor queues stale scans
+	 */
+	VfhMailbox<ScanFrame> scans;
+	VfhMailbox<OdomFrame> odoms;
+	OdomFrame postedOdom;/* callback side */
+	OdomFrame odom;/* worker side, the last one taken */
+	std::thread worker;
+	/* scans and odometry replaced before the worker took them */
+	std::atomic<uint64_t> droppedScans;
+	std::atomic<uint64_t> droppedOdoms;
+	/* from scanCallback to the command published, worker written */
+	VfhTickHistogram scanToCommand;
+	/* from the scan header stamp to the command published, transport and
+	 * serialization included: compare the node to the nodelet with it */
+	VfhTickHistogram stampToCommand;
 	void scanCallback(sensor_msgs::LaserScanConstPtr const& scan);
 	void odomCallback(nav_msgs::OdometryConstPtr const& odom);
-	struct {
-		double angle;/* ::atan2(angularzVelocity, linearxVelocity) */
-		double stamp;
-	} desiredVelocity;
+	void run();
+	void reportMetrics();
 };
 }
 #endif /* YUIWONGVFHPLUSDEMO_VFPPLUS_HPP */
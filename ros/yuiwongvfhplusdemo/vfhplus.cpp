@@ -16,7 +16,7 @@
 namespace yuiwong
 {
 VfhPlusNode::VfhPlusNode(ros::NodeHandle nh, ros::NodeHandle pnh):
-nh(nh), pnh(pnh)
+nh(nh), pnh(pnh), droppedScans(0), droppedOdoms(0)
 {
 	ROS_INFO("Starting VFH");
 	VfhPlus::Param p;
@@ -60,8 +60,39 @@ nh(nh), pnh(pnh)
 	this->vfh = boost::make_shared<VfhPlus>(p);
 	this->vfh->setRobotRadius(robot_radius);
 	this->vfh->init();
-	this->desiredVelocity.angle = 0;
-	this->desiredVelocity.stamp = 0;
+	std::string logPath("");
+	this->pnh.param<std::string>("log_path", logPath, "");
+	if (logPath.length() > 0) {
+		if (!this->log.open(logPath, p, robot_radius)) {
+			throw std::runtime_error("cannot open log " + logPath);
+		}
+		ROS_INFO("logging scans and decisions to %s", logPath.c_str());
+	}
+	std::string tracePath("");
+	this->pnh.param<std::string>("trace_path", tracePath, "");
+	if (tracePath.length() > 0) {
+		this->tracer.reset(new VfhTracer());
+		if (!this->tracer->start(tracePath)) {
+			throw std::runtime_error("cannot open trace " + tracePath);
+		}
+		this->vfh->setTracer(this->tracer.get());
+		ROS_INFO("tracing planner updates to %s", tracePath.c_str());
+	}
+	std::string dumpPath("");
+	this->pnh.param<std::string>("dump_path", dumpPath, "");
+	if (dumpPath.length() > 0) {
+		int dumpFrames;
+		this->pnh.param<int>("dump_frames", dumpFrames, 256);
+		if (!this->vfh->startDump(dumpPath, dumpFrames)) {
+			throw std::runtime_error("cannot open dump " + dumpPath);
+		}
+		ROS_INFO("dumping the last %d planner grids to %s",
+			dumpFrames, dumpPath.c_str());
+	}
+	this->postedOdom.linearX = 0;
+	this->postedOdom.desiredAngle = 0;
+	this->postedOdom.desiredStamp = 0;
+	this->odom = this->postedOdom;
 	// subscribe to topics
 	std::string scanTopic("");
 	this->pnh.param<std::string>("scan_topic", scanTopic, "/scan");
@@ -82,11 +113,15 @@ nh(nh), pnh(pnh)
 	this->pnh.param<std::string>("topic", t, "/cmd_vel");
 	this->velPublisher = this->nh.advertise<geometry_msgs::Twist>(
 		t, sizeof(size_t));
+	this->worker = std::thread(&VfhPlusNode::run, this);
 }
 VfhPlusNode::~VfhPlusNode()
 {
 	this->scanSubscriber.shutdown();
 	this->odomSubscriber.shutdown();
+	this->scans.close();
+	this->worker.join();
+	this->reportMetrics();
 	/* stop the robot */
 	geometry_msgs::TwistPtr vel(new geometry_msgs::Twist());
 	vel->linear.x = 0.0;
@@ -95,58 +130,147 @@ VfhPlusNode::~VfhPlusNode()
 }
 void VfhPlusNode::odomCallback(nav_msgs::OdometryConstPtr const& odom)
 {
-	this->robotLinearX = odom->twist.twist.linear.x;
+	this->postedOdom.linearX = odom->twist.twist.linear.x;
 	double const yaw = ::atan2(
 		odom->twist.twist.angular.z, odom->twist.twist.linear.x);
 	ROS_INFO_STREAM("odomCallback " << yaw);
 	if (!std::isnan(yaw)) {
-		//this->desiredVelocity.angle = yaw;
-		this->desiredVelocity.angle = 0;
+		//this->postedOdom.desiredAngle = yaw;
+		this->postedOdom.desiredAngle = 0;
 		if (!odom->header.stamp.isSimTime()) {
-			this->desiredVelocity.stamp = odom->header.stamp.toSec();
+			this->postedOdom.desiredStamp = odom->header.stamp.toSec();
 		} else {
-			this->desiredVelocity.stamp = ros::Time::now().toSec();
+			this->postedOdom.desiredStamp = ros::Time::now().toSec();
 		}
 	}
+	if (!this->odoms.post(this->postedOdom)) {
+		this->droppedOdoms.fetch_add(1, std::memory_order_relaxed);
+	}
 }
 void VfhPlusNode::scanCallback(sensor_msgs::LaserScanConstPtr const& scan)
 {
+	VfhTraceSpan const span(this->tracer.get(), "scanCallback");
 	ROS_DEBUG("scanCallbac ranges %zu",scan->ranges.size());
+	ScanFrame const frame = { scan, VfhTicks() };
+	if (!this->scans.post(frame)) {
+		/* the worker was still planning, the older scan is stale now */
+		this->droppedScans.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+/** @brief the worker: plan for the newest scan until shut down */
+void VfhPlusNode::run()
+{
 	double const goalTolerance = 0.2;
-	double desiredAngle;
-	if ((ros::Time::now().toSec() - this->desiredVelocity.stamp)
-		> goalTolerance) {
-		ROS_INFO_STREAM(__LINE__ << " scanCallback: no desiredVelocity");
-		return;
+	double const reportPeriod = 10.0;
+	ros::WallTime reported = ros::WallTime::now();
+	ScanFrame frame;
+	while (this->scans.wait(frame)) {
+		if ((ros::WallTime::now() - reported).toSec() >= reportPeriod) {
+			this->reportMetrics();
+			reported = ros::WallTime::now();
+		}
+		VfhTraceSpan const span(this->tracer.get(), "plan");
+		this->odoms.take(this->odom);
+		sensor_msgs::LaserScan const& scan = *frame.scan;
+		if ((ros::Time::now().toSec() - this->odom.desiredStamp)
+			> goalTolerance) {
+			ROS_INFO_STREAM(__LINE__ << " run: no desiredVelocity");
+			continue;
+		}
+		/* straight from the message, shared with the driver in a nodelet */
+		VfhPlus::convertScan(
+			scan.ranges.data(),
+			scan.ranges.size(),
+			scan.angle_min,
+			scan.angle_max,
+			scan.angle_increment,
+			scan.range_max,
+			this->laserRanges);
+		/* time the planner by the scan itself, not by when it got here */
+		this->update(
+			scan.header.stamp.toSec(),
+			this->odom.desiredAngle,
+			frame.receivedTicks);/* perform vfh+ */
+		/* end to end: transport included, by the driver's stamp */
+		double const sinceStamp =
+			(ros::Time::now() - scan.header.stamp).toSec();
+		if (sinceStamp >= 0) {
+			this->stampToCommand.record(static_cast<uint64_t>(
+				sinceStamp * 1e9 * VfhTicksPerNanosecond()));
+		}
+		frame.scan.reset();
 	}
-	desiredAngle = this->desiredVelocity.angle;
-	VfhPlus::convertScan(
-		scan->ranges,
-		scan->angle_min,
-		scan->angle_max,
-		scan->angle_increment,
-		scan->range_max,
-		this->laserRanges);
-	this->update(desiredAngle);/* perform vfh+ */
 }
-void VfhPlusNode::update(double const desiredAngle)
+/** @brief log the hand-over drops and the scan to command latency */
+void VfhPlusNode::reportMetrics()
+{
+	VfhStageStats const latency = this->scanToCommand.summarize();
+	VfhStageStats const endToEnd = this->stampToCommand.summarize();
+	ROS_INFO(
+		"%lu commands, %lu scans and %lu odometry dropped, scan to command "
+		"mean %.0lf us, p50 %.0lf us, p99 %.0lf us, max %.0lf us, "
+		"scan stamp to command mean %.0lf us, p50 %.0lf us, p99 %.0lf us, "
+		"max %.0lf us",
+		static_cast<unsigned long>(latency.count),
+		static_cast<unsigned long>(
+			this->droppedScans.load(std::memory_order_relaxed)),
+		static_cast<unsigned long>(
+			this->droppedOdoms.load(std::memory_order_relaxed)),
+		latency.meanNs * 1e-3,
+		latency.p50Ns * 1e-3,
+		latency.p99Ns * 1e-3,
+		latency.maxNs * 1e-3,
+		endToEnd.meanNs * 1e-3,
+		endToEnd.p50Ns * 1e-3,
+		endToEnd.p99Ns * 1e-3,
+		endToEnd.maxNs * 1e-3);
+}
+void VfhPlusNode::update(
+	double const stamp,
+	double const desiredAngle,
+	uint64_t const receivedTicks)
 {
 	double const desiredDist = 2.0;
 	double const currGoalDistanceTolerance = 0.250;
+	double const currentLinearX = 0.3;//this->odom.linearX;
 	double chosenLinearX, chosenAngularZ;
 	this->vfh->update(
+		stamp,
 		this->laserRanges,
-		0.3,//this->robotLinearX,
+		currentLinearX,
 		//desiredAngle + (M_PI / 2.0),
 		desiredAngle,
 		desiredDist,
 		currGoalDistanceTolerance,
 		chosenLinearX,
 		chosenAngularZ);
+	if (this->log.isOpen()) {
+		VfhTraceSpan const span(this->tracer.get(), "logWrite");
+		VfhLogRecord record;
+		record.stamp = stamp;
+		record.currentLinearX = currentLinearX;
+		record.goalDirection = desiredAngle;
+		record.goalDistance = desiredDist;
+		record.goalDistanceTolerance = currGoalDistanceTolerance;
+		record.chosenLinearX = chosenLinearX;
+		record.chosenAngularZ = chosenAngularZ;
+		std::copy(
+			this->laserRanges.begin(),
+			this->laserRanges.end(),
+			record.laserRanges);
+		if (!this->log.write(
+			record, this->vfh->Hist, this->vfh->getHistogramSize())) {
+			ROS_WARN_THROTTLE(1.0, "cannot write the scan/decision log");
+		}
+	}
 	geometry_msgs::TwistPtr vel(new geometry_msgs::Twist());
 	vel->linear.x = chosenLinearX;
 	vel->angular.z = chosenAngularZ;
+	{
+	VfhTraceSpan const span(this->tracer.get(), "publish");
 	velPublisher.publish(vel);
+	}
+	this->scanToCommand.record(VfhTicks() - receivedTicks);
 	ROS_INFO(
 		"angular %lf -> linear x %lf, angular z %lf",
 		desiredAngle,
@@ -154,12 +278,3 @@ void VfhPlusNode::update(double const desiredAngle)
 		vel->angular.z);
 }
 }
-int main(int argc, char** argv)
-{
-	ros::init(argc, argv, "VFH +");
-	ros::NodeHandle nh;
-	ros::NodeHandle pnh("~");
-	yuiwong::VfhPlusNode vfh(nh, pnh);
-	ros::spin();
-	return 0;
-}
@@ -0,0 +1,33 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ *(at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * the node as a nodelet: loaded into the lidar driver's nodelet manager,
+ * scans come as the driver's own message, no TCPROS, no copy
+ */
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "yuiwong/rosvfhplus.hpp"
+namespace yuiwong
+{
+struct VfhPlusNodelet: public nodelet::Nodelet {
+private:
+	virtual void onInit() override {
+		this->node.reset(new VfhPlusNode(
+			this->getNodeHandle(), this->getPrivateNodeHandle()));
+	}
+	std::unique_ptr<VfhPlusNode> node;
+};
+}
+PLUGINLIB_EXPORT_CLASS(yuiwong::VfhPlusNodelet, nodelet::Nodelet)
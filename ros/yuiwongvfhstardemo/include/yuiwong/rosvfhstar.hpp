@@ -12,8 +12,8 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * ======================================================================== */
-#ifndef YUIWONGVFHPLUSDEMO_VFPPLUS_HPP
-#define YUIWONGVFHPLUSDEMO_VFPPLUS_HPP
+#ifndef YUIWONGVFHSTARDEMO_VFHSTAR_HPP
+#define YUIWONGVFHSTARDEMO_VFHSTAR_HPP
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
 #include <geometry_msgs/Pose2D.h>
@@ -22,27 +22,73 @@
 #include <tf/transform_datatypes.h>
 #include <tf/transform_listener.h>
 #include <tf/transform_broadcaster.h>
+#include <atomic>
+#include <thread>
+#include "yuiwong/vfhplus.hpp"
 #include "yuiwong/vfhstar.hpp"
+#include "yuiwong/vfhlog.hpp"
+#include "yuiwong/vfhtrace.hpp"
+#include "yuiwong/vfhmailbox.hpp"
+#include "yuiwong/vfhstats.hpp"
 namespace yuiwong {
-struct VfhPlusNode {
-	VfhPlusNode(ros::NodeHandle nh, ros::NodeHandle pnh);
-	~VfhPlusNode();
-	void update(double const desiredAngle);
+struct VfhStarNode {
+	VfhStarNode(ros::NodeHandle nh, ros::NodeHandle pnh);
+	~VfhStarNode();
+	/**
+	 * @brief plan and publish a command, on the worker thread
+	 * @param stamp the scan header stamp, in seconds
+	 * @param desiredAngle the desired direction, in radian
+	 * @param receivedTicks VfhTicks() when the scan came in
+	 */
+	void update(
+		double const stamp,
+		double const desiredAngle,
+		uint64_t const receivedTicks);
 private:
-	boost::shared_ptr<VfhPlus> vfh;
-	double robotLinearX;/* meter/s */
+	/* a scan handed to the worker */
+	struct ScanFrame {
+		sensor_msgs::LaserScanConstPtr scan;
+		uint64_t receivedTicks;/* VfhTicks() in scanCallback */
+	};
+	/* what the worker needs of the odometry */
+	struct OdomFrame {
+		double linearX;/* meter/s */
+		double desiredAngle;/* ::atan2(angularzVelocity, linearxVelocity) */
+		double desiredStamp;
+	};
+	boost::shared_ptr<VfhStar> vfh;
 	std::array<double, 361> laserRanges;
 	ros::NodeHandle nh;
 	ros::NodeHandle pnh;
 	ros::Subscriber scanSubscriber;
 	ros::Subscriber odomSubscriber;
 	ros::Publisher velPublisher;
+	/* scan/decision log, open when ~log_path is set */
+	VfhLogWriter log;
+	/* span tracer, set when ~trace_path is set */
+	std::unique_ptr<VfhTracer> tracer;
+	/*
+	 * the callbacks only hand scans and odometry over, latest wins, the
+	 * worker thread plans and publishes: a slow update neither delays
+	 * the odometry nor queues stale scans
+	 */
+	VfhMailbox<ScanFrame> scans;
+	VfhMailbox<OdomFrame> odoms;
+	OdomFrame postedOdom;/* callback side */
+	OdomFrame odom;/* worker side, the last one taken */
+	std::thread worker;
+	/* scans and odometry replaced before the worker took them */
+	std::atomic<uint64_t> droppedScans;
+	std::atomic<uint64_t> droppedOdoms;
+	/* from scanCallback to the command published, worker written */
+	VfhTickHistogram scanToCommand;
+	/* from the scan header stamp to the command published, transport and
+	 * serialization included: compare the node to the nodelet with it */
+	VfhTickHistogram stampToCommand;
 	void scanCallback(sensor_msgs::LaserScanConstPtr const& scan);
 	void odomCallback(nav_msgs::OdometryConstPtr const& odom);
-	struct {
-		double angle;/* ::atan2(angularzVelocity, linearxVelocity) */
-		double stamp;
-	} desiredVelocity;
+	void run();
+	void reportMetrics();
 };
 }
-#endif /* YUIWONGVFHPLUSDEMO_VFPPLUS_HPP */
+#endif /* YUIWONGVFHSTARDEMO_VFHSTAR_HPP */
@@ -15,53 +15,85 @@
 #include "yuiwong/rosvfhstar.hpp"
 namespace yuiwong
 {
-VfhPlusNode::VfhPlusNode(ros::NodeHandle nh, ros::NodeHandle pnh):
-nh(nh), pnh(pnh)
+VfhStarNode::VfhStarNode(ros::NodeHandle nh, ros::NodeHandle pnh):
+nh(nh), pnh(pnh), droppedScans(0), droppedOdoms(0)
 {
-	ROS_INFO("Starting VFH");
-	VfhPlus::Param p;
-	p.cell_size = 100;// mm, cell dimension
-	p.window_diameter = 60;// number of cells
-	p.sector_angle = 5;// deg, sector angle
-	if(!this->pnh.getParam("safety_dist_0ms", p.safety_dist_0ms))
-		p.safety_dist_0ms = 100;// mm, double, safe distance at 0 m/s
-	if(!this->pnh.getParam("safety_dist_1ms", p.safety_dist_1ms))
-		p.safety_dist_1ms = 100;// mm, double, safe distance at 1 m/s
-	if(!this->pnh.getParam("max_speed", p.max_speed))
-		p.max_speed = 200;// mm/sec, int, max speed
-	if(!this->pnh.getParam("max_speed_narrow_opening", p.max_speed_narrow_opening))
-		p.max_speed_narrow_opening = 200;// mm/sec, int, max speed in the narrow opening
-	if(!this->pnh.getParam("max_speed_wide_opening", p.max_speed_wide_opening))
-		p.max_speed_wide_opening = 300;// mm/sec, int, max speed in the wide opening
-	if(!this->pnh.getParam("max_acceleration", p.max_acceleration))
-		p.max_acceleration = 200;// mm/sec^2, int, max acceleration
-	if(!this->pnh.getParam("min_turnrate", p.min_turnrate))
-		p.min_turnrate = 40;// deg/sec, int, min turn rate <--- not used
-	if(!this->pnh.getParam("max_turnrate_0ms", p.max_turnrate_0ms))
-		p.max_turnrate_0ms = 40;// deg/sec, int, max turn rate at 0 m/s
-	if(!this->pnh.getParam("max_turnrate_1ms", p.max_turnrate_1ms))
-		p.max_turnrate_1ms = 40;// deg/sec, int, max turn rate at 1 m/s
-	p.min_turn_radius_safety_factor = 1.0;// double ????
-	if(!this->pnh.getParam("free_space_cutoff_0ms", p.free_space_cutoff_0ms))
-		p.free_space_cutoff_0ms = 2000000.0;//double, low threshold free space at 0 m/s
-	if(!this->pnh.getParam("obs_cutoff_0ms", p.obs_cutoff_0ms))
-		p.obs_cutoff_0ms = 4000000.0;//double, high threshold obstacle at 0 m/s
-	if(!this->pnh.getParam("free_space_cutoff_1ms", p.free_space_cutoff_1ms))
-		p.free_space_cutoff_1ms = 2000000.0;//double, low threshold free space at 1 m/s
-	if(!this->pnh.getParam("obs_cutoff_1ms", p.obs_cutoff_1ms))
-		p.obs_cutoff_1ms = 4000000.0;//double, high threshold obstacle at 1 m/s
-	if(!this->pnh.getParam("weight_desired_dir", p.weight_desired_dir))
-		p.weight_desired_dir = 5.0;//double, weight desired direction
-	if(!this->pnh.getParam("weight_current_dir", p.weight_current_dir))
-		p.weight_current_dir = 1.0;//double, weight current direction
-	double robot_radius;
-	if(!this->pnh.getParam("robot_radius", robot_radius))
-		robot_radius = 300.0;// robot radius in mm
-	this->vfh = boost::make_shared<VfhPlus>(p);
-	this->vfh->setRobotRadius(robot_radius);
+	ROS_INFO("Starting VFH*");
+	/* VfhStar::Param's defaults, in meters and radians */
+	VfhStar::Param p;
+	this->pnh.param<double>("cell_width", p.cellWidth, p.cellWidth);
+	this->pnh.param<int>(
+		"window_diameter", p.windowDiameter, p.windowDiameter);
+	this->pnh.param<double>("sector_angle", p.sectorAngle, p.sectorAngle);
+	this->pnh.param<double>("max_speed", p.maxSpeed, p.maxSpeed);
+	this->pnh.param<double>(
+		"max_speed_narrow_opening",
+		p.maxSpeedNarrowOpening,
+		p.maxSpeedNarrowOpening);
+	this->pnh.param<double>(
+		"max_speed_wide_opening",
+		p.maxSpeedWideOpening,
+		p.maxSpeedWideOpening);
+	this->pnh.param<double>(
+		"safety_dist_0ms", p.zeroSafetyDistance, p.zeroSafetyDistance);
+	this->pnh.param<double>(
+		"safety_dist_max", p.maxSafetyDistance, p.maxSafetyDistance);
+	this->pnh.param<double>(
+		"max_turnrate_0ms", p.zeroMaxTurnrate, p.zeroMaxTurnrate);
+	this->pnh.param<double>(
+		"max_turnrate_max", p.maxMaxTurnrate, p.maxMaxTurnrate);
+	this->pnh.param<double>(
+		"free_space_cutoff_0ms",
+		p.zeroFreeSpaceCutoff,
+		p.zeroFreeSpaceCutoff);
+	this->pnh.param<double>(
+		"free_space_cutoff_max",
+		p.maxFreeSpaceCutoff,
+		p.maxFreeSpaceCutoff);
+	this->pnh.param<double>(
+		"obs_cutoff_0ms", p.zeroObsCutoff, p.zeroObsCutoff);
+	this->pnh.param<double>(
+		"obs_cutoff_max", p.maxObsCutoff, p.maxObsCutoff);
+	this->pnh.param<double>(
+		"max_acceleration", p.maxAcceleration, p.maxAcceleration);
+	this->pnh.param<double>(
+		"weight_desired_dir",
+		p.desiredDirectionWeight,
+		p.desiredDirectionWeight);
+	this->pnh.param<double>(
+		"weight_current_dir",
+		p.currentDirectionWeight,
+		p.currentDirectionWeight);
+	this->pnh.param<double>("robot_radius", p.robotRadius, p.robotRadius);
+	this->pnh.param<double>(
+		"step_distance", p.stepDistance, p.stepDistance);
+	this->pnh.param<int>("process_times", p.processTimes, p.processTimes);
+	this->pnh.param<double>(
+		"discount_factor", p.discountFactor, p.discountFactor);
+	this->vfh = boost::make_shared<VfhStar>(p);
 	this->vfh->init();
-	this->desiredVelocity.angle = 0;
-	this->desiredVelocity.stamp = 0;
+	std::string logPath("");
+	this->pnh.param<std::string>("log_path", logPath, "");
+	if (logPath.length() > 0) {
+		if (!this->log.open(logPath, p, p.robotRadius)) {
+			throw std::runtime_error("cannot open log " + logPath);
+		}
+		ROS_INFO("logging scans and decisions to %s", logPath.c_str());
+	}
+	std::string tracePath("");
+	this->pnh.param<std::string>("trace_path", tracePath, "");
+	if (tracePath.length() > 0) {
+		this->tracer.reset(new VfhTracer());
+		if (!this->tracer->start(tracePath)) {
+			throw std::runtime_error("cannot open trace " + tracePath);
+		}
+		this->vfh->setTracer(this->tracer.get());
+		ROS_INFO("tracing planner updates to %s", tracePath.c_str());
+	}
+	this->postedOdom.linearX = 0;
+	this->postedOdom.desiredAngle = 0;
+	this->postedOdom.desiredStamp = 0;
+	this->odom = this->postedOdom;
 	// subscribe to topics
 	std::string scanTopic("");
 	this->pnh.param<std::string>("scan_topic", scanTopic, "/scan");
@@ -69,84 +101,180 @@ nh(nh), pnh(pnh)
 		throw std::logic_error("scan topic is empty");
 	}
 	scanSubscriber = this->nh.subscribe(
-		scanTopic, 1, &VfhPlusNode::scanCallback, this);
+		scanTopic, 1, &VfhStarNode::scanCallback, this);
 	std::string odomTopic("");
 	this->pnh.param<std::string>("odom_topic", odomTopic, "/odom");
 	if(odomTopic.length() <= 0) {
 		throw std::logic_error("odom topic is empty");
 	}
 	odomSubscriber = this->nh.subscribe(
-		odomTopic, 1, &VfhPlusNode::odomCallback, this);
+		odomTopic, 1, &VfhStarNode::odomCallback, this);
 	// cmd_vel publisher
 	std::string t("");
 	this->pnh.param<std::string>("topic", t, "/cmd_vel");
 	this->velPublisher = this->nh.advertise<geometry_msgs::Twist>(
 		t, sizeof(size_t));
+	this->worker = std::thread(&VfhStarNode::run, this);
 }
-VfhPlusNode::~VfhPlusNode()
+VfhStarNode::~VfhStarNode()
 {
 	this->scanSubscriber.shutdown();
 	this->odomSubscriber.shutdown();
+	this->scans.close();
+	this->worker.join();
+	this->reportMetrics();
 	/* stop the robot */
 	geometry_msgs::TwistPtr vel(new geometry_msgs::Twist());
 	vel->linear.x = 0.0;
 	vel->angular.z = 0.0;
 	velPublisher.publish(vel);
 }
-void VfhPlusNode::odomCallback(nav_msgs::OdometryConstPtr const& odom)
+void VfhStarNode::odomCallback(nav_msgs::OdometryConstPtr const& odom)
 {
-	this->robotLinearX = odom->twist.twist.linear.x;
+	this->postedOdom.linearX = odom->twist.twist.linear.x;
 	double const yaw = ::atan2(
 		odom->twist.twist.angular.z, odom->twist.twist.linear.x);
 	ROS_INFO_STREAM("odomCallback " << yaw);
 	if (!std::isnan(yaw)) {
-		//this->desiredVelocity.angle = yaw;
-		this->desiredVelocity.angle = 0;
+		//this->postedOdom.desiredAngle = yaw;
+		this->postedOdom.desiredAngle = 0;
 		if (!odom->header.stamp.isSimTime()) {
-			this->desiredVelocity.stamp = odom->header.stamp.toSec();
+			this->postedOdom.desiredStamp = odom->header.stamp.toSec();
 		} else {
-			this->desiredVelocity.stamp = ros::Time::now().toSec();
+			this->postedOdom.desiredStamp = ros::Time::now().toSec();
 		}
 	}
+	if (!this->odoms.post(this->postedOdom)) {
+		this->droppedOdoms.fetch_add(1, std::memory_order_relaxed);
+	}
 }
-void VfhPlusNode::scanCallback(sensor_msgs::LaserScanConstPtr const& scan)
+void VfhStarNode::scanCallback(sensor_msgs::LaserScanConstPtr const& scan)
 {
+	VfhTraceSpan const span(this->tracer.get(), "scanCallback");
 	ROS_DEBUG("scanCallbac ranges %zu",scan->ranges.size());
+	ScanFrame const frame = { scan, VfhTicks() };
+	if (!this->scans.post(frame)) {
+		/* the worker was still planning, the older scan is stale now */
+		this->droppedScans.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+/** @brief the worker: plan for the newest scan until shut down */
+void VfhStarNode::run()
+{
 	double const goalTolerance = 0.2;
-	double desiredAngle;
-	if ((ros::Time::now().toSec() - this->desiredVelocity.stamp)
-		> goalTolerance) {
-		ROS_INFO_STREAM(__LINE__ << " scanCallback: no desiredVelocity");
-		return;
+	double const reportPeriod = 10.0;
+	ros::WallTime reported = ros::WallTime::now();
+	ScanFrame frame;
+	while (this->scans.wait(frame)) {
+		if ((ros::WallTime::now() - reported).toSec() >= reportPeriod) {
+			this->reportMetrics();
+			reported = ros::WallTime::now();
+		}
+		VfhTraceSpan const span(this->tracer.get(), "plan");
+		this->odoms.take(this->odom);
+		sensor_msgs::LaserScan const& scan = *frame.scan;
+		if ((ros::Time::now().toSec() - this->odom.desiredStamp)
+			> goalTolerance) {
+			ROS_INFO_STREAM(__LINE__ << " run: no desiredVelocity");
+			continue;
+		}
+		/* straight from the message, shared with the driver in a nodelet */
+		VfhPlus::convertScan(
+			scan.ranges.data(),
+			scan.ranges.size(),
+			scan.angle_min,
+			scan.angle_max,
+			scan.angle_increment,
+			scan.range_max,
+			this->laserRanges);
+		/* time the planner by the scan itself, not by when it got here */
+		this->update(
+			scan.header.stamp.toSec(),
+			this->odom.desiredAngle,
+			frame.receivedTicks);/* perform vfh* */
+		/* end to end: transport included, by the driver's stamp */
+		double const sinceStamp =
+			(ros::Time::now() - scan.header.stamp).toSec();
+		if (sinceStamp >= 0) {
+			this->stampToCommand.record(static_cast<uint64_t>(
+				sinceStamp * 1e9 * VfhTicksPerNanosecond()));
+		}
+		frame.scan.reset();
 	}
-	desiredAngle = this->desiredVelocity.angle;
-	VfhPlus::convertScan(
-		scan->ranges,
-		scan->angle_min,
-		scan->angle_max,
-		scan->angle_increment,
-		scan->range_max,
-		this->laserRanges);
-	this->update(desiredAngle);/* perform vfh+ */
 }
-void VfhPlusNode::update(double const desiredAngle)
+/** @brief log the hand-over drops and the scan to command latency */
+void VfhStarNode::reportMetrics()
+{
+	VfhStageStats const latency = this->scanToCommand.summarize();
+	VfhStageStats const endToEnd = this->stampToCommand.summarize();
+	ROS_INFO(
+		"%lu commands, %lu scans and %lu odometry dropped, scan to command "
+		"mean %.0lf us, p50 %.0lf us, p99 %.0lf us, max %.0lf us, "
+		"scan stamp to command mean %.0lf us, p50 %.0lf us, p99 %.0lf us, "
+		"max %.0lf us",
+		static_cast<unsigned long>(latency.count),
+		static_cast<unsigned long>(
+			this->droppedScans.load(std::memory_order_relaxed)),
+		static_cast<unsigned long>(
+			this->droppedOdoms.load(std::memory_order_relaxed)),
+		latency.meanNs * 1e-3,
+		latency.p50Ns * 1e-3,
+		latency.p99Ns * 1e-3,
+		latency.maxNs * 1e-3,
+		endToEnd.meanNs * 1e-3,
+		endToEnd.p50Ns * 1e-3,
+		endToEnd.p99Ns * 1e-3,
+		endToEnd.maxNs * 1e-3);
+}
+void VfhStarNode::update(
+	double const stamp,
+	double const desiredAngle,
+	uint64_t const receivedTicks)
 {
 	double const desiredDist = 2.0;
 	double const currGoalDistanceTolerance = 0.250;
+	double const currentLinearX = 0.3;//this->odom.linearX;
 	double chosenLinearX, chosenAngularZ;
 	this->vfh->update(
+		stamp,
 		this->laserRanges,
-		0.3,//this->robotLinearX,
+		currentLinearX,
 		//desiredAngle + (M_PI / 2.0),
 		desiredAngle,
 		desiredDist,
 		currGoalDistanceTolerance,
 		chosenLinearX,
 		chosenAngularZ);
+	if (this->log.isOpen()) {
+		VfhTraceSpan const span(this->tracer.get(), "logWrite");
+		VfhLogRecord record;
+		record.stamp = stamp;
+		record.currentLinearX = currentLinearX;
+		record.goalDirection = desiredAngle;
+		record.goalDistance = desiredDist;
+		record.goalDistanceTolerance = currGoalDistanceTolerance;
+		record.chosenLinearX = chosenLinearX;
+		record.chosenAngularZ = chosenAngularZ;
+		std::copy(
+			this->laserRanges.begin(),
+			this->laserRanges.end(),
+			record.laserRanges);
+		std::vector<double> const& histogram = this->vfh->getHistogram();
+		if (!this->log.write(
+			record,
+			histogram.data(),
+			static_cast<int>(histogram.size()))) {
+			ROS_WARN_THROTTLE(1.0, "cannot write the scan/decision log");
+		}
+	}
 	geometry_msgs::TwistPtr vel(new geometry_msgs::Twist());
 	vel->linear.x = chosenLinearX;
 	vel->angular.z = chosenAngularZ;
+	{
+	VfhTraceSpan const span(this->tracer.get(), "publish");
 	velPublisher.publish(vel);
+	}
+	this->scanToCommand.record(VfhTicks() - receivedTicks);
 	ROS_INFO(
 		"angular %lf -> linear x %lf, angular z %lf",
 		desiredAngle,
@@ -154,12 +282,3 @@ void VfhPlusNode::update(double const desiredAngle)
 		vel->angular.z);
 }
 }
-int main(int argc, char** argv)
-{
-	ros::init(argc, argv, "VFH +");
-	ros::NodeHandle nh;
-	ros::NodeHandle pnh("~");
-	yuiwong::VfhPlusNode vfh(nh, pnh);
-	ros::spin();
-	return 0;
-}
@@ -0,0 +1,1296 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * micro and macro benchmarks of VfhPlus and VfhStar.
+ * every run uses the same synthetic scans (fixed seed, no library random
+ * distributions), so the JSON written to stdout can be compared across
+ * commits.
+ * usage: yuiwongvfhimpl_bench [--quick] [--filter text] [--label text]
+ * [--threads n] [--perf]
+ * --perf samples hardware counters per stage (see VfhPerfProbe) into the
+ * planners' stats, its syscalls then inflate the latency of the update
+ * runs.
+ * lookahead<threads>.depth<n> is VfhStar's update searching n steps ahead
+ * on a VfhWorkPool of that many threads; lookahead<threads>.deadline
+ * repeats the deepest of those whose p99 fits a 20 Hz cycle, its config
+ * giving the depth. lookahead.anytime<ms> is the budgeted update, up to
+ * that deep, its stats counting the rounds the deadline cut.
+ * lookahead.reroot and lookahead.rebuild drive through a field of posts,
+ * with and without carrying the search over from the update before.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "yuiwong/vfh.hpp"
+#include "yuiwong/vfhplus.hpp"
+#include "yuiwong/vfhpluspack.hpp"
+#include "yuiwong/vfhstar.hpp"
+#include "yuiwong/vfhtrace.hpp"
+#include "yuiwong/vfhworkpool.hpp"
+namespace yuiwong
+{
+namespace
+{
+typedef std::array<double, 361> Ranges;
+struct Options {
+	bool quick;
+	bool perf;
+	std::string filter;
+	std::string label;
+	int threads;
+};
+struct Result {
+	std::string name;
+	std::string config;/* a JSON object */
+	size_t iterations;
+	double itemsPerOp;
+	double seconds;/* total of the timed regions, or wall time */
+	std::vector<double> ns;/* per op */
+	size_t tableBytes;/* cell tables and grids of the planner, 0 if none */
+	std::string stats;/* a JSON object, the planner's own stats, if any */
+};
+double volatile Sink;
+double Uniform(std::mt19937& rng, double const lo, double const hi)
+{
+	return lo + ((hi - lo) * (rng() / 4294967296.0));
+}
+/**
+ * @brief a room with a few boxes approaching the robot, in millimetres,
+ * as convertScan would give them
+ */
+std::vector<Ranges> MakeScene(size_t const frames, uint32_t const seed)
+{
+	std::mt19937 rng(seed);
+	struct Box {
+		int center;
+		int halfWidth;
+		double distance;
+	};
+	std::vector<Box> boxes(6);
+	for (auto& b: boxes) {
+		b.center = static_cast<int>(Uniform(rng, 20, 340));
+		b.halfWidth = static_cast<int>(Uniform(rng, 4, 30));
+		b.distance = Uniform(rng, 800, 3500);
+	}
+	std::vector<Ranges> scene(frames);
+	for (auto& ranges: scene) {
+		for (int i = 0; i < 361; ++i) {
+			ranges[i] = 4000 + Uniform(rng, -10, 10);
+		}
+		for (auto& b: boxes) {
+			for (int i = b.center - b.halfWidth;
+				i <= b.center + b.halfWidth; ++i) {
+				if ((i >= 0) && (i < 361)) {
+					ranges[i] = std::min(
+						ranges[i], b.distance + Uniform(rng, -10, 10));
+				}
+			}
+			b.distance -= 5;
+			if (b.distance < 700) {
+				b.distance = 3500;
+			}
+		}
+	}
+	return scene;
+}
+/**
+ * @brief a room 2.5 m around crowded with posts, some always in front,
+ * so a look-ahead search has to route around them
+ */
+std::vector<Ranges> MakeClutter(size_t const frames, uint32_t const seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<Ranges> scene(frames);
+	for (auto& ranges: scene) {
+		for (int i = 0; i < 361; ++i) {
+			ranges[i] = 2500 + Uniform(rng, -10, 10);
+		}
+		for (int k = 0; k < 16; ++k) {
+			int const center = static_cast<int>((k < 4)
+				? Uniform(rng, 140, 220) : Uniform(rng, 0, 360));
+			int const halfWidth = static_cast<int>(Uniform(rng, 3, 12));
+			double const distance = Uniform(rng, 600, 2200);
+			for (int i = center - halfWidth; i <= center + halfWidth; ++i) {
+				if ((i >= 0) && (i < 361)) {
+					ranges[i] = std::min(ranges[i], distance);
+				}
+			}
+		}
+	}
+	return scene;
+}
+/**
+ * @brief a robot driving step meters a frame straight through a field of
+ * posts, as its laser would see them, in millimetres
+ */
+std::vector<Ranges> MakeWalk(
+	size_t const frames, double const step, uint32_t const seed)
+{
+	std::mt19937 rng(seed);
+	struct Post {
+		double x;
+		double y;
+		double radius;
+	};
+	std::vector<Post> posts(16);
+	for (size_t k = 0; k < posts.size(); ++k) {
+		/* a few across the way, the drive stops short of them */
+		posts[k].x = (k < 5)
+			? Uniform(rng, -0.8, 0.8) : Uniform(rng, -2.2, 2.2);
+		posts[k].y = Uniform(rng, 0.9, 2.0);
+		posts[k].radius = Uniform(rng, 0.1, 0.25);
+	}
+	std::vector<Ranges> scene(frames);
+	for (size_t f = 0; f < frames; ++f) {
+		double const y = f * step;
+		for (int i = 0; i < 361; ++i) {
+			double const a = i * M_PI / 360.0;
+			double const dx = ::cos(a);
+			double const dy = ::sin(a);
+			/* the walls of a room 5 m wide, 4.5 m ahead of the start */
+			double t = 4.0;
+			if (::fabs(dx) > 1e-9) {
+				t = std::min(t, 2.5 / ::fabs(dx));
+			}
+			if (dy > 1e-9) {
+				t = std::min(t, (4.5 - y) / dy);
+			}
+			for (auto const& p: posts) {
+				double const ox = -p.x;
+				double const oy = y - p.y;
+				double const b = (dx * ox) + (dy * oy);
+				double const d = (b * b)
+					- ((ox * ox) + (oy * oy) - (p.radius * p.radius));
+				if ((d > 0) && (-b - ::sqrt(d) > 0)) {
+					t = std::min(t, -b - ::sqrt(d));
+				}
+			}
+			scene[f][i] = (t * 1e3) + Uniform(rng, -10, 10);
+		}
+	}
+	return scene;
+}
+VfhPlus::Param PlusParam(int const window, int const sector, int const tables)
+{
+	VfhPlus::Param p;
+	p.cell_size = 100;
+	p.window_diameter = window;
+	p.sector_angle = sector;
+	p.safety_dist_0ms = 100;
+	p.safety_dist_1ms = (tables > 1) ? 300 : 100;
+	p.max_speed = 400;
+	p.max_speed_narrow_opening = 200;
+	p.max_speed_wide_opening = 300;
+	p.max_acceleration = 200;
+	p.min_turnrate = 40;
+	p.max_turnrate_0ms = 40;
+	p.max_turnrate_1ms = 40;
+	p.min_turn_radius_safety_factor = 1.0;
+	p.free_space_cutoff_0ms = 2e6;
+	p.obs_cutoff_0ms = 4e6;
+	p.free_space_cutoff_1ms = 2e6;
+	p.obs_cutoff_1ms = 4e6;
+	p.weight_desired_dir = 5.0;
+	p.weight_current_dir = 1.0;
+	return p;
+}
+VfhStar::Param StarParam(int const window, int const sector, int const tables)
+{
+	VfhStar::Param p;
+	p.windowDiameter = window;
+	p.sectorAngle = sector * M_PI / 180.0;
+	if (tables <= 1) {
+		p.maxSafetyDistance = p.zeroSafetyDistance;
+	}
+	return p;
+}
+std::string Config(int const window, int const sector, int const tables)
+{
+	char buf[128];
+	snprintf(
+		buf,
+		sizeof(buf),
+		"{\"window_diameter\": %d, \"sector_angle\": %d, \"tables\": %d}",
+		window,
+		sector,
+		tables);
+	return buf;
+}
+double Percentile(std::vector<double> const& sorted, double const p)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t const i = std::min(
+		sorted.size() - 1,
+		static_cast<size_t>(::ceil(p * sorted.size())) - 1);
+	return sorted[i];
+}
+void Print(Result const& r, bool const last)
+{
+	std::vector<double> sorted(r.ns);
+	std::sort(sorted.begin(), sorted.end());
+	double sum = 0;
+	for (double const v: sorted) {
+		sum += v;
+	}
+	printf(
+		"    {\"name\": \"%s\", \"config\": %s, \"iterations\": %zu, "
+		"\"throughput_per_s\": %.1lf, \"mean_ns\": %.1lf, "
+		"\"p50_ns\": %.1lf, \"p99_ns\": %.1lf, \"p999_ns\": %.1lf, "
+		"\"max_ns\": %.1lf, \"table_bytes\": %zu%s%s}%s\n",
+		r.name.c_str(),
+		r.config.c_str(),
+		r.iterations,
+		(r.seconds > 0) ? (r.iterations * r.itemsPerOp / r.seconds) : 0.0,
+		sorted.empty() ? 0.0 : (sum / sorted.size()),
+		Percentile(sorted, 0.5),
+		Percentile(sorted, 0.99),
+		Percentile(sorted, 0.999),
+		sorted.empty() ? 0.0 : sorted.back(),
+		r.tableBytes,
+		r.stats.empty() ? "" : ", \"stats\": ",
+		r.stats.c_str(),
+		last ? "" : ",");
+}
+std::string StatsJson(VfhStats::Snapshot const& s)
+{
+	if (!s.enabled) {
+		return "{}";
+	}
+	std::string json("{");
+	char buf[256];
+	for (int i = 0; i < VfhStats::StageCount; ++i) {
+		VfhStageStats const& st = s.stages[i];
+		snprintf(
+			buf,
+			sizeof(buf),
+			"\"%s\": {\"count\": %llu, \"mean_ns\": %.1lf, "
+			"\"p50_ns\": %.1lf, \"p99_ns\": %.1lf, \"p999_ns\": %.1lf, "
+			"\"max_ns\": %.1lf}, ",
+			VfhStats::stageName(static_cast<VfhStats::Stage>(i)),
+			static_cast<unsigned long long>(st.count),
+			st.meanNs,
+			st.p50Ns,
+			st.p99Ns,
+			st.p999Ns,
+			st.maxNs);
+		json += buf;
+	}
+	for (int i = 0; i < VfhStats::EventCount; ++i) {
+		snprintf(
+			buf,
+			sizeof(buf),
+			"\"%s\": %llu%s",
+			VfhStats::eventName(static_cast<VfhStats::Event>(i)),
+			static_cast<unsigned long long>(s.events[i]),
+			(i + 1 < VfhStats::EventCount) ? ", " : "");
+		json += buf;
+	}
+	uint64_t const probes = s.events[VfhStats::EventTranspositionHit]
+		+ s.events[VfhStats::EventTranspositionMiss];
+	if (probes > 0) {
+		snprintf(
+			buf,
+			sizeof(buf),
+			", \"transpositionHitRate\": %.4lf",
+			static_cast<double>(s.events[VfhStats::EventTranspositionHit])
+			/ probes);
+		json += buf;
+	}
+	if (s.perfAvailable != 0) {
+		json += ", \"perf\": {";
+		for (int i = 0; i < VfhStats::StageCount; ++i) {
+			VfhStagePerf const& p = s.perf[i];
+			snprintf(
+				buf,
+				sizeof(buf),
+				"%s\"%s\": {\"samples\": %llu",
+				(i > 0) ? ", " : "",
+				VfhStats::stageName(static_cast<VfhStats::Stage>(i)),
+				static_cast<unsigned long long>(p.samples));
+			json += buf;
+			for (int k = 0; k < VfhPerfProbe::CounterCount; ++k) {
+				if ((s.perfAvailable & (1u << k)) == 0) {
+					continue;
+				}
+				snprintf(
+					buf,
+					sizeof(buf),
+					", \"%s\": %.1lf",
+					VfhPerfProbe::counterName(
+						static_cast<VfhPerfProbe::Counter>(k)),
+					p.mean[k]);
+				json += buf;
+			}
+			json += "}";
+		}
+		json += "}";
+	}
+	json += "}";
+	return json;
+}
+struct Runner {
+	Options const& options;
+	std::vector<Result> results;
+	explicit Runner(Options const& options): options(options) {}
+	bool wanted(std::string const& name) const {
+		return this->options.filter.empty()
+			|| (name.find(this->options.filter) != std::string::npos);
+	}
+	size_t iterations(size_t const n) const {
+		return this->options.quick ? std::max<size_t>(1, n / 10) : n;
+	}
+	/**
+	 * @brief time op(i) for every iteration, setup(i) runs untimed right
+	 * before it
+	 */
+	template <typename Setup, typename Op>
+	void run(
+		std::string const& name,
+		std::string const& config,
+		size_t const n,
+		Setup setup,
+		Op op,
+		double const itemsPerOp = 1) {
+		if (!this->wanted(name)) {
+			return;
+		}
+		size_t const iterations = this->iterations(n);
+		size_t const warmup = std::min<size_t>(iterations / 10, 100);
+		for (size_t i = 0; i < warmup; ++i) {
+			setup(i);
+			op(i);
+		}
+		Result r;
+		r.name = name;
+		r.config = config;
+		r.iterations = iterations;
+		r.itemsPerOp = itemsPerOp;
+		r.ns.resize(iterations);
+		double total = 0;
+		for (size_t i = 0; i < iterations; ++i) {
+			setup(i);
+			auto const t0 = std::chrono::steady_clock::now();
+			op(i);
+			auto const t1 = std::chrono::steady_clock::now();
+			r.ns[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+			total += r.ns[i];
+		}
+		r.seconds = total * 1e-9;
+		r.tableBytes = 0;
+		this->results.push_back(r);
+	}
+	/**
+	 * @brief the memory and the stats of the planner of the last run, if
+	 * it ran
+	 */
+	void planner(
+		std::string const& name,
+		size_t const bytes,
+		VfhStats::Snapshot const& stats) {
+		if (!this->results.empty() && (this->results.back().name == name)) {
+			this->results.back().tableBytes = bytes;
+			this->results.back().stats = StatsJson(stats);
+		}
+	}
+	void add(Result const& r) {
+		if (this->wanted(r.name)) {
+			this->results.push_back(r);
+		}
+	}
+};
+inline void NoSetup(size_t) {}
+}
+/** @brief reaches into the planners for the per stage benchmarks */
+struct VfhBench {
+	static size_t TableBytes(VfhPlus const& v) {
+		size_t n = 0;
+		for (auto const& t: v.Cell_Sector) {
+			for (auto const& column: t) {
+				for (auto const& cell: column) {
+					n += sizeof(cell) + (cell.capacity() * sizeof(int));
+				}
+			}
+		}
+		n += v.cellArc.capacity() * sizeof(v.cellArc[0]);
+		n += 5 * v.WINDOW_DIAMETER * v.WINDOW_DIAMETER * sizeof(double);
+		return n;
+	}
+	static size_t TableBytes(VfhStar const& v) {
+		size_t n = v.cellSector.capacity() * sizeof(v.cellSector[0]);
+		n += v.windowCells.capacity() * sizeof(v.windowCells[0]);
+		n += 5 * v.windowDiameter * v.windowDiameter * sizeof(double);
+		return n;
+	}
+	/** @brief every stage of VfhPlus and its update, one configuration */
+	static void Plus(
+		Runner& runner,
+		int const window,
+		int const sector,
+		int const tables,
+		bool const stages) {
+		std::string const config = Config(window, sector, tables);
+		VfhPlus::Param const param = PlusParam(window, sector, tables);
+		double const robotRadius = 300;
+		runner.run(
+			"plus.init",
+			config,
+			20,
+			NoSetup,
+			[&](size_t) {
+				VfhPlus v(param);
+				v.setRobotRadius(robotRadius);
+				v.init();
+				Sink = v.Hist[0];
+			});
+		std::vector<Ranges> const scene = MakeScene(64, 1);
+		VfhPlus v(param);
+		v.setRobotRadius(robotRadius);
+		v.init();
+		if (runner.options.perf && !v.enablePerfCounters()) {
+			fprintf(stderr, "hardware counters unavailable\n");
+		}
+		size_t const cells = v.WINDOW_DIAMETER * v.WINDOW_DIAMETER;
+		double stamp = 0;
+		double linearX = 0.1;
+		runner.run(
+			"plus.update",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				double angularZ;
+				stamp += 0.05;
+				v.update(
+					stamp,
+					scene[i % scene.size()],
+					linearX,
+					0.2,
+					2.0,
+					0.25,
+					linearX,
+					angularZ);
+				Sink = angularZ;
+			});
+		runner.planner("plus.update", TableBytes(v), v.stats());
+		{
+		/* the speed picked with the direction, among 4 bands */
+		VfhPlus banded(param);
+		banded.setRobotRadius(robotRadius);
+		banded.setSpeedBands(4);
+		banded.init();
+		double bandedLinearX = 0.1;
+		runner.run(
+			"plus.updateBands4",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				double angularZ;
+				stamp += 0.05;
+				banded.update(
+					stamp,
+					scene[i % scene.size()],
+					bandedLinearX,
+					0.2,
+					2.0,
+					0.25,
+					bandedLinearX,
+					angularZ);
+				Sink = angularZ;
+			});
+		runner.planner(
+			"plus.updateBands4", TableBytes(banded), banded.stats());
+		}
+		/* a robot standing in a static scene: the histograms are reused */
+		double staticLinearX = 0;
+		runner.run(
+			"plus.updateStatic",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t) {
+				double angularZ;
+				stamp += 0.05;
+				v.update(
+					stamp,
+					scene[0],
+					staticLinearX,
+					0.2,
+					2.0,
+					0.25,
+					staticLinearX,
+					angularZ);
+				staticLinearX = 0;
+				Sink = angularZ;
+			});
+		/*
+		 * a scan streamed in 12 packets of 30 ranges (31 for the last),
+		 * timed from the last packet: the scan-to-command latency left once
+		 * the lidar is done
+		 */
+		size_t const packet = 30;
+		size_t const lastPacket = 11 * packet;
+		double streamLinearX = 0.1;
+		runner.run(
+			"plus.streamLastSlice",
+			config,
+			5000,
+			[&](size_t const i) {
+				Ranges const& ranges = scene[i % scene.size()];
+				stamp += 0.05;
+				v.beginScan(stamp, streamLinearX, 0.2, 2.0, 0.25);
+				for (size_t first = 0; first < lastPacket; first += packet) {
+					v.addScanSlice(first, ranges.data() + first, packet);
+				}
+			},
+			[&](size_t const i) {
+				double angularZ;
+				v.addScanSlice(
+					lastPacket,
+					scene[i % scene.size()].data() + lastPacket,
+					361 - lastPacket);
+				v.finishScan(streamLinearX, angularZ);
+				Sink = angularZ;
+			});
+		if (!stages) {
+			return;
+		}
+		{
+		/* the cost of the spans, flushed to nowhere */
+		VfhTracer tracer;
+		tracer.start("/dev/null");
+		v.setTracer(&tracer);
+		runner.run(
+			"plus.updateTraced",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				double angularZ;
+				stamp += 0.05;
+				v.update(
+					stamp,
+					scene[i % scene.size()],
+					linearX,
+					0.2,
+					2.0,
+					0.25,
+					linearX,
+					angularZ);
+				Sink = angularZ;
+			});
+		v.setTracer(nullptr);
+		}
+		/* the state of every stage, per scene frame */
+		int const speed = 200;
+		int const hs = v.HIST_SIZE;
+		std::vector<std::vector<double> > primary(scene.size());
+		std::vector<std::vector<double> > binary(scene.size());
+		std::vector<std::vector<double> > masked(scene.size());
+		std::vector<std::vector<std::vector<double> > > mags(scene.size());
+		for (size_t f = 0; f < scene.size(); ++f) {
+			v.buildPrimaryPolarHistogram(scene[f], speed);
+			primary[f].assign(v.Hist, v.Hist + hs);
+			mags[f] = v.Cell_Mag;
+			v.buildBinaryPolarHistogram(speed);
+			binary[f].assign(v.Hist, v.Hist + hs);
+			v.buildMaskedPolarHistogram(speed);
+			masked[f].assign(v.Hist, v.Hist + hs);
+		}
+		runner.run(
+			"plus.cellsMag",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				Sink = v.Calculate_Cells_Mag(scene[i % scene.size()], speed);
+			},
+			cells);
+		runner.run(
+			"plus.primaryHistogram",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				Sink = v.buildPrimaryPolarHistogram(
+					scene[i % scene.size()], speed);
+			});
+		runner.run(
+			"plus.binaryHistogram",
+			config,
+			20000,
+			[&](size_t const i) {
+				std::copy(
+					primary[i % scene.size()].begin(),
+					primary[i % scene.size()].end(),
+					v.Hist);
+			},
+			[&](size_t) { Sink = v.buildBinaryPolarHistogram(speed); });
+		runner.run(
+			"plus.maskedHistogram",
+			config,
+			5000,
+			[&](size_t const i) {
+				std::copy(
+					binary[i % scene.size()].begin(),
+					binary[i % scene.size()].end(),
+					v.Hist);
+				v.Cell_Mag = mags[i % scene.size()];
+			},
+			[&](size_t) { Sink = v.buildMaskedPolarHistogram(speed); });
+		runner.run(
+			"plus.selectDirection",
+			config,
+			20000,
+			[&](size_t const i) {
+				std::copy(
+					masked[i % scene.size()].begin(),
+					masked[i % scene.size()].end(),
+					v.Hist);
+			},
+			[&](size_t) { Sink = v.selectDirection(); });
+		/* every open sector scored */
+		v.setSectorScoring(true);
+		runner.run(
+			"plus.selectSectors",
+			config,
+			20000,
+			[&](size_t const i) {
+				std::copy(
+					masked[i % scene.size()].begin(),
+					masked[i % scene.size()].end(),
+					v.Hist);
+			},
+			[&](size_t) { Sink = v.selectDirection(); });
+		v.setSectorScoring(false);
+		/* 200 waypoints asked of one masked histogram */
+		std::vector<double> goals(200);
+		for (size_t g = 0; g < goals.size(); ++g) {
+			goals[g] = (2.0 * M_PI * g / goals.size()) - M_PI;
+		}
+		std::vector<double> picked(goals.size());
+		std::vector<double> speeds(goals.size());
+		runner.run(
+			"plus.queryGoals200",
+			config,
+			20000,
+			[&](size_t const i) {
+				std::copy(
+					masked[i % scene.size()].begin(),
+					masked[i % scene.size()].end(),
+					v.Hist);
+			},
+			[&](size_t) {
+				v.queryGoals(
+					goals.data(), goals.size(), picked.data(), speeds.data());
+				Sink = picked[0];
+			});
+		/* a hokuyo like scan, 270 degree, 1081 rays */
+		std::vector<float> rays(1081);
+		for (size_t i = 0; i < rays.size(); ++i) {
+			rays[i] = scene[0][i % 361] * 1e-3;
+		}
+		double const angleMin = -3.0 * M_PI / 4.0;
+		double const angleMax = 3.0 * M_PI / 4.0;
+		double const increment = (angleMax - angleMin) / (rays.size() - 1);
+		Ranges converted;
+		runner.run(
+			"plus.convertScan",
+			config,
+			20000,
+			NoSetup,
+			[&](size_t) {
+				VfhPlus::convertScan(
+					rays, angleMin, angleMax, increment, 30.0, converted);
+				Sink = converted[180];
+			});
+		runner.run(
+			"ConvertScan",
+			config,
+			20000,
+			NoSetup,
+			[&](size_t) {
+				ConvertScan(
+					rays, angleMin, angleMax, increment, 30.0, converted);
+				Sink = converted[180];
+			});
+	}
+	/** @brief every stage of VfhStar and its update, one configuration */
+	static void Star(
+		Runner& runner,
+		int const window,
+		int const sector,
+		int const tables,
+		bool const stages) {
+		std::string const config = Config(window, sector, tables);
+		VfhStar::Param const param = StarParam(window, sector, tables);
+		runner.run(
+			"star.init",
+			config,
+			20,
+			NoSetup,
+			[&](size_t) {
+				VfhStar v(param);
+				v.init();
+				Sink = v.histogram[0];
+			});
+		std::vector<Ranges> const scene = MakeScene(64, 1);
+		VfhStar v(param);
+		v.init();
+		if (runner.options.perf && !v.enablePerfCounters()) {
+			fprintf(stderr, "hardware counters unavailable\n");
+		}
+		double stamp = 0;
+		double linearX = 0.1;
+		runner.run(
+			"star.update",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				double angularZ;
+				stamp += 0.05;
+				v.update(
+					stamp,
+					scene[i % scene.size()],
+					linearX,
+					0.2,
+					2.0,
+					0.25,
+					linearX,
+					angularZ);
+				Sink = angularZ;
+			});
+		runner.planner("star.update", TableBytes(v), v.stats());
+		if (!stages) {
+			return;
+		}
+		double const speed = 0.2;
+		std::vector<std::vector<double> > primary(scene.size());
+		std::vector<std::vector<double> > binary(scene.size());
+		std::vector<std::vector<double> > masked(scene.size());
+		std::vector<std::vector<std::vector<double> > > mags(scene.size());
+		for (size_t f = 0; f < scene.size(); ++f) {
+			v.buildPrimaryPolarHistogram(scene[f], speed);
+			primary[f] = v.histogram;
+			mags[f] = v.cellMag;
+			v.buildBinaryPolarHistogram(speed);
+			binary[f] = v.histogram;
+			v.buildMaskedPolarHistogram(speed);
+			masked[f] = v.histogram;
+		}
+		runner.run(
+			"star.cellsMag",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				Sink = v.calculateCellsMagnitude(
+					scene[i % scene.size()], speed);
+			},
+			v.windowDiameter * v.windowDiameter);
+		runner.run(
+			"star.primaryHistogram",
+			config,
+			5000,
+			NoSetup,
+			[&](size_t const i) {
+				Sink = v.buildPrimaryPolarHistogram(
+					scene[i % scene.size()], speed);
+			});
+		runner.run(
+			"star.binaryHistogram",
+			config,
+			20000,
+			[&](size_t const i) { v.histogram = primary[i % scene.size()]; },
+			[&](size_t) {
+				v.buildBinaryPolarHistogram(speed);
+				Sink = v.histogram[0];
+			});
+		runner.run(
+			"star.maskedHistogram",
+			config,
+			5000,
+			[&](size_t const i) {
+				v.histogram = binary[i % scene.size()];
+				v.cellMag = mags[i % scene.size()];
+			},
+			[&](size_t) {
+				v.buildMaskedPolarHistogram(speed);
+				Sink = v.histogram[0];
+			});
+		runner.run(
+			"star.selectDirection",
+			config,
+			20000,
+			[&](size_t const i) { v.histogram = masked[i % scene.size()]; },
+			[&](size_t) {
+				v.selectDirection();
+				Sink = v.pickedDirection;
+			});
+		runner.run(
+			"star.lookAhead",
+			config,
+			2000,
+			[&](size_t const i) { v.cellMag = mags[i % scene.size()]; },
+			[&](size_t) {
+				v.searchDirection(
+					speed, std::chrono::steady_clock::time_point::max());
+				Sink = v.pickedDirection;
+			});
+	}
+	/**
+	 * @brief VfhStar's update at growing look-ahead depths, the search on
+	 * 1, 4 and 8 threads, until the p99 misses the 20 Hz deadline
+	 */
+	static void LookAhead(Runner& runner) {
+		double const deadlineNs = 50e6;
+		int const maxDepth = 16;
+		std::vector<Ranges> const scene = MakeClutter(64, 1);
+		int const threads[] = { 1, 4, 8 };
+		for (int const t: threads) {
+			char deadline[64];
+			snprintf(deadline, sizeof(deadline), "lookahead%d.deadline", t);
+			std::unique_ptr<VfhWorkPool> pool;
+			if (t > 1) {
+				pool.reset(new VfhWorkPool(t));
+			}
+			Result best;
+			int bestDepth = 0;
+			for (int depth = 1; depth <= maxDepth; ++depth) {
+				char name[64];
+				char config[128];
+				snprintf(name, sizeof(name), "lookahead%d.depth%d", t, depth);
+				snprintf(
+					config,
+					sizeof(config),
+					"{\"threads\": %d, \"process_times\": %d}",
+					t,
+					depth);
+				if (!runner.wanted(name) && !runner.wanted(deadline)) {
+					continue;
+				}
+				VfhStar::Param param = StarParam(60, 5, 20);
+				param.processTimes = depth;
+				param.searchNodes = 1 << 16;
+				VfhStar v(param);
+				v.init();
+				v.setSearchPool(pool.get());
+				double stamp = 0;
+				double linearX = 0.1;
+				Result r;
+				r.name = name;
+				r.config = config;
+				r.iterations = 0;
+				Runner probe(runner.options);
+				probe.run(
+					name,
+					config,
+					200,
+					NoSetup,
+					[&](size_t const i) {
+						double angularZ;
+						stamp += 0.05;
+						v.update(
+							stamp,
+							scene[i % scene.size()],
+							linearX,
+							0.2,
+							2.0,
+							0.25,
+							linearX,
+							angularZ);
+						Sink = angularZ;
+					});
+				probe.planner(name, 0, v.stats());
+				if (probe.results.empty()) {
+					continue;/* filtered out */
+				}
+				r = probe.results.back();
+				runner.add(r);
+				std::vector<double> sorted(r.ns);
+				std::sort(sorted.begin(), sorted.end());
+				if (Percentile(sorted, 0.99) > deadlineNs) {
+					break;
+				}
+				best = r;
+				bestDepth = depth;
+			}
+			if (bestDepth > 0) {
+				char config[128];
+				snprintf(
+					config,
+					sizeof(config),
+					"{\"threads\": %d, \"deadline_ms\": %.0lf, "
+					"\"process_times\": %d}",
+					t,
+					deadlineNs * 1e-6,
+					bestDepth);
+				best.name = deadline;
+				best.config = config;
+				runner.add(best);
+			}
+		}
+		int const budgets[] = { 5, 10, 25 };
+		for (int const ms: budgets) {
+			char name[64];
+			char config[128];
+			snprintf(name, sizeof(name), "lookahead.anytime%d", ms);
+			snprintf(
+				config,
+				sizeof(config),
+				"{\"budget_ms\": %d, \"process_times\": %d}",
+				ms,
+				maxDepth);
+			VfhStar::Param param = StarParam(60, 5, 20);
+			param.processTimes = maxDepth;
+			param.searchNodes = 1 << 16;
+			VfhStar v(param);
+			v.init();
+			double stamp = 0;
+			double linearX = 0.1;
+			runner.run(
+				name,
+				config,
+				200,
+				NoSetup,
+				[&](size_t const i) {
+					double angularZ;
+					stamp += 0.05;
+					Sink = v.update(
+						stamp,
+						ms * 1e-3,
+						scene[i % scene.size()],
+						linearX,
+						0.2,
+						2.0,
+						0.25,
+						linearX,
+						angularZ);
+				});
+			runner.planner(name, 0, v.stats());
+		}
+		/* the robot moves as the scene does, its odometry tells the planner */
+		double const step = 0.005;
+		std::vector<Ranges> const walk = MakeWalk(64, step, 1);
+		for (int const reroot: { 0, 1 }) {
+			std::string const name =
+				reroot ? "lookahead.reroot" : "lookahead.rebuild";
+			std::string const config = reroot
+				? "{\"process_times\": 8, \"reroot\": true}"
+				: "{\"process_times\": 8, \"reroot\": false}";
+			VfhStar::Param param = StarParam(60, 5, 20);
+			param.processTimes = 8;
+			param.searchNodes = 1 << 16;
+			param.rerootSearch = reroot != 0;
+			VfhStar v(param);
+			v.init();
+			double stamp = 0;
+			double linearX = 0.1;
+			size_t frame = 0;
+			runner.run(
+				name,
+				config,
+				200,
+				NoSetup,
+				[&](size_t) {
+					double angularZ;
+					size_t const at = frame % walk.size();
+					size_t const next = (frame + 1) % walk.size();
+					stamp += 0.05;
+					v.update(
+						stamp,
+						walk[at],
+						linearX,
+						0.2,
+						2.0,
+						0.25,
+						linearX,
+						angularZ);
+					Sink = angularZ;
+					/* back to the start after the last frame */
+					v.setOdometry(
+						(static_cast<double>(next) - at) * step, 0, 0);
+					++frame;
+				});
+			runner.planner(name, 0, v.stats());
+		}
+	}
+	/**
+	 * @brief VfhPlusPack against the same planners one by one, and both
+	 * spread over a pool of threads
+	 */
+	static void Pack(Runner& runner) {
+		std::string const config = Config(60, 5, 20);
+		VfhPlus::Param const param = PlusParam(60, 5, 20);
+		double const robotRadius = 300;
+		std::vector<Ranges> const scene = MakeScene(64, 1);
+		double const frameSeconds = 0.05;
+		{
+		VfhPlusPack<4> pack(param, robotRadius);
+		pack.init();
+		VfhPlusPack<4>::Input in[4];
+		VfhPlusPack<4>::Output out[4];
+		runner.run(
+			"pack4.update",
+			config,
+			2000,
+			[&](size_t const i) {
+				for (int l = 0; l < 4; ++l) {
+					in[l].laserRanges = &scene[(i + l * 7) % scene.size()];
+					in[l].currentLinearX = 0.05 * l;
+					in[l].goalDirection = 0.1 * l;
+					in[l].goalDistance = 2.0;
+					in[l].goalDistanceTolerance = 0.25;
+				}
+			},
+			[&](size_t const i) {
+				pack.update(i * frameSeconds, in, out);
+				Sink = out[0].chosenAngularZ;
+			},
+			4);
+		}
+		VfhPlusPack<8> pack(param, robotRadius);
+		pack.init();
+		VfhPlusPack<8>::Input in[8];
+		VfhPlusPack<8>::Output out[8];
+		auto const fill = [&](size_t const i) {
+			for (int l = 0; l < 8; ++l) {
+				in[l].laserRanges = &scene[(i + l * 7) % scene.size()];
+				in[l].currentLinearX = 0.05 * l;
+				in[l].goalDirection = 0.1 * l;
+				in[l].goalDistance = 2.0;
+				in[l].goalDistanceTolerance = 0.25;
+			}
+		};
+		runner.run(
+			"pack8.update",
+			config,
+			2000,
+			fill,
+			[&](size_t const i) {
+				pack.update(i * frameSeconds, in, out);
+				Sink = out[0].chosenAngularZ;
+			},
+			8);
+		std::vector<std::unique_ptr<VfhPlus> > planners;
+		for (int l = 0; l < 8; ++l) {
+			planners.emplace_back(new VfhPlus(param));
+			planners.back()->setRobotRadius(robotRadius);
+			planners.back()->init();
+		}
+		runner.run(
+			"instances8.update",
+			config,
+			2000,
+			fill,
+			[&](size_t const i) {
+				for (int l = 0; l < 8; ++l) {
+					double linearX, angularZ;
+					planners[l]->update(
+						i * frameSeconds,
+						*in[l].laserRanges,
+						in[l].currentLinearX,
+						in[l].goalDirection,
+						in[l].goalDistance,
+						in[l].goalDistanceTolerance,
+						linearX,
+						angularZ);
+					Sink = angularZ;
+				}
+			},
+			8);
+		Pool(runner, config, param, robotRadius, scene, true);
+		Pool(runner, config, param, robotRadius, scene, false);
+	}
+	/**
+	 * @brief every thread of the pool owns 8 planners, as one pack or as
+	 * 8 instances, and updates them for every frame
+	 */
+	static void Pool(
+		Runner& runner,
+		std::string const& config,
+		VfhPlus::Param const& param,
+		double const robotRadius,
+		std::vector<Ranges> const& scene,
+		bool const packed) {
+		int const threads = runner.options.threads;
+		char name[64];
+		snprintf(
+			name,
+			sizeof(name),
+			"pool%d.%s.update",
+			threads,
+			packed ? "pack8" : "instances8");
+		if (!runner.wanted(name)) {
+			return;
+		}
+		size_t const frames = runner.iterations(2000);
+		std::vector<std::vector<double> > ns(threads);
+		/* the planners are built before the clock starts */
+		std::atomic<int> ready(0);
+		std::atomic<bool> go(false);
+		auto const worker = [&](int const t) {
+			std::unique_ptr<VfhPlusPack<8> > pack;
+			std::vector<std::unique_ptr<VfhPlus> > planners;
+			if (packed) {
+				pack.reset(new VfhPlusPack<8>(param, robotRadius));
+				pack->init();
+			} else {
+				for (int l = 0; l < 8; ++l) {
+					planners.emplace_back(new VfhPlus(param));
+					planners.back()->setRobotRadius(robotRadius);
+					planners.back()->init();
+				}
+			}
+			VfhPlusPack<8>::Input in[8];
+			VfhPlusPack<8>::Output out[8];
+			ns[t].resize(frames);
+			ready.fetch_add(1);
+			while (!go.load()) {
+				std::this_thread::yield();
+			}
+			for (size_t i = 0; i < frames; ++i) {
+				for (int l = 0; l < 8; ++l) {
+					in[l].laserRanges = &scene[(i + l * 7 + t) % scene.size()];
+					in[l].currentLinearX = 0.05 * l;
+					in[l].goalDirection = 0.1 * l;
+					in[l].goalDistance = 2.0;
+					in[l].goalDistanceTolerance = 0.25;
+				}
+				auto const t0 = std::chrono::steady_clock::now();
+				if (packed) {
+					pack->update(i * 0.05, in, out);
+				} else {
+					for (int l = 0; l < 8; ++l) {
+						planners[l]->update(
+							i * 0.05,
+							*in[l].laserRanges,
+							in[l].currentLinearX,
+							in[l].goalDirection,
+							in[l].goalDistance,
+							in[l].goalDistanceTolerance,
+							out[l].chosenLinearX,
+							out[l].chosenAngularZ);
+					}
+				}
+				auto const t1 = std::chrono::steady_clock::now();
+				ns[t][i] = std::chrono::duration<double, std::nano>(
+					t1 - t0).count();
+			}
+		};
+		std::vector<std::thread> pool;
+		for (int t = 0; t < threads; ++t) {
+			pool.emplace_back(worker, t);
+		}
+		while (ready.load() < threads) {
+			std::this_thread::yield();
+		}
+		auto const begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for (auto& t: pool) {
+			t.join();
+		}
+		Result r;
+		r.name = name;
+		r.config = config;
+		r.iterations = frames * threads;
+		r.itemsPerOp = 8;
+		r.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - begin).count();
+		for (auto const& v: ns) {
+			r.ns.insert(r.ns.end(), v.begin(), v.end());
+		}
+		r.tableBytes = 0;
+		runner.add(r);
+	}
+};
+}
+int main(int argc, char** argv)
+{
+	using namespace yuiwong;
+	Options options;
+	options.quick = false;
+	options.perf = false;
+	options.threads = 4;
+	for (int i = 1; i < argc; ++i) {
+		if (::strcmp(argv[i], "--quick") == 0) {
+			options.quick = true;
+		} else if ((::strcmp(argv[i], "--filter") == 0) && (i + 1 < argc)) {
+			options.filter = argv[++i];
+		} else if ((::strcmp(argv[i], "--label") == 0) && (i + 1 < argc)) {
+			options.label = argv[++i];
+		} else if ((::strcmp(argv[i], "--threads") == 0) && (i + 1 < argc)) {
+			options.threads = std::max(1, ::atoi(argv[++i]));
+		} else if (::strcmp(argv[i], "--perf") == 0) {
+			options.perf = true;
+		} else {
+			fprintf(
+				stderr,
+				"usage: %s [--quick] [--filter text] [--label text] "
+				"[--threads n] [--perf]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	Runner runner(options);
+	/* every stage at the default configuration */
+	VfhBench::Plus(runner, 60, 5, 20, true);
+	VfhBench::Star(runner, 60, 5, 20, true);
+	/* sweeps, update and init only */
+	int const windows[] = { 40, 60, 80 };
+	int const sectors[] = { 5, 10 };
+	int const tables[] = { 1, 20 };
+	for (int const w: windows) {
+		for (int const s: sectors) {
+			for (int const t: tables) {
+				if ((w == 60) && (s == 5) && (t == 20)) {
+					continue;/* done above */
+				}
+				VfhBench::Plus(runner, w, s, t, false);
+				VfhBench::Star(runner, w, s, t, false);
+			}
+		}
+	}
+	VfhBench::Pack(runner);
+	VfhBench::LookAhead(runner);
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	printf("{\n");
+	printf("  \"schema\": 1,\n");
+	printf("  \"label\": \"%s\",\n", options.label.c_str());
+	printf("  \"compiler\": \"%s\",\n", __VERSION__);
+	printf("  \"quick\": %s,\n", options.quick ? "true" : "false");
+	printf("  \"max_rss_kb\": %ld,\n", usage.ru_maxrss);
+	printf("  \"results\": [\n");
+	for (size_t i = 0; i < runner.results.size(); ++i) {
+		Print(runner.results[i], (i + 1) == runner.results.size());
+	}
+	printf("  ]\n}\n");
+	return 0;
+}
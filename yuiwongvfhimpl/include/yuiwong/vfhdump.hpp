@@ -0,0 +1,155 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPDUMP_HPP
+#define YUIWONGVFHIMPL_VFPDUMP_HPP 1
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+namespace yuiwong {
+/**
+ * @brief binary grid/histogram dump of a VfhPlus planner, decoded offline
+ * by the vfhdump tool
+ * a preallocated, memory mapped file, native byte order, every field 8
+ * bytes aligned:
+ * - VfhDumpHeader
+ * - the grids fixed by init, GridCount of windowDiameter^2 doubles,
+ * cell (x, y) at [x * windowDiameter + y]
+ * - the cell sector tables, sectorTables of windowDiameter^2 cells, each
+ * a bit set of histogramSize bits (sectorBytes bytes), padded to 8 bytes
+ * - a ring of frameCapacity frames of frameSize bytes: VfhDumpFrame, the
+ * cell magnitudes (a grid) and the histogram (histogramSize doubles)
+ * once the file is mapped, a frame costs two memcpy: no formatting, no
+ * syscall, the kernel writes the pages back on its own.
+ */
+struct VfhDump {
+	/** @brief the grids fixed by init */
+	enum Grid: uint32_t {
+		GridDirection,/* Cell_Direction, degrees */
+		GridDistance,/* Cell_Dist, millimeters */
+		GridEnlargement,/* Cell_Enlarge, degrees */
+		GridCount,
+	};
+	static constexpr uint32_t Version = 1;
+	/** @brief "VFHDUMP" followed by a zero byte */
+	static char const Magic[8];
+	static char const* gridName(Grid const grid);
+};
+struct VfhDumpHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t windowDiameter;/* cells */
+	uint32_t histogramSize;/* sectors */
+	uint32_t sectorAngle;/* degrees */
+	uint32_t sectorTables;/* cell sector tables, one per speed */
+	uint32_t sectorBytes;/* bytes of one cell's sector bit set */
+	uint32_t frameCapacity;/* frames in the ring */
+	uint32_t frameSize;/* bytes of a frame, grids included */
+	double cellWidth;/* millimeters */
+	double robotRadius;/* millimeters */
+	uint64_t firstFrame;/* file offset of the ring */
+};
+/** @brief one update, followed by its cell magnitudes and histogram */
+struct VfhDumpFrame {
+	uint64_t sequence;/* 1 for the first frame, 0 while written */
+	double stamp;/* seconds, as given to update */
+	double desiredDirection;/* degrees */
+	double pickedDirection;/* degrees */
+	double maxSpeed;/* mm/s, for the picked direction */
+	double blockedCircleRadius;/* millimeters */
+	/** @brief Cell_Mag, windowDiameter^2 doubles */
+	inline double* cellMagnitude() {
+		return reinterpret_cast<double*>(this + 1);
+	}
+	inline double const* cellMagnitude() const {
+		return reinterpret_cast<double const*>(this + 1);
+	}
+	/** @brief Hist, histogramSize doubles */
+	inline double* histogram(uint32_t const windowDiameter) {
+		return this->cellMagnitude() + (windowDiameter * windowDiameter);
+	}
+	inline double const* histogram(uint32_t const windowDiameter) const {
+		return this->cellMagnitude() + (windowDiameter * windowDiameter);
+	}
+};
+static_assert((sizeof(VfhDumpHeader) % 8) == 0, "unaligned VfhDumpHeader");
+static_assert((sizeof(VfhDumpFrame) % 8) == 0, "unaligned VfhDumpFrame");
+/**
+ * @brief creates a dump and fills it, see VfhPlus::startDump
+ * open and close allocate and do I/O, frames do neither
+ */
+struct VfhDumpWriter {
+	VfhDumpWriter();
+	~VfhDumpWriter();
+	/**
+	 * @brief create (or truncate) and map a dump
+	 * @param layout windowDiameter, histogramSize, sectorAngle,
+	 * sectorTables, frameCapacity, cellWidth and robotRadius, the rest
+	 * is filled in here
+	 * @return false on I/O error
+	 */
+	bool open(std::string const& path, VfhDumpHeader const& layout);
+	void close();
+	inline bool isOpen() const { return this->data != nullptr; }
+	inline VfhDumpHeader const& header() const { return *this->head; }
+	/** @brief where to write a grid fixed by init */
+	double* grid(VfhDump::Grid const grid);
+	/** @brief where to write the bit sets of a cell sector table */
+	uint8_t* sectors(uint32_t const table);
+	/**
+	 * @brief the ring slot of the next frame, overwriting the oldest one
+	 * @note fill it and commitFrame it before the next beginFrame
+	 */
+	VfhDumpFrame* beginFrame();
+	void commitFrame(VfhDumpFrame* const frame);
+private:
+	VfhDumpWriter(VfhDumpWriter const&) = delete;
+	VfhDumpWriter& operator=(VfhDumpWriter const&) = delete;
+	uint8_t* data;
+	size_t size;
+	VfhDumpHeader* head;
+	uint64_t frames;/* frames begun */
+};
+/** @brief memory maps a dump and walks its frames, oldest first */
+struct VfhDumpReader {
+	VfhDumpReader();
+	~VfhDumpReader();
+	/** @return false on I/O error or when it is not a dump */
+	bool open(std::string const& path);
+	void close();
+	inline VfhDumpHeader const& header() const { return *this->head; }
+	double const* grid(VfhDump::Grid const grid) const;
+	/** @brief whether an obstacle in cell (x, y) blocks sector */
+	bool sector(
+		uint32_t const table,
+		uint32_t const x,
+		uint32_t const y,
+		uint32_t const sector) const;
+	/** @brief the complete frames in the ring */
+	inline size_t frameCount() const { return this->order.size(); }
+	/** @brief the i-th complete frame, in sequence order */
+	inline VfhDumpFrame const& frame(size_t const i) const {
+		return *this->order[i];
+	}
+private:
+	VfhDumpReader(VfhDumpReader const&) = delete;
+	VfhDumpReader& operator=(VfhDumpReader const&) = delete;
+	uint8_t const* data;
+	size_t size;
+	VfhDumpHeader const* head;
+	std::vector<VfhDumpFrame const*> order;
+};
+}
+#endif
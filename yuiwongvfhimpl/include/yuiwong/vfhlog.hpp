@@ -0,0 +1,153 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPLOG_HPP
+#define YUIWONGVFHIMPL_VFPLOG_HPP 1
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <array>
+#include "yuiwong/vfhplus.hpp"
+#include "yuiwong/vfhstar.hpp"
+namespace yuiwong {
+/**
+ * @brief binary scan/decision log
+ * append-only file, native byte order, every field 8 bytes aligned:
+ * - VfhLogHeader, then the planner Param fields in declaration order,
+ * one double each
+ * - one VfhLogRecord per update, each followed by its histogram snapshot
+ * (one byte per sector, 0 free, 1 blocked) padded to 8 bytes
+ * a record torn by a crash is ignored by the reader.
+ */
+struct VfhLog {
+	enum Planner: uint32_t {
+		PlannerVfhPlus = 1,
+		PlannerVfhStar = 2,
+	};
+	static constexpr uint32_t Version = 1;
+	/** @brief "VFHLOG" followed by two zero bytes */
+	static char const Magic[8];
+};
+struct VfhLogHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t planner;/* VfhLog::Planner */
+	uint32_t paramSize;/* Param fields (doubles) following this header */
+	uint32_t reserved;
+	double robotRadius;/* as given to setRobotRadius */
+};
+/** @brief what the planner saw and decided in one update */
+struct VfhLogRecord {
+	uint32_t size;/* bytes of this record, histogram and padding included */
+	uint32_t histogramSize;/* sectors in the snapshot, 0 if none */
+	double stamp;/* seconds, as given to update */
+	double currentLinearX;/* meter/s */
+	double goalDirection;/* radian */
+	double goalDistance;/* meter */
+	double goalDistanceTolerance;/* meter */
+	double chosenLinearX;/* meter/s */
+	double chosenAngularZ;/* radian/s */
+	double laserRanges[361];/* by convertScan */
+	/** @brief the ranges as the planner takes them */
+	inline std::array<double, 361> const& ranges() const {
+		return *reinterpret_cast<std::array<double, 361> const*>(
+			this->laserRanges);
+	}
+	/** @brief the histogram snapshot, histogramSize bytes */
+	inline uint8_t const* histogram() const {
+		return reinterpret_cast<uint8_t const*>(this + 1);
+	}
+};
+static_assert(sizeof(std::array<double, 361>) == (361 * sizeof(double)),
+	"std::array<double, 361> must be a plain array");
+static_assert((sizeof(VfhLogHeader) % 8) == 0, "unaligned VfhLogHeader");
+static_assert((sizeof(VfhLogRecord) % 8) == 0, "unaligned VfhLogRecord");
+/**
+ * @brief appends records to a log, one write per record
+ * cheap enough to call from the control loop: no formatting, one
+ * syscall per update
+ */
+struct VfhLogWriter {
+	VfhLogWriter();
+	~VfhLogWriter();
+	/**
+	 * @brief open a log for a VfhPlus planner, a new file gets the header,
+	 * an existing one is appended to if its header matches
+	 * @return false on I/O error or header mismatch
+	 */
+	bool open(
+		std::string const& path,
+		VfhPlus::Param const& param,
+		double const robotRadius);
+	/** @brief open a log for a VfhStar planner */
+	bool open(
+		std::string const& path,
+		VfhStar::Param const& param,
+		double const robotRadius);
+	void close();
+	inline bool isOpen() const { return this->fd >= 0; }
+	/**
+	 * @brief append one update
+	 * @param record the update, size and histogramSize are filled in here
+	 * @param histogram the histogram to snapshot, may be nullptr
+	 * @param histogramSize sectors in histogram
+	 * @return false on I/O error
+	 */
+	bool write(
+		VfhLogRecord& record,
+		double const* histogram = nullptr,
+		int const histogramSize = 0);
+private:
+	VfhLogWriter(VfhLogWriter const&) = delete;
+	VfhLogWriter& operator=(VfhLogWriter const&) = delete;
+	bool open(
+		std::string const& path,
+		VfhLog::Planner const planner,
+		double const* param,
+		uint32_t const paramSize,
+		double const robotRadius);
+	int fd;
+	std::string buffer;/* record plus snapshot, reused */
+};
+/** @brief memory maps a log and walks its records without copying */
+struct VfhLogReader {
+	VfhLogReader();
+	~VfhLogReader();
+	/** @return false on I/O error or when it is not a log */
+	bool open(std::string const& path);
+	void close();
+	inline VfhLogHeader const& header() const { return *this->head; }
+	/** @brief the Param of a VfhPlus log */
+	VfhPlus::Param plusParam() const;
+	/** @brief the Param of a VfhStar log */
+	VfhStar::Param starParam() const;
+	/** @brief restart from the first record */
+	inline void rewind() { this->offset = this->firstRecord; }
+	/**
+	 * @brief the next record, points into the mapping
+	 * @return nullptr at the end of the log
+	 */
+	VfhLogRecord const* next();
+private:
+	VfhLogReader(VfhLogReader const&) = delete;
+	VfhLogReader& operator=(VfhLogReader const&) = delete;
+	uint8_t const* data;
+	size_t size;
+	VfhLogHeader const* head;
+	double const* param;
+	size_t firstRecord;
+	size_t offset;
+};
+}
+#endif
@@ -0,0 +1,141 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPMAILBOX_HPP
+#define YUIWONGVFHIMPL_VFPMAILBOX_HPP 1
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+namespace yuiwong {
+/**
+ * @brief sleep while word holds expected (a futex wait on Linux)
+ * @param timeoutMs < 0 to wait for ever
+ * @param shared word is in memory shared between processes
+ * @return false on timeout, true when woken or word changed (spuriously
+ * too, callers check again)
+ */
+bool VfhFutexWait(
+	std::atomic<uint32_t>& word,
+	uint32_t const expected,
+	int const timeoutMs,
+	bool const shared = false);
+/** @brief wake up to n threads sleeping on word */
+void VfhFutexWake(
+	std::atomic<uint32_t>& word,
+	int const n,
+	bool const shared = false);
+/**
+ * @brief a single slot, latest wins mailbox between one producer and one
+ * consumer thread
+ * a triple buffer: the producer fills its own slot and swaps it with the
+ * middle one, the consumer swaps its slot with the middle one when that is
+ * fresh. neither side locks or waits on the other: a message the consumer
+ * did not take in time is replaced, and counted by post(). the consumer
+ * may sleep in wait() until a message comes, the producer then pays one
+ * futex wake.
+ */
+template <typename T>
+struct VfhMailbox {
+	VfhMailbox():
+		writeIndex(0),
+		state(1),
+		sleepers(0),
+		readIndex(2) {}
+	/**
+	 * @brief producer: publish message, replacing one not taken yet
+	 * @return false when a message was replaced (dropped)
+	 */
+	bool post(T const& message) {
+		this->slots[this->writeIndex] = message;
+		uint32_t old = this->state.load(std::memory_order_relaxed);
+		/* seq_cst pairs with the consumer's sleepers/state check */
+		while (!this->state.compare_exchange_weak(
+			old,
+			(old & Closed) | this->writeIndex | Fresh,
+			std::memory_order_seq_cst,
+			std::memory_order_relaxed)) {
+		}
+		this->writeIndex = old & IndexMask;
+		if (this->sleepers.load(std::memory_order_seq_cst) != 0) {
+			VfhFutexWake(this->state, 1);
+		}
+		return (old & Fresh) == 0;
+	}
+	/**
+	 * @brief consumer: take the newest message, if there is a new one
+	 * @return false when nothing was posted since the last take
+	 */
+	bool take(T& message) {
+		uint32_t old = this->state.load(std::memory_order_relaxed);
+		if ((old & Fresh) == 0) {
+			return false;
+		}
+		/* only the consumer clears Fresh, it stays set while retrying */
+		while (!this->state.compare_exchange_weak(
+			old,
+			(old & Closed) | this->readIndex,
+			std::memory_order_acq_rel,
+			std::memory_order_relaxed)) {
+		}
+		this->readIndex = old & IndexMask;
+		message = std::move(this->slots[this->readIndex]);
+		return true;
+	}
+	/**
+	 * @brief consumer: take the next message, sleeping until one comes
+	 * @param timeoutMs < 0 to wait for ever
+	 * @return false on timeout, or once closed and the last message taken
+	 */
+	bool wait(T& message, int const timeoutMs = -1) {
+		for (;;) {
+			if (this->take(message)) {
+				return true;
+			}
+			this->sleepers.store(1, std::memory_order_seq_cst);
+			uint32_t const s = this->state.load(std::memory_order_seq_cst);
+			bool woken = true;
+			if ((s & (Fresh | Closed)) == 0) {
+				woken = VfhFutexWait(this->state, s, timeoutMs);
+			}
+			this->sleepers.store(0, std::memory_order_relaxed);
+			if (((s & Closed) != 0) || !woken) {
+				return this->take(message);
+			}
+		}
+	}
+	/** @brief wake the consumer for good, wait() then returns false */
+	void close() {
+		this->state.fetch_or(Closed, std::memory_order_seq_cst);
+		VfhFutexWake(this->state, 1);
+	}
+	inline bool isClosed() const {
+		return (this->state.load(std::memory_order_acquire) & Closed) != 0;
+	}
+private:
+	VfhMailbox(VfhMailbox const&) = delete;
+	VfhMailbox& operator=(VfhMailbox const&) = delete;
+	static constexpr uint32_t IndexMask = 3;
+	static constexpr uint32_t Fresh = 4;/* the middle slot is unread */
+	static constexpr uint32_t Closed = 8;
+	T slots[3];
+	/* the producer's, the shared and the consumer's words apart */
+	uint32_t writeIndex;
+	char pad0[64];
+	std::atomic<uint32_t> state;/* middle slot index | Fresh | Closed */
+	std::atomic<uint32_t> sleepers;
+	char pad1[64];
+	uint32_t readIndex;
+};
+}
+#endif
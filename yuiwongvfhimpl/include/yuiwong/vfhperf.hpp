@@ -0,0 +1,65 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPPERF_HPP
+#define YUIWONGVFHIMPL_VFPPERF_HPP 1
+#include <stdint.h>
+namespace yuiwong {
+/**
+ * @brief hardware performance counters of one thread, as one
+ * perf_event_open group (user space only)
+ * reading costs a syscall, so it is opt-in: see
+ * VfhPlus::enablePerfCounters. counters the CPU or the kernel do not
+ * offer are left out of the group and read as 0, see available().
+ * @note perf_event_paranoid must allow self monitoring (<= 2), which
+ * containers often do not: open() then fails and nothing is measured
+ */
+struct VfhPerfProbe {
+	enum Counter {
+		CounterCycles,
+		CounterInstructions,
+		CounterL1dMisses,/* L1 data cache read misses */
+		CounterLlcMisses,/* last level cache read misses */
+		CounterBranchMisses,
+		CounterCount,
+	};
+	static char const* counterName(Counter const counter);
+	VfhPerfProbe();
+	~VfhPerfProbe();
+	/**
+	 * @brief open the counters for the calling thread, the one that will
+	 * read them
+	 * @return false when perf events are unavailable
+	 */
+	bool open();
+	void close();
+	inline bool isOpen() const { return this->fds[CounterCycles] >= 0; }
+	/** @brief bit mask of the counters in the group, 1 << Counter */
+	uint32_t available() const;
+	/**
+	 * @brief the current counts, with one read of the group
+	 * @param[out] values counts, 0 for unavailable counters
+	 * @return false when not open or the read failed
+	 */
+	bool read(uint64_t (&values)[CounterCount]) const;
+private:
+	VfhPerfProbe(VfhPerfProbe const&) = delete;
+	VfhPerfProbe& operator=(VfhPerfProbe const&) = delete;
+	int fds[CounterCount];
+	/* position of each group member in a group read */
+	int slot[CounterCount];
+	int members;
+};
+}
+#endif
@@ -18,7 +18,16 @@
 #include <stdio.h>
 #include <vector>
 #include <array>
+#include <memory>
+#include <algorithm>
+#include "yuiwong/vfhdump.hpp"
+#include "yuiwong/vfhsnapshot.hpp"
+#include "yuiwong/vfhstats.hpp"
 namespace yuiwong {
+template <int Lanes> struct VfhPlusPack;
+struct VfhPlusAdaptive;
+struct VfhBench;
+struct VfhTest;
 /** @brief Vector Field Histogram local navigation algorithm
 The vfh class implements the Vector Field Histogram Plus local
 navigation method by Ulrich and Borenstein. VFH+ provides real-time
@@ -164,15 +173,44 @@ struct VfhPlus {
 	};
 	VfhPlus(Param const& param);
 	virtual ~VfhPlus();
+	/**
+	 * @brief convert a laser scan to the laser ranges update takes
+	 * @param ranges the scan ranges, in meter, as sensor_msgs/LaserScan
+	 * @param n count of ranges
+	 * @param angleMin the scan start angle, in radian
+	 * @param angleMax the scan end angle, in radian
+	 * @param angleIncrement the angle between ranges, in radian
+	 * @param rangeMax the scan maximum range, in meter
+	 * @param[out] result two per degree over the front half, in mm
+	 * @note reads the ranges in place, so a message shared in process
+	 * (a nodelet) is never copied
+	 */
 	static std::array<double, 361>& convertScan(
-		std::vector<float> const ranges,
+		float const* const ranges,
+		size_t const n,
 		double const angleMin,
 		double const angleMax,
 		double const angleIncrement,
 		double const rangeMax,
 		std::array<double, 361>& result);
+	static inline std::array<double, 361>& convertScan(
+		std::vector<float> const& ranges,
+		double const angleMin,
+		double const angleMax,
+		double const angleIncrement,
+		double const rangeMax,
+		std::array<double, 361>& result) {
+		return convertScan(
+			ranges.data(),
+			ranges.size(),
+			angleMin,
+			angleMax,
+			angleIncrement,
+			rangeMax,
+			result);
+	}
 	static void convertScan(
-		std::vector<float> const ranges,
+		std::vector<float> const& ranges,
 		double const angleMin,
 		double const angleMax,
 		double const angleIncrement,
@@ -204,6 +242,124 @@ struct VfhPlus {
 		double const goalDistanceTolerance,
 		double& chosenLinearX,
 		double& chosenAngularZ);
+	/**
+	 * @brief update the vfh+ state with an explicit timestamp
+	 * @param stamp monotonic timestamp of the laser readings, in seconds,
+	 * e.g. the scan header stamp. it drives the acceleration limit instead
+	 * of the wall clock, so replaying the same stamps gives bit-identical
+	 * outputs at any replay speed
+	 * @see update
+	 */
+	void update(
+		double const stamp,
+		std::array<double, 361> const& laserRanges,
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance,
+		double& chosenLinearX,
+		double& chosenAngularZ);
+	/**
+	 * @brief start a scan that arrives in slices (lidar packets): the
+	 * cells and histogram sectors of each slice are filled in as it comes,
+	 * so finishScan only has the selection left to do
+	 * @param stamp monotonic timestamp of the scan, in seconds, as update
+	 * @see update for the other params
+	 * @note beginScan, addScanSlice..., finishScan is one update; call
+	 * them from the thread that runs update
+	 */
+	void beginScan(
+		double const stamp,
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance);
+	/**
+	 * @brief fill in the cells seen by laser ranges [first, first + n)
+	 * @param ranges n ranges, in mm, as convertScan puts them at first..
+	 * @return false before beginScan, past index 360, or when some of the
+	 * ranges were given already (those are ignored)
+	 */
+	bool addScanSlice(
+		size_t const first, double const* const ranges, size_t const n);
+	/**
+	 * @brief finish the scan: ranges no slice gave count as convertScan's
+	 * unknown (-1, occupied), then the direction and the motion are picked
+	 * as update does
+	 * @note the histogram sums the cells in slice order, not update's, so
+	 * a sector exactly on a threshold may come out differently
+	 * @return false without beginScan, the outputs are then untouched
+	 */
+	bool finishScan(double& chosenLinearX, double& chosenAngularZ);
+	/**
+	 * @brief let update reuse the last histograms for a scan whose ranges
+	 * moved less than tolerance past the cell boundaries they were on
+	 * @param tolerance mm, 0 (the default) reuses only when the cell grid
+	 * is exactly the same, so the outputs are the same as without reuse
+	 * @note the reuse is counted by the cellsReused and histogramsReused
+	 * events of stats()
+	 */
+	inline void setReuseTolerance(double const tolerance) {
+		this->reuseTolerance = tolerance;
+	}
+	/**
+	 * @brief the cell sector tables, one per speed band, init builds: 20
+	 * by default, 1 when the safety distance does not grow with speed
+	 * @note before init, fewer tables make init faster and the enlarged
+	 * obstacles coarser in speed
+	 */
+	inline void setCellSectorTables(int const tables) {
+		if (tables > 0) {
+			this->NUM_CELL_SECTOR_TABLES = tables;
+		}
+	}
+	/**
+	 * @brief let update pick the speed with the direction: the histograms
+	 * of bands speeds, evenly up to the current max speed, come from one
+	 * pass over the cells, and the band whose opening drives fastest, its
+	 * speed capped by the opening's, is driven
+	 * @param bands 0 or 1 (the default) plans for the current speed alone
+	 * @note a slower band can fit through a gap the obstacles enlarged for
+	 * the faster ones close, or see it wide. as update, anything inside the
+	 * safety distance of the current speed brakes, and the blocked circles
+	 * of a band slower than the current speed are the current speed's: the
+	 * robot turns as it is driving. each band tried without an opening
+	 * counts a hemmedIn event, driving slower than the fastest a
+	 * speedBandSlower one. the last histograms are not reused, and
+	 * streamed scans plan for the current speed alone. set before init,
+	 * init builds the sector arcs the bands need, else the first update
+	 * does
+	 */
+	inline void setSpeedBands(int const bands) {
+		this->speedBands = std::max(bands, 0);
+	}
+	/**
+	 * @brief let update score every open sector of the masked histogram,
+	 * instead of the centre and the 40deg in from the borders of each
+	 * opening: a sector costs weight_desired_dir times its angle to the
+	 * goal, plus weight_current_dir times its angle to the last picked
+	 * direction, plus clearanceWeight times how far it is inside
+	 * clearanceDegrees of the nearer border of its opening
+	 * @param enable false (the default) weighs the candidates of each
+	 * opening
+	 * @param clearanceWeight 0 (the default) steers as close to the goal
+	 * as the enlarged obstacles let, the weights are not negative
+	 * @param clearanceDegrees the margin from the borders
+	 * @note the goal direction itself is picked when the sectors on both
+	 * sides of it are open and it costs no more than the best sector.
+	 * openings narrower than 10deg are skipped, narrower than 80deg drive
+	 * max_speed_narrow_opening, wider ones max_speed_wide_opening, or the
+	 * current max speed 40deg or more in from both borders. queryGoals
+	 * scores the same way
+	 */
+	inline void setSectorScoring(
+		bool const enable,
+		double const clearanceWeight = 0,
+		double const clearanceDegrees = 40) {
+		this->sectorScoring = enable;
+		this->clearanceWeight = clearanceWeight;
+		this->clearanceDegrees = clearanceDegrees;
+	}
 	inline int getMinTurnrate() const { return this->MIN_TURNRATE; }
 	/** @brief angle to goal, in degrees. 0deg is to our right */
 	inline double getDesiredAngle() const { return this->desiredDirection; }
@@ -221,12 +377,147 @@ struct VfhPlus {
 void SetMinTurnrate(int min_turnrate) { MIN_TURNRATE = min_turnrate; }
 void SetCurrentMaxSpeed(int Current_Max_Speed);
 // The Histogram.
-// This is public so that monitoring tools can get at it; it shouldn't
-// be modified externally.
+// Rewritten several times by every update: only read it from the
+// updating thread, monitoring tools on other threads use readSnapshot.
+// It shouldn't be modified externally.
 // Sweeps in an anti-clockwise direction.
 double *Hist;
-void Print_Cells_Mag();
+	/** @brief sectors in Hist */
+	inline int getHistogramSize() const { return this->HIST_SIZE; }
+	/**
+	 * @brief the direction and the speed update would pick toward each of
+	 * n goals, weighed as update weighs its goal against the masked
+	 * histogram of the last update; the planner is left as it is, so
+	 * which of many waypoints can be headed for is asked at once
+	 * @param goalDirections n goal directions, in radian, as update's
+	 * goalDirection
+	 * @param n count of goals
+	 * @param desiredWeight weight of the goal direction, as
+	 * weight_desired_dir
+	 * @param currentWeight weight of the last picked direction, as
+	 * weight_current_dir
+	 * @param[out] pickedDirections n directions, in radian, as
+	 * goalDirection
+	 * @param[out] maxSpeeds n speeds, the max for the picked directions, in
+	 * meter/s, 0 when hemmed in (or something is inside the safety
+	 * distance)
+	 * @note after update or finishScan, from the thread that runs them, as
+	 * Hist. the goals are weighed a candidate direction at a time, so a
+	 * batch costs about its candidates times its goals, or with
+	 * setSectorScoring, a pass over the sectors per goal. the
+	 * speeds are capped by the speed band driven, see setSpeedBands, and
+	 * ignore the acceleration limit and the goal distance
+	 */
+	void queryGoals(
+		double const* const goalDirections,
+		size_t const n,
+		double const desiredWeight,
+		double const currentWeight,
+		double* const pickedDirections,
+		double* const maxSpeeds) const;
+	/** @brief queryGoals with the planner's weights */
+	inline void queryGoals(
+		double const* const goalDirections,
+		size_t const n,
+		double* const pickedDirections,
+		double* const maxSpeeds) const {
+		this->queryGoals(
+			goalDirections, n, U1, U2, pickedDirections, maxSpeeds);
+	}
+	/**
+	 * @brief copy the outcome of the newest update: masked histogram,
+	 * picked direction, chosen velocities and the cells seen occupied
+	 * @note any thread, lock free, never delays update()
+	 * @param[out] frame the copy, its vectors are reused
+	 * @return false before the first update
+	 */
+	inline bool readSnapshot(VfhSnapshotFrame& frame) const {
+		return this->snapshotFrames.read(frame);
+	}
+	/**
+	 * @brief per stage latency and event counters of update(), safe to
+	 * call from a monitoring thread while the planner runs
+	 * @see VfhStats
+	 */
+	inline VfhStats::Snapshot stats() const {
+		return this->stageStats.snapshot();
+	}
+	/**
+	 * @brief emit a span for update() and each of its stages
+	 * @param tracer shared timeline, nullptr to stop tracing, must outlive
+	 * the planner's updates
+	 */
+	inline void setTracer(VfhTracer* const tracer) { this->tracer = tracer; }
+	/**
+	 * @brief sample hardware counters around update() and its stages,
+	 * reported by stats(), costs a syscall per stage boundary
+	 * @note call from the thread that runs update()
+	 * @return false when perf events are unavailable, or the library was
+	 * built without YUIWONGVFHIMPL_STATS
+	 */
+	bool enablePerfCounters();
+	void disablePerfCounters();
+	/**
+	 * @brief dump the grids fixed by init once, then the cell magnitudes
+	 * and the histogram of every update, to a ring of frames in a
+	 * memory mapped file, see VfhDump; decode it with the vfhdump tool
+	 * @note after init, init stops it; the frames cost two memcpy per
+	 * update
+	 * @param path the dump file, truncated
+	 * @param frames the ring size, the last frames updates are kept
+	 * @return false on I/O error or before init
+	 */
+	bool startDump(std::string const& path, int const frames = 256);
+	void stopDump();
 private:
+	template <int Lanes> friend struct VfhPlusPack;
+	friend struct VfhPlusAdaptive;
+	friend struct VfhBench;
+	friend struct VfhTest;
+	/**
+	 * @brief remember the stamp of this update
+	 * @param stamp monotonic timestamp, in seconds
+	 * @return the seconds elapsed since the last update, < 0 on the first one
+	 */
+	double advanceUpdateTime(double const stamp);
+	/**
+	 * @brief store the goal of this update and work out the speed the
+	 * histograms should be built for
+	 * @return the current pose speed, mm/s
+	 */
+	int beginUpdate(
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance);
+	/**
+	 * @brief pick a direction from the primary histogram in Hist
+	 * @param primaryOk false when something got inside the safety distance
+	 * @param currentPoseSpeed the current pose speed, mm/s
+	 */
+	void decideDirection(bool const primaryOk, int const currentPoseSpeed);
+	/**
+	 * @brief choose the speed and turn rate for the picked direction
+	 * @param diffSeconds time elapsed since the last update, in seconds
+	 * @param currentPoseSpeed the current pose speed, mm/s
+	 * @param[out] chosenLinearX the chosen linear x velocity, in meter/s
+	 * @param[out] chosenAngularZ the chosen turn rate, in radian/s
+	 */
+	void chooseMotion(
+		double const diffSeconds,
+		int const currentPoseSpeed,
+		double& chosenLinearX,
+		double& chosenAngularZ);
+	/**
+	 * @brief publish the outcome of this update to readSnapshot
+	 * @param stamp as given to update, in seconds
+	 * @param chosenLinearX the chosen linear x velocity, in meter/s
+	 * @param chosenAngularZ the chosen turn rate, in radian/s
+	 */
+	void publishSnapshot(
+		double const stamp,
+		double const chosenLinearX,
+		double const chosenAngularZ);
 // Functions
 int VFH_Allocate();
 double deltaAngle(int a1, int a2);
@@ -253,6 +544,58 @@ int buildPrimaryPolarHistogram(
 	std::array<double, 361> const& laserRanges, int speed);
 int buildBinaryPolarHistogram(int speed);
 int buildMaskedPolarHistogram(int speed);
+	/*
+	 * a direction selectDirection weighs: a candidate of an opening, or
+	 * with goal set, the goal direction itself when it is between angle
+	 * and last, the candidates 40deg in from the borders of a wide opening
+	 */
+	struct Candidate {
+		bool goal;
+		double angle;/* degrees */
+		double last;/* degrees */
+		int speed;/* mm/s */
+	};
+	/**
+	 * @brief the candidate directions of the openings in Hist
+	 * @param[out] candidates in the order the openings are met, none when
+	 * hemmed in
+	 * @return false when nothing is in the forward 180deg
+	 */
+	bool findCandidates(std::vector<Candidate>& candidates) const;
+	/* the sectors of Hist as setSectorScoring scores them */
+	struct SectorTable {
+		std::vector<float> blocked;/* 1, or 0 when in an opening */
+		std::vector<float> clearanceCost;/* the clearance term */
+	};
+	/**
+	 * @brief the sectors of Hist, and the openings they are in
+	 * @param[out] table HIST_SIZE sectors
+	 * @return false when nothing is in the forward 180deg
+	 */
+	bool findSectors(SectorTable& table) const;
+	/**
+	 * @brief the cheapest direction of a SectorTable, see setSectorScoring
+	 * @param table of findSectors
+	 * @param desired the goal direction, degrees in [0, 360)
+	 * @param last the last picked direction, degrees in [0, 360)
+	 * @param desiredWeight weight of the goal direction
+	 * @param currentWeight weight of the last picked direction
+	 * @param[out] picked the direction, degrees in [0, 360)
+	 * @param[out] speed its max speed, mm/s
+	 * @return false when hemmed in: no sector is in an opening
+	 */
+	bool scoreSectors(
+		SectorTable const& table,
+		double const desired,
+		double const last,
+		double const desiredWeight,
+		double const currentWeight,
+		double& picked,
+		int& speed) const;
+	/** @brief the max speed of a sector in an opening of Hist, mm/s */
+	int sectorSpeed(int const sector) const;
+	/** @brief the first sector of Hist in the forward 180deg, or -1 */
+	int firstObstacle() const;
 int Select_Candidate_Angle();
 int selectDirection();
 	/**
@@ -264,11 +607,50 @@ int selectDirection();
 	void setMotion(double& speed, int& turnrate, int const currentSpeed);
 // AB: This doesn't seem to be implemented anywhere...
 // int Read_Min_Turning_Radius_From_File(char *filename);
-void Print_Cells_Dir();
-void Print_Cells_Dist();
-void Print_Cells_Sector();
-void Print_Cells_Enlargement_Angle();
-void Print_Hist();
+	/** @brief write this update to the dump, if started */
+	void captureDump(double const stamp);
+	/**
+	 * @brief fill in the cells seen by laser range index of the scan
+	 * being streamed
+	 */
+	void streamRange(int const index, double const range);
+	/**
+	 * @brief the cell grid of the last update holds for this scan: every
+	 * range is between the same cell thresholds, within reuseTolerance,
+	 * and the speed gives the same sector table and safety distance
+	 * @param speed the current pose speed, mm/s
+	 */
+	bool sameCells(
+		std::array<double, 361> const& laserRanges, int const speed);
+	/**
+	 * @brief remember the primary histogram in Hist and the range
+	 * intervals that give the same cell grid, for sameCells
+	 */
+	void rememberCells(
+		std::array<double, 361> const& laserRanges,
+		int const speed,
+		bool const primaryOk);
+	/** @brief Cell_Sector as cellArc, for the speed bands */
+	void buildCellArcs();
+	/**
+	 * @brief the primary histogram of each speed band, and the limits
+	 * its blocked circles set, from one pass over the front cells
+	 * @param laserRanges laser (or sonar) readings
+	 * @param currentPoseSpeed the current pose speed, mm/s
+	 */
+	void buildSpeedBandHistograms(
+		std::array<double, 361> const& laserRanges,
+		int const currentPoseSpeed);
+	/**
+	 * @brief threshold and mask the speed band histograms, then pick the
+	 * direction in the fastest band with an opening
+	 */
+	void decideSpeedBand();
+	/** @brief the next update builds every histogram again */
+	inline void forgetCells() {
+		this->reuseCells = false;
+		this->reuseMaskedSpeed = -1;
+	}
 // Returns the speed index into Cell_Sector, for a given speed in mm/sec.
 // This exists so that only a few (potentially large) Cell_Sector tables must be stored.
 int Get_Speed_Index(int speed);
@@ -319,14 +701,84 @@ std::vector<std::vector<double> > Cell_Enlarge;
 std::vector<std::vector<std::vector<std::vector<int> > > > Cell_Sector;
 std::vector<double> Candidate_Angle;
 std::vector<int> Candidate_Speed;
+	std::vector<Candidate> candidates;/* selectDirection's findCandidates */
 double dist_eps;
 double ang_eps;
 double *Last_Binary_Hist;
 // Minimum turning radius at different speeds, in millimeters
 std::vector<int> Min_Turning_Radius;
-	// Keep track of last update, so we can monitor acceleration
+	// Keep track of last update, so we can monitor acceleration,
+	// < 0 until the first update
 	double lastUpdateTime;
 	double lastChosenLinearX;/* meter/s */
+	VfhStats stageStats;
+	VfhTracer* tracer;
+	std::unique_ptr<VfhPerfProbe> perfProbe;
+	VfhSnapshot snapshotFrames;
+	VfhDumpWriter dump;
+	/* the front cells by the laser range index that sees them */
+	struct StreamCell {
+		int x;
+		int y;
+		double threshold;/* the cell is occupied when range < threshold */
+	};
+	std::vector<int> streamCellStart;/* 362: bucket i is [i], [i + 1] */
+	std::vector<StreamCell> streamCells;
+	/* the scan between beginScan and finishScan */
+	std::vector<uint8_t> streamSeen;/* 361: range given already */
+	bool streaming;
+	bool streamBlocked;/* something got inside the safety distance */
+	double streamStamp;
+	double streamDiffSeconds;
+	int streamPoseSpeed;/* mm/s */
+	int streamSpeedIndex;
+	double streamSafeRadius;/* mm */
+	/* the thresholds of each streamCellStart bucket, ascending */
+	std::vector<double> rangeThresholds;
+	/*
+	 * the histograms of the last update, reused while sameCells: a range
+	 * in [reuseLow, reuseHigh) gives the same cells
+	 */
+	double reuseTolerance;/* mm */
+	bool reuseCells;
+	bool reusePrimaryOk;
+	int reuseSpeedIndex;
+	double reuseSafeRadius;/* mm */
+	int reuseMaskedSpeed;/* mm/s, < 0 when reuseMasked is stale */
+	double reuseBlockedCircleRadius;/* mm */
+	std::vector<double> reuseLow;/* 361 */
+	std::vector<double> reuseHigh;/* 361 */
+	std::vector<double> reusePrimary;/* HIST_SIZE */
+	std::vector<double> reuseMasked;/* HIST_SIZE */
+	int maskedSpeedCap;/* mm/s, of the masked histogram, for queryGoals */
+	/* a speed band of setSpeedBands, as this update sees it */
+	struct SpeedBand {
+		int speed;/* mm/s */
+		int table;/* into Cell_Sector */
+		double safeRadius;/* mm */
+		int maskSpeed;/* mm/s, of the blocked circles */
+		double centerOffset;/* cells, of the blocked circles */
+		double blockedRadius;/* mm */
+		double blockedCells2;/* blockedRadius squared, in cells */
+		double phiLeft;/* degrees */
+		double phiRight;/* degrees */
+		bool blocked;/* something inside its safety distance */
+	};
+	int speedBands;
+	std::vector<SpeedBand> bands;
+	std::vector<double> bandHist;/* HIST_SIZE per band */
+	std::vector<double> bandLastBinary;/* HIST_SIZE per band */
+	std::vector<double> bandDiff;/* HIST_SIZE + 1 per band, steps */
+	/*
+	 * Cell_Sector as arcs, (first sector, count), for the speed bands,
+	 * access as: cellArc[(table * WINDOW_DIAMETER^2) + (x * WINDOW_DIAMETER)
+	 * + y]
+	 */
+	std::vector<std::pair<int, int> > cellArc;
+	bool sectorScoring;
+	double clearanceWeight;
+	double clearanceDegrees;
+	SectorTable sectors;/* selectDirection's findSectors */
 };
 }
 #endif
@@ -0,0 +1,109 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPPLUSADAPTIVE_HPP
+#define YUIWONGVFHIMPL_VFPPLUSADAPTIVE_HPP 1
+#include <memory>
+#include <array>
+#include "yuiwong/vfhplus.hpp"
+namespace yuiwong {
+/**
+ * @brief VfhPlus under a time budget
+ * two planners: the configured one and a coarser one precomputed beside it
+ * (larger sectors, larger cells over the same window, fewer speed tables).
+ * when the smoothed update time trends over the budget the updates go to
+ * the coarse planner, until the fine one is predicted to fit again; both
+ * thresholds, and a minimum stay in each mode, make the switch hysteretic.
+ * the speed, the picked direction and the binary histogram carry over at
+ * a switch, so the robot does not notice it.
+ * the fine planner's stats() count the switches (coarseEnter, coarseExit)
+ * and the updates run coarse (coarseUpdate).
+ */
+struct VfhPlusAdaptive {
+	/** @brief when to switch, as fractions of the budget update is given */
+	struct Budget {
+		/** @brief go coarse above this smoothed time, default 0.8 */
+		double coarseAbove;
+		/** @brief go back below this predicted fine time, default 0.5 */
+		double fineBelow;
+		/** @brief weight of a new update time in the average, default 0.2 */
+		double smoothing;
+		/** @brief updates to stay in a mode after a switch, default 20 */
+		int minUpdates;
+		Budget();
+	};
+	/**
+	 * @brief param with twice the sector angle (when 360 stays a multiple
+	 * of it) and cells twice as large over the same window
+	 */
+	static VfhPlus::Param Coarsen(VfhPlus::Param const& param);
+	/**
+	 * @param param the fine planner's
+	 * @param coarse the coarse planner's, e.g. Coarsen(param)
+	 * @param coarseTables its cell sector tables, see
+	 * VfhPlus::setCellSectorTables
+	 */
+	VfhPlusAdaptive(
+		VfhPlus::Param const& param,
+		VfhPlus::Param const& coarse,
+		int const coarseTables = 4,
+		Budget const& budget = Budget());
+	explicit VfhPlusAdaptive(VfhPlus::Param const& param);
+	void setRobotRadius(double const robotRadius);
+	/** @brief start up both planners, in fine mode */
+	void init();
+	/**
+	 * @brief VfhPlus::update with the time it may take
+	 * @param budget seconds per update, <= 0 for no budget (fine mode)
+	 * @see VfhPlus::update(double const, ...)
+	 */
+	void update(
+		double const stamp,
+		double const budget,
+		std::array<double, 361> const& laserRanges,
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance,
+		double& chosenLinearX,
+		double& chosenAngularZ);
+	inline bool isCoarse() const { return this->coarseMode; }
+	/** @brief the planner the next update goes to */
+	inline VfhPlus& planner() { return *this->planners[this->coarseMode]; }
+	inline VfhPlus const& fine() const { return *this->planners[0]; }
+	inline VfhPlus const& coarse() const { return *this->planners[1]; }
+	/** @brief the smoothed update time of the current mode, in seconds */
+	inline double smoothedSeconds() const { return this->smoothed; }
+	/** @brief how much slower the fine planner is, from its cell tables */
+	inline double costRatio() const { return this->fineCost; }
+	/** @brief the fine planner's, with the switch events */
+	inline VfhStats::Snapshot stats() const {
+		return this->planners[0]->stats();
+	}
+private:
+	VfhPlusAdaptive(VfhPlusAdaptive const&) = delete;
+	VfhPlusAdaptive& operator=(VfhPlusAdaptive const&) = delete;
+	/** @brief cells and cell sectors an update walks through */
+	static double Cost(VfhPlus const& planner);
+	/** @brief hand the state of the current planner to the other one */
+	void switchMode();
+	Budget budget;
+	std::unique_ptr<VfhPlus> planners[2];/* fine, coarse */
+	bool coarseMode;
+	int updatesInMode;
+	double smoothed;/* seconds, < 0 before the first update in a mode */
+	double fineCost;/* fine / coarse Cost */
+};
+}
+#endif
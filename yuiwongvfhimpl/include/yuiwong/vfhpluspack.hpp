@@ -0,0 +1,107 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPPLUSPACK_HPP
+#define YUIWONGVFHIMPL_VFPPLUSPACK_HPP 1
+#include <memory>
+#include <vector>
+#include <array>
+#include "yuiwong/vfhplus.hpp"
+namespace yuiwong {
+/**
+ * @brief an "instance pack" of VfhPlus planners that share one geometry
+ * configuration and are updated in lock step
+ * the cell pass of Calculate_Cells_Mag, the primary histogram accumulation
+ * and the thresholding of buildBinaryPolarHistogram are the same
+ * instruction stream for every planner, so the pack interleaves the
+ * planners' cell magnitudes and histograms lane by lane (AoSoA):
+ * cellMag[cell][lane] and histogram[sector][lane].
+ * the lane loops have a compile time trip count, built for an AVX2 or
+ * AVX-512 target (see YUIWONGVFHIMPL_NATIVE) one pass updates 4 or 8
+ * planners at once.
+ * masking, selection and the motion commands stay per planner, the pack
+ * hands each lane back to its own VfhPlus for them.
+ * @note instantiated for 4 and 8 lanes
+ * @note meant for large scale simulation and offline evaluation, where
+ * many robots use the same Param and robot radius
+ * @note the pack builds every lane's histograms for its current speed
+ * alone and anew each update: a lane's setSpeedBands and
+ * setReuseTolerance have no effect here. setSectorScoring does, the lane
+ * selects its direction itself
+ */
+template <int Lanes>
+struct VfhPlusPack {
+	/** @brief the VfhPlus::update arguments of one lane */
+	struct Input {
+		std::array<double, 361> const* laserRanges;
+		double currentLinearX;/* meter/s */
+		double goalDirection;/* radian, 0 is to the right */
+		double goalDistance;/* meter */
+		double goalDistanceTolerance;/* meter */
+	};
+	/** @brief the VfhPlus::update results of one lane */
+	struct Output {
+		double chosenLinearX;/* meter/s */
+		double chosenAngularZ;/* radian/s */
+	};
+	VfhPlusPack(VfhPlus::Param const& param, double const robotRadius);
+	/** @brief start up every planner and build the shared cell list */
+	void init();
+	/**
+	 * @brief update all the planners, same as calling VfhPlus::update on
+	 * each of them with the lane's input
+	 * @param input the per lane inputs
+	 * @param[out] output the per lane chosen velocities
+	 */
+	void update(Input const (&input)[Lanes], Output (&output)[Lanes]);
+	/**
+	 * @brief update all the planners with an explicit timestamp
+	 * @param stamp monotonic timestamp of the laser readings, in seconds
+	 * @see VfhPlus::update(double const, ...)
+	 */
+	void update(
+		double const stamp,
+		Input const (&input)[Lanes],
+		Output (&output)[Lanes]);
+	/**
+	 * @brief the planner of the given lane, 0 <= lane < Lanes
+	 * @note its speed bands and reuse tolerance are ignored, see above
+	 */
+	inline VfhPlus& planner(int const lane) { return *this->planners[lane]; }
+	inline VfhPlus const& planner(int const lane) const {
+		return *this->planners[lane];
+	}
+private:
+	/* a cell in front of the robot, in buildPrimaryPolarHistogram order */
+	struct Cell {
+		int x;
+		int y;
+		int rangeIndex;/* index into the converted laser ranges */
+		double distance;/* millimetres */
+		double threshold;/* the cell is full when the range is below this */
+		double baseMag;
+	};
+	std::unique_ptr<VfhPlus> planners[Lanes];
+	std::vector<Cell> cells;
+	int histogramSize;
+	/* laser ranges transposed to [rangeIndex][lane] */
+	std::vector<double> ranges;
+	/* [cell][lane] */
+	std::vector<double> cellMag;
+	/* [sector][lane] */
+	std::vector<double> histogram;
+	std::vector<double> lastBinaryHistogram;
+};
+}
+#endif
@@ -0,0 +1,148 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPSHM_HPP
+#define YUIWONGVFHIMPL_VFPSHM_HPP 1
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+namespace yuiwong {
+/** @brief CLOCK_MONOTONIC in nanoseconds, comparable across processes */
+inline uint64_t VfhMonotonicNs()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull) + ts.tv_nsec;
+}
+/** @brief what a producer sends the vfhshmd planner daemon */
+struct VfhShmInput {
+	enum Kind: uint32_t {
+		KindScan = 1,/* plan for laserRanges */
+		KindOdometry = 2,/* the speed and goal for the next scans */
+		KindStop = 3,/* the daemon exits */
+	};
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t sequence;/* the producer's, echoed in the command */
+	uint64_t sentNs;/* VfhMonotonicNs() when pushed */
+	double stamp;/* seconds, the scan's */
+	/* KindOdometry */
+	double currentLinearX;/* meter/s */
+	double goalDirection;/* radian, 0 is to the right */
+	double goalDistance;/* meter */
+	double goalDistanceTolerance;/* meter */
+	/* KindScan, as convertScan gives them */
+	double laserRanges[361];
+};
+/** @brief what the vfhshmd planner daemon answers a scan with */
+struct VfhShmCommand {
+	uint64_t sequence;/* of the scan planned for */
+	uint64_t scanSentNs;/* its sentNs */
+	uint64_t planNs;/* spent in the planner update */
+	uint64_t droppedScans;/* replaced by newer ones so far */
+	double stamp;/* the scan's */
+	double chosenLinearX;/* meter/s */
+	double chosenAngularZ;/* radian/s */
+};
+/**
+ * @brief a single producer, single consumer ring of fixed size messages
+ * in a file shared between processes (put it on a tmpfs: /dev/shm)
+ * push and pop copy one message and touch two cache lines of indices,
+ * no syscall unless the consumer sleeps in wait(): then the producer
+ * wakes it with one futex wake.
+ */
+struct VfhShmRing {
+	/** @brief the first page of the file, then capacity slots */
+	struct Header {
+		char magic[8];/* "VFHSHM", written last by create */
+		uint32_t version;
+		uint32_t slotSize;/* bytes, a multiple of 64 */
+		uint32_t capacity;/* slots, a power of two */
+		uint32_t messageSize;/* bytes */
+		char pad0[40];
+		std::atomic<uint64_t> head;/* slots pushed, producer written */
+		char pad1[56];
+		std::atomic<uint64_t> tail;/* slots popped, consumer written */
+		char pad2[56];
+		std::atomic<uint32_t> pushes;/* the futex word wait() sleeps on */
+		std::atomic<uint32_t> sleepers;/* the consumer is in wait() */
+	};
+	static constexpr uint32_t Version = 1;
+	/** @brief "VFHSHM" followed by two zero bytes */
+	static char const Magic[8];
+	VfhShmRing();
+	~VfhShmRing();
+	/**
+	 * @brief create (or truncate) the ring file and map it
+	 * @param capacity slots, rounded up to a power of two
+	 * @return false on I/O error
+	 */
+	bool create(
+		std::string const& path,
+		uint32_t const messageSize,
+		uint32_t const capacity);
+	/**
+	 * @brief map a ring another process created
+	 * @return false on I/O error, before create finished or when the
+	 * message size differs
+	 */
+	bool attach(std::string const& path, uint32_t const messageSize);
+	void close();
+	inline bool isOpen() const { return this->head != nullptr; }
+	/**
+	 * @brief producer: copy message in
+	 * @return false when the ring is full
+	 */
+	bool push(void const* const message);
+	/**
+	 * @brief consumer: copy the oldest message out
+	 * @return false when the ring is empty
+	 */
+	bool pop(void* const message);
+	/**
+	 * @brief consumer: sleep until the ring is not empty
+	 * @param timeoutMs < 0 to wait for ever
+	 * @param spins times to poll before sleeping, 0 sleeps at once
+	 * @return false on timeout
+	 */
+	bool wait(int const timeoutMs = -1, int const spins = 0);
+	template <typename T>
+	inline bool push(T const& message) {
+		static_assert(std::is_trivially_copyable<T>::value, "not POD");
+		return (sizeof(T) == this->head->messageSize)
+			&& this->push(static_cast<void const*>(&message));
+	}
+	template <typename T>
+	inline bool pop(T& message) {
+		static_assert(std::is_trivially_copyable<T>::value, "not POD");
+		return (sizeof(T) == this->head->messageSize)
+			&& this->pop(static_cast<void*>(&message));
+	}
+private:
+	VfhShmRing(VfhShmRing const&) = delete;
+	VfhShmRing& operator=(VfhShmRing const&) = delete;
+	inline uint8_t* slot(uint64_t const i) const {
+		return this->data + this->headerSize
+			+ ((i & (this->head->capacity - 1)) * this->head->slotSize);
+	}
+	uint8_t* data;
+	size_t size;
+	size_t headerSize;
+	Header* head;
+};
+}
+#endif
@@ -0,0 +1,99 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPSNAPSHOT_HPP
+#define YUIWONGVFHIMPL_VFPSNAPSHOT_HPP 1
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+namespace yuiwong {
+/** @brief the outcome of one planner update, as monitoring readers see it */
+struct VfhSnapshotFrame {
+	uint64_t updates;/* updates published so far, this one included */
+	double stamp;/* seconds, as given to update */
+	double pickedDirection;/* radian, as goalDirection */
+	double maxSpeed;/* meter/s, for the picked direction */
+	double chosenLinearX;/* meter/s */
+	double chosenAngularZ;/* radian/s */
+	double blockedCircleRadius;/* meter */
+	/* the masked polar histogram, 1 blocked, 0 free */
+	std::vector<uint8_t> histogram;
+	/* window cells, [y * windowDiameter + x], 1 where an obstacle was seen */
+	int windowDiameter;
+	std::vector<uint8_t> cells;
+};
+/**
+ * @brief publishes planner frames to readers on other threads
+ * a double buffered seqlock: the one writer (the control loop) fills the
+ * buffer readers are not pointed at and then flips, so it never waits.
+ * a reader copies the newest buffer and retries only when the writer
+ * lapped it twice meanwhile. neither side locks or allocates once the
+ * sizes are set.
+ */
+struct VfhSnapshot {
+	/** @brief the fixed part of a frame, see VfhSnapshotFrame */
+	struct Header {
+		uint64_t updates;
+		double stamp;
+		double pickedDirection;
+		double maxSpeed;
+		double chosenLinearX;
+		double chosenAngularZ;
+		double blockedCircleRadius;
+	};
+	VfhSnapshot();
+	/**
+	 * @brief size the buffers, drops what was published
+	 * @note not concurrent with publish or read
+	 */
+	void reset(int const histogramSize, int const windowDiameter);
+	/**
+	 * @brief publish a frame, single writer
+	 * @param fill fill(header, histogram, cells) writes the frame into
+	 * the histogram and cells arrays of the sizes given to reset, and
+	 * every field of the header but updates
+	 */
+	template <typename Fill>
+	void publish(Fill fill) {
+		uint64_t const n = this->published.load(std::memory_order_relaxed) + 1;
+		Buffer& b = this->buffers[n & 1];
+		uint64_t const sequence = b.sequence.load(std::memory_order_relaxed);
+		b.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		b.header.updates = n;
+		fill(b.header, b.histogram.data(), b.cells.data());
+		b.sequence.store(sequence + 2, std::memory_order_release);
+		this->published.store(n, std::memory_order_release);
+	}
+	/**
+	 * @brief copy the newest frame, any thread, never blocks the writer
+	 * @param[out] frame the copy, its vectors are reused
+	 * @return false when nothing was published yet
+	 */
+	bool read(VfhSnapshotFrame& frame) const;
+private:
+	VfhSnapshot(VfhSnapshot const&) = delete;
+	VfhSnapshot& operator=(VfhSnapshot const&) = delete;
+	struct Buffer {
+		std::atomic<uint64_t> sequence;/* odd while written */
+		Header header;
+		std::vector<uint8_t> histogram;
+		std::vector<uint8_t> cells;
+	};
+	std::atomic<uint64_t> published;
+	int windowDiameter;
+	Buffer buffers[2];
+};
+}
+#endif
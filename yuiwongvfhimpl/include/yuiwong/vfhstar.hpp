@@ -14,13 +14,52 @@
  * ======================================================================== */
 #ifndef YUIWONGVFHIMPL_VFPSTAR_HPP
 #define YUIWONGVFHIMPL_VFPSTAR_HPP 1
+#include <stdint.h>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "yuiwong/vfhsnapshot.hpp"
+#include "yuiwong/vfhstats.hpp"
 namespace yuiwong {
+struct VfhBench;
+struct VfhTest;
+struct VfhWorkPool;
 /**
  * @implements vfh*
+ * the candidate directions at the current pose are projected
+ * processTimes steps of stepDistance ahead; at the current and at each
+ * projected pose the masked histogram is rebuilt from this update's cell
+ * grid and its candidates expanded in turn, an A* search over g
+ * (discounted vfh+ direction costs) and h (the turn still owed to the
+ * goal). the first step of the cheapest path reaching that depth is the
+ * picked direction. nodes come from a pool init allocates.
+ * with setSearchPool the cheapest open nodes are expanded a batch at a
+ * time across the pool's threads, each with its own scratch histogram;
+ * the cheapest path found to the last depth bounds them all, so no thread
+ * keeps a branch that cannot beat it.
+ * different step sequences often end at about the same pose: a table keyed
+ * by the pose quantized to a cell and half a sector, and the speed index,
+ * keeps each such pose's masked histogram and candidates for the rest of
+ * the update. the stats count its hits (transpositionHit) and misses
+ * (transpositionMiss). a pose on a cell sees the occupied cells through a
+ * view of the window tables init builds around a cell: moving the view
+ * moves its origin only, so its histogram costs the sector accumulation
+ * alone.
+ * given a time budget, update deepens the search a step at a time instead,
+ * up to processTimes, and keeps the first step of the deepest round that
+ * completed before the deadline: plain vfh+ until the first one does.
+ * consecutive updates search about the same poses. with rerootSearch the
+ * table's entries the last search used are carried over: moved into this
+ * update's robot frame by the odometry shift, so the subtree of the step
+ * taken is found again from the new root, and dropped where a cell within
+ * the window around them changed. only those, and poses not seen before,
+ * are projected anew.
  * @see
  * - vfh http://www-personal.umich.edu/~johannb/Papers/paper16.pdf
+ * - vfh* I. Ulrich, J. Borenstein, VFH*: local obstacle avoidance with
+ * look-ahead verification, ICRA 2000
  */
 struct VfhStar {
 	constexpr static double defaultTolerance = 0.2;
@@ -116,17 +155,53 @@ struct VfhStar {
 		double minTurnRadiusSafetyFactor;/* default 1.0 */
 		/** @param robotRadius, in meters, default 0.2 meters */
 		double robotRadius;
+		/**
+		 * @param stepDistance ds, how far a candidate direction is
+		 * projected, in meters, default 0.4 meters
+		 * @note the total projected distance dt = processTimes * stepDistance
+		 * should stay well inside the window
+		 */
+		double stepDistance;
+		/**
+		 * @param processTimes ng, the look-ahead depth in projected steps,
+		 * the deepest one under an update budget, 0 for plain vfh+,
+		 * default 3
+		 */
+		int processTimes;
+		/**
+		 * @param discountFactor lambda, the weight of a projected step's
+		 * cost relative to the step before it, default 0.8
+		 */
+		double discountFactor;
+		/**
+		 * @param searchNodes, the look-ahead node pool, allocated by init,
+		 * default 4096
+		 */
+		int searchNodes;
+		/**
+		 * @param transpositionEntries, slots of the table of projected
+		 * poses the look-ahead reuses, rounded up to a power of two by
+		 * init, 0 to project every node at its exact pose, off the cells'
+		 * lattice, default 512
+		 */
+		int transpositionEntries;
+		/**
+		 * @param rerootSearch, carry the table's projected poses over to
+		 * the next update, moved by the odometry shift, default true
+		 * @see setOdometry
+		 */
+		bool rerootSearch;
 		Param();
 	};
 	VfhStar(Param const& param);
 	virtual ~VfhStar() = default;
-	/* total projected distance dt = ng * ds */
 	/** @brief start up the vfh* algorithm */
 	void init();
 	/**
-	 * @brief update the vfh+ state using the laser readings and the robot
+	 * @brief update the vfh* state using the laser readings and the robot
 	 * speed
-	 * @param laserRanges the laser (or sonar) readings, by convertScan
+	 * @param laserRanges the laser (or sonar) readings, in mm, by
+	 * convertScan
 	 * @param currentLinearX the current robot linear x velocity, in meter/s
 	 * @param goalDirection the desired direction, in radian,
 	 * 0 is to the right
@@ -147,15 +222,66 @@ struct VfhStar {
 		double const goalDistanceTolerance,
 		double& chosenLinearX,
 		double& chosenAngularZ);
+	/**
+	 * @brief update the vfh* state with an explicit timestamp
+	 * @param stamp monotonic timestamp of the laser readings, in seconds,
+	 * e.g. the scan header stamp. it drives the acceleration limit instead
+	 * of the wall clock, so replaying the same stamps gives bit-identical
+	 * outputs at any replay speed
+	 * @see update
+	 */
+	void update(
+		double const stamp,
+		std::array<double, 361> const& laserRanges,
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance,
+		double& chosenLinearX,
+		double& chosenAngularZ);
+	/**
+	 * @brief update the vfh* state within a time budget: the look-ahead
+	 * deepens a step at a time, up to processTimes, while the budget lasts
+	 * @param budget seconds from the call, <= 0 to search processTimes deep
+	 * whatever it takes. the rounds are cut at the deadline, the histograms
+	 * before them are not
+	 * @return the depth the picked direction was verified to, 0 for plain
+	 * vfh+ (nothing in front, hemmed in, or no round completed)
+	 * @note not bit-identical on replay when the budget cuts a round
+	 * @see update(double const, ...)
+	 */
+	int update(
+		double const stamp,
+		double const budget,
+		std::array<double, 361> const& laserRanges,
+		double const currentLinearX,
+		double const goalDirection,
+		double const goalDistance,
+		double const goalDistanceTolerance,
+		double& chosenLinearX,
+		double& chosenAngularZ);
+	/**
+	 * @brief the robot's motion since the last update, as odometry
+	 * measured it, for the next update to carry the search over
+	 * @param forward in meters, along the heading at the last update
+	 * @param left in meters
+	 * @param turn radians, anti-clockwise
+	 * @note without it the next update dead-reckons the command it gave.
+	 * logs do not record it, so a replay dead-reckons
+	 */
+	void setOdometry(
+		double const forward, double const left, double const turn);
+	/** @brief the depth the last update's direction was verified to */
+	inline int lastSearchDepth() const { return this->searchDepth; }
 	inline void setRobotRadius(double const robotRadius) {
 		this->robotRadius = robotRadius;
 	}
 	/**
 	 * @brief get the safety distance at the given speed
 	 * @param speed given speed, in m/s
-	 * @return the safety distance
+	 * @return the safety distance, in meters
 	 */
-	int getSafetyDistance(double const speed) const;
+	double getSafetyDistance(double const speed) const;
 	/**
 	 * @brief set the current max speed
 	 * @param maxSpeed current max speed, in m/s
@@ -167,8 +293,71 @@ struct VfhStar {
 	 * @return max turn rate in radians
 	 */
 	double getMaxTurnrate(double const speed) const;
+	/**
+	 * @brief the masked histogram of the last update, sweeps in an
+	 * anti-clockwise direction
+	 * @note only from the updating thread, see readSnapshot
+	 */
+	inline std::vector<double> const& getHistogram() const {
+		return this->histogram;
+	}
+	/**
+	 * @brief copy the outcome of the newest update: masked histogram,
+	 * picked direction, chosen velocities and the cells seen occupied
+	 * @note any thread, lock free, never delays update()
+	 * @param[out] frame the copy, its vectors are reused
+	 * @return false before the first update
+	 */
+	inline bool readSnapshot(VfhSnapshotFrame& frame) const {
+		return this->snapshotFrames.read(frame);
+	}
+	/**
+	 * @brief per stage latency and event counters of update(), safe to
+	 * call from a monitoring thread while the planner runs
+	 * @see VfhStats
+	 */
+	inline VfhStats::Snapshot stats() const {
+		return this->stageStats.snapshot();
+	}
+	/**
+	 * @brief emit a span for update() and each of its stages
+	 * @param tracer shared timeline, nullptr to stop tracing, must outlive
+	 * the planner's updates
+	 */
+	inline void setTracer(VfhTracer* const tracer) { this->tracer = tracer; }
+	/**
+	 * @brief sample hardware counters around update() and its stages,
+	 * reported by stats(), costs a syscall per stage boundary
+	 * @note call from the thread that runs update()
+	 * @return false when perf events are unavailable, or the library was
+	 * built without YUIWONGVFHIMPL_STATS
+	 */
+	bool enablePerfCounters();
+	void disablePerfCounters();
+	/**
+	 * @brief expand the look-ahead nodes on a pool's threads, a batch of
+	 * the cheapest open ones at a time. the picked direction is the one
+	 * the serial search picks, the cost of a path does not depend on the
+	 * batch
+	 * @param pool nullptr to search on the updating thread alone, must
+	 * outlive the planner's updates
+	 * @note not during update, allocates a scratch histogram per thread
+	 */
+	void setSearchPool(VfhWorkPool* const pool);
 protected:
+	friend struct VfhBench;
+	friend struct VfhTest;
 	void allocate();
+	/**
+	 * @brief publish the outcome of this update to readSnapshot
+	 * @param stamp as given to update, in seconds
+	 * @param chosenLinearX the chosen linear x velocity, in meter/s
+	 * @param chosenAngularZ the chosen turn rate, in radian/s
+	 */
+	void publishSnapshot(
+		double const stamp,
+		double const chosenLinearX,
+		double const chosenAngularZ);
 	/**
 	 * @brief build the primary polar histogram
 	 * @param laserRanges laser (or sonar) readings
@@ -191,6 +380,230 @@ protected:
 	void buildMaskedPolarHistogram(double const speed);
 	/** @brief select the used direction */
 	void selectDirection();
+	/**
+	 * @brief the candidate directions of a masked histogram
+	 * @param histogram masked, 1 blocked, 0 free
+	 * @param heading the robot's, its forward half is searched for the
+	 * first obstacle, radians
+	 * @param desired the direction to the goal, radians
+	 * @param[out] angles the candidate directions, radians
+	 * @param[out] speeds their max speeds, m/s
+	 * @param[out] borders the openings, as (right, left) border angles
+	 * @return false when there is no obstacle in front
+	 */
+	bool collectCandidates(
+		std::vector<double> const& histogram,
+		double const heading,
+		double const desired,
+		std::vector<double>& angles,
+		std::vector<double>& speeds,
+		std::vector<std::pair<double, double> >& borders) const;
+	/**
+	 * @brief select the used direction by the look-ahead search
+	 * @param speed robot speed, m/s
+	 * @param deadline steady clock, max() to search processTimes deep at
+	 * once
+	 * @return the depth the picked direction was verified to, 0 for plain
+	 * vfh+
+	 */
+	int searchDirection(
+		double const speed,
+		std::chrono::steady_clock::time_point const deadline);
+	/**
+	 * @brief one best first search to searchLimit deep from the current
+	 * pose
+	 * @param speed robot speed, m/s
+	 * @param r robot radius and safety distance, in meters
+	 * @param speedIndex of this update
+	 * @param deadline steady clock, max() for none
+	 * @return the node whose first step to take: the cheapest clear one at
+	 * searchLimit, else the deepest expanded one; -1 for none, -2 when the
+	 * deadline cut the search
+	 */
+	int lookAhead(
+		double const speed,
+		double const r,
+		int const speedIndex,
+		std::chrono::steady_clock::time_point const deadline);
+	/* a look-ahead node: a pose after depth projected steps */
+	struct SearchNode {
+		double x;/* in meters, robot frame of this update */
+		double y;
+		double direction;/* of the step into the node, and its heading */
+		double g;
+		double f;/* g + h */
+		double firstDirection;/* of the depth 1 ancestor */
+		double firstSpeed;
+		int depth;
+		int parent;/* -1 for depth 1 */
+	};
+	/* what expanding a node writes, one per searching thread */
+	struct SearchScratch {
+		std::vector<double> histogram;
+		std::vector<double> angles;
+		std::vector<double> speeds;
+		std::vector<std::pair<double, double> > borders;
+	};
+	/*
+	 * a projected pose of this update: its masked histogram and the
+	 * candidates taken from it, both at the quantized pose, or at the one
+	 * of a previous update moved into this update's robot frame
+	 */
+	struct Transposition {
+		uint64_t key;
+		uint32_t generation;/* a slot is empty unless the table's */
+		uint32_t used;/* the generation that last looked it up */
+		double x, y, heading;/* the pose it was projected at */
+		bool ready;/* filled, else claimed by a node of the current batch */
+		bool clear;/* false for a dead end */
+		bool candidatesKept;/* false when they did not fit angles */
+		std::vector<double> histogram;
+		std::vector<double> angles;
+		std::vector<double> speeds;
+	};
+	/**
+	 * @brief expand a look-ahead node: its masked histogram, its candidate
+	 * directions and the children they lead to
+	 * @param node at a depth < searchLimit
+	 * @param index its index in nodes
+	 * @param speed robot speed, m/s
+	 * @param r robot radius and safety distance, in meters
+	 * @param bound see branch
+	 * @param scratch the calling thread's
+	 * @param entry the node's transposition, filled here unless ready,
+	 * nullptr for none
+	 * @param[out] children
+	 * @return false when the node is a dead end
+	 * @note safe from several threads at once, for distinct entries
+	 */
+	bool expand(
+		SearchNode const& node,
+		int const index,
+		double const speed,
+		double const r,
+		std::atomic<double>& bound,
+		SearchScratch& scratch,
+		Transposition* const entry,
+		std::vector<SearchNode>& children) const;
+	/**
+	 * @brief the transposition of a node, claimed for it when new
+	 * @param node the node
+	 * @param speedIndex of this update
+	 * @param[out] hit true when it is ready
+	 * @return nullptr without a table, when the probed slots are taken,
+	 * or when another node of the batch claimed it
+	 */
+	Transposition* findTransposition(
+		SearchNode const& node, int const speedIndex, bool& hit);
+	/** @brief the table key of a pose quantized to a cell and half a sector */
+	uint64_t transpositionKey(
+		double const x,
+		double const y,
+		double const heading,
+		int const speedIndex) const;
+	/**
+	 * @brief carry the entries the last search used over to this update,
+	 * moved by the odometry shift, but those near a changed cell
+	 * @param goalX this update's goal, in meters
+	 * @param goalY
+	 * @param previous the last search's generation
+	 */
+	void reroot(
+		double const goalX, double const goalY, uint32_t const previous);
+	/**
+	 * @brief the occupied cells that differ from the last search's, in
+	 * this update's robot frame, into changedCells
+	 * @param c cosine of the odometry turn
+	 * @param s its sine
+	 */
+	void findChangedCells(double const c, double const s);
+	/**
+	 * @brief the pose a node's histogram is projected at: with the table,
+	 * its own quantized to a cell and half a sector
+	 */
+	void searchPose(
+		SearchNode const& node, double& x, double& y, double& heading) const;
+	/**
+	 * @brief the children of a node, a step along each candidate direction
+	 * @param node the parent
+	 * @param index its index in nodes, -1 for the current pose
+	 * @param kt the direction to the goal from the parent, radians
+	 * @param previous the parent's heading for the turn cost, radians
+	 * @param angles the candidate directions, radians
+	 * @param speeds their max speeds, m/s
+	 * @param r robot radius and safety distance, in meters
+	 * @param bound f of the cheapest clear node at the last depth so far,
+	 * lowered by the children that reach it
+	 * @param[out] children those at the last depth that are clear and not
+	 * above bound, the others below it
+	 */
+	void branch(
+		SearchNode const& node,
+		int const index,
+		double const kt,
+		double const previous,
+		std::vector<double> const& angles,
+		std::vector<double> const& speeds,
+		double const r,
+		std::atomic<double>& bound,
+		std::vector<SearchNode>& children) const;
+	/** @brief the direction to the goal from a pose, heading when at it */
+	double targetDirection(
+		double const x, double const y, double const heading) const;
+	/**
+	 * @brief the masked histogram at a projected pose, from the occupied
+	 * cells of this update
+	 * @param x position, in meters, in the robot frame of this update
+	 * @param y position, in meters, +y is forward
+	 * @param heading radians
+	 * @param speed robot speed, m/s
+	 * @param[out] histogram 1 blocked, 0 free, histogramSize sectors
+	 * @return false when an obstacle is inside the safety distance there
+	 */
+	bool projectHistogram(
+		double const x,
+		double const y,
+		double const heading,
+		double const speed,
+		std::vector<double>& histogram) const;
+	/*
+	 * a cell of the window around a cell, at windowDiameter * i + j as
+	 * cellMag[i][j] is around the robot's
+	 */
+	struct WindowCell {
+		double distance;/* in meters */
+		double direction;/* radians */
+		double mag;
+	};
+	/**
+	 * @brief projectHistogram at a pose on a cell: the occupied cells seen
+	 * through the window tables, by their offset from it
+	 * @param px cells to the right of the robot's
+	 * @param py cells in front of it
+	 * @see projectHistogram
+	 */
+	bool projectWindow(
+		int const px,
+		int const py,
+		double const heading,
+		double const speed,
+		std::vector<double>& histogram) const;
+	/**
+	 * @brief threshold a projected histogram and mask what the turning
+	 * circles block, in place
+	 * @param phiRight the right limit of the directions reachable, radians
+	 * @param phiLeft the left one
+	 */
+	void maskProjection(
+		double const heading,
+		double const speed,
+		double const phiRight,
+		double const phiLeft,
+		std::vector<double>& histogram) const;
+	/** @brief size the search scratch for searchPool */
+	void reserveSearch();
+	/** @return true when an obstacle is inside r of (x, y), in meters */
+	bool collides(double const x, double const y, double const r) const;
 	/**
 	 * @brief the robot going too fast, such does it overshoot before it can
 	 * turn to the goal?
@@ -261,6 +674,12 @@ protected:
 	double const currentDirectionWeight;
 	double const minTurnRadiusSafetyFactor;/* default 1.0 */
 	double robotRadius;/* in meters */
+	double const stepDistance;/* ds, in meters */
+	int const processTimes;/* ng */
+	double const discountFactor;/* lambda */
+	int const searchNodes;
+	int const transpositionEntries;
+	bool const rerootSearch;
 	/*
 	 * radius of dis-allowed circles, either side of the robot,
 	 * which we can't enter due to our minimum turning radius
@@ -276,8 +695,8 @@ protected:
 	double maxSpeedForPickedDirection;
 	/*
 	 * the histogram.
-	 * this is public so that monitoring tools can get at it;
-	 * it shouldn't be modified externally.
+	 * rewritten several times by every update, monitoring tools on other
+	 * threads use readSnapshot.
 	 * sweeps in an anti-clockwise direction
 	 */
 	std::vector<double> histogram;
@@ -288,22 +707,71 @@ protected:
 	std::vector<std::vector<double> > cellDirection;
 	std::vector<std::vector<double> > cellEnlarge;
 	/*
-	 * cellSector[x][y] is a vector of indices to sectors that are effected
-	 * if cell (x,y) contains an obstacle.
-	 * cell enlargement is taken into account.
-	 * access as: cellSector[speedIndex][x][y][sectorIndex]
+	 * the sectors that are effected if cell (x,y) contains an obstacle,
+	 * cell enlargement taken into account: an arc, its first sector and
+	 * how many. read only after init.
+	 * access as: cellSector[speedIndex * windowDiameter^2
+	 * + windowDiameter * x + y]
 	 */
-	std::vector<std::vector<std::vector<std::vector<int> > > > cellSector;
+	std::vector<std::pair<int, int> > cellSector;
 	std::vector<double> candidateAngle;
 	std::vector<double> candidateSpeed;
+	/* preallocated by init, never grown by update */
+	std::vector<SearchNode> nodes;
+	std::vector<int> openNodes;/* a heap by f */
+	/* the cells occupied this update, (x, y) in meters */
+	std::vector<std::pair<double, double> > occupiedCells;
+	/* the same in cells from the robot's, +y forward */
+	std::vector<std::pair<int, int> > occupiedCellIndices;
+	/* the window around a cell, see WindowCell, cellSector enlarges it */
+	std::vector<WindowCell> windowCells;
+	/* and at the last search, in its robot frame */
+	std::vector<std::pair<double, double> > lastOccupiedCells;
+	/* the same by cell, windowDiameter * x + y */
+	std::vector<char> occupancy;
+	std::vector<char> lastOccupancy;
+	std::vector<std::pair<double, double> > changedCells;
+	/* one per pool thread, [0] for the updating thread */
+	std::vector<SearchScratch> searchScratch;
+	/* the open nodes expanded together, and what each gave */
+	std::vector<int> batch;
+	std::vector<char> batchExpanded;
+	std::vector<std::vector<SearchNode> > batchChildren;
+	std::vector<Transposition*> batchEntry;
+	/* open addressing, a power of two slots, empty when disabled */
+	std::vector<Transposition> transpositions;
+	/* as many, reroot moves the carried entries in and swaps */
+	std::vector<Transposition> spareTranspositions;
+	uint32_t transpositionGeneration;/* bumped by every search */
+	/*
+	 * the shift from the last search's robot frame to this update's: the
+	 * new origin there and the turn, known unless an update went by
+	 * without a search, or without odometry
+	 */
+	double shiftX, shiftY, shiftTurn;
+	bool shiftKnown;
+	double odometryForward, odometryLeft, odometryTurn;
+	bool odometryGiven;/* by setOdometry since the last update */
+	bool searchKept;/* the last update searched, its table can be carried */
+	std::atomic<double> searchBound;
+	double goalX, goalY;/* in meters, robot frame of this update */
+	int searchLimit;/* the depth of the current round */
+	int searchDepth;/* reached by the last update */
 	double desiredDirection, goalDistance, goalDistanceTolerance;
 	double pickedDirection;
-	/* keep track of last update, so we can monitor acceleration */
+	/*
+	 * keep track of last update, so we can monitor acceleration,
+	 * < 0 until the first update
+	 */
 	double lastUpdateTime;
 	double lastChosenLinearX;/* in m/s */
+	double lastChosenAngularZ;/* in radians/s */
 	double lastPickedDirection;
-	//double stepDistance;/* ds */
-	//int processTimes;/* ng */
+	VfhStats stageStats;
+	VfhTracer* tracer;
+	VfhWorkPool* searchPool;
+	std::unique_ptr<VfhPerfProbe> perfProbe;
+	VfhSnapshot snapshotFrames;
 };
 }
 #endif
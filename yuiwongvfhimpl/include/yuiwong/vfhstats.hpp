@@ -0,0 +1,267 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPSTATS_HPP
+#define YUIWONGVFHIMPL_VFPSTATS_HPP 1
+#include <stdint.h>
+#include <atomic>
+#include "yuiwong/vfhperf.hpp"
+#include "yuiwong/vfhtrace.hpp"
+namespace yuiwong {
+/** @brief latency of one stage (or any other span), in nanoseconds */
+struct VfhStageStats {
+	uint64_t count;
+	double meanNs;
+	double p50Ns;
+	double p99Ns;
+	double p999Ns;
+	double maxNs;
+};
+/**
+ * @brief a log-linear histogram of tick counts
+ * every power of two is split into 4 linear buckets, so a bucket is at
+ * most 25% wide. one thread records, any thread may read: the counters
+ * are atomics written with plain relaxed stores, so recording costs no
+ * locked instruction and a reader never stops the writer.
+ */
+struct VfhTickHistogram {
+	static constexpr int SubBits = 2;
+	static constexpr int Buckets = 64 << SubBits;
+	VfhTickHistogram();
+	/** @brief record one value, single writer */
+	inline void record(uint64_t const ticks) {
+		auto& c = this->counts[bucketOf(ticks)];
+		c.store(c.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		this->sum.store(
+			this->sum.load(std::memory_order_relaxed) + ticks,
+			std::memory_order_relaxed);
+		if (ticks > this->max.load(std::memory_order_relaxed)) {
+			this->max.store(ticks, std::memory_order_relaxed);
+		}
+	}
+	static inline int bucketOf(uint64_t const ticks) {
+		if (ticks < (1u << SubBits)) {
+			return ticks;
+		}
+		int const msb = 63 - __builtin_clzll(ticks);
+		return ((msb - SubBits + 1) << SubBits)
+			+ ((ticks >> (msb - SubBits)) & ((1u << SubBits) - 1));
+	}
+	/** @brief the smallest value of a bucket */
+	static uint64_t bucketLow(int const bucket);
+	/**
+	 * @brief count, mean, percentiles and maximum in nanoseconds, safe
+	 * while recording
+	 */
+	VfhStageStats summarize() const;
+	std::atomic<uint64_t> counts[Buckets];
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+};
+/** @brief mean hardware counts of one stage, see VfhPerfProbe */
+struct VfhStagePerf {
+	uint64_t samples;
+	double mean[VfhPerfProbe::CounterCount];
+};
+/**
+ * @brief per stage latency and event counters of a planner
+ * recorded by the planner's update() when the library is built with
+ * YUIWONGVFHIMPL_STATS (cmake option of the same name), else everything
+ * stays 0. read it from any thread with snapshot().
+ */
+struct VfhStats {
+	enum Stage {
+		StageUpdate,/* the whole update() */
+		StageCellsMagnitude,
+		StagePrimaryHistogram,/* the cell pass included */
+		StageBinaryHistogram,
+		StageMaskedHistogram,
+		StageSelectDirection,
+		StageLookAhead,/* VfhStar's search over projected poses */
+		StageSetMotion,
+		StageCount,
+	};
+	enum Event {
+		/* something inside the safety distance, histogram all blocked */
+		EventSafetyShortCircuit,
+		/* no candidate direction, brake and turn on the spot */
+		EventHemmedIn,
+		/* nothing in front, full speed to the goal */
+		EventNoObstacle,
+		/* binary histogram sectors kept from the last update */
+		EventHysteresisHold,
+		/* the scan left the cell grid as it was: primary histogram reused */
+		EventCellsReused,
+		/* and the speed too: binary and masked histograms reused */
+		EventHistogramsReused,
+		/* VfhPlusAdaptive went to its coarse planner, over budget */
+		EventCoarseEnter,
+		/* and back to the fine one */
+		EventCoarseExit,
+		/* an update VfhPlusAdaptive ran on its coarse planner */
+		EventCoarseUpdate,
+		/* nodes VfhStar's look-ahead projected */
+		EventLookAheadNodes,
+		/* no path reached the look-ahead depth: dead ends or a full pool */
+		EventLookAheadFallback,
+		/* a deepening round of VfhStar's budgeted update cut by its deadline */
+		EventLookAheadDeadline,
+		/* a projected pose's masked histogram found in VfhStar's table */
+		EventTranspositionHit,
+		/* and projected anew, hit / (hit + miss) is the table's hit rate */
+		EventTranspositionMiss,
+		/* a projected pose VfhStar carried over from its previous search */
+		EventRerootKept,
+		/* and dropped there, near cells that changed since */
+		EventRerootInvalidated,
+		/* VfhPlus drove a speed band below its fastest, see setSpeedBands */
+		EventSpeedBandSlower,
+		EventCount,
+	};
+	struct Snapshot {
+		bool enabled;/* built with YUIWONGVFHIMPL_STATS */
+		VfhStageStats stages[StageCount];
+		uint64_t events[EventCount];
+		/* 1 << VfhPerfProbe::Counter, 0 when no probe is attached */
+		uint32_t perfAvailable;
+		VfhStagePerf perf[StageCount];
+	};
+	/** @brief a static string, also the name of the stage's trace span */
+	static inline char const* stageName(Stage const stage) {
+		static char const* const names[StageCount] = {
+			"update",
+			"cellsMagnitude",
+			"primaryHistogram",
+			"binaryHistogram",
+			"maskedHistogram",
+			"selectDirection",
+			"lookAhead",
+			"setMotion",
+		};
+		return ((stage >= 0) && (stage < StageCount))
+			? names[stage] : "unknown";
+	}
+	static char const* eventName(Event const event);
+	VfhStats();
+	inline void record(Stage const stage, uint64_t const ticks) {
+		this->histograms[stage].record(ticks);
+	}
+	/** @brief count events, single writer */
+	inline void count(Event const event, uint64_t const n = 1) {
+		auto& e = this->events[event];
+		e.store(e.load(std::memory_order_relaxed) + n,
+			std::memory_order_relaxed);
+	}
+	/**
+	 * @brief sample hardware counters around every stage too
+	 * @param probe opened by the updating thread, nullptr to stop
+	 */
+	inline void setPerfProbe(VfhPerfProbe const* const probe) {
+		this->probe.store(probe, std::memory_order_relaxed);
+	}
+	inline VfhPerfProbe const* perfProbe() const {
+		return this->probe.load(std::memory_order_relaxed);
+	}
+	/** @brief add the counts of one stage, single writer */
+	inline void recordPerf(
+		Stage const stage,
+		uint64_t const (&begin)[VfhPerfProbe::CounterCount],
+		uint64_t const (&end)[VfhPerfProbe::CounterCount]) {
+		for (int i = 0; i < VfhPerfProbe::CounterCount; ++i) {
+			auto& t = this->perfTotals[stage][i];
+			t.store(t.load(std::memory_order_relaxed) + (end[i] - begin[i]),
+				std::memory_order_relaxed);
+		}
+		auto& n = this->perfSamples[stage];
+		n.store(n.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	}
+	/** @brief a consistent enough copy, safe while the planner updates */
+	Snapshot snapshot() const;
+private:
+	VfhStats(VfhStats const&) = delete;
+	VfhStats& operator=(VfhStats const&) = delete;
+	VfhTickHistogram histograms[StageCount];
+	std::atomic<uint64_t> events[EventCount];
+	std::atomic<VfhPerfProbe const*> probe;
+	std::atomic<uint64_t> perfTotals[StageCount][VfhPerfProbe::CounterCount];
+	std::atomic<uint64_t> perfSamples[StageCount];
+};
+/**
+ * @brief records the ticks of its scope as one stage, into the stats and
+ * as a span of the tracer, either may be nullptr
+ */
+struct VfhStageTimer {
+	inline VfhStageTimer(
+		VfhStats* const stats,
+		VfhTracer* const tracer,
+		VfhStats::Stage const stage):
+		stats(stats),
+		tracer(tracer),
+		stage(stage),
+		perf((stats != nullptr) && (stats->perfProbe() != nullptr)
+			&& stats->perfProbe()->read(this->perfBegin)),
+		begin(((stats != nullptr) || (tracer != nullptr)) ? VfhTicks() : 0) {
+		if (tracer != nullptr) {
+			tracer->begin(VfhStats::stageName(stage), this->begin);
+		}
+	}
+	inline ~VfhStageTimer() {
+		if ((this->stats == nullptr) && (this->tracer == nullptr)) {
+			return;
+		}
+		uint64_t const end = VfhTicks();
+		if (this->stats != nullptr) {
+			this->stats->record(this->stage, end - this->begin);
+			/* after the clock, so the stage time excludes the syscall */
+			uint64_t perfEnd[VfhPerfProbe::CounterCount];
+			if (this->perf && this->stats->perfProbe()->read(perfEnd)) {
+				this->stats->recordPerf(this->stage, this->perfBegin, perfEnd);
+			}
+		}
+		if (this->tracer != nullptr) {
+			this->tracer->end(VfhStats::stageName(this->stage), end);
+		}
+	}
+private:
+	VfhStageTimer(VfhStageTimer const&) = delete;
+	VfhStageTimer& operator=(VfhStageTimer const&) = delete;
+	VfhStats* const stats;
+	VfhTracer* const tracer;
+	VfhStats::Stage const stage;
+	uint64_t perfBegin[VfhPerfProbe::CounterCount];
+	bool const perf;
+	uint64_t const begin;
+};
+}
+/*
+ * YUIWONGVFHSTAGE(stats, tracer, Stage) times the rest of the enclosing
+ * scope, YUIWONGVFHEVENT(stats, Event, n) counts events. without
+ * YUIWONGVFHIMPL_STATS the stats are compiled out and a stage costs one
+ * null tracer check.
+ */
+#ifdef YUIWONGVFHIMPL_STATS
+#define YUIWONGVFHSTAGE(stats, tracer, stage) \
+	::yuiwong::VfhStageTimer const yuiwongVfhStageTimer( \
+		&(stats), (tracer), ::yuiwong::VfhStats::stage)
+#define YUIWONGVFHEVENT(stats, event, n) \
+	(stats).count(::yuiwong::VfhStats::event, (n))
+#else
+#define YUIWONGVFHSTAGE(stats, tracer, stage) \
+	::yuiwong::VfhStageTimer const yuiwongVfhStageTimer( \
+		nullptr, (tracer), ::yuiwong::VfhStats::stage)
+#define YUIWONGVFHEVENT(stats, event, n) do {} while (0)
+#endif
+#endif
@@ -0,0 +1,151 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPTRACE_HPP
+#define YUIWONGVFHIMPL_VFPTRACE_HPP 1
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "yuiwong/vfhticks.hpp"
+namespace yuiwong {
+/** @brief one begin, end or instant event of the timeline */
+struct VfhTraceEvent {
+	uint64_t ticks;/* VfhTicks */
+	char const* name;/* static string */
+	uint32_t tid;
+	char phase;/* 'B', 'E' or 'i', as in the Chrome trace format */
+};
+/** @brief the kernel thread id of the caller, cached per thread */
+uint32_t VfhTraceThreadId();
+/**
+ * @brief span tracer for the planners and their callers
+ * events go into a preallocated ring (a bounded multi producer, single
+ * consumer queue), recording never allocates, locks or does I/O. when the
+ * ring is full new events are dropped and counted. a flusher thread
+ * (start) drains the ring to a Chrome trace JSON file (chrome://tracing,
+ * Perfetto), so every thread that shares the tracer shares one timeline.
+ * @note event names must be static strings, only their pointers are kept
+ */
+struct VfhTracer {
+	/** @param capacity events in the ring, rounded up to a power of two */
+	explicit VfhTracer(size_t const capacity = 1 << 16);
+	~VfhTracer();
+	inline void begin(char const* name, uint64_t const ticks = VfhTicks()) {
+		this->push(name, ticks, 'B');
+	}
+	inline void end(char const* name, uint64_t const ticks = VfhTicks()) {
+		this->push(name, ticks, 'E');
+	}
+	inline void instant(char const* name, uint64_t const ticks = VfhTicks()) {
+		this->push(name, ticks, 'i');
+	}
+	/**
+	 * @brief start the flusher thread writing to path
+	 * @param periodMs how often the ring is drained
+	 * @return false when the file cannot be created or already started
+	 */
+	bool start(std::string const& path, int const periodMs = 100);
+	/** @brief drain what is left, close the file and join the flusher */
+	void stop();
+	/**
+	 * @brief move the recorded events to out, single consumer: not while
+	 * the flusher runs
+	 * @return events moved
+	 */
+	size_t drain(std::vector<VfhTraceEvent>& out);
+	/** @brief events lost to a full ring */
+	inline uint64_t dropped() const {
+		return this->droppedEvents.load(std::memory_order_relaxed);
+	}
+private:
+	VfhTracer(VfhTracer const&) = delete;
+	VfhTracer& operator=(VfhTracer const&) = delete;
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		VfhTraceEvent event;
+	};
+	inline void push(char const* name, uint64_t const ticks, char const phase) {
+		uint64_t pos = this->head.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;) {
+			slot = &this->slots[pos & this->mask];
+			uint64_t const sequence =
+				slot->sequence.load(std::memory_order_acquire);
+			int64_t const diff = static_cast<int64_t>(sequence - pos);
+			if (diff == 0) {
+				if (this->head.compare_exchange_weak(
+					pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				this->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+				return;
+			} else {
+				pos = this->head.load(std::memory_order_relaxed);
+			}
+		}
+		slot->event.ticks = ticks;
+		slot->event.name = name;
+		slot->event.tid = VfhTraceThreadId();
+		slot->event.phase = phase;
+		slot->sequence.store(pos + 1, std::memory_order_release);
+	}
+	void flush();
+	void run(int const periodMs);
+	std::unique_ptr<Slot[]> slots;
+	uint64_t mask;
+	/* producers and the consumer on their own cache lines */
+	char pad0[64];
+	std::atomic<uint64_t> head;
+	char pad1[64];
+	uint64_t tail;
+	char pad2[64];
+	std::atomic<uint64_t> droppedEvents;
+	/* the flusher */
+	std::thread flusher;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool running;
+	FILE* file;
+	bool firstEvent;
+	uint64_t originTicks;
+	std::vector<VfhTraceEvent> pending;
+};
+/** @brief a begin/end span of its scope, tracer may be nullptr */
+struct VfhTraceSpan {
+	inline VfhTraceSpan(VfhTracer* const tracer, char const* name):
+		tracer(tracer), name(name) {
+		if (tracer != nullptr) {
+			tracer->begin(name);
+		}
+	}
+	inline ~VfhTraceSpan() {
+		if (this->tracer != nullptr) {
+			this->tracer->end(this->name);
+		}
+	}
+private:
+	VfhTraceSpan(VfhTraceSpan const&) = delete;
+	VfhTraceSpan& operator=(VfhTraceSpan const&) = delete;
+	VfhTracer* const tracer;
+	char const* const name;
+};
+}
+#endif
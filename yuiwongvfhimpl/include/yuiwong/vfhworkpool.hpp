@@ -0,0 +1,92 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#ifndef YUIWONGVFHIMPL_VFPWORKPOOL_HPP
+#define YUIWONGVFHIMPL_VFPWORKPOOL_HPP 1
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+namespace yuiwong {
+/**
+ * @brief a fixed pool of threads running batches of independent tasks
+ * run() hands the tasks [0, n) out as one contiguous range per thread. a
+ * thread takes its tasks off the front of its range; once that is empty
+ * it steals the back half of what is left of another thread's range. a
+ * range is one atomic word, so taking and stealing are a compare and
+ * swap each and never lock. the word carries the batch too: a thief that
+ * read a range in one batch cannot take it in the next. the calling
+ * thread works as thread 0, the others sleep on a futex between batches.
+ * nothing allocates after the constructor.
+ */
+struct VfhWorkPool {
+	/** @param threads the caller included, at least 1 */
+	explicit VfhWorkPool(int const threads);
+	~VfhWorkPool();
+	/** @brief the threads a batch runs on, the caller included */
+	inline int size() const { return this->threads; }
+	/**
+	 * @brief call fn(task, thread) for every task in [0, n), return once
+	 * all returned
+	 * @param fn called concurrently, thread in [0, size()) is the index
+	 * of the calling thread, for per thread scratch
+	 * @note one batch at a time: from one thread, or serialized. more
+	 * than 65535 tasks run as several batches
+	 */
+	template <typename F>
+	inline void run(uint32_t const n, F& fn) {
+		this->run(n, &Thunk<F>, &fn);
+	}
+	void run(
+		uint32_t const n,
+		void (*fn)(void*, uint32_t, int),
+		void* const context);
+private:
+	VfhWorkPool(VfhWorkPool const&) = delete;
+	VfhWorkPool& operator=(VfhWorkPool const&) = delete;
+	template <typename F>
+	static void Thunk(void* const fn, uint32_t const task, int const thread) {
+		(*static_cast<F*>(fn))(task, thread);
+	}
+	/*
+	 * [begin, end) of the tasks left to a thread in a batch: the batch in
+	 * the high 32 bits, end in the next 16, begin in the low 16
+	 */
+	struct Queue {
+		std::atomic<uint64_t> range;
+		char pad[64 - sizeof(std::atomic<uint64_t>)];
+	};
+	/** @brief one batch of at most 65535 tasks, base + [0, n) */
+	void runBatch(uint32_t const base, uint32_t const n);
+	void loop(int const thread);
+	/** @brief run tasks, own then stolen ones, until there are none */
+	void work(int const thread);
+	void runTask(int const thread, uint32_t const task);
+	bool next(int const thread, uint32_t& task);
+	int const threads;
+	std::unique_ptr<Queue[]> queues;
+	std::vector<std::thread> workers;
+	std::atomic<void (*)(void*, uint32_t, int)> fn;
+	std::atomic<void*> context;
+	std::atomic<uint32_t> base;/* added to the tasks of the batch */
+	char pad0[64];
+	std::atomic<uint32_t> generation;/* a batch or stop, workers sleep on it */
+	std::atomic<bool> stopping;
+	char pad1[64];
+	std::atomic<uint32_t> remaining;/* tasks of the batch not returned */
+	std::atomic<uint32_t> waiting;/* the caller sleeps on remaining */
+};
+}
+#endif
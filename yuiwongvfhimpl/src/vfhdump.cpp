@@ -0,0 +1,233 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhdump.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+namespace yuiwong
+{
+char const VfhDump::Magic[8] = { 'V', 'F', 'H', 'D', 'U', 'M', 'P', 0 };
+namespace
+{
+size_t Padded(size_t const n)
+{
+	return (n + 7) & ~static_cast<size_t>(7);
+}
+size_t GridSize(VfhDumpHeader const& header)
+{
+	return header.windowDiameter * header.windowDiameter * sizeof(double);
+}
+size_t SectorsSize(VfhDumpHeader const& header)
+{
+	return Padded(static_cast<size_t>(header.windowDiameter)
+		* header.windowDiameter * header.sectorBytes);
+}
+}
+char const* VfhDump::gridName(Grid const grid)
+{
+	switch (grid) {
+	case GridDirection: return "direction";
+	case GridDistance: return "distance";
+	case GridEnlargement: return "enlargement";
+	default: return "unknown";
+	}
+}
+VfhDumpWriter::VfhDumpWriter():
+	data(nullptr), size(0), head(nullptr), frames(0) {}
+VfhDumpWriter::~VfhDumpWriter()
+{
+	this->close();
+}
+/**
+ * @brief create (or truncate) and map a dump
+ * @param layout windowDiameter, histogramSize, sectorAngle,
+ * sectorTables, frameCapacity, cellWidth and robotRadius, the rest
+ * is filled in here
+ * @return false on I/O error
+ */
+bool VfhDumpWriter::open(std::string const& path, VfhDumpHeader const& layout)
+{
+	this->close();
+	if ((layout.windowDiameter == 0) || (layout.histogramSize == 0)
+		|| (layout.frameCapacity == 0)) {
+		return false;
+	}
+	VfhDumpHeader header = layout;
+	::memcpy(header.magic, VfhDump::Magic, sizeof(header.magic));
+	header.version = VfhDump::Version;
+	header.sectorBytes = (header.histogramSize + 7) / 8;
+	header.frameSize = sizeof(VfhDumpFrame) + GridSize(header)
+		+ (header.histogramSize * sizeof(double));
+	header.firstFrame = sizeof(VfhDumpHeader)
+		+ (VfhDump::GridCount * GridSize(header))
+		+ (header.sectorTables * SectorsSize(header));
+	size_t const size = header.firstFrame
+		+ (static_cast<size_t>(header.frameCapacity) * header.frameSize);
+	int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	/* blocks allocated now, not on a page fault in the control loop */
+	bool const allocated = (::ftruncate(fd, size) == 0)
+		&& (::posix_fallocate(fd, 0, size) == 0);
+	void* const m = allocated
+		? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+		: MAP_FAILED;
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	this->data = static_cast<uint8_t*>(m);
+	this->size = size;
+	/* touch every page, frames then only copy */
+	::memset(this->data, 0, size);
+	this->head = reinterpret_cast<VfhDumpHeader*>(this->data);
+	*this->head = header;
+	this->frames = 0;
+	return true;
+}
+void VfhDumpWriter::close()
+{
+	if (this->data != nullptr) {
+		::munmap(this->data, this->size);
+	}
+	this->data = nullptr;
+	this->size = 0;
+	this->head = nullptr;
+	this->frames = 0;
+}
+/** @brief where to write a grid fixed by init */
+double* VfhDumpWriter::grid(VfhDump::Grid const grid)
+{
+	return reinterpret_cast<double*>(this->data + sizeof(VfhDumpHeader)
+		+ (grid * GridSize(*this->head)));
+}
+/** @brief where to write the bit sets of a cell sector table */
+uint8_t* VfhDumpWriter::sectors(uint32_t const table)
+{
+	return this->data + sizeof(VfhDumpHeader)
+		+ (VfhDump::GridCount * GridSize(*this->head))
+		+ (table * SectorsSize(*this->head));
+}
+/**
+ * @brief the ring slot of the next frame, overwriting the oldest one
+ * @note fill it and commitFrame it before the next beginFrame
+ */
+VfhDumpFrame* VfhDumpWriter::beginFrame()
+{
+	VfhDumpHeader const& h = *this->head;
+	VfhDumpFrame* const frame = reinterpret_cast<VfhDumpFrame*>(
+		this->data + h.firstFrame
+		+ ((this->frames % h.frameCapacity) * h.frameSize));
+	++this->frames;
+	/* a crash before commitFrame leaves the slot marked torn */
+	frame->sequence = 0;
+	std::atomic_signal_fence(std::memory_order_release);
+	return frame;
+}
+void VfhDumpWriter::commitFrame(VfhDumpFrame* const frame)
+{
+	std::atomic_signal_fence(std::memory_order_release);
+	frame->sequence = this->frames;
+}
+VfhDumpReader::VfhDumpReader(): data(nullptr), size(0), head(nullptr) {}
+VfhDumpReader::~VfhDumpReader()
+{
+	this->close();
+}
+/** @return false on I/O error or when it is not a dump */
+bool VfhDumpReader::open(std::string const& path)
+{
+	this->close();
+	int const fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if ((::fstat(fd, &st) != 0)
+		|| (static_cast<size_t>(st.st_size) < sizeof(VfhDumpHeader))) {
+		::close(fd);
+		return false;
+	}
+	void* const m = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	this->data = static_cast<uint8_t const*>(m);
+	this->size = st.st_size;
+	this->head = reinterpret_cast<VfhDumpHeader const*>(this->data);
+	VfhDumpHeader const& h = *this->head;
+	if ((::memcmp(h.magic, VfhDump::Magic, sizeof(VfhDump::Magic)) != 0)
+		|| (h.version != VfhDump::Version)
+		|| (h.sectorBytes != ((h.histogramSize + 7) / 8))
+		|| (h.frameSize != (sizeof(VfhDumpFrame) + GridSize(h)
+		+ (h.histogramSize * sizeof(double))))
+		|| ((h.firstFrame
+		+ (static_cast<size_t>(h.frameCapacity) * h.frameSize))
+		> this->size)) {
+		this->close();
+		return false;
+	}
+	for (uint32_t i = 0; i < h.frameCapacity; ++i) {
+		VfhDumpFrame const* const frame =
+			reinterpret_cast<VfhDumpFrame const*>(
+				this->data + h.firstFrame
+				+ (static_cast<size_t>(i) * h.frameSize));
+		if (frame->sequence != 0) {
+			this->order.push_back(frame);
+		}
+	}
+	std::sort(
+		this->order.begin(),
+		this->order.end(),
+		[](VfhDumpFrame const* const a, VfhDumpFrame const* const b) {
+			return a->sequence < b->sequence;
+		});
+	return true;
+}
+void VfhDumpReader::close()
+{
+	if (this->data != nullptr) {
+		::munmap(const_cast<uint8_t*>(this->data), this->size);
+	}
+	this->data = nullptr;
+	this->size = 0;
+	this->head = nullptr;
+	this->order.clear();
+}
+double const* VfhDumpReader::grid(VfhDump::Grid const grid) const
+{
+	return reinterpret_cast<double const*>(this->data
+		+ sizeof(VfhDumpHeader) + (grid * GridSize(*this->head)));
+}
+/** @brief whether an obstacle in cell (x, y) blocks sector */
+bool VfhDumpReader::sector(
+	uint32_t const table,
+	uint32_t const x,
+	uint32_t const y,
+	uint32_t const sector) const
+{
+	VfhDumpHeader const& h = *this->head;
+	uint8_t const* const bits = this->data + sizeof(VfhDumpHeader)
+		+ (VfhDump::GridCount * GridSize(h)) + (table * SectorsSize(h))
+		+ (((x * h.windowDiameter) + y) * h.sectorBytes);
+	return (bits[sector >> 3] & (1u << (sector & 7))) != 0;
+}
+}
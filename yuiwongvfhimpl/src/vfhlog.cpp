@@ -0,0 +1,346 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhlog.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+namespace yuiwong
+{
+char const VfhLog::Magic[8] = { 'V', 'F', 'H', 'L', 'O', 'G', 0, 0 };
+namespace
+{
+size_t constexpr PlusParamSize = 19;
+size_t constexpr StarParamSize = 25;
+size_t Padded(size_t const n)
+{
+	return (n + 7) & ~static_cast<size_t>(7);
+}
+bool WriteAll(int const fd, char const* data, size_t n)
+{
+	while (n > 0) {
+		ssize_t const w = ::write(fd, data, n);
+		if (w < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += w;
+		n -= w;
+	}
+	return true;
+}
+}
+VfhLogWriter::VfhLogWriter(): fd(-1) {}
+VfhLogWriter::~VfhLogWriter()
+{
+	this->close();
+}
+/**
+ * @brief open a log for a VfhPlus planner, a new file gets the header,
+ * an existing one is appended to if its header matches
+ * @return false on I/O error or header mismatch
+ */
+bool VfhLogWriter::open(
+	std::string const& path,
+	VfhPlus::Param const& param,
+	double const robotRadius)
+{
+	double const p[PlusParamSize] = {
+		param.cell_size,
+		static_cast<double>(param.window_diameter),
+		static_cast<double>(param.sector_angle),
+		param.safety_dist_0ms,
+		param.safety_dist_1ms,
+		static_cast<double>(param.max_speed),
+		static_cast<double>(param.max_speed_narrow_opening),
+		static_cast<double>(param.max_speed_wide_opening),
+		static_cast<double>(param.max_acceleration),
+		static_cast<double>(param.min_turnrate),
+		static_cast<double>(param.max_turnrate_0ms),
+		static_cast<double>(param.max_turnrate_1ms),
+		param.min_turn_radius_safety_factor,
+		param.free_space_cutoff_0ms,
+		param.obs_cutoff_0ms,
+		param.free_space_cutoff_1ms,
+		param.obs_cutoff_1ms,
+		param.weight_desired_dir,
+		param.weight_current_dir,
+	};
+	return this->open(
+		path, VfhLog::PlannerVfhPlus, p, PlusParamSize, robotRadius);
+}
+/** @brief open a log for a VfhStar planner */
+bool VfhLogWriter::open(
+	std::string const& path,
+	VfhStar::Param const& param,
+	double const robotRadius)
+{
+	double const p[StarParamSize] = {
+		param.cellWidth,
+		static_cast<double>(param.windowDiameter),
+		param.sectorAngle,
+		param.maxSpeed,
+		param.maxSpeedNarrowOpening,
+		param.maxSpeedWideOpening,
+		param.zeroSafetyDistance,
+		param.maxSafetyDistance,
+		param.zeroMaxTurnrate,
+		param.maxMaxTurnrate,
+		param.zeroFreeSpaceCutoff,
+		param.maxFreeSpaceCutoff,
+		param.zeroObsCutoff,
+		param.maxObsCutoff,
+		param.maxAcceleration,
+		param.desiredDirectionWeight,
+		param.currentDirectionWeight,
+		param.minTurnRadiusSafetyFactor,
+		param.robotRadius,
+		param.stepDistance,
+		static_cast<double>(param.processTimes),
+		param.discountFactor,
+		static_cast<double>(param.searchNodes),
+		static_cast<double>(param.transpositionEntries),
+		param.rerootSearch ? 1.0 : 0.0,
+	};
+	return this->open(
+		path, VfhLog::PlannerVfhStar, p, StarParamSize, robotRadius);
+}
+bool VfhLogWriter::open(
+	std::string const& path,
+	VfhLog::Planner const planner,
+	double const* param,
+	uint32_t const paramSize,
+	double const robotRadius)
+{
+	this->close();
+	VfhLogHeader h;
+	::memset(&h, 0, sizeof(h));
+	::memcpy(h.magic, VfhLog::Magic, sizeof(h.magic));
+	h.version = VfhLog::Version;
+	h.planner = planner;
+	h.paramSize = paramSize;
+	h.robotRadius = robotRadius;
+	std::string head(sizeof(h) + (paramSize * sizeof(double)), '\0');
+	::memcpy(&head[0], &h, sizeof(h));
+	::memcpy(&head[sizeof(h)], param, paramSize * sizeof(double));
+	int const fd = ::open(
+		path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		if (!WriteAll(fd, head.data(), head.size())) {
+			::close(fd);
+			return false;
+		}
+	} else {
+		/* append only to a log of the same planner and configuration */
+		std::string existing(head.size(), '\0');
+		ssize_t const r = ::pread(fd, &existing[0], existing.size(), 0);
+		if ((r != static_cast<ssize_t>(existing.size()))
+			|| (existing != head)) {
+			::close(fd);
+			return false;
+		}
+	}
+	this->fd = fd;
+	return true;
+}
+void VfhLogWriter::close()
+{
+	if (this->fd >= 0) {
+		::close(this->fd);
+		this->fd = -1;
+	}
+}
+/**
+ * @brief append one update
+ * @param record the update, size and histogramSize are filled in here
+ * @param histogram the histogram to snapshot, may be nullptr
+ * @param histogramSize sectors in histogram
+ * @return false on I/O error
+ */
+bool VfhLogWriter::write(
+	VfhLogRecord& record,
+	double const* histogram,
+	int const histogramSize)
+{
+	if (this->fd < 0) {
+		return false;
+	}
+	size_t const n = ((histogram != nullptr) && (histogramSize > 0))
+		? histogramSize : 0;
+	record.size = sizeof(record) + Padded(n);
+	record.histogramSize = n;
+	this->buffer.assign(record.size, '\0');
+	::memcpy(&this->buffer[0], &record, sizeof(record));
+	for (size_t i = 0; i < n; ++i) {
+		this->buffer[sizeof(record) + i] = (histogram[i] != 0) ? 1 : 0;
+	}
+	return WriteAll(this->fd, this->buffer.data(), this->buffer.size());
+}
+VfhLogReader::VfhLogReader():
+	data(nullptr),
+	size(0),
+	head(nullptr),
+	param(nullptr),
+	firstRecord(0),
+	offset(0) {}
+VfhLogReader::~VfhLogReader()
+{
+	this->close();
+}
+/** @return false on I/O error or when it is not a log */
+bool VfhLogReader::open(std::string const& path)
+{
+	this->close();
+	int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if ((::fstat(fd, &st) != 0)
+		|| (static_cast<size_t>(st.st_size) < sizeof(VfhLogHeader))) {
+		::close(fd);
+		return false;
+	}
+	void* const m = ::mmap(
+		nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	::madvise(m, st.st_size, MADV_SEQUENTIAL);
+	this->data = static_cast<uint8_t const*>(m);
+	this->size = st.st_size;
+	this->head = reinterpret_cast<VfhLogHeader const*>(this->data);
+	this->firstRecord = sizeof(VfhLogHeader)
+		+ (this->head->paramSize * sizeof(double));
+	size_t const expected = (this->head->planner == VfhLog::PlannerVfhPlus)
+		? PlusParamSize : StarParamSize;
+	if ((::memcmp(this->head->magic, VfhLog::Magic, sizeof(VfhLog::Magic))
+		!= 0)
+		|| (this->head->version != VfhLog::Version)
+		|| ((this->head->planner != VfhLog::PlannerVfhPlus)
+		&& (this->head->planner != VfhLog::PlannerVfhStar))
+		|| (this->head->paramSize != expected)
+		|| (this->firstRecord > this->size)) {
+		this->close();
+		return false;
+	}
+	this->param = reinterpret_cast<double const*>(this->head + 1);
+	this->offset = this->firstRecord;
+	return true;
+}
+void VfhLogReader::close()
+{
+	if (this->data != nullptr) {
+		::munmap(const_cast<uint8_t*>(this->data), this->size);
+	}
+	this->data = nullptr;
+	this->size = 0;
+	this->head = nullptr;
+	this->param = nullptr;
+	this->firstRecord = 0;
+	this->offset = 0;
+}
+/** @brief the Param of a VfhPlus log */
+VfhPlus::Param VfhLogReader::plusParam() const
+{
+	double const* const p = this->param;
+	VfhPlus::Param param;
+	param.cell_size = p[0];
+	param.window_diameter = p[1];
+	param.sector_angle = p[2];
+	param.safety_dist_0ms = p[3];
+	param.safety_dist_1ms = p[4];
+	param.max_speed = p[5];
+	param.max_speed_narrow_opening = p[6];
+	param.max_speed_wide_opening = p[7];
+	param.max_acceleration = p[8];
+	param.min_turnrate = p[9];
+	param.max_turnrate_0ms = p[10];
+	param.max_turnrate_1ms = p[11];
+	param.min_turn_radius_safety_factor = p[12];
+	param.free_space_cutoff_0ms = p[13];
+	param.obs_cutoff_0ms = p[14];
+	param.free_space_cutoff_1ms = p[15];
+	param.obs_cutoff_1ms = p[16];
+	param.weight_desired_dir = p[17];
+	param.weight_current_dir = p[18];
+	return param;
+}
+/** @brief the Param of a VfhStar log */
+VfhStar::Param VfhLogReader::starParam() const
+{
+	double const* const p = this->param;
+	VfhStar::Param param;
+	param.cellWidth = p[0];
+	param.windowDiameter = p[1];
+	param.sectorAngle = p[2];
+	param.maxSpeed = p[3];
+	param.maxSpeedNarrowOpening = p[4];
+	param.maxSpeedWideOpening = p[5];
+	param.zeroSafetyDistance = p[6];
+	param.maxSafetyDistance = p[7];
+	param.zeroMaxTurnrate = p[8];
+	param.maxMaxTurnrate = p[9];
+	param.zeroFreeSpaceCutoff = p[10];
+	param.maxFreeSpaceCutoff = p[11];
+	param.zeroObsCutoff = p[12];
+	param.maxObsCutoff = p[13];
+	param.maxAcceleration = p[14];
+	param.desiredDirectionWeight = p[15];
+	param.currentDirectionWeight = p[16];
+	param.minTurnRadiusSafetyFactor = p[17];
+	param.robotRadius = p[18];
+	param.stepDistance = p[19];
+	param.processTimes = p[20];
+	param.discountFactor = p[21];
+	param.searchNodes = p[22];
+	param.transpositionEntries = p[23];
+	param.rerootSearch = p[24] != 0;
+	return param;
+}
+/**
+ * @brief the next record, points into the mapping
+ * @return nullptr at the end of the log
+ */
+VfhLogRecord const* VfhLogReader::next()
+{
+	if ((this->data == nullptr)
+		|| ((this->offset + sizeof(VfhLogRecord)) > this->size)) {
+		return nullptr;
+	}
+	VfhLogRecord const* const record =
+		reinterpret_cast<VfhLogRecord const*>(this->data + this->offset);
+	if ((record->size < (sizeof(VfhLogRecord) + record->histogramSize))
+		|| ((this->offset + record->size) > this->size)) {
+		/* torn by a crash while writing */
+		return nullptr;
+	}
+	this->offset += record->size;
+	return record;
+}
+}
@@ -0,0 +1,91 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhmailbox.hpp"
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+namespace yuiwong
+{
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+	"a futex word must be a plain 32 bit word");
+/**
+ * @brief sleep while word holds expected (a futex wait on Linux)
+ * @param timeoutMs < 0 to wait for ever
+ * @param shared word is in memory shared between processes
+ * @return false on timeout, true when woken or word changed (spuriously
+ * too, callers check again)
+ */
+bool VfhFutexWait(
+	std::atomic<uint32_t>& word,
+	uint32_t const expected,
+	int const timeoutMs,
+	bool const shared)
+{
+#ifdef __linux__
+	struct timespec timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	long const r = ::syscall(
+		SYS_futex,
+		reinterpret_cast<uint32_t*>(&word),
+		shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+		expected,
+		(timeoutMs < 0) ? nullptr : &timeout,
+		nullptr,
+		0);
+	return (r == 0) || (errno != ETIMEDOUT);
+#else
+	/* no futex: poll, a millisecond at a time */
+	auto const deadline = std::chrono::steady_clock::now()
+		+ std::chrono::milliseconds(timeoutMs);
+	while (word.load(std::memory_order_acquire) == expected) {
+		if ((timeoutMs >= 0) && (std::chrono::steady_clock::now() >= deadline)) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	(void)shared;
+	return true;
+#endif
+}
+/** @brief wake up to n threads sleeping on word */
+void VfhFutexWake(
+	std::atomic<uint32_t>& word,
+	int const n,
+	bool const shared)
+{
+#ifdef __linux__
+	::syscall(
+		SYS_futex,
+		reinterpret_cast<uint32_t*>(&word),
+		shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+		n,
+		nullptr,
+		nullptr,
+		0);
+#else
+	(void)word;
+	(void)n;
+	(void)shared;
+#endif
+}
+}
@@ -0,0 +1,156 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhperf.hpp"
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+namespace yuiwong
+{
+namespace
+{
+#ifdef __linux__
+int OpenCounter(uint32_t const type, uint64_t const config, int const group)
+{
+	struct perf_event_attr attr;
+	::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = (group < 0) ? 1 : 0;/* the leader starts the group */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return ::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+uint64_t CacheMiss(uint64_t const cache)
+{
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+}
+char const* VfhPerfProbe::counterName(Counter const counter)
+{
+	switch (counter) {
+	case CounterCycles: return "cycles";
+	case CounterInstructions: return "instructions";
+	case CounterL1dMisses: return "l1dMisses";
+	case CounterLlcMisses: return "llcMisses";
+	case CounterBranchMisses: return "branchMisses";
+	default: return "unknown";
+	}
+}
+VfhPerfProbe::VfhPerfProbe(): members(0)
+{
+	for (int i = 0; i < CounterCount; ++i) {
+		this->fds[i] = -1;
+		this->slot[i] = -1;
+	}
+}
+VfhPerfProbe::~VfhPerfProbe()
+{
+	this->close();
+}
+/**
+ * @brief open the counters for the calling thread, the one that will
+ * read them
+ * @return false when perf events are unavailable
+ */
+bool VfhPerfProbe::open()
+{
+	this->close();
+#ifdef __linux__
+	struct {
+		uint32_t type;
+		uint64_t config;
+	} const events[CounterCount] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, CacheMiss(PERF_COUNT_HW_CACHE_L1D) },
+		{ PERF_TYPE_HW_CACHE, CacheMiss(PERF_COUNT_HW_CACHE_LL) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+	int const leader = OpenCounter(
+		events[CounterCycles].type, events[CounterCycles].config, -1);
+	if (leader < 0) {
+		return false;
+	}
+	this->fds[CounterCycles] = leader;
+	this->slot[CounterCycles] = this->members++;
+	for (int i = CounterCycles + 1; i < CounterCount; ++i) {
+		/* a counter the CPU lacks is left out, the rest still work */
+		int const fd = OpenCounter(events[i].type, events[i].config, leader);
+		if (fd >= 0) {
+			this->fds[i] = fd;
+			this->slot[i] = this->members++;
+		}
+	}
+	::ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	::ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+#else
+	return false;
+#endif
+}
+void VfhPerfProbe::close()
+{
+	/* members first, then the leader */
+	for (int i = CounterCount - 1; i >= 0; --i) {
+		if (this->fds[i] >= 0) {
+			::close(this->fds[i]);
+		}
+		this->fds[i] = -1;
+		this->slot[i] = -1;
+	}
+	this->members = 0;
+}
+/** @brief bit mask of the counters in the group, 1 << Counter */
+uint32_t VfhPerfProbe::available() const
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < CounterCount; ++i) {
+		if (this->fds[i] >= 0) {
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+/**
+ * @brief the current counts, with one read of the group
+ * @param[out] values counts, 0 for unavailable counters
+ * @return false when not open or the read failed
+ */
+bool VfhPerfProbe::read(uint64_t (&values)[CounterCount]) const
+{
+	if (!this->isOpen()) {
+		return false;
+	}
+	/* PERF_FORMAT_GROUP: nr, then one value per member */
+	uint64_t buf[1 + CounterCount];
+	ssize_t const n = ::read(this->fds[CounterCycles], buf, sizeof(buf));
+	if ((n < static_cast<ssize_t>(sizeof(uint64_t)))
+		|| (buf[0] != static_cast<uint64_t>(this->members))) {
+		return false;
+	}
+	for (int i = 0; i < CounterCount; ++i) {
+		values[i] = (this->slot[i] >= 0) ? buf[1 + this->slot[i]] : 0;
+	}
+	return true;
+}
+}
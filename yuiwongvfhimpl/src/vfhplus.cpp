@@ -14,14 +14,37 @@
  * ======================================================================== */
 #include "yuiwong/vfhplus.hpp"
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include "yuiwong/time.hpp"
 #include "yuiwong/angle.hpp"
 #define DTOR(d) ((d) * M_PI / 180)
 namespace yuiwong
 {
+namespace
+{
+/** @brief deltaAngle of two angles in [0, 360), branch free */
+inline double DeltaDegrees(double const a1, double const a2)
+{
+	double const d = a2 - a1;
+	return (d >= 180) ? (d - 360) : ((d < -180) ? (d + 360) : d);
+}
+/** @brief fabs(deltaAngle) of two angles in [0, 360), branch free */
+inline double AbsDeltaDegrees(double const a1, double const a2)
+{
+	double const d = ::fabs(a2 - a1);
+	return (d > 180) ? (360 - d) : d;
+}
+/** @brief an angle in [0, 360), normalized only when it is not */
+inline double PositiveDegrees(double const a)
+{
+	return ((a >= 0) && (a < 360)) ? a : NormalizeDegreeAnglePositive(a);
+}
+}
 /**
 * VfhPlus constructor
 * @param cell_size local map cell size
@@ -69,7 +92,27 @@ VfhPlus::VfhPlus(Param const& param):
 	pickedDirection(90),
 	lastPickedDirection(pickedDirection),
 	lastUpdateTime(-1.0),
-	lastChosenLinearX(0)
+	lastChosenLinearX(0),
+	tracer(nullptr),
+	streaming(false),
+	streamBlocked(false),
+	streamStamp(0),
+	streamDiffSeconds(-1.0),
+	streamPoseSpeed(0),
+	streamSpeedIndex(0),
+	streamSafeRadius(0),
+	reuseTolerance(0),
+	reuseCells(false),
+	reusePrimaryOk(false),
+	reuseSpeedIndex(0),
+	reuseSafeRadius(0),
+	reuseMaskedSpeed(-1),
+	reuseBlockedCircleRadius(0),
+	maskedSpeedCap(param.max_speed),
+	speedBands(0),
+	sectorScoring(false),
+	clearanceWeight(0),
+	clearanceDegrees(40)
 {
 this->Last_Binary_Hist = nullptr;
 this->Hist = nullptr;
@@ -203,6 +246,9 @@ void VfhPlus::init()
 	printf("CELL_WIDTH: %1.1f\tWINDOW_DIAMETER: %d\tSECTOR_ANGLE: %d\tROBOT_RADIUS: %1.1f\tSAFETY_DIST: %1.1f\tMAX_SPEED: %d\tMAX_TURNRATE: %d\tFree Space Cutoff: %1.1f\tObs Cutoff: %1.1f\tWeight Desired Dir: %1.1f\tWeight Current_Dir:%1.1f\n", CELL_WIDTH, WINDOW_DIAMETER, SECTOR_ANGLE, ROBOT_RADIUS, SAFETY_DIST, MAX_SPEED, MAX_TURNRATE, Binary_Hist_Low, Binary_Hist_High, U1, U2);
 	*/
 	VFH_Allocate();
+	this->snapshotFrames.reset(HIST_SIZE, WINDOW_DIAMETER);
+	/* the dump layout follows the tables, start it again after init */
+	this->dump.close();
 	for(x = 0;x<HIST_SIZE;x++) {
 	Hist[x] = 0;
 	Last_Binary_Hist[x] = 1;
@@ -336,7 +382,59 @@ void VfhPlus::init()
 	}
 	}
 	}
-	this->lastUpdateTime = NowSecond();
+	/*
+	 * bucket the cells Calculate_Cells_Mag looks at by the range that
+	 * decides them, x outer and y inner as there
+	 */
+	int const front = static_cast<int>(::ceil(WINDOW_DIAMETER / 2.0));
+	std::vector<int> counts(362, 0);
+	std::vector<int> rangeIndex(WINDOW_DIAMETER * front);
+	for (x = 0; x < WINDOW_DIAMETER; ++x) {
+		for (y = 0; y < front; ++y) {
+			int const index = std::min(360, std::max(0,
+				static_cast<int>(::rint(Cell_Direction[x][y] * 2.0))));
+			rangeIndex[(x * front) + y] = index;
+			++counts[index + 1];
+		}
+	}
+	for (i = 0; i < 361; ++i) {
+		counts[i + 1] += counts[i];
+	}
+	this->streamCellStart = counts;
+	this->streamCells.resize(WINDOW_DIAMETER * front);
+	for (x = 0; x < WINDOW_DIAMETER; ++x) {
+		for (y = 0; y < front; ++y) {
+			StreamCell& cell =
+				this->streamCells[counts[rangeIndex[(x * front) + y]]++];
+			cell.x = x;
+			cell.y = y;
+			cell.threshold = Cell_Dist[x][y] + CELL_WIDTH / 2.0;
+		}
+	}
+	this->streamSeen.assign(361, 0);
+	this->streaming = false;
+	this->rangeThresholds.resize(this->streamCells.size());
+	for (i = 0; i < 361; ++i) {
+		int const end = this->streamCellStart[i + 1];
+		for (int c = this->streamCellStart[i]; c < end; ++c) {
+			this->rangeThresholds[c] = this->streamCells[c].threshold;
+		}
+		std::sort(
+			this->rangeThresholds.begin() + this->streamCellStart[i],
+			this->rangeThresholds.begin() + end);
+	}
+	this->reuseLow.assign(361, 0);
+	this->reuseHigh.assign(361, 0);
+	this->reusePrimary.assign(HIST_SIZE, 0);
+	this->reuseMasked.assign(HIST_SIZE, 0);
+	this->bands.clear();
+	this->cellArc.clear();
+	if (this->speedBands > 1) {
+		this->buildCellArcs();
+	}
+	this->forgetCells();
+	/* no update yet, the first one must not accelerate from the init time */
+	this->lastUpdateTime = -1.0;
 }
 /**
 * Allocate the VFH+ memory
@@ -380,8 +478,35 @@ Last_Binary_Hist = new double[HIST_SIZE];
 this->SetCurrentMaxSpeed(MAX_SPEED);
 return(1);
 }
+/**
+ * @brief update the vfh+ state using the laser readings and the robot speed,
+ * timed by the wall clock
+ * @see update(double const, ...)
+ */
+void VfhPlus::update(
+	std::array<double, 361> const& laserRanges,
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance,
+	double& chosenLinearX,
+	double& chosenAngularZ)
+{
+	this->update(
+		NowSecond(),
+		laserRanges,
+		currentLinearX,
+		goalDirection,
+		goalDistance,
+		goalDistanceTolerance,
+		chosenLinearX,
+		chosenAngularZ);
+}
 /**
  * @brief update the vfh+ state using the laser readings and the robot speed
+ * @param stamp monotonic timestamp of the laser readings, in seconds,
+ * drives the acceleration limit, so replaying the same stamps gives the
+ * same outputs at any replay speed
  * @param laserRanges the laser (or sonar) readings, by convertScan
  * @param currentLinearX the current robot linear x velocity, in meter/s
  * @param goalDirection the desired direction, in radian, 0 is to the right
@@ -394,6 +519,7 @@ return(1);
  * radian/s
  */
 void VfhPlus::update(
+	double const stamp,
 	std::array<double, 361> const& laserRanges,
 	double const currentLinearX,
 	double const goalDirection,
@@ -402,12 +528,255 @@ void VfhPlus::update(
 	double& chosenLinearX,
 	double& chosenAngularZ)
 {
-	double const now = NowSecond();
-	double const diffSeconds = now - this->lastUpdateTime;
-	this->lastUpdateTime = now;
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageUpdate);
+	double const diffSeconds = this->advanceUpdateTime(stamp);
+	int const currentPoseSpeed = this->beginUpdate(
+		currentLinearX, goalDirection, goalDistance, goalDistanceTolerance);
+	if (this->speedBands > 1) {
+		// choose the speed band with the direction, see setSpeedBands
+		this->forgetCells();
+		this->buildSpeedBandHistograms(laserRanges, currentPoseSpeed);
+		this->decideSpeedBand();
+		this->chooseMotion(
+			diffSeconds, currentPoseSpeed, chosenLinearX, chosenAngularZ);
+		this->publishSnapshot(stamp, chosenLinearX, chosenAngularZ);
+		this->captureDump(stamp);
+		return;
+	}
+	bool primaryOk;
+	bool const cellsReused = this->sameCells(laserRanges, currentPoseSpeed);
+	if (cellsReused) {
+		YUIWONGVFHEVENT(this->stageStats, EventCellsReused, 1);
+		primaryOk = this->reusePrimaryOk;
+		std::copy(this->reusePrimary.begin(), this->reusePrimary.end(), Hist);
+	} else {
+		primaryOk =
+			buildPrimaryPolarHistogram(laserRanges, currentPoseSpeed) != 0;
+		this->rememberCells(laserRanges, currentPoseSpeed, primaryOk);
+	}
+	if (cellsReused && primaryOk
+		&& (currentPoseSpeed == this->reuseMaskedSpeed)) {
+		// the binary histogram is the last one, hysteresis and all, so is
+		// the masked one: only the selection depends on the goal
+		YUIWONGVFHEVENT(this->stageStats, EventHistogramsReused, 1);
+		std::copy(this->reuseMasked.begin(), this->reuseMasked.end(), Hist);
+		Blocked_Circle_Radius = this->reuseBlockedCircleRadius;
+		selectDirection();
+	} else {
+		this->decideDirection(primaryOk, currentPoseSpeed);
+		if (primaryOk) {
+			// selectDirection leaves the masked histogram in Hist
+			std::copy(Hist, Hist + HIST_SIZE, this->reuseMasked.begin());
+			this->reuseMaskedSpeed = currentPoseSpeed;
+			this->reuseBlockedCircleRadius = Blocked_Circle_Radius;
+		} else {
+			this->reuseMaskedSpeed = -1;
+		}
+	}
+	this->chooseMotion(
+		diffSeconds, currentPoseSpeed, chosenLinearX, chosenAngularZ);
+	this->publishSnapshot(stamp, chosenLinearX, chosenAngularZ);
+	this->captureDump(stamp);
+}
+/**
+ * @brief start a scan that arrives in slices (lidar packets): the cells
+ * and histogram sectors of each slice are filled in as it comes, so
+ * finishScan only has the selection left to do
+ * @param stamp monotonic timestamp of the scan, in seconds, as update
+ * @see update for the other params
+ */
+void VfhPlus::beginScan(
+	double const stamp,
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance)
+{
+	this->streamStamp = stamp;
+	this->streamDiffSeconds = this->advanceUpdateTime(stamp);
+	this->streamPoseSpeed = this->beginUpdate(
+		currentLinearX, goalDirection, goalDistance, goalDistanceTolerance);
+	this->streamSpeedIndex = this->Get_Speed_Index(this->streamPoseSpeed);
+	this->streamSafeRadius = ROBOT_RADIUS
+		+ static_cast<double>(this->Get_Safety_Dist(this->streamPoseSpeed));
+	std::fill(this->Hist, this->Hist + HIST_SIZE, 0.0);
+	std::fill(this->streamSeen.begin(), this->streamSeen.end(), 0);
+	this->forgetCells();
+	this->streamBlocked = false;
+	this->streaming = true;
+}
+/**
+ * @brief fill in the cells seen by laser ranges [first, first + n)
+ * @param ranges n ranges, in mm, as convertScan puts them at first..
+ * @return false before beginScan, past index 360, or when some of the
+ * ranges were given already (those are ignored)
+ */
+bool VfhPlus::addScanSlice(
+	size_t const first, double const* const ranges, size_t const n)
+{
+	if (!this->streaming || (first > 361) || (n > (361 - first))) {
+		return false;
+	}
+	bool fresh = true;
+	for (size_t i = 0; i < n; ++i) {
+		uint8_t& seen = this->streamSeen[first + i];
+		if (seen != 0) {
+			fresh = false;
+			continue;
+		}
+		seen = 1;
+		this->streamRange(static_cast<int>(first + i), ranges[i]);
+	}
+	return fresh;
+}
+/**
+ * @brief finish the scan: ranges no slice gave count as convertScan's
+ * unknown (-1, occupied), then the direction and the motion are picked as
+ * update does
+ * @return false without beginScan, the outputs are then untouched
+ */
+bool VfhPlus::finishScan(double& chosenLinearX, double& chosenAngularZ)
+{
+	if (!this->streaming) {
+		return false;
+	}
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageUpdate);
+	this->streaming = false;
+	for (int i = 0; i < 361; ++i) {
+		if (this->streamSeen[i] == 0) {
+			this->streamRange(i, -1.0);
+		}
+	}
+	if (this->streamBlocked) {
+		std::fill(this->Hist, this->Hist + HIST_SIZE, 1.0);
+	}
+	this->decideDirection(!this->streamBlocked, this->streamPoseSpeed);
+	this->chooseMotion(
+		this->streamDiffSeconds,
+		this->streamPoseSpeed,
+		chosenLinearX,
+		chosenAngularZ);
+	this->publishSnapshot(this->streamStamp, chosenLinearX, chosenAngularZ);
+	this->captureDump(this->streamStamp);
+	return true;
+}
+/**
+ * @brief fill in the cells seen by laser range index of the scan being
+ * streamed, as Calculate_Cells_Mag and buildPrimaryPolarHistogram do
+ */
+void VfhPlus::streamRange(int const index, double const range)
+{
+	if (this->streamBlocked) {
+		return;
+	}
+	std::vector<std::vector<std::vector<int> > > const& sectors =
+		this->Cell_Sector[this->streamSpeedIndex];
+	int const end = this->streamCellStart[index + 1];
+	for (int c = this->streamCellStart[index]; c < end; ++c) {
+		StreamCell const& cell = this->streamCells[c];
+		double& mag = this->Cell_Mag[cell.x][cell.y];
+		if (cell.threshold > range) {
+			if ((Cell_Dist[cell.x][cell.y] < this->streamSafeRadius)
+				&& !((cell.x == CENTER_X) && (cell.y == CENTER_Y))) {
+				// Something got inside our safety distance
+				this->streamBlocked = true;
+				return;
+			}
+			mag = Cell_Base_Mag[cell.x][cell.y];
+			for (int const s: sectors[cell.x][cell.y]) {
+				Hist[s] += mag;
+			}
+		} else {
+			mag = 0.0;
+		}
+	}
+}
+/**
+ * @brief the cell grid of the last update holds for this scan: every range
+ * is between the same cell thresholds, within reuseTolerance, and the
+ * speed gives the same sector table and safety distance
+ * @param speed the current pose speed, mm/s
+ */
+bool VfhPlus::sameCells(
+	std::array<double, 361> const& laserRanges, int const speed)
+{
+	if (!this->reuseCells
+		|| (this->reuseSpeedIndex != this->Get_Speed_Index(speed))
+		|| (this->reuseSafeRadius != (ROBOT_RADIUS
+		+ static_cast<double>(this->Get_Safety_Dist(speed))))) {
+		return false;
+	}
+	bool same = true;
+	for (int i = 0; i < 361; ++i) {
+		/* no early exit: a branch free loop the compiler vectorizes */
+		same &= (laserRanges[i] >= this->reuseLow[i])
+			& (laserRanges[i] < this->reuseHigh[i]);
+	}
+	return same;
+}
+/**
+ * @brief remember the primary histogram in Hist and the range intervals
+ * that give the same cell grid, for sameCells
+ */
+void VfhPlus::rememberCells(
+	std::array<double, 361> const& laserRanges,
+	int const speed,
+	bool const primaryOk)
+{
+	double const inf = std::numeric_limits<double>::infinity();
+	for (int i = 0; i < 361; ++i) {
+		double const range = laserRanges[i];
+		if (std::isnan(range)) {
+			/* never the same: NaN compares false to everything */
+			this->reuseLow[i] = inf;
+			this->reuseHigh[i] = -inf;
+			continue;
+		}
+		/* a cell is occupied when range < its threshold */
+		auto const begin = this->rangeThresholds.begin()
+			+ this->streamCellStart[i];
+		auto const end = this->rangeThresholds.begin()
+			+ this->streamCellStart[i + 1];
+		auto const above = std::upper_bound(begin, end, range);
+		this->reuseLow[i] = ((above == begin) ? -inf : *(above - 1))
+			- this->reuseTolerance;
+		this->reuseHigh[i] = ((above == end) ? inf : *above)
+			+ this->reuseTolerance;
+	}
+	std::copy(Hist, Hist + HIST_SIZE, this->reusePrimary.begin());
+	this->reusePrimaryOk = primaryOk;
+	this->reuseSpeedIndex = this->Get_Speed_Index(speed);
+	this->reuseSafeRadius = ROBOT_RADIUS
+		+ static_cast<double>(this->Get_Safety_Dist(speed));
+	this->reuseCells = true;
+}
+/**
+ * @brief remember the stamp of this update
+ * @param stamp monotonic timestamp, in seconds
+ * @return the seconds elapsed since the last update, < 0 on the first one
+ */
+double VfhPlus::advanceUpdateTime(double const stamp)
+{
+	double const diffSeconds = (this->lastUpdateTime < 0)
+		? -1.0 : (stamp - this->lastUpdateTime);
+	this->lastUpdateTime = stamp;
+	return diffSeconds;
+}
+/**
+ * @brief store the goal of this update and work out the speed the
+ * histograms should be built for
+ * @return the current pose speed, mm/s
+ */
+int VfhPlus::beginUpdate(
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance)
+{
 	this->desiredDirection = RadianToDegree(goalDirection + (M_PI / 2.0));
 	this->goaldist = goalDistance * 1e3;
 	this->goaldistTolerance = goalDistanceTolerance * 1e3;
+	this->maskedSpeedCap = Current_Max_Speed;
 	// Set currentPoseSpeed to the maximum of
 	// the set point (lastChosenSpeed) and the current actual speed.
 	// This ensures conservative behaviour if the set point somehow ramps up
@@ -424,12 +793,19 @@ void VfhPlus::update(
 		currentPoseSpeed = this->lastChosenLinearX * 1e3;
 	}
 	// printf("update: currentPoseSpeed = %d\n",currentPoseSpeed);
-	// Work out how much time has elapsed since the last update,
-	// so we know how much to increase speed by, given MAX_ACCELERATION.
-	// printf("update: buildPrimaryPolarHistogram\n");
-	if (buildPrimaryPolarHistogram(laserRanges,currentPoseSpeed) == 0) {
+	return currentPoseSpeed;
+}
+/**
+ * @brief pick a direction from the primary histogram in Hist
+ * @param primaryOk false when something got inside the safety distance
+ * @param currentPoseSpeed the current pose speed, mm/s
+ */
+void VfhPlus::decideDirection(bool const primaryOk, int const currentPoseSpeed)
+{
+	if (!primaryOk) {
 		// Something's inside our safety distance: brake hard and
 		// turn on the spot
+		YUIWONGVFHEVENT(this->stageStats, EventSafetyShortCircuit, 1);
 		pickedDirection = lastPickedDirection;
 		maxSpeedForPickedDirection = 0;
 		lastPickedDirection = pickedDirection;
@@ -440,6 +816,275 @@ void VfhPlus::update(
 		// and maxSpeedForPickedDirection
 		selectDirection();
 	}
+}
+/**
+ * @brief Cell_Sector as arcs, where each cell's sectors start and how
+ * many, for the speed bands to add a cell in two steps
+ */
+void VfhPlus::buildCellArcs()
+{
+	int const w = WINDOW_DIAMETER;
+	this->cellArc.assign(
+		NUM_CELL_SECTOR_TABLES * w * w, std::make_pair(0, 0));
+	for (int t = 0; t < NUM_CELL_SECTOR_TABLES; ++t) {
+		for (int x = 0; x < w; ++x) {
+			for (int y = 0; y < w; ++y) {
+				/* ascending: an arc round 0 starts past its one gap */
+				std::vector<int> const& sectors = Cell_Sector[t][x][y];
+				int const count = static_cast<int>(sectors.size());
+				int first = 0;
+				while (((first + 1) < count)
+					&& (sectors[first + 1] == (sectors[first] + 1))) {
+					++first;
+				}
+				first = ((first + 1) < count) ? (first + 1) : 0;
+				this->cellArc[(t * w * w) + (x * w) + y] = std::make_pair(
+					(count > 0) ? sectors[first] : 0, count);
+			}
+		}
+	}
+}
+/**
+ * @brief the primary histogram of each speed band, and the limits its
+ * blocked circles set, from one pass over the front cells: the cells are
+ * tested against the scan once, as Calculate_Cells_Mag does, and each
+ * occupied one is added to every band as buildPrimaryPolarHistogram and
+ * the phi_left, phi_right loop of buildMaskedPolarHistogram do. a band
+ * masks with the blocked circles of the faster of its speed and the
+ * current one
+ * @param laserRanges laser (or sonar) readings
+ * @param currentPoseSpeed the current pose speed, mm/s: an occupied cell
+ * inside its safety distance blocks every band, as update short-circuits
+ */
+void VfhPlus::buildSpeedBandHistograms(
+	std::array<double, 361> const& laserRanges,
+	int const currentPoseSpeed)
+{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StagePrimaryHistogram);
+	int const count = this->speedBands;
+	int const w = WINDOW_DIAMETER;
+	if (this->cellArc.empty()) {
+		this->buildCellArcs();
+	}
+	if (static_cast<int>(this->bands.size()) != count) {
+		this->bands.resize(count);
+		this->bandHist.assign(count * HIST_SIZE, 0);
+		/* blocked, as Last_Binary_Hist starts */
+		this->bandLastBinary.assign(count * HIST_SIZE, 1);
+		this->bandDiff.assign(count * (HIST_SIZE + 1), 0);
+	}
+	double const currentSafeRadius = ROBOT_RADIUS
+		+ static_cast<double>(this->Get_Safety_Dist(currentPoseSpeed));
+	int const fastest = static_cast<int>(Min_Turning_Radius.size()) - 1;
+	for (int k = 0; k < count; ++k) {
+		SpeedBand& band = this->bands[k];
+		band.speed = (Current_Max_Speed * (k + 1)) / count;
+		band.table = this->Get_Speed_Index(band.speed);
+		band.safeRadius = ROBOT_RADIUS
+			+ static_cast<double>(this->Get_Safety_Dist(band.speed));
+		band.maskSpeed = std::min(
+			std::max(band.speed, currentPoseSpeed), fastest);
+		band.centerOffset = Min_Turning_Radius[band.maskSpeed] / CELL_WIDTH;
+		band.blockedRadius = Min_Turning_Radius[band.maskSpeed]
+			+ ROBOT_RADIUS
+			+ static_cast<double>(this->Get_Safety_Dist(band.maskSpeed));
+		band.blockedCells2 = (band.blockedRadius / CELL_WIDTH)
+			* (band.blockedRadius / CELL_WIDTH);
+		band.phiLeft = 180;
+		band.phiRight = 0;
+		band.blocked = false;
+	}
+	/*
+	 * each cell adds its magnitude over an arc of sectors: as a step up
+	 * where the arc starts and down where it ends, so a band costs the
+	 * cell two adds, and a running sum over the sectors at the end
+	 */
+	std::fill(this->bandDiff.begin(), this->bandDiff.end(), 0.0);
+	int const n = static_cast<int>(::ceil(w / 2.0));
+	for (int y = 0; y < n; ++y) {
+		for (int x = 0; x < w; ++x) {
+			double& mag = this->Cell_Mag[x][y];
+			double const direction = Cell_Direction[x][y];
+			if ((Cell_Dist[x][y] + (CELL_WIDTH / 2.0))
+				<= laserRanges[static_cast<int>(::rint(direction * 2.0))]) {
+				mag = 0.0;/* the laser goes past the cell */
+				continue;
+			}
+			mag = Cell_Base_Mag[x][y];
+			bool const center = (x == CENTER_X) && (y == CENTER_Y);
+			if ((Cell_Dist[x][y] < currentSafeRadius) && !center) {
+				// inside the safety distance of the speed driven: brake
+				for (int k = 0; k < count; ++k) {
+					this->bands[k].blocked = true;
+				}
+				return;
+			}
+			/* the blocked circle on the cell's side can move its phi */
+			bool const right = deltaAngle(direction, 90.0) > 0;
+			for (int k = 0; k < count; ++k) {
+				SpeedBand& band = this->bands[k];
+				if (band.blocked) {
+					continue;
+				}
+				if ((Cell_Dist[x][y] < band.safeRadius) && !center) {
+					band.blocked = true;
+					continue;
+				}
+				double* const d = &this->bandDiff[k * (HIST_SIZE + 1)];
+				std::pair<int, int> const& arc =
+					this->cellArc[(band.table * w * w) + (x * w) + y];
+				int const end = arc.first + arc.second;
+				d[arc.first] += mag;
+				if (end > HIST_SIZE) {
+					d[0] += mag;
+					d[end - HIST_SIZE] -= mag;
+				} else {
+					d[end] -= mag;
+				}
+				/* most cells are out of the circle: test that first */
+				double const cx = right ? (CENTER_X + band.centerOffset - x)
+					: (CENTER_X - band.centerOffset - x);
+				double const cy = CENTER_Y - y;
+				if (((cx * cx) + (cy * cy)) >= band.blockedCells2) {
+					continue;
+				}
+				if (right) {
+					if (deltaAngle(direction, band.phiRight) <= 0) {
+						band.phiRight = direction;
+					}
+				} else if (deltaAngle(direction, band.phiLeft) > 0) {
+					band.phiLeft = direction;
+				}
+			}
+		}
+	}
+	for (int k = 0; k < count; ++k) {
+		double const* const d = &this->bandDiff[k * (HIST_SIZE + 1)];
+		double* const h = &this->bandHist[k * HIST_SIZE];
+		double sum = 0;
+		for (int i = 0; i < HIST_SIZE; ++i) {
+			sum += d[i];
+			h[i] = sum;
+		}
+	}
+}
+/**
+ * @brief threshold and mask the speed band histograms, as
+ * buildBinaryPolarHistogram and buildMaskedPolarHistogram do, each with
+ * its own hysteresis, then pick the direction in the fastest band with an
+ * opening and cap the speed to it
+ */
+void VfhPlus::decideSpeedBand()
+{
+	int const count = this->speedBands;
+	{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageBinaryHistogram);
+	for (int k = 0; k < count; ++k) {
+		SpeedBand const& band = this->bands[k];
+		if (band.blocked) {
+			continue;
+		}
+		double* const h = &this->bandHist[k * HIST_SIZE];
+		double* const last = &this->bandLastBinary[k * HIST_SIZE];
+		double const high = this->Get_Binary_Hist_High(band.speed);
+		double const low = this->Get_Binary_Hist_Low(band.speed);
+		for (int i = 0; i < HIST_SIZE; ++i) {
+			if (h[i] > high) {
+				h[i] = 1.0;
+			} else if (h[i] < low) {
+				h[i] = 0.0;
+			} else {
+				YUIWONGVFHEVENT(this->stageStats, EventHysteresisHold, 1);
+				h[i] = last[i];
+			}
+			last[i] = h[i];
+		}
+	}
+	}
+	{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageMaskedHistogram);
+	double const angleAhead = 90;
+	for (int k = 0; k < count; ++k) {
+		SpeedBand const& band = this->bands[k];
+		if (band.blocked) {
+			continue;
+		}
+		double* const h = &this->bandHist[k * HIST_SIZE];
+		for (int i = 0; i < HIST_SIZE; ++i) {
+			double const angle = i * SECTOR_ANGLE;
+			bool const open = (h[i] == 0)
+				&& (((deltaAngle(angle, band.phiRight) <= 0)
+				&& (deltaAngle(angle, angleAhead) >= 0))
+				|| ((deltaAngle(angle, band.phiLeft) >= 0)
+				&& (deltaAngle(angle, angleAhead) <= 0)));
+			h[i] = open ? 0.0 : 1.0;
+		}
+	}
+	}
+	/*
+	 * the fastest band first: its opening may be narrow, so a slower band
+	 * is tried while it could drive faster than the speed so far
+	 */
+	double const lastPicked = lastPickedDirection;
+	bool tried = false;
+	int best = -1;
+	int bestSpeed = 0;
+	double bestPicked = lastPicked;
+	for (int k = count - 1; k >= 0; --k) {
+		SpeedBand const& band = this->bands[k];
+		if (band.blocked) {
+			continue;
+		}
+		if (band.speed <= bestSpeed) {
+			break;
+		}
+		double const* const h = &this->bandHist[k * HIST_SIZE];
+		std::copy(h, h + HIST_SIZE, Hist);
+		Blocked_Circle_Radius = band.blockedRadius;
+		lastPickedDirection = lastPicked;
+		selectDirection();
+		tried = true;
+		int const speed = std::min(maxSpeedForPickedDirection, band.speed);
+		if (speed > bestSpeed) {
+			best = k;
+			bestSpeed = speed;
+			bestPicked = pickedDirection;
+		}
+	}
+	if (best >= 0) {
+		// leave Hist and the circles of the band driven, for the snapshot
+		// and cantTurnToGoal
+		double const* const h = &this->bandHist[best * HIST_SIZE];
+		std::copy(h, h + HIST_SIZE, Hist);
+		Blocked_Circle_Radius = this->bands[best].blockedRadius;
+		pickedDirection = bestPicked;
+		lastPickedDirection = bestPicked;
+		maxSpeedForPickedDirection = bestSpeed;
+		this->maskedSpeedCap = this->bands[best].speed;
+		if (best < (count - 1)) {
+			YUIWONGVFHEVENT(this->stageStats, EventSpeedBandSlower, 1);
+		}
+		return;
+	}
+	if (!tried) {
+		// something's inside the safety distance of every band
+		std::fill(Hist, Hist + HIST_SIZE, 1.0);
+		this->decideDirection(false, 0);
+	}
+}
+/**
+ * @brief choose the speed and turn rate for the picked direction
+ * @param diffSeconds time elapsed since the last update, in seconds
+ * @param currentPoseSpeed the current pose speed, mm/s
+ * @param[out] chosenLinearX the chosen linear x velocity, in meter/s
+ * @param[out] chosenAngularZ the chosen turn rate, in radian/s
+ */
+void VfhPlus::chooseMotion(
+	double const diffSeconds,
+	int const currentPoseSpeed,
+	double& chosenLinearX,
+	double& chosenAngularZ)
+{
 	// printf("Picked Angle: %f\n", pickedDirection);
 	// OK, so now we've chosen a direction. Time to choose a speed.
 	// How much can we change our speed by?
@@ -471,11 +1116,71 @@ void VfhPlus::update(
 	// printf("Max Speed for picked angle: %d\n",maxSpeedForPickedDirection);
 	// Set the chosen_turnrate, and possibly modify the chosen_speed
 	int chosenTurnrate = 0;
+	{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageSetMotion);
 	this->setMotion(chosenLinearX0, chosenTurnrate, currentPoseSpeed);
+	}
 	chosenLinearX = chosenLinearX0;
 	chosenAngularZ = NormalizeAngle(DegreeToRadian(chosenTurnrate));
 	this->lastChosenLinearX = chosenLinearX0;
 }
+/**
+ * @brief sample hardware counters around update() and its stages,
+ * reported by stats(), costs a syscall per stage boundary
+ * @note call from the thread that runs update()
+ * @return false when perf events are unavailable, or the library was
+ * built without YUIWONGVFHIMPL_STATS
+ */
+bool VfhPlus::enablePerfCounters()
+{
+#ifdef YUIWONGVFHIMPL_STATS
+	std::unique_ptr<VfhPerfProbe> probe(new VfhPerfProbe());
+	if (!probe->open()) {
+		return false;
+	}
+	this->stageStats.setPerfProbe(probe.get());
+	this->perfProbe = std::move(probe);
+	return true;
+#else
+	return false;
+#endif
+}
+void VfhPlus::disablePerfCounters()
+{
+	this->stageStats.setPerfProbe(nullptr);
+	this->perfProbe.reset();
+}
+/**
+ * @brief publish the outcome of this update to readSnapshot
+ * @param stamp as given to update, in seconds
+ * @param chosenLinearX the chosen linear x velocity, in meter/s
+ * @param chosenAngularZ the chosen turn rate, in radian/s
+ */
+void VfhPlus::publishSnapshot(
+	double const stamp,
+	double const chosenLinearX,
+	double const chosenAngularZ)
+{
+	this->snapshotFrames.publish([&](
+		VfhSnapshot::Header& header, uint8_t* histogram, uint8_t* cells) {
+		header.stamp = stamp;
+		header.pickedDirection = DegreeToRadian(this->pickedDirection) - HPi;
+		header.maxSpeed = this->maxSpeedForPickedDirection * 1e-3;
+		header.chosenLinearX = chosenLinearX;
+		header.chosenAngularZ = chosenAngularZ;
+		header.blockedCircleRadius = this->Blocked_Circle_Radius * 1e-3;
+		for (int i = 0; i < this->HIST_SIZE; ++i) {
+			histogram[i] = (this->Hist[i] != 0) ? 1 : 0;
+		}
+		int const n = this->WINDOW_DIAMETER;
+		for (int x = 0; x < n; ++x) {
+			std::vector<double> const& column = this->Cell_Mag[x];
+			for (int y = 0; y < n; ++y) {
+				cells[(y * n) + x] = (column[y] != 0) ? 1 : 0;
+			}
+		}
+	});
+}
 /**
 * The robot going too fast, such does it overshoot before it can turn to the goal?
 * @return true if the robot cannot turn to the goal
@@ -561,6 +1266,7 @@ if (Candidate_Angle.size() == 0)
 {
 // We're hemmed in by obstacles -- nowhere to go,
 // so brake hard and turn on the spot.
+YUIWONGVFHEVENT(this->stageStats, EventHemmedIn, 1);
 pickedDirection = lastPickedDirection;
 maxSpeedForPickedDirection = 0;
 lastPickedDirection = pickedDirection;
@@ -583,33 +1289,278 @@ maxSpeedForPickedDirection = Candidate_Speed[i];
 lastPickedDirection = pickedDirection;
 return(1);
 }
+/**
+ * @brief the first sector of Hist in the forward 180deg, where the
+ * openings are walked from
+ * @return -1 when nothing is in the forward 180deg
+ */
+int VfhPlus::firstObstacle() const
+{
+	// only look at the forward 180deg for first obstacle.
+	for (int i = 0; i < (HIST_SIZE / 2); ++i) {
+		if (Hist[i] == 1) {
+			return i;
+		}
+	}
+	return -1;
+}
+/**
+ * @brief the candidate directions of the openings in Hist, as
+ * selectDirection weighs them
+ * @param[out] candidates in the order the openings are met, anticlockwise
+ * from the first obstacle, none when hemmed in
+ * @return false when nothing is in the forward 180deg: no opening to find
+ */
+bool VfhPlus::findCandidates(std::vector<Candidate>& candidates) const
+{
+	candidates.clear();
+	int const start = this->firstObstacle();
+	if (start == -1) {
+		return false;
+	}
+	int const narrowSpeed =
+		std::min(Current_Max_Speed, MAX_SPEED_NARROW_OPENING);
+	int const wideSpeed = std::min(Current_Max_Speed, MAX_SPEED_WIDE_OPENING);
+	// Find the left and right borders of each opening, and consider it
+	bool left = true;
+	int first = 0;
+	for (int i = start; i <= (start + HIST_SIZE); ++i) {
+		double const h = Hist[i % HIST_SIZE];
+		if ((h == 0) && left) {
+			first = (i % HIST_SIZE) * SECTOR_ANGLE;
+			left = false;
+		}
+		if ((h != 1) || left) {
+			continue;
+		}
+		left = true;
+		int second = ((i % HIST_SIZE) - 1) * SECTOR_ANGLE;
+		if (second < 0) {
+			second += 360;
+		}
+		double const angle = deltaAngle(
+			static_cast<double>(first), static_cast<double>(second));
+		if (::fabs(angle) < 10) {
+			continue;// ignore very narrow openings
+		}
+		double const centre = first + ((second - first) / 2.0);
+		if (::fabs(angle) < 80) {
+			// narrow opening: aim for the centre
+			Candidate const c = { false, centre, 0, narrowSpeed };
+			candidates.push_back(c);
+			continue;
+		}
+		// wide opening: consider the centre, and 40deg from each border,
+		// and the goal direction when it is between those two
+		double const right = static_cast<double>((first + 40) % 360);
+		double leftmost = static_cast<double>(second - 40);
+		if (leftmost < 0) {
+			leftmost += 360;
+		}
+		Candidate const c[4] = {
+			{ false, centre, 0, Current_Max_Speed },
+			{ false, right, 0, wideSpeed },
+			{ false, leftmost, 0, wideSpeed },
+			{ true, right, leftmost, wideSpeed } };
+		candidates.insert(candidates.end(), c, c + 4);
+	}
+	return true;
+}
+/**
+ * @brief the sectors of Hist, whether each is in an opening and how far
+ * in, as setSectorScoring scores them
+ * @param[out] table HIST_SIZE sectors
+ * @return false when nothing is in the forward 180deg
+ */
+bool VfhPlus::findSectors(SectorTable& table) const
+{
+	int const start = this->firstObstacle();
+	if (start == -1) {
+		return false;
+	}
+	int const n = HIST_SIZE;
+	table.blocked.resize(n);
+	table.clearanceCost.resize(n);
+	int const sectorAngle = SECTOR_ANGLE;
+	float const margin = this->clearanceDegrees;
+	float const weight = this->clearanceWeight * 0.5;
+	float* const blocked = table.blocked.data();
+	float* const clearanceCost = table.clearanceCost.data();
+	for (int i = 0; i < n; ++i) {
+		blocked[i] = Hist[i];
+	}
+	std::fill(clearanceCost, clearanceCost + n, 0.0f);
+	/*
+	 * on from the obstacle at start, each opening is seen at its left
+	 * border, the last round 0 at start: a very narrow one is blocked,
+	 * and a sector of the others costs as far as it is inside the margin
+	 * of the nearer border
+	 */
+	int count = 0;
+	for (int i = start + 1; i <= n; ++i) {
+		if ((i < n) && (Hist[i] == 0)) {
+			++count;
+			continue;
+		}
+		int const border = (i < n) ? i : start;
+		count += (i < n) ? 0 : start;
+		// ignore very narrow openings
+		bool const narrow = ((count - 1) * sectorAngle) < 10;
+		if ((count == 0) || (!narrow && (weight == 0))) {
+			count = 0;
+			continue;
+		}
+		/* the opening from its right border, in at most two runs */
+		int const first = border - count;
+		int const wrapped = (first < 0) ? -first : 0;
+		for (int run = 0; run < 2; ++run) {
+			int const begin = (run == 0) ? (first + wrapped) : (n - wrapped);
+			int const end = (run == 0) ? border : n;
+			int const offset = (run == 0) ? (wrapped - begin) : -begin;
+			for (int k = begin; k < end; ++k) {
+				int const o = k + offset;
+				int const inside = std::min(o, count - 1 - o) * sectorAngle;
+				float const within = margin - inside;
+				blocked[k] = narrow ? 1.0f : 0.0f;
+				clearanceCost[k] = narrow ? 0.0f
+					: (weight * (within + std::fabs(within)));
+			}
+		}
+		count = 0;
+	}
+	return true;
+}
+/**
+ * @brief the max speed of a sector in an opening of Hist, by the width
+ * of the opening and how far in the sector is
+ * @param sector in an opening
+ * @return mm/s
+ */
+int VfhPlus::sectorSpeed(int const sector) const
+{
+	int const n = HIST_SIZE;
+	int right = 1;
+	for (int i = sector; ; ++right) {
+		i = (i == 0) ? (n - 1) : (i - 1);
+		if (Hist[i] != 0) {
+			break;
+		}
+	}
+	int left = 1;
+	for (int i = sector; ; ++left) {
+		i = (i == (n - 1)) ? 0 : (i + 1);
+		if (Hist[i] != 0) {
+			break;
+		}
+	}
+	int const width = (right + left - 2) * SECTOR_ANGLE;
+	if (width < 80) {
+		return std::min(Current_Max_Speed, MAX_SPEED_NARROW_OPENING);
+	}
+	if (((std::min(right, left) - 1) * SECTOR_ANGLE) >= 40) {
+		return Current_Max_Speed;
+	}
+	return std::min(Current_Max_Speed, MAX_SPEED_WIDE_OPENING);
+}
+/**
+ * @brief the cheapest direction of a SectorTable: every sector, then the
+ * goal direction itself when the sectors on both sides of it are in an
+ * opening
+ * @param table of findSectors
+ * @param desired the goal direction, degrees in [0, 360)
+ * @param last the last picked direction, degrees in [0, 360)
+ * @param desiredWeight weight of the goal direction
+ * @param currentWeight weight of the last picked direction
+ * @param[out] picked the direction, degrees in [0, 360)
+ * @param[out] speed its max speed, mm/s
+ * @return false when hemmed in: no sector is in an opening
+ */
+bool VfhPlus::scoreSectors(
+	SectorTable const& table,
+	double const desired,
+	double const last,
+	double const desiredWeight,
+	double const currentWeight,
+	double& picked,
+	int& speed) const
+{
+	int const n = HIST_SIZE;
+	double const sectorAngle = SECTOR_ANGLE;
+	float const* const blocked = table.blocked.data();
+	float const* const clearanceCost = table.clearanceCost.data();
+	/*
+	 * each sector's cost as a key, the cost in fixed point (to about
+	 * 1e-3 degree at the default weights) above the sector, so one
+	 * integer min is the argmin, ties to the lower sector. in float, as
+	 * fine as the key, and no compare of floats, which would keep the
+	 * loop branchy under -ftrapping-math: the compiler vectorizes it
+	 */
+	int const blockedKey = 1 << 20;// 2 * blockedKey << 9 fits an int
+	float const scale = (blockedKey - 1) / ((180 *
+		(desiredWeight + currentWeight))
+		+ (this->clearanceWeight * this->clearanceDegrees) + 1);
+	float const desiredf = desired;
+	float const lastf = last;
+	float const desiredWeightf = desiredWeight;
+	float const currentWeightf = currentWeight;
+	float const sectorAnglef = SECTOR_ANGLE;
+	int best = std::numeric_limits<int>::max();
+	for (int i = 0; i < n; ++i) {
+		float const angle = i * sectorAnglef;
+		// fabs(deltaAngle) of angles in [0, 360)
+		float const toDesired =
+			180 - std::fabs(180 - std::fabs(angle - desiredf));
+		float const toLast = 180 - std::fabs(180 - std::fabs(angle - lastf));
+		float const cost = (desiredWeightf * toDesired)
+			+ (currentWeightf * toLast) + clearanceCost[i];
+		int const key =
+			static_cast<int>((cost * scale) + (blocked[i] * blockedKey));
+		best = std::min(best, (key << 9) | i);
+	}
+	if ((best >> 9) >= blockedKey) {
+		return false;
+	}
+	int const sector = best & 511;
+	picked = sector * sectorAngle;
+	int pickedSector = sector;
+	/*
+	 * the goal direction, finer than its sector: sector i covers
+	 * [i, i + 1) * SECTOR_ANGLE, the goal is between the sectors on both
+	 * sides of it, both open
+	 */
+	int const goal = static_cast<int>(::floor(desired / sectorAngle)) % n;
+	int const next = (goal + 1) % n;
+	if ((blocked[goal] == 0) && (blocked[next] == 0)) {
+		double const sectorCost =
+			(desiredWeight * AbsDeltaDegrees(picked, desired))
+			+ (currentWeight * AbsDeltaDegrees(picked, last))
+			+ clearanceCost[sector];
+		double const goalCost = (currentWeight
+			* AbsDeltaDegrees(desired, last))
+			+ std::max(clearanceCost[goal], clearanceCost[next]);
+		if (goalCost <= sectorCost) {
+			picked = desired;
+			pickedSector = goal;
+		}
+	}
+	speed = this->sectorSpeed(pickedSector);
+	return true;
+}
 /**
 * Select the used direction
 * @return 1
 */
 int VfhPlus::selectDirection()
 {
-int start, i, left;
-double angle, new_angle;
-std::vector<std::pair<int,int> > border;
-std::pair<int,int> new_border;
+YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageSelectDirection);
 Candidate_Angle.clear();
 Candidate_Speed.clear();
-//
-// set start to sector of first obstacle
-//
-start = -1;
-// only look at the forward 180deg for first obstacle.
-for(i = 0;i<HIST_SIZE/2;i++)
-{
-if (Hist[i] == 1)
-{
-start = i;
-break;
-}
-}
-if (start == -1)
+bool const obstacle = this->sectorScoring
+	? this->findSectors(this->sectors)
+	: this->findCandidates(this->candidates);
+if (!obstacle)
 {
+YUIWONGVFHEVENT(this->stageStats, EventNoObstacle, 1);
 pickedDirection = desiredDirection;
 lastPickedDirection = pickedDirection;
 maxSpeedForPickedDirection = Current_Max_Speed;
@@ -617,165 +1568,208 @@ maxSpeedForPickedDirection = Current_Max_Speed;
 // 		 pickedDirection, lastPickedDirection, maxSpeedForPickedDirection);
 return(1);
 }
-//
-// Find the left and right borders of each opening
-//
-border.clear();
-//printf("Start: %d\n", start);
-left = 1;
-for(i = start;i<= (start+HIST_SIZE);i++) {
-if ((Hist[i % HIST_SIZE] == 0) && (left)) {
-new_border.first = (i % HIST_SIZE) * SECTOR_ANGLE;
-left = 0;
-}
-if ((Hist[i % HIST_SIZE] == 1) && (!left)) {
-new_border.second = ((i % HIST_SIZE) - 1) * SECTOR_ANGLE;
-if (new_border.second < 0) {
-new_border.second += 360;
-}
-border.push_back(new_border);
-left = 1;
-}
-}
-//
-// Consider each opening
-//
-for(i = 0;i<(int)border.size();i++)
-{
-// printf("BORDER: %d %d\n", border[i].first, border[i].second);
-angle = deltaAngle(border[i].first, border[i].second);
-if (fabs(angle) < 10)
-{
-// ignore very narrow openings
-continue;
-}
-if (fabs(angle) < 80)
-{
-// narrow opening: aim for the centre
-new_angle = border[i].first + (border[i].second - border[i].first) / 2.0;
-Candidate_Angle.push_back(new_angle);
-Candidate_Speed.push_back(std::min(
-	Current_Max_Speed,MAX_SPEED_NARROW_OPENING));
-}
-else
-{
-// wide opening: consider the centre, and 40deg from each border
-new_angle = border[i].first + (border[i].second - border[i].first) / 2.0;
-Candidate_Angle.push_back(new_angle);
-Candidate_Speed.push_back(Current_Max_Speed);
-new_angle = (double)((border[i].first + 40) % 360);
-Candidate_Angle.push_back(new_angle);
-Candidate_Speed.push_back(std::min(Current_Max_Speed,MAX_SPEED_WIDE_OPENING));
-new_angle = (double)(border[i].second - 40);
-if (new_angle < 0)
-new_angle += 360;
-Candidate_Angle.push_back(new_angle);
-Candidate_Speed.push_back(std::min(Current_Max_Speed,MAX_SPEED_WIDE_OPENING));
-// See if candidate dir is in this opening
-if ((deltaAngle(desiredDirection, Candidate_Angle[Candidate_Angle.size()-2]) < 0) &&
-(deltaAngle(desiredDirection, Candidate_Angle[Candidate_Angle.size()-1]) > 0)) {
-Candidate_Angle.push_back(desiredDirection);
-Candidate_Speed.push_back(std::min(Current_Max_Speed,MAX_SPEED_WIDE_OPENING));
-}
-}
+if (this->sectorScoring) {
+	// the cheapest sector is the one candidate, none when hemmed in
+	double picked = 0;
+	int speed = 0;
+	if (this->scoreSectors(
+		this->sectors,
+		PositiveDegrees(desiredDirection),
+		PositiveDegrees(lastPickedDirection),
+		U1,
+		U2,
+		picked,
+		speed)) {
+		Candidate_Angle.push_back(picked);
+		Candidate_Speed.push_back(speed);
+	}
+	Select_Candidate_Angle();
+	return(1);
+}
+for (Candidate const& c: this->candidates) {
+	if (!c.goal) {
+		Candidate_Angle.push_back(c.angle);
+		Candidate_Speed.push_back(c.speed);
+	} else if ((deltaAngle(desiredDirection, c.angle) < 0)
+		&& (deltaAngle(desiredDirection, c.last) > 0)) {
+		// See if candidate dir is in this opening
+		Candidate_Angle.push_back(desiredDirection);
+		Candidate_Speed.push_back(c.speed);
+	}
 }
 Select_Candidate_Angle();
 return(1);
 }
 /**
-* Print the cells directions
-*/
-void VfhPlus::Print_Cells_Dir()
-{
-int x, y;
-printf("\nCell Directions:\n");
-printf("****************\n");
-for(y = 0;y<WINDOW_DIAMETER;y++) {
-for(x = 0;x<WINDOW_DIAMETER;x++) {
-printf("%1.1f\t", Cell_Direction[x][y]);
-}
-printf("\n");
-}
-}
-/**
-* Print the cells magnitude
-*/
-void VfhPlus::Print_Cells_Mag()
-{
-int x, y;
-printf("\nCell Magnitudes:\n");
-printf("****************\n");
-for(y = 0;y<WINDOW_DIAMETER;y++) {
-for(x = 0;x<WINDOW_DIAMETER;x++) {
-printf("%1.1f\t", Cell_Mag[x][y]);
-}
-printf("\n");
-}
-}
-/**
-* Print the cells distances
-*/
-void VfhPlus::Print_Cells_Dist()
+ * @brief the direction and the speed update would pick toward each of n
+ * goals, weighed as Select_Candidate_Angle does against the masked
+ * histogram of the last update; the planner is left as it is
+ * @param goalDirections n goal directions, in radian, as update's
+ * goalDirection
+ * @param n count of goals
+ * @param desiredWeight weight of the goal direction, as weight_desired_dir
+ * @param currentWeight weight of the last picked direction, as
+ * weight_current_dir
+ * @param[out] pickedDirections n directions, in radian, as goalDirection
+ * @param[out] maxSpeeds n speeds, the max for the picked directions, in
+ * meter/s, 0 when hemmed in
+ */
+void VfhPlus::queryGoals(
+	double const* const goalDirections,
+	size_t const n,
+	double const desiredWeight,
+	double const currentWeight,
+	double* const pickedDirections,
+	double* const maxSpeeds) const
 {
-int x, y;
-printf("\nCell Distances:\n");
-printf("****************\n");
-for(y = 0;y<WINDOW_DIAMETER;y++) {
-for(x = 0;x<WINDOW_DIAMETER;x++) {
-printf("%1.1f\t", Cell_Dist[x][y]);
-}
-printf("\n");
-}
+	std::vector<Candidate> candidates;
+	SectorTable table;
+	bool const obstacle = this->sectorScoring
+		? this->findSectors(table) : this->findCandidates(candidates);
+	double const speedCap = static_cast<double>(this->maskedSpeedCap) * 1e-3;
+	if (!obstacle || (!this->sectorScoring && candidates.empty())) {
+		// nothing in front, full speed to every goal, or hemmed in
+		double const hemmed =
+			NormalizeAngle(DegreeToRadian(lastPickedDirection) - HPi);
+		for (size_t g = 0; g < n; ++g) {
+			pickedDirections[g] = obstacle
+				? hemmed : NormalizeAngle(goalDirections[g]);
+			maxSpeeds[g] = obstacle ? 0.0 : std::min(speedCap,
+				static_cast<double>(Current_Max_Speed) * 1e-3);
+		}
+		return;
+	}
+	/* the goals in degrees, as desiredDirection, in [0, 360) */
+	std::vector<double> desired(n);
+	for (size_t g = 0; g < n; ++g) {
+		desired[g] = NormalizeDegreeAnglePositive(
+			RadianToDegree(goalDirections[g] + HPi));
+	}
+	double const last = NormalizeDegreeAnglePositive(lastPickedDirection);
+	if (this->sectorScoring) {
+		for (size_t g = 0; g < n; ++g) {
+			double picked = lastPickedDirection;
+			int speed = 0;
+			this->scoreSectors(table, desired[g], last,
+				desiredWeight, currentWeight, picked, speed);
+			pickedDirections[g] = NormalizeAngle(DegreeToRadian(picked) - HPi);
+			maxSpeeds[g] = std::min(static_cast<double>(speed) * 1e-3, speedCap);
+		}
+		return;
+	}
+	/*
+	 * a candidate at a time over all the goals, branch free.
+	 * pickedDirections holds degrees until the end
+	 */
+	std::vector<double> weight(n, 10000000);
+	double* const picked = pickedDirections;
+	std::fill(picked, picked + n, 90.0);
+	std::fill(maxSpeeds, maxSpeeds + n, 0.0);
+	for (Candidate const& c: candidates) {
+		double const speed =
+			std::min(static_cast<double>(c.speed) * 1e-3, speedCap);
+		if (c.goal) {
+			// the goal direction itself, when it is in this opening
+			for (size_t g = 0; g < n; ++g) {
+				bool const inside = (DeltaDegrees(desired[g], c.angle) < 0)
+					&& (DeltaDegrees(desired[g], c.last) > 0);
+				double const w =
+					currentWeight * AbsDeltaDegrees(last, desired[g]);
+				bool const better = inside && (w < weight[g]);
+				weight[g] = better ? w : weight[g];
+				picked[g] = better ? desired[g] : picked[g];
+				maxSpeeds[g] = better ? speed : maxSpeeds[g];
+			}
+			continue;
+		}
+		double const angle = NormalizeDegreeAnglePositive(c.angle);
+		double const current =
+			currentWeight * AbsDeltaDegrees(last, angle);
+		for (size_t g = 0; g < n; ++g) {
+			double const w = (desiredWeight * AbsDeltaDegrees(angle, desired[g]))
+				+ current;
+			bool const better = w < weight[g];
+			weight[g] = better ? w : weight[g];
+			picked[g] = better ? angle : picked[g];
+			maxSpeeds[g] = better ? speed : maxSpeeds[g];
+		}
+	}
+	for (size_t g = 0; g < n; ++g) {
+		picked[g] = NormalizeAngle(DegreeToRadian(picked[g]) - HPi);
+	}
 }
 /**
-* Print the cells sectors
-*/
-void VfhPlus::Print_Cells_Sector()
+ * @brief dump the grids fixed by init once, then the cell magnitudes
+ * and the histogram of every update, to a ring of frames in a
+ * memory mapped file, see VfhDump; decode it with the vfhdump tool
+ * @note after init, init stops it; the frames cost two memcpy per
+ * update
+ * @param path the dump file, truncated
+ * @param frames the ring size, the last frames updates are kept
+ * @return false on I/O error or before init
+ */
+bool VfhPlus::startDump(std::string const& path, int const frames)
 {
-int x, y;
-unsigned int i;
-printf("\nCell Sectors for table 0:\n");
-printf("***************************\n");
-for(y = 0;y<WINDOW_DIAMETER;y++) {
-for(x = 0;x<WINDOW_DIAMETER;x++) {
-for(i = 0;i<Cell_Sector[0][x][y].size();i++) {
-if (i < (Cell_Sector[0][x][y].size() -1)) {
-printf("%d,", Cell_Sector[0][x][y][i]);
-} else {
-printf("%d\t\t", Cell_Sector[0][x][y][i]);
-}
-}
-}
-printf("\n");
-}
+	if ((this->Hist == nullptr) || (frames <= 0)) {
+		return false;
+	}
+	VfhDumpHeader layout;
+	::memset(&layout, 0, sizeof(layout));
+	layout.windowDiameter = this->WINDOW_DIAMETER;
+	layout.histogramSize = this->HIST_SIZE;
+	layout.sectorAngle = this->SECTOR_ANGLE;
+	layout.sectorTables = this->Cell_Sector.size();
+	layout.frameCapacity = frames;
+	layout.cellWidth = this->CELL_WIDTH;
+	layout.robotRadius = this->ROBOT_RADIUS;
+	if (!this->dump.open(path, layout)) {
+		return false;
+	}
+	int const n = this->WINDOW_DIAMETER;
+	std::vector<std::vector<double> > const* const grids[] = {
+		&this->Cell_Direction, &this->Cell_Dist, &this->Cell_Enlarge };
+	for (uint32_t g = 0; g < VfhDump::GridCount; ++g) {
+		double* const grid = this->dump.grid(static_cast<VfhDump::Grid>(g));
+		for (int x = 0; x < n; ++x) {
+			::memcpy(grid + (x * n), (*grids[g])[x].data(), n * sizeof(double));
+		}
+	}
+	uint32_t const sectorBytes = this->dump.header().sectorBytes;
+	for (size_t t = 0; t < this->Cell_Sector.size(); ++t) {
+		uint8_t* bits = this->dump.sectors(t);
+		for (int x = 0; x < n; ++x) {
+			for (int y = 0; y < n; ++y, bits += sectorBytes) {
+				for (int const s: this->Cell_Sector[t][x][y]) {
+					bits[s >> 3] |= static_cast<uint8_t>(1u << (s & 7));
+				}
+			}
+		}
+	}
+	return true;
 }
-/**
-* Print the cells enlargement angles
-*/
-void VfhPlus::Print_Cells_Enlargement_Angle()
+void VfhPlus::stopDump()
 {
-int x, y;
-printf("\nEnlargement Angles:\n");
-printf("****************\n");
-for(y = 0;y<WINDOW_DIAMETER;y++) {
-for(x = 0;x<WINDOW_DIAMETER;x++) {
-printf("%1.1f\t", Cell_Enlarge[x][y]);
-}
-printf("\n");
-}
+	this->dump.close();
 }
-/**
-* Print the histogram
-*/
-void VfhPlus::Print_Hist()
+/** @brief write this update to the dump, if started */
+void VfhPlus::captureDump(double const stamp)
 {
-int x;
-printf("Histogram:\n");
-printf("****************\n");
-for(x = 0;x<= (HIST_SIZE/2);x++) {
-printf("%d,%1.1f\n", (x * SECTOR_ANGLE), Hist[x]);
-}
-printf("\n\n");
+	if (!this->dump.isOpen()) {
+		return;
+	}
+	VfhDumpFrame* const frame = this->dump.beginFrame();
+	frame->stamp = stamp;
+	frame->desiredDirection = this->desiredDirection;
+	frame->pickedDirection = this->pickedDirection;
+	frame->maxSpeed = this->maxSpeedForPickedDirection;
+	frame->blockedCircleRadius = this->Blocked_Circle_Radius;
+	int const n = this->WINDOW_DIAMETER;
+	double* const cells = frame->cellMagnitude();
+	for (int x = 0; x < n; ++x) {
+		::memcpy(cells + (x * n), this->Cell_Mag[x].data(), n * sizeof(double));
+	}
+	::memcpy(frame->histogram(n), this->Hist, this->HIST_SIZE * sizeof(double));
+	this->dump.commitFrame(frame);
 }
 /**
 * Calcualte the cells magnitude
@@ -786,6 +1780,7 @@ printf("\n\n");
 int VfhPlus::Calculate_Cells_Mag(
 	std::array<double, 361> const& laserRanges, int speed)
 {
+YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageCellsMagnitude);
 int x, y;
 double safeSpeed = (double) Get_Safety_Dist(speed);
 double r = ROBOT_RADIUS + safeSpeed;
@@ -849,6 +1844,7 @@ return(1);
 int VfhPlus::buildPrimaryPolarHistogram(
 	std::array<double, 361> const& laserRanges, int speed)
 {
+YUIWONGVFHSTAGE(this->stageStats, this->tracer, StagePrimaryHistogram);
 int x, y;
 unsigned int i;
 // index into the vector of Cell_Sector tables
@@ -865,11 +1861,6 @@ Hist[x] = 1;
 }
 return 0;
 }
-// Print_Cells_Dist();
-// Print_Cells_Dir();
-// Print_Cells_Mag();
-// Print_Cells_Sector();
-// Print_Cells_Enlargement_Angle();
 // Only have to go through the cells in front.
 for(y = 0;y<= (int)ceil(WINDOW_DIAMETER/2.0);y++) {
 for(x = 0;x<WINDOW_DIAMETER;x++) {
@@ -887,6 +1878,7 @@ return(1);
 */
 int VfhPlus::buildBinaryPolarHistogram(int speed)
 {
+YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageBinaryHistogram);
 int x;
 for(x = 0;x<HIST_SIZE;x++) {
 if (Hist[x] > Get_Binary_Hist_High(speed)) {
@@ -894,6 +1886,7 @@ Hist[x] = 1.0;
 } else if (Hist[x] < Get_Binary_Hist_Low(speed)) {
 Hist[x] = 0.0;
 } else {
+YUIWONGVFHEVENT(this->stageStats, EventHysteresisHold, 1);
 Hist[x] = Last_Binary_Hist[x];
 }
 }
@@ -912,6 +1905,7 @@ return(1);
 */
 int VfhPlus::buildMaskedPolarHistogram(int speed)
 {
+YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageMaskedHistogram);
 int x, y;
 double center_x_right, center_x_left, center_y, dist_r, dist_l;
 double angle_ahead, phi_left, phi_right, angle;
@@ -1009,8 +2003,21 @@ void VfhPlus::setMotion(double& linearX, int& turnrate, int const actualSpeed)
 	/*std::cout << "mx " << mx << " pickedDirection " << pickedDirection
 		<< " tr " << turnrate << "\n";*/
 }
+/**
+ * @brief convert a laser scan to the laser ranges update takes
+ * @param ranges the scan ranges, in meter, as sensor_msgs/LaserScan
+ * @param n count of ranges
+ * @param angleMin the scan start angle, in radian
+ * @param angleMax the scan end angle, in radian
+ * @param angleIncrement the angle between ranges, in radian
+ * @param rangeMax the scan maximum range, in meter
+ * @param[out] result two per degree over the front half, in mm
+ * @note reads the ranges in place, so a message shared in process
+ * (a nodelet) is never copied
+ */
 std::array<double, 361>& VfhPlus::convertScan(
-	std::vector<float> const ranges,
+	float const* const ranges,
+	size_t const n,
 	double const angleMin,
 	double const angleMax,
 	double const angleIncrement,
@@ -1018,7 +2025,6 @@ std::array<double, 361>& VfhPlus::convertScan(
 	std::array<double, 361>& result)
 {
 	std::fill(result.begin(), result.end(), -1.0);
-	size_t const n = ranges.size();
 	double const laserSpan = angleMax - angleMin;
 	if ((DoubleCompare(laserSpan, M_PI) > 0) || (n > 180)) {
 		/* in case we are using hokuyo */
@@ -1055,7 +2061,7 @@ std::array<double, 361>& VfhPlus::convertScan(
 	return result;
 }
 void VfhPlus::convertScan(
-	std::vector<float> const ranges,
+	std::vector<float> const& ranges,
 	double const angleMin,
 	double const angleMax,
 	double const angleIncrement,
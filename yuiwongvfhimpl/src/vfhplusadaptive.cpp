@@ -0,0 +1,167 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhplusadaptive.hpp"
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+namespace yuiwong
+{
+VfhPlusAdaptive::Budget::Budget():
+	coarseAbove(0.8), fineBelow(0.5), smoothing(0.2), minUpdates(20) {}
+/**
+ * @brief param with twice the sector angle (when 360 stays a multiple of
+ * it) and cells twice as large over the same window
+ */
+VfhPlus::Param VfhPlusAdaptive::Coarsen(VfhPlus::Param const& param)
+{
+	VfhPlus::Param p = param;
+	if ((360 % (2 * param.sector_angle)) == 0) {
+		p.sector_angle = 2 * param.sector_angle;
+	}
+	p.cell_size = 2 * param.cell_size;
+	p.window_diameter = std::max(2, (param.window_diameter + 1) / 2);
+	return p;
+}
+VfhPlusAdaptive::VfhPlusAdaptive(
+	VfhPlus::Param const& param,
+	VfhPlus::Param const& coarse,
+	int const coarseTables,
+	Budget const& budget):
+	budget(budget),
+	coarseMode(false),
+	updatesInMode(0),
+	smoothed(-1.0),
+	fineCost(1.0)
+{
+	this->planners[0].reset(new VfhPlus(param));
+	this->planners[1].reset(new VfhPlus(coarse));
+	this->planners[1]->setCellSectorTables(coarseTables);
+}
+VfhPlusAdaptive::VfhPlusAdaptive(VfhPlus::Param const& param):
+	VfhPlusAdaptive(param, Coarsen(param)) {}
+void VfhPlusAdaptive::setRobotRadius(double const robotRadius)
+{
+	this->planners[0]->setRobotRadius(robotRadius);
+	this->planners[1]->setRobotRadius(robotRadius);
+}
+/** @brief start up both planners, in fine mode */
+void VfhPlusAdaptive::init()
+{
+	this->planners[0]->init();
+	this->planners[1]->init();
+	this->coarseMode = false;
+	this->updatesInMode = 0;
+	this->smoothed = -1.0;
+	this->fineCost = Cost(*this->planners[0])
+		/ std::max(1.0, Cost(*this->planners[1]));
+}
+/**
+ * @brief VfhPlus::update with the time it may take
+ * @param budget seconds per update, <= 0 for no budget (fine mode)
+ * @see VfhPlus::update(double const, ...)
+ */
+void VfhPlusAdaptive::update(
+	double const stamp,
+	double const budget,
+	std::array<double, 361> const& laserRanges,
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance,
+	double& chosenLinearX,
+	double& chosenAngularZ)
+{
+	if ((budget <= 0) && this->coarseMode) {
+		YUIWONGVFHEVENT(this->planners[0]->stageStats, EventCoarseExit, 1);
+		this->switchMode();
+	}
+	VfhPlus& p = this->planner();
+	auto const begin = std::chrono::steady_clock::now();
+	p.update(
+		stamp,
+		laserRanges,
+		currentLinearX,
+		goalDirection,
+		goalDistance,
+		goalDistanceTolerance,
+		chosenLinearX,
+		chosenAngularZ);
+	double const seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+	if (this->coarseMode) {
+		YUIWONGVFHEVENT(this->planners[0]->stageStats, EventCoarseUpdate, 1);
+	}
+	this->smoothed = (this->smoothed < 0) ? seconds : (this->smoothed
+		+ (this->budget.smoothing * (seconds - this->smoothed)));
+	++this->updatesInMode;
+	if ((budget <= 0) || (this->updatesInMode < this->budget.minUpdates)) {
+		return;
+	}
+	if (this->coarseMode) {
+		/* what the fine planner would take under the same load */
+		if ((this->smoothed * this->fineCost)
+			< (this->budget.fineBelow * budget)) {
+			YUIWONGVFHEVENT(this->planners[0]->stageStats, EventCoarseExit, 1);
+			this->switchMode();
+		}
+	} else if (this->smoothed > (this->budget.coarseAbove * budget)) {
+		YUIWONGVFHEVENT(this->planners[0]->stageStats, EventCoarseEnter, 1);
+		this->switchMode();
+	}
+}
+/** @brief cells and cell sectors an update walks through */
+double VfhPlusAdaptive::Cost(VfhPlus const& planner)
+{
+	int const front =
+		static_cast<int>(::ceil(planner.WINDOW_DIAMETER / 2.0));
+	double cost = 0;
+	for (int x = 0; x < planner.WINDOW_DIAMETER; ++x) {
+		for (int y = 0; y < front; ++y) {
+			cost += 1 + planner.Cell_Sector[0][x][y].size();
+		}
+	}
+	return cost;
+}
+/** @brief hand the state of the current planner to the other one */
+void VfhPlusAdaptive::switchMode()
+{
+	VfhPlus const& from = *this->planners[this->coarseMode];
+	VfhPlus& to = *this->planners[!this->coarseMode];
+	to.lastUpdateTime = from.lastUpdateTime;
+	to.lastChosenLinearX = from.lastChosenLinearX;
+	to.pickedDirection = from.pickedDirection;
+	to.lastPickedDirection = from.lastPickedDirection;
+	/* a sector is blocked when any sector it overlaps was */
+	int const a = to.SECTOR_ANGLE;
+	int const b = from.SECTOR_ANGLE;
+	for (int s = 0; s < to.HIST_SIZE; ++s) {
+		int const first = (s * a) / b;
+		int const last =
+			std::min(from.HIST_SIZE, (((s + 1) * a) + b - 1) / b);
+		double blocked = 0;
+		for (int f = first; f < last; ++f) {
+			blocked = std::max(blocked, from.Last_Binary_Hist[f]);
+		}
+		to.Last_Binary_Hist[s] = blocked;
+	}
+	to.forgetCells();
+	/* the average restarts at the other planner's expected cost */
+	this->smoothed = (this->smoothed < 0) ? -1.0 : (this->coarseMode
+		? (this->smoothed * this->fineCost)
+		: (this->smoothed / this->fineCost));
+	this->coarseMode = !this->coarseMode;
+	this->updatesInMode = 0;
+}
+}
@@ -0,0 +1,220 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhpluspack.hpp"
+#include <math.h>
+#include <algorithm>
+#include "yuiwong/time.hpp"
+namespace yuiwong
+{
+template <int Lanes>
+VfhPlusPack<Lanes>::VfhPlusPack(
+	VfhPlus::Param const& param, double const robotRadius):
+	histogramSize(0)
+{
+	for (int l = 0; l < Lanes; ++l) {
+		this->planners[l].reset(new VfhPlus(param));
+		this->planners[l]->setRobotRadius(robotRadius);
+	}
+}
+/** @brief start up every planner and build the shared cell list */
+template <int Lanes>
+void VfhPlusPack<Lanes>::init()
+{
+	for (int l = 0; l < Lanes; ++l) {
+		this->planners[l]->init();
+	}
+	VfhPlus const& p = *this->planners[0];
+	this->histogramSize = p.HIST_SIZE;
+	/*
+	 * same cells and order as Calculate_Cells_Mag and
+	 * buildPrimaryPolarHistogram (y outer, x inner), so the sums are the
+	 * same as the ones of a single planner.
+	 * the centre cell has no direction and is left out.
+	 */
+	this->cells.clear();
+	int const n = static_cast<int>(::ceil(p.WINDOW_DIAMETER / 2.0));
+	for (int y = 0; y < n; ++y) {
+		for (int x = 0; x < p.WINDOW_DIAMETER; ++x) {
+			if ((x == p.CENTER_X) && (y == p.CENTER_Y)) {
+				continue;
+			}
+			Cell cell;
+			cell.x = x;
+			cell.y = y;
+			cell.rangeIndex = static_cast<int>(
+				::rint(p.Cell_Direction[x][y] * 2.0));
+			cell.distance = p.Cell_Dist[x][y];
+			cell.threshold = p.Cell_Dist[x][y] + p.CELL_WIDTH / 2.0;
+			cell.baseMag = p.Cell_Base_Mag[x][y];
+			this->cells.push_back(cell);
+		}
+	}
+	this->ranges.assign(361 * Lanes, 0);
+	this->cellMag.assign(this->cells.size() * Lanes, 0);
+	this->histogram.assign(this->histogramSize * Lanes, 0);
+	this->lastBinaryHistogram.assign(this->histogramSize * Lanes, 0);
+	for (int l = 0; l < Lanes; ++l) {
+		for (int s = 0; s < this->histogramSize; ++s) {
+			this->lastBinaryHistogram[s * Lanes + l] =
+				this->planners[l]->Last_Binary_Hist[s];
+		}
+	}
+}
+/**
+ * @brief update all the planners, same as calling VfhPlus::update on
+ * each of them with the lane's input
+ * @param input the per lane inputs
+ * @param[out] output the per lane chosen velocities
+ */
+template <int Lanes>
+void VfhPlusPack<Lanes>::update(
+	Input const (&input)[Lanes], Output (&output)[Lanes])
+{
+	this->update(NowSecond(), input, output);
+}
+/**
+ * @brief update all the planners with an explicit timestamp
+ * @param stamp monotonic timestamp of the laser readings, in seconds
+ * @see VfhPlus::update(double const, ...)
+ */
+template <int Lanes>
+void VfhPlusPack<Lanes>::update(
+	double const stamp, Input const (&input)[Lanes], Output (&output)[Lanes])
+{
+	int speed[Lanes];
+	int speedIndex[Lanes];
+	double safetyRadius[Lanes];
+	double high[Lanes];
+	double low[Lanes];
+	double blocked[Lanes];
+	bool sameTable = true;
+	for (int l = 0; l < Lanes; ++l) {
+		VfhPlus& p = *this->planners[l];
+		Input const& in = input[l];
+		/* the pack builds the histograms itself, update must not reuse */
+		p.forgetCells();
+		speed[l] = p.beginUpdate(
+			in.currentLinearX,
+			in.goalDirection,
+			in.goalDistance,
+			in.goalDistanceTolerance);
+		speedIndex[l] = p.Get_Speed_Index(speed[l]);
+		safetyRadius[l] = p.ROBOT_RADIUS
+			+ static_cast<double>(p.Get_Safety_Dist(speed[l]));
+		high[l] = p.Get_Binary_Hist_High(speed[l]);
+		low[l] = p.Get_Binary_Hist_Low(speed[l]);
+		blocked[l] = 0;
+		sameTable = sameTable && (speedIndex[l] == speedIndex[0]);
+		std::array<double, 361> const& lr = *in.laserRanges;
+		for (int i = 0; i < 361; ++i) {
+			this->ranges[i * Lanes + l] = lr[i];
+		}
+	}
+	/* Calculate_Cells_Mag, all lanes at once */
+	int const cellsCount = static_cast<int>(this->cells.size());
+	for (int c = 0; c < cellsCount; ++c) {
+		Cell const& cell = this->cells[c];
+		double const* const rg = &this->ranges[cell.rangeIndex * Lanes];
+		double* const mag = &this->cellMag[c * Lanes];
+		for (int l = 0; l < Lanes; ++l) {
+			bool const full = cell.threshold > rg[l];
+			mag[l] = full ? cell.baseMag : 0.0;
+			/* something got inside the safety distance of this lane */
+			blocked[l] = (full && (cell.distance < safetyRadius[l]))
+				? 1.0 : blocked[l];
+		}
+	}
+	/* buildPrimaryPolarHistogram */
+	std::fill(this->histogram.begin(), this->histogram.end(), 0);
+	if (sameTable) {
+		std::vector<std::vector<std::vector<int> > > const& table =
+			this->planners[0]->Cell_Sector[speedIndex[0]];
+		for (int c = 0; c < cellsCount; ++c) {
+			double const* const mag = &this->cellMag[c * Lanes];
+			double any = 0;
+			for (int l = 0; l < Lanes; ++l) {
+				any += mag[l];
+			}
+			if (any == 0) {
+				continue;/* empty in every lane */
+			}
+			std::vector<int> const& sectors =
+				table[this->cells[c].x][this->cells[c].y];
+			for (int const s: sectors) {
+				double* const h = &this->histogram[s * Lanes];
+				for (int l = 0; l < Lanes; ++l) {
+					h[l] += mag[l];
+				}
+			}
+		}
+	} else {
+		/* lanes at different speeds read different tables */
+		for (int c = 0; c < cellsCount; ++c) {
+			double const* const mag = &this->cellMag[c * Lanes];
+			for (int l = 0; l < Lanes; ++l) {
+				if (mag[l] == 0) {
+					continue;
+				}
+				std::vector<int> const& sectors = this->planners[0]->Cell_Sector[
+					speedIndex[l]][this->cells[c].x][this->cells[c].y];
+				for (int const s: sectors) {
+					this->histogram[s * Lanes + l] += mag[l];
+				}
+			}
+		}
+	}
+	/* buildBinaryPolarHistogram, blocked lanes keep their last histogram */
+	for (int s = 0; s < this->histogramSize; ++s) {
+		double* const h = &this->histogram[s * Lanes];
+		double* const last = &this->lastBinaryHistogram[s * Lanes];
+		for (int l = 0; l < Lanes; ++l) {
+			double const v = (h[l] > high[l])
+				? 1.0 : ((h[l] < low[l]) ? 0.0 : last[l]);
+			h[l] = v;
+			last[l] = (blocked[l] != 0) ? last[l] : v;
+		}
+	}
+	/* the rest is per planner */
+	for (int l = 0; l < Lanes; ++l) {
+		VfhPlus& p = *this->planners[l];
+		if (blocked[l] != 0) {
+			std::fill(p.Hist, p.Hist + this->histogramSize, 1.0);
+			p.decideDirection(false, speed[l]);
+		} else {
+			for (int s = 0; s < this->histogramSize; ++s) {
+				p.Hist[s] = this->histogram[s * Lanes + l];
+				p.Last_Binary_Hist[s] = p.Hist[s];
+			}
+			for (int c = 0; c < cellsCount; ++c) {
+				p.Cell_Mag[this->cells[c].x][this->cells[c].y] =
+					this->cellMag[c * Lanes + l];
+			}
+			p.buildMaskedPolarHistogram(speed[l]);
+			p.selectDirection();
+		}
+		double const diffSeconds = p.advanceUpdateTime(stamp);
+		p.chooseMotion(
+			diffSeconds,
+			speed[l],
+			output[l].chosenLinearX,
+			output[l].chosenAngularZ);
+		p.publishSnapshot(
+			stamp, output[l].chosenLinearX, output[l].chosenAngularZ);
+		p.captureDump(stamp);
+	}
+}
+template struct VfhPlusPack<4>;
+template struct VfhPlusPack<8>;
+}
@@ -0,0 +1,220 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhshm.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "yuiwong/vfhmailbox.hpp"
+namespace yuiwong
+{
+char const VfhShmRing::Magic[8] = { 'V', 'F', 'H', 'S', 'H', 'M', 0, 0 };
+namespace
+{
+size_t constexpr HeaderSize = 4096;
+static_assert(sizeof(VfhShmRing::Header) <= HeaderSize, "header too big");
+static_assert((ATOMIC_LLONG_LOCK_FREE == 2) && (ATOMIC_INT_LOCK_FREE == 2),
+	"shared atomics must be lock free");
+inline void VfhCpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+uint32_t SlotSize(uint32_t const messageSize)
+{
+	return (messageSize + 63) & ~static_cast<uint32_t>(63);
+}
+}
+VfhShmRing::VfhShmRing():
+	data(nullptr), size(0), headerSize(HeaderSize), head(nullptr) {}
+VfhShmRing::~VfhShmRing()
+{
+	this->close();
+}
+/**
+ * @brief create (or truncate) the ring file and map it
+ * @param capacity slots, rounded up to a power of two
+ * @return false on I/O error
+ */
+bool VfhShmRing::create(
+	std::string const& path,
+	uint32_t const messageSize,
+	uint32_t const capacity)
+{
+	this->close();
+	if ((messageSize == 0) || (capacity == 0)) {
+		return false;
+	}
+	uint32_t n = 1;
+	while (n < capacity) {
+		n <<= 1;
+	}
+	size_t const size = HeaderSize
+		+ (static_cast<size_t>(n) * SlotSize(messageSize));
+	int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	void* const m = (::ftruncate(fd, size) == 0)
+		? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+		: MAP_FAILED;
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	this->data = static_cast<uint8_t*>(m);
+	this->size = size;
+	/* touch every page, a push then never faults */
+	::memset(this->data, 0, size);
+	Header* const h = reinterpret_cast<Header*>(this->data);
+	h->version = Version;
+	h->slotSize = SlotSize(messageSize);
+	h->capacity = n;
+	h->messageSize = messageSize;
+	h->head.store(0, std::memory_order_relaxed);
+	h->tail.store(0, std::memory_order_relaxed);
+	h->pushes.store(0, std::memory_order_relaxed);
+	h->sleepers.store(0, std::memory_order_relaxed);
+	/* the magic last: attach() fails until the header is complete */
+	std::atomic_thread_fence(std::memory_order_release);
+	::memcpy(h->magic, Magic, sizeof(Magic));
+	this->head = h;
+	return true;
+}
+/**
+ * @brief map a ring another process created
+ * @return false on I/O error, before create finished or when the
+ * message size differs
+ */
+bool VfhShmRing::attach(std::string const& path, uint32_t const messageSize)
+{
+	this->close();
+	int const fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if ((::fstat(fd, &st) != 0)
+		|| (static_cast<size_t>(st.st_size) < HeaderSize)) {
+		::close(fd);
+		return false;
+	}
+	void* const m = ::mmap(
+		nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		return false;
+	}
+	this->data = static_cast<uint8_t*>(m);
+	this->size = st.st_size;
+	Header* const h = reinterpret_cast<Header*>(this->data);
+	bool const ok = (::memcmp(h->magic, Magic, sizeof(Magic)) == 0);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (!ok
+		|| (h->version != Version)
+		|| (h->messageSize != messageSize)
+		|| (h->slotSize != SlotSize(messageSize))
+		|| (h->capacity == 0)
+		|| ((h->capacity & (h->capacity - 1)) != 0)
+		|| ((HeaderSize + (static_cast<size_t>(h->capacity) * h->slotSize))
+		> this->size)) {
+		this->close();
+		return false;
+	}
+	this->head = h;
+	return true;
+}
+void VfhShmRing::close()
+{
+	if (this->data != nullptr) {
+		::munmap(this->data, this->size);
+	}
+	this->data = nullptr;
+	this->size = 0;
+	this->head = nullptr;
+}
+/**
+ * @brief producer: copy message in
+ * @return false when the ring is full
+ */
+bool VfhShmRing::push(void const* const message)
+{
+	Header& h = *this->head;
+	uint64_t const i = h.head.load(std::memory_order_relaxed);
+	if ((i - h.tail.load(std::memory_order_acquire)) >= h.capacity) {
+		return false;
+	}
+	::memcpy(this->slot(i), message, h.messageSize);
+	h.head.store(i + 1, std::memory_order_release);
+	/* seq_cst pairs with wait(): either it sees the push or we see it */
+	h.pushes.fetch_add(1, std::memory_order_seq_cst);
+	if (h.sleepers.load(std::memory_order_seq_cst) != 0) {
+		VfhFutexWake(h.pushes, 1, true);
+	}
+	return true;
+}
+/**
+ * @brief consumer: copy the oldest message out
+ * @return false when the ring is empty
+ */
+bool VfhShmRing::pop(void* const message)
+{
+	Header& h = *this->head;
+	uint64_t const i = h.tail.load(std::memory_order_relaxed);
+	if (h.head.load(std::memory_order_acquire) == i) {
+		return false;
+	}
+	::memcpy(message, this->slot(i), h.messageSize);
+	h.tail.store(i + 1, std::memory_order_release);
+	return true;
+}
+/**
+ * @brief consumer: sleep until the ring is not empty
+ * @param timeoutMs < 0 to wait for ever
+ * @param spins times to poll before sleeping, 0 sleeps at once
+ * @return false on timeout
+ */
+bool VfhShmRing::wait(int const timeoutMs, int const spins)
+{
+	Header& h = *this->head;
+	for (int i = 0; i < spins; ++i) {
+		if (h.head.load(std::memory_order_acquire)
+			!= h.tail.load(std::memory_order_relaxed)) {
+			return true;
+		}
+		VfhCpuRelax();
+	}
+	for (;;) {
+		uint64_t const tail = h.tail.load(std::memory_order_relaxed);
+		if (h.head.load(std::memory_order_acquire) != tail) {
+			return true;
+		}
+		h.sleepers.store(1, std::memory_order_seq_cst);
+		uint32_t const pushes = h.pushes.load(std::memory_order_seq_cst);
+		bool woken = true;
+		if (h.head.load(std::memory_order_acquire) == tail) {
+			woken = VfhFutexWait(h.pushes, pushes, timeoutMs, true);
+		}
+		h.sleepers.store(0, std::memory_order_relaxed);
+		if (!woken) {
+			return h.head.load(std::memory_order_acquire) != tail;
+		}
+	}
+}
+}
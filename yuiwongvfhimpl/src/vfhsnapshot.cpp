@@ -0,0 +1,79 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhsnapshot.hpp"
+#include <string.h>
+namespace yuiwong
+{
+VfhSnapshot::VfhSnapshot(): published(0), windowDiameter(0)
+{
+	for (auto& b: this->buffers) {
+		b.sequence.store(0, std::memory_order_relaxed);
+		::memset(&b.header, 0, sizeof(b.header));
+	}
+}
+/**
+ * @brief size the buffers, drops what was published
+ * @note not concurrent with publish or read
+ */
+void VfhSnapshot::reset(int const histogramSize, int const windowDiameter)
+{
+	for (auto& b: this->buffers) {
+		b.sequence.store(0, std::memory_order_relaxed);
+		::memset(&b.header, 0, sizeof(b.header));
+		b.histogram.assign(histogramSize, 0);
+		b.cells.assign(windowDiameter * windowDiameter, 0);
+	}
+	this->windowDiameter = windowDiameter;
+	this->published.store(0, std::memory_order_release);
+}
+/**
+ * @brief copy the newest frame, any thread, never blocks the writer
+ * @param[out] frame the copy, its vectors are reused
+ * @return false when nothing was published yet
+ */
+bool VfhSnapshot::read(VfhSnapshotFrame& frame) const
+{
+	for (;;) {
+		uint64_t const n = this->published.load(std::memory_order_acquire);
+		if (n == 0) {
+			return false;
+		}
+		Buffer const& b = this->buffers[n & 1];
+		uint64_t const sequence = b.sequence.load(std::memory_order_acquire);
+		if ((sequence & 1) != 0) {
+			continue;/* lapped: the writer is refilling this one */
+		}
+		Header header;
+		::memcpy(&header, &b.header, sizeof(header));
+		frame.histogram.resize(b.histogram.size());
+		::memcpy(frame.histogram.data(), b.histogram.data(), b.histogram.size());
+		frame.cells.resize(b.cells.size());
+		::memcpy(frame.cells.data(), b.cells.data(), b.cells.size());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (b.sequence.load(std::memory_order_relaxed) != sequence) {
+			continue;
+		}
+		frame.updates = header.updates;
+		frame.stamp = header.stamp;
+		frame.pickedDirection = header.pickedDirection;
+		frame.maxSpeed = header.maxSpeed;
+		frame.chosenLinearX = header.chosenLinearX;
+		frame.chosenAngularZ = header.chosenAngularZ;
+		frame.blockedCircleRadius = header.blockedCircleRadius;
+		frame.windowDiameter = this->windowDiameter;
+		return true;
+	}
+}
+}
@@ -13,13 +13,44 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * ======================================================================== */
 #include "yuiwong/vfhstar.hpp"
+#include "yuiwong/vfhworkpool.hpp"
 #include "yuiwong/debug.hpp"
 #include "yuiwong/time.hpp"
 #include "yuiwong/math.hpp"
 #include "yuiwong/angle.hpp"
 #include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 namespace yuiwong
 {
+namespace
+{
+/**
+ * @brief add mag to an arc of sectors, first and how many, round the end
+ * of the histogram: two runs the compiler vectorizes
+ */
+inline void AddSectors(
+	double* const histogram,
+	int const size,
+	std::pair<int, int> const& arc,
+	double const mag)
+{
+	int const end = arc.first + arc.second;
+	for (int i = arc.first; i < std::min(end, size); ++i) {
+		histogram[i] += mag;
+	}
+	for (int i = 0; i < end - size; ++i) {
+		histogram[i] += mag;
+	}
+}
+/** @brief the first slot of a key in a table of mask + 1 slots */
+inline size_t TranspositionSlot(uint64_t const key, size_t const mask)
+{
+	return static_cast<size_t>(
+		(key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+}
+}
 VfhStar::Param::Param():
 	cellWidth(0.1),
 	windowDiameter(60),
@@ -39,7 +70,13 @@ VfhStar::Param::Param():
 	desiredDirectionWeight(5.0),
 	currentDirectionWeight(1.0),
 	minTurnRadiusSafetyFactor(1.0),
-	robotRadius(0.2) {}
+	robotRadius(0.2),
+	stepDistance(0.4),
+	processTimes(3),
+	discountFactor(0.8),
+	searchNodes(4096),
+	transpositionEntries(512),
+	rerootSearch(true) {}
 VfhStar::VfhStar(Param const& param):
 	cellWidth(param.cellWidth),
 	windowDiameter(param.windowDiameter),
@@ -60,11 +97,33 @@ VfhStar::VfhStar(Param const& param):
 	currentDirectionWeight(param.currentDirectionWeight),
 	minTurnRadiusSafetyFactor(param.minTurnRadiusSafetyFactor),
 	robotRadius(param.robotRadius),
+	stepDistance(param.stepDistance),
+	processTimes(param.processTimes),
+	discountFactor(param.discountFactor),
+	searchNodes(param.searchNodes),
+	transpositionEntries(param.transpositionEntries),
+	rerootSearch(param.rerootSearch),
+	histogramSize(0),
+	transpositionGeneration(0),
+	shiftX(0),
+	shiftY(0),
+	shiftTurn(0),
+	shiftKnown(false),
+	odometryForward(0),
+	odometryLeft(0),
+	odometryTurn(0),
+	odometryGiven(false),
+	searchKept(false),
+	searchLimit(0),
+	searchDepth(0),
 	desiredDirection(HPi),
 	pickedDirection(HPi),
 	lastUpdateTime(-1.0),
 	lastChosenLinearX(0),
-	lastPickedDirection(pickedDirection)
+	lastChosenAngularZ(0),
+	lastPickedDirection(pickedDirection),
+	tracer(nullptr),
+	searchPool(nullptr)
 {
 	if (DoubleCompare(
 		this->zeroSafetyDistance, this->maxSafetyDistance) == 0) {
@@ -73,7 +132,6 @@ VfhStar::VfhStar(Param const& param):
 	} else {
 		this->cellSectorTablesCount = 20;
 	}
-	
 }
 /** @brief start up the vfh* algorithm */
 void VfhStar::init()
@@ -108,6 +166,7 @@ void VfhStar::init()
 		this->desiredDirectionWeight,
 		this->currentDirectionWeight);
 	this->allocate();
+	this->snapshotFrames.reset(this->histogramSize, this->windowDiameter);
 	std::fill(this->histogram.begin(), this->histogram.end(), 0);
 	std::fill(
 		this->lastBinaryHistogram.begin(), this->lastBinaryHistogram.end(), 1);
@@ -120,6 +179,8 @@ void VfhStar::init()
 	double neg_sector_to_plus_dir = 0;
 	double plus_sector_to_neg_dir = 0;
 	double plus_sector_to_plus_dir = 0;
+	int const w = this->windowDiameter;
+	std::vector<char> covered(this->histogramSize);
 	for (int x = 0; x < this->windowDiameter; ++x) {
 		for (int y = 0; y < this->windowDiameter; ++y) {
 			this->cellMag[x][y] = 0;
@@ -187,7 +248,7 @@ void VfhStar::init()
 			for (int cellSectorTabIdx = 0;
 				cellSectorTabIdx < this->cellSectorTablesCount;
 				++cellSectorTabIdx) {
-				int const max_speed_this_table =
+				double const tableSpeed =
 					(static_cast<double>(cellSectorTabIdx + 1)
 					/ static_cast<double>(this->cellSectorTablesCount))
 					* this->maxSpeed;
@@ -197,20 +258,20 @@ void VfhStar::init()
 				 */
 				if (DoubleCompare(this->cellDistance[x][y]) > 0) {
 					double const r = this->robotRadius
-						+ this->getSafetyDistance(max_speed_this_table);
+						+ this->getSafetyDistance(tableSpeed);
+					/* all round once the cell is as close */
 					this->cellEnlarge[x][y] =
-						::asin(r / this->cellDistance[x][y]);
+						::asin(std::min(1.0, r / this->cellDistance[x][y]));
 				} else {
 					this->cellEnlarge[x][y] = 0;
 				}
-				this->cellSector[cellSectorTabIdx][x][y].clear();
+				std::fill(covered.begin(), covered.end(), 0);
 				double const plusDirection = this->cellDirection[x][y]
 					+ this->cellEnlarge[x][y];
 				double const negDirection = this->cellDirection[x][y]
 					- this->cellEnlarge[x][y];
-				int const n = DPi / this->sectorAngle;
-				int i;
-				for (i = 0; i < n; ++i) {
+				int const n = this->histogramSize;
+				for (int i = 0; i < n; ++i) {
 					/*
 					 * set plusSector and negSector to the angles to the two
 					 * adjacent sectors
@@ -222,8 +283,8 @@ void VfhStar::init()
 							- (negSector - DPi);
 					} else if (DoubleCompare(negDirection - negSector, M_PI)
 						> 0) {
-						neg_sector_to_neg_dir = negSector
-							- (negDirection + DPi);
+						neg_sector_to_neg_dir = (negDirection - DPi)
+							- negSector;
 					} else {
 						neg_sector_to_neg_dir = negDirection - negSector;
 					}
@@ -232,8 +293,8 @@ void VfhStar::init()
 							- (plusSector - DPi);
 					} else if (DoubleCompare(negDirection - plusSector, M_PI)
 						> 0) {
-						plus_sector_to_neg_dir = plusSector
-							- (negDirection + DPi);
+						plus_sector_to_neg_dir = (negDirection - DPi)
+							- plusSector;
 					} else {
 						plus_sector_to_neg_dir = negDirection - plusSector;
 					}
@@ -242,8 +303,8 @@ void VfhStar::init()
 							- (plusSector - DPi);
 					} else if (DoubleCompare(plusDirection - plusSector, M_PI)
 						> 0) {
-						plus_sector_to_plus_dir = plusSector
-							- (plusDirection + DPi);
+						plus_sector_to_plus_dir = (plusDirection - DPi)
+							- plusSector;
 					} else {
 						plus_sector_to_plus_dir = plusDirection - plusSector;
 					}
@@ -252,49 +313,131 @@ void VfhStar::init()
 							- (negSector - DPi);
 					} else if (DoubleCompare(plusDirection - negSector, M_PI)
 						> 0) {
-						neg_sector_to_plus_dir = negSector
-							- (plusDirection + DPi);
+						neg_sector_to_plus_dir = (plusDirection - DPi)
+							- negSector;
 					} else {
 						neg_sector_to_plus_dir = plusDirection - negSector;
 					}
+					bool neg_dir_bw;
+					if ((DoubleCompare(neg_sector_to_neg_dir) >= 0)
+						&& (DoubleCompare(plus_sector_to_neg_dir) <= 0)) {
+						neg_dir_bw = true;
+					} else {
+						neg_dir_bw = false;
+					}
+					bool plus_dir_bw;
+					if ((DoubleCompare(neg_sector_to_plus_dir) >= 0)
+						&& (DoubleCompare(plus_sector_to_plus_dir) <= 0)) {
+						plus_dir_bw = true;
+					} else {
+						plus_dir_bw = false;
+					}
+					bool dir_around_sector;
+					if ((DoubleCompare(neg_sector_to_neg_dir) <= 0)
+						&& (DoubleCompare(neg_sector_to_plus_dir) >= 0)) {
+						dir_around_sector = true;
+					} else {
+						dir_around_sector = false;
+					}
+					if ((DoubleCompare(plus_sector_to_neg_dir) <= 0)
+						&& (DoubleCompare(plus_sector_to_plus_dir) >= 0)) {
+						plus_dir_bw = true;
+					}
+					if (plus_dir_bw || neg_dir_bw || dir_around_sector) {
+						covered[i] = 1;
+					}
 				}
-				bool neg_dir_bw;
-				if ((DoubleCompare(neg_sector_to_neg_dir) >= 0)
-					&& (DoubleCompare(plus_sector_to_neg_dir) <= 0)) {
-					neg_dir_bw = true;
-				} else {
-					neg_dir_bw = false;
-				}
-				bool plus_dir_bw;
-				if ((DoubleCompare(neg_sector_to_plus_dir) >= 0)
-					&& (DoubleCompare(plus_sector_to_plus_dir) <= 0)) {
-					plus_dir_bw = true;
-				} else {
-					plus_dir_bw = false;
-				}
-				bool dir_around_sector;
-				if ((DoubleCompare(neg_sector_to_neg_dir) <= 0)
-					&& (DoubleCompare(neg_sector_to_plus_dir) >= 0)) {
-					dir_around_sector = true;
-				} else {
-					dir_around_sector = false;
-				}
-				if ((DoubleCompare(plus_sector_to_neg_dir) <= 0)
-					&& (DoubleCompare(plus_sector_to_plus_dir) >= 0)) {
-					plus_dir_bw = true;
-				}
-				if (plus_dir_bw || neg_dir_bw || dir_around_sector) {
-					this->cellSector[cellSectorTabIdx][x][y].push_back(i);
+				/* the sectors covered make an arc: where it starts, how long */
+				std::pair<int, int>& arc = this->cellSector[
+					(cellSectorTabIdx * w * w) + (w * x) + y];
+				arc = std::make_pair(0, 0);
+				for (int i = 0; i < n; ++i) {
+					if (covered[i] != 0) {
+						++arc.second;
+						if (covered[(i + n - 1) % n] == 0) {
+							arc.first = i;
+						}
+					}
 				}
 			}
 		}
 	}
-	this->lastUpdateTime = NowSecond();
+	/*
+	 * the window around a cell for projectWindow, as projectHistogram
+	 * takes a cell at a projected pose, enlarged by cellSector
+	 */
+	this->windowCells.resize(w * w);
+	for (int i = 0; i < w; ++i) {
+		for (int j = 0; j < w; ++j) {
+			double const dx = (i - this->centerX) * this->cellWidth;
+			double const dy = (this->centerY - j) * this->cellWidth;
+			WindowCell& cell = this->windowCells[(w * i) + j];
+			cell.distance = ::hypot(dx, dy);
+			cell.direction = NormalizeAnglePositive(::atan2(dy, dx));
+			double const m = 3e3 - (cell.distance * 1e3);
+			cell.mag = (m * m) * (m * m) / 1e8;
+		}
+	}
+	/* no update yet, the first one must not accelerate from the init time */
+	this->lastUpdateTime = -1.0;
+}
+/**
+ * @brief update the vfh* state using the laser readings and the robot
+ * speed, timed by the wall clock
+ * @see update(double const, ...)
+ */
+void VfhStar::update(
+	std::array<double, 361> const& laserRanges,
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance,
+	double& chosenLinearX,
+	double& chosenAngularZ)
+{
+	this->update(
+		NowSecond(),
+		laserRanges,
+		currentLinearX,
+		goalDirection,
+		goalDistance,
+		goalDistanceTolerance,
+		chosenLinearX,
+		chosenAngularZ);
+}
+/**
+ * @brief update the vfh* state with an explicit timestamp, searching
+ * processTimes deep
+ * @see update(double const, double const, ...)
+ */
+void VfhStar::update(
+	double const stamp,
+	std::array<double, 361> const& laserRanges,
+	double const currentLinearX,
+	double const goalDirection,
+	double const goalDistance,
+	double const goalDistanceTolerance,
+	double& chosenLinearX,
+	double& chosenAngularZ)
+{
+	this->update(
+		stamp,
+		0,
+		laserRanges,
+		currentLinearX,
+		goalDirection,
+		goalDistance,
+		goalDistanceTolerance,
+		chosenLinearX,
+		chosenAngularZ);
 }
 /**
- * @brief update the vfh+ state using the laser readings and the robot
+ * @brief update the vfh* state using the laser readings and the robot
  * speed
- * @param laserRanges the laser (or sonar) readings, by convertScan
+ * @param stamp monotonic timestamp of the laser readings, in seconds
+ * @param budget seconds the update may take, <= 0 for no limit
+ * @param laserRanges the laser (or sonar) readings, in mm, by
+ * convertScan
  * @param currentLinearX the current robot linear x velocity, in meter/s
  * @param goalDirection the desired direction, in radian,
  * 0 is to the right
@@ -306,8 +449,11 @@ void VfhStar::init()
  * in meter/s
  * @param[out] chosenAngularZ the chosen turn rathe to drive the robot, in
  * radian/s
+ * @return the look-ahead depth the picked direction was verified to
  */
-void VfhStar::update(
+int VfhStar::update(
+	double const stamp,
+	double const budget,
 	std::array<double, 361> const& laserRanges,
 	double const currentLinearX,
 	double const goalDirection,
@@ -316,9 +462,41 @@ void VfhStar::update(
 	double& chosenLinearX,
 	double& chosenAngularZ)
 {
-	double const now = NowSecond();
-	double const diffSeconds = now - this->lastUpdateTime;
-	this->lastUpdateTime = now;
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageUpdate);
+	/* the search gets what the histograms leave of the budget */
+	std::chrono::steady_clock::time_point const deadline = (budget > 0)
+		? (std::chrono::steady_clock::now()
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(budget)))
+		: std::chrono::steady_clock::time_point::max();
+	int depth = 0;
+	/* < 0 on the first update */
+	double const diffSeconds = (this->lastUpdateTime < 0)
+		? -1.0 : (stamp - this->lastUpdateTime);
+	this->lastUpdateTime = stamp;
+	/*
+	 * where the last search's robot frame lies in this one: odometry when
+	 * given, else the last command over the time since
+	 */
+	this->shiftKnown = this->searchKept && (this->odometryGiven
+		|| ((diffSeconds >= 0) && (diffSeconds <= 0.3)));
+	if (this->shiftKnown) {
+		double forward = this->odometryForward;
+		double left = this->odometryLeft;
+		double turn = this->odometryTurn;
+		if (!this->odometryGiven) {
+			double const d = this->lastChosenLinearX * diffSeconds;
+			turn = this->lastChosenAngularZ * diffSeconds;
+			forward = d * ::cos(turn / 2.0);
+			left = d * ::sin(turn / 2.0);
+		}
+		/* +y is forward, +x to the right */
+		this->shiftX = -left;
+		this->shiftY = forward;
+		this->shiftTurn = turn;
+	}
+	this->odometryGiven = false;
+	this->searchKept = false;
 	this->desiredDirection = goalDirection + HPi;
 	this->goalDistance = goalDistance;
 	this->goalDistanceTolerance = goalDistanceTolerance;
@@ -349,6 +527,7 @@ void VfhStar::update(
 		 * something's inside our safety distance:
 		 * brake hard and turn on the spot
 		 */
+		YUIWONGVFHEVENT(this->stageStats, EventSafetyShortCircuit, 1);
 		this->pickedDirection = this->lastPickedDirection;
 		this->maxSpeedForPickedDirection = 0;
 		this->lastPickedDirection = this->pickedDirection;
@@ -359,7 +538,11 @@ void VfhStar::update(
 		 * sets pickedDirection, lastPickedDirection,
 		 * and maxSpeedForPickedDirection
 		 */
-		this->selectDirection();
+		if (this->processTimes > 0) {
+			depth = this->searchDirection(currentPoseSpeed, deadline);
+		} else {
+			this->selectDirection();
+		}
 	}
 	YUIWONGLOGNDEBU("VfhStar", "pickedDirection %lf", this->pickedDirection);
 	/*
@@ -399,17 +582,24 @@ void VfhStar::update(
 		this->maxSpeedForPickedDirection);
 	/* set the chosen turnrate, and possibly modify the chosen speed */
 	double chosenTurnrate = 0;
-	this->setMotion(chosenLinearX0, chosenTurnrate, currentPoseSpeed);
+	{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageSetMotion);
+	this->setMotion(currentPoseSpeed, chosenLinearX0, chosenTurnrate);
+	}
 	chosenLinearX = chosenLinearX0;
 	chosenAngularZ = NormalizeAngle(chosenTurnrate);
 	this->lastChosenLinearX = chosenLinearX0;
+	this->lastChosenAngularZ = chosenAngularZ;
+	this->searchDepth = depth;
+	this->publishSnapshot(stamp, chosenLinearX, chosenAngularZ);
+	return depth;
 }
 /**
  * @brief get the safety distance at the given speed
  * @param speed given speed, in m/s
- * @return the safety distance
+ * @return the safety distance, in meters
  */
-int VfhStar::getSafetyDistance(double const speed) const
+double VfhStar::getSafetyDistance(double const speed) const
 {
 	double d = this->zeroSafetyDistance + (speed
 		* (this->maxSafetyDistance - this->zeroSafetyDistance));
@@ -437,7 +627,7 @@ void VfhStar::setCurrentMaxSpeed(double const maxSpeed)
 	for (int x = 0; x < n; ++x) {
 		double const dx = x / 1e3;/* dx in m/s */
 		/* dtheta in radians/s */
-		double const dtheta = this->getMaxTurnrate(x);
+		double const dtheta = this->getMaxTurnrate(dx);
 		/* in meters */
 		this->minTurningRadius[x] = (((dx / ::tan(dtheta)))
 			* this->minTurnRadiusSafetyFactor);
@@ -474,17 +664,65 @@ void VfhStar::allocate()
 	this->cellDistance.resize(this->windowDiameter, tempv);
 	this->cellEnlarge.resize(this->windowDiameter, tempv);
 	}
-	{
-	std::vector<std::vector<int> > tempv(
-		this->windowDiameter, std::vector<int>{});
-	std::vector<std::vector<std::vector<int> > > const tempv2(
-		this->windowDiameter, tempv);
-	this->cellSector.resize(this->cellSectorTablesCount, tempv2);
-	}
+	this->cellSector.assign(
+		this->cellSectorTablesCount * this->windowDiameter
+		* this->windowDiameter, std::make_pair(0, 0));
 	this->histogram.clear();
 	this->lastBinaryHistogram.clear();
 	this->histogram.resize(this->histogramSize, 0);
 	this->lastBinaryHistogram.resize(this->histogramSize, 0);
+	/* an update never allocates: the look-ahead works in these */
+	this->candidateAngle.reserve(this->histogramSize * 2);
+	this->candidateSpeed.reserve(this->histogramSize * 2);
+	this->reserveSearch();
+	{
+	size_t const cells = this->windowDiameter * this->windowDiameter;
+	this->occupiedCells.reserve(cells);
+	this->occupiedCellIndices.reserve(cells);
+	this->lastOccupiedCells.clear();
+	this->lastOccupiedCells.reserve(cells);
+	this->occupancy.assign(cells, 0);
+	this->lastOccupancy.assign(cells, 0);
+	/* a cell can appear in the one grid and vanish from the other */
+	this->changedCells.reserve(2 * cells);
+	}
+	this->nodes.clear();
+	this->nodes.reserve(std::max(1, this->searchNodes));
+	this->openNodes.clear();
+	this->openNodes.reserve(std::max(1, this->searchNodes));
+	{
+	size_t slots = 0;
+	if (this->transpositionEntries > 0) {
+		for (slots = 1;
+			slots < static_cast<size_t>(this->transpositionEntries);
+			slots <<= 1) {
+		}
+	}
+	Transposition empty;
+	empty.key = 0;
+	empty.generation = 0;
+	empty.used = 0;
+	empty.x = 0;
+	empty.y = 0;
+	empty.heading = 0;
+	empty.ready = false;
+	empty.clear = false;
+	empty.candidatesKept = false;
+	empty.histogram.assign(this->histogramSize, 0);
+	this->transpositions.assign(slots, empty);
+	this->spareTranspositions.assign(
+		this->rerootSearch ? slots : 0, empty);
+	/* the few candidates a pose usually has, more are taken again */
+	for (auto& t: this->transpositions) {
+		t.angles.reserve(this->histogramSize / 2);
+		t.speeds.reserve(this->histogramSize / 2);
+	}
+	for (auto& t: this->spareTranspositions) {
+		t.angles.reserve(this->histogramSize / 2);
+		t.speeds.reserve(this->histogramSize / 2);
+	}
+	this->transpositionGeneration = 0;
+	}
 	this->setCurrentMaxSpeed(this->maxSpeed);
 	YUIWONGLOGNDEBU("VfhStar", "allocate done");
 }
@@ -498,6 +736,7 @@ void VfhStar::allocate()
 bool VfhStar::buildPrimaryPolarHistogram(
 	std::array<double, 361> const& laserRanges, double const speed)
 {
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StagePrimaryHistogram);
 	/* index into the vector of cell_sector tables */
 	std::fill(this->histogram.begin(), this->histogram.end(), 0);
 	if (!this->calculateCellsMagnitude(laserRanges, speed)) {
@@ -505,13 +744,24 @@ bool VfhStar::buildPrimaryPolarHistogram(
 		std::fill(this->histogram.begin(), this->histogram.end(), 1);
 		return false;
 	}
-	int const speedIndex = this->getSpeedIndex(speed);
-	/* only have to go through the cells in front */
+	int const w = this->windowDiameter;
+	std::pair<int, int> const* const sectors =
+		&this->cellSector[this->getSpeedIndex(speed) * w * w];
+	/*
+	 * only have to go through the cells in front, in the order VfhPlus
+	 * adds them up. an empty cell adds nothing
+	 */
 	int const n = ::ceil(this->windowDiameter / 2.0);
-	for (int y = 0;y <= n; ++y) {
-		for (int x = 0; x < this->windowDiameter; ++x) {
-			auto& tmp = this->cellSector[speedIndex][x][y];
-			std::fill(tmp.begin(), tmp.end(), this->cellMag[x][y]);
+	for (int y = 0; y <= n; ++y) {
+		for (int x = 0; x < w; ++x) {
+			double const mag = this->cellMag[x][y];
+			if (mag != 0) {
+				AddSectors(
+					this->histogram.data(),
+					this->histogramSize,
+					sectors[(w * x) + y],
+					mag);
+			}
 		}
 	}
 	return true;
@@ -522,6 +772,7 @@ bool VfhStar::buildPrimaryPolarHistogram(
  */
 void VfhStar::buildBinaryPolarHistogram(double const speed)
 {
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageBinaryHistogram);
 	for (int x = 0; x < this->histogramSize; ++x) {
 		if (DoubleCompare(
 			this->histogram[x], this->getObsBinaryHistogram(speed)) > 0) {
@@ -530,6 +781,7 @@ void VfhStar::buildBinaryPolarHistogram(double const speed)
 			this->histogram[x], this->getFreeBinaryHistogram(speed)) < 0) {
 			this->histogram[x] = 0.0;
 		} else {
+			YUIWONGVFHEVENT(this->stageStats, EventHysteresisHold, 1);
 			this->histogram[x] = this->lastBinaryHistogram[x];
 		}
 	}
@@ -544,6 +796,7 @@ void VfhStar::buildBinaryPolarHistogram(double const speed)
  */
 void VfhStar::buildMaskedPolarHistogram(double const speed)
 {
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageMaskedHistogram);
 	/*
 	 * centerX[left|right] is the centre of the circles on either side that
 	 * are blocked due to the robot's dynamics.
@@ -614,21 +867,15 @@ void VfhStar::buildMaskedPolarHistogram(double const speed)
 /** @brief select the used direction */
 void VfhStar::selectDirection()
 {
-	this->candidateAngle.clear();
-	this->candidateSpeed.clear();
-	/* set start to sector of first obstacle */
-	int start = -1;
-	{
-	/* only look at the forward 180deg for first obstacle */
-	int const n = this->histogramSize / 2;
-	for(int i = 0; i < n; ++i) {
-		if (DoubleCompare(this->histogram[i], 1) == 0) {
-			start = i;
-			break;
-		}
-	}
-	}
-	if (start == -1) {
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageSelectDirection);
+	if (!this->collectCandidates(
+		this->histogram,
+		HPi,
+		this->desiredDirection,
+		this->candidateAngle,
+		this->candidateSpeed,
+		this->searchScratch[0].borders)) {
+		YUIWONGVFHEVENT(this->stageStats, EventNoObstacle, 1);
 		this->pickedDirection = this->desiredDirection;
 		this->lastPickedDirection = this->pickedDirection;
 		this->maxSpeedForPickedDirection = this->currentMaxSpeed;
@@ -641,23 +888,62 @@ void VfhStar::selectDirection()
 			 this->maxSpeedForPickedDirection);
 		return;
 	}
+	this->selectCandidateAngle();
+}
+/**
+ * @brief the candidate directions of a masked histogram
+ * @param histogram masked, 1 blocked, 0 free
+ * @param heading the robot's, its forward half is searched for the
+ * first obstacle, radians
+ * @param desired the direction to the goal, radians
+ * @param[out] angles the candidate directions, radians
+ * @param[out] speeds their max speeds, m/s
+ * @param[out] borders the openings, as (right, left) border angles
+ * @return false when there is no obstacle in front
+ */
+bool VfhStar::collectCandidates(
+	std::vector<double> const& histogram,
+	double const heading,
+	double const desired,
+	std::vector<double>& angles,
+	std::vector<double>& speeds,
+	std::vector<std::pair<double, double> >& borders) const
+{
+	angles.clear();
+	speeds.clear();
+	int const size = this->histogramSize;
+	/* set start to sector of first obstacle */
+	int start = -1;
+	{
+	/* only look at the forward 180deg for first obstacle */
+	int const first = static_cast<int>(::rint(
+		NormalizeAnglePositive(heading - HPi) / this->sectorAngle)) % size;
+	int const n = size / 2;
+	for (int i = 0; i < n; ++i) {
+		int const s = (first + i) % size;
+		if (DoubleCompare(histogram[s], 1) == 0) {
+			start = s;
+			break;
+		}
+	}
+	}
+	if (start == -1) {
+		return false;
+	}
 	/* find the left and right borders of each opening */
-	std::vector<std::pair<int, double> > border;
-	std::pair<int,int> newborder;
-	int const n = start + this->histogramSize;
+	borders.clear();
+	std::pair<double, double> newborder;
+	int const n = start + size;
 	bool left = true;
-	for (int i = start;i <= n; ++i) {
-		if ((DoubleCompare(this->histogram[i % this->histogramSize]) == 0)
-			&& left) {
-			newborder.first = (i % this->histogramSize) * this->sectorAngle;
+	for (int i = start; i <= n; ++i) {
+		if ((DoubleCompare(histogram[i % size]) == 0) && left) {
+			newborder.first = (i % size) * this->sectorAngle;
 			left = false;
 		}
-		if ((DoubleCompare(this->histogram[i % this->histogramSize], 1) == 0)
-			&& (!left)) {
-			newborder.second = ((i % this->histogramSize) - 1)
-				* this->sectorAngle;
-			newborder.second = NormalizeAnglePositive(newborder.second);
-			border.push_back(newborder);
+		if ((DoubleCompare(histogram[i % size], 1) == 0) && (!left)) {
+			newborder.second = NormalizeAnglePositive(
+				((i % size) - 1) * this->sectorAngle);
+			borders.push_back(newborder);
 			left = true;
 		}
 	}
@@ -665,46 +951,991 @@ void VfhStar::selectDirection()
 	double const veryNarrowO = DegreeToRadian(10);
 	double const narrowO = DegreeToRadian(80);
 	double const r40 = DegreeToRadian(40);
-	for (auto const& b: border) {
+	for (auto const& b: borders) {
 		double const angle = DeltaAngle(b.first, b.second);
 		if (DoubleCompare(::fabs(angle), veryNarrowO) < 0) {
 			continue;/* ignore very narrow openings */
 		}
+		/* an opening may go across 0 */
+		double const centre = NormalizeAnglePositive(b.first + (angle / 2.0));
 		if (DoubleCompare(::fabs(angle), narrowO) < 0) {
 			/* narrow opening: aim for the centre */
-			double const newangle = b.first + (b.second - b.first) / 2.0;
-			this->candidateAngle.push_back(newangle);
-			this->candidateSpeed.push_back(std::min(
+			angles.push_back(centre);
+			speeds.push_back(std::min(
 				this->currentMaxSpeed, this->maxSpeedNarrowOpening));
 		} else {
 			/*
 			 * wide opening: consider the centre, and 'r40' from each border
 			 */
-			double newangle = b.first + (b.second - b.first) / 2.0;
-			this->candidateAngle.push_back(newangle);
-			this->candidateSpeed.push_back(this->currentMaxSpeed);
-			newangle = NormalizeAnglePositive(b.first + r40);
-			this->candidateAngle.push_back(newangle);
-			this->candidateSpeed.push_back(std::min(
+			angles.push_back(centre);
+			speeds.push_back(this->currentMaxSpeed);
+			angles.push_back(NormalizeAnglePositive(b.first + r40));
+			speeds.push_back(std::min(
 				this->currentMaxSpeed, this->maxSpeedWideOpening));
-			newangle = NormalizeAnglePositive(b.second - r40);
-			this->candidateAngle.push_back(newangle);
-			this->candidateSpeed.push_back(std::min(
+			angles.push_back(NormalizeAnglePositive(b.second - r40));
+			speeds.push_back(std::min(
 				this->currentMaxSpeed, this->maxSpeedWideOpening));
 			/* see if candidate dir is in this opening */
 			if ((DoubleCompare(DeltaAngle(
-				this->desiredDirection,
-				this->candidateAngle[this->candidateAngle.size() - 2])) < 0)
+				desired, angles[angles.size() - 2])) < 0)
 				&& (DoubleCompare(DeltaAngle(
-				this->desiredDirection,
-				this->candidateAngle[this->candidateAngle.size() - 1])) > 0)) {
-				this->candidateAngle.push_back(this->desiredDirection);
-				this->candidateSpeed.push_back(std::min(
+				desired, angles[angles.size() - 1])) > 0)) {
+				angles.push_back(desired);
+				speeds.push_back(std::min(
 					this->currentMaxSpeed, this->maxSpeedWideOpening));
 			}
 		}
 	}
-	this->selectCandidateAngle();
+	return true;
+}
+/**
+ * @brief select the used direction by the look-ahead search
+ * @param speed robot speed, m/s
+ * @param deadline steady clock, max() to search processTimes deep at once
+ * @return the depth the picked direction was verified to, 0 for plain
+ * vfh+
+ */
+int VfhStar::searchDirection(
+	double const speed,
+	std::chrono::steady_clock::time_point const deadline)
+{
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageLookAhead);
+	/*
+	 * every projected histogram is rebuilt from these, the last search's
+	 * are kept to tell what changed since
+	 */
+	this->occupiedCells.swap(this->lastOccupiedCells);
+	this->occupancy.swap(this->lastOccupancy);
+	this->occupiedCells.clear();
+	this->occupiedCellIndices.clear();
+	std::fill(this->occupancy.begin(), this->occupancy.end(), 0);
+	for (int x = 0; x < this->windowDiameter; ++x) {
+		for (int y = 0; y < this->windowDiameter; ++y) {
+			if (DoubleCompare(this->cellMag[x][y]) != 0) {
+				this->occupiedCells.push_back(std::make_pair(
+					(x - this->centerX) * this->cellWidth,
+					(this->centerY - y) * this->cellWidth));
+				this->occupiedCellIndices.push_back(std::make_pair(
+					x - this->centerX, this->centerY - y));
+				this->occupancy[(this->windowDiameter * x) + y] = 1;
+			}
+		}
+	}
+	/* the current pose is expanded as any other, its candidates first */
+	SearchScratch& scratch = this->searchScratch[0];
+	if (!this->projectHistogram(0, 0, HPi, speed, scratch.histogram)) {
+		this->candidateAngle.clear();
+		this->candidateSpeed.clear();
+		this->selectCandidateAngle();
+		return 0;
+	}
+	if (!this->collectCandidates(
+		scratch.histogram,
+		HPi,
+		this->desiredDirection,
+		this->candidateAngle,
+		this->candidateSpeed,
+		scratch.borders)) {
+		YUIWONGVFHEVENT(this->stageStats, EventNoObstacle, 1);
+		this->pickedDirection = this->desiredDirection;
+		this->lastPickedDirection = this->pickedDirection;
+		this->maxSpeedForPickedDirection = this->currentMaxSpeed;
+		return 0;
+	}
+	if (this->candidateAngle.empty()) {
+		this->selectCandidateAngle();
+		return 0;
+	}
+	double const r = this->robotRadius + this->getSafetyDistance(speed);
+	/* the goal in the robot frame of this update */
+	double const goalX = this->goalDistance * ::cos(this->desiredDirection);
+	double const goalY = this->goalDistance * ::sin(this->desiredDirection);
+	/* empties the table, the deepening rounds share it */
+	uint32_t const previous = this->transpositionGeneration;
+	if (++this->transpositionGeneration == 0) {
+		for (auto& t: this->transpositions) {
+			t.generation = 0;
+		}
+		for (auto& t: this->spareTranspositions) {
+			t.generation = 0;
+		}
+		this->transpositionGeneration = 1;
+	}
+	if (this->shiftKnown && !this->spareTranspositions.empty()) {
+		this->reroot(goalX, goalY, previous);
+	}
+	this->goalX = goalX;
+	this->goalY = goalY;
+	int const speedIndex = this->getSpeedIndex(speed);
+	/*
+	 * iterative deepening under a deadline: every round that completes
+	 * replaces the first step with one verified a step further. plain
+	 * vfh+ stands until the first one does
+	 */
+	bool const anytime =
+		deadline != std::chrono::steady_clock::time_point::max();
+	int achieved = 0;
+	double direction = 0;
+	double directionSpeed = 0;
+	for (int depth = anytime ? 1 : this->processTimes;
+		depth <= this->processTimes;
+		++depth) {
+		this->searchLimit = depth;
+		int const reached = this->lookAhead(speed, r, speedIndex, deadline);
+		if (reached == -2) {
+			YUIWONGVFHEVENT(this->stageStats, EventLookAheadDeadline, 1);
+			break;
+		}
+		if (reached < 0) {
+			break;/* no projected step is clear */
+		}
+		SearchNode const& node = this->nodes[reached];
+		direction = node.firstDirection;
+		directionSpeed = node.firstSpeed;
+		achieved = node.depth;
+		if (node.depth < depth) {
+			break;/* dead ends before this depth, deeper is no better */
+		}
+	}
+	this->searchKept = !this->spareTranspositions.empty();
+	if (achieved == 0) {
+		this->selectCandidateAngle();
+		return 0;
+	}
+	this->pickedDirection = direction;
+	this->maxSpeedForPickedDirection = directionSpeed;
+	this->lastPickedDirection = this->pickedDirection;
+	return achieved;
+}
+/**
+ * @brief one best first search to searchLimit deep from the current pose
+ * @return the node whose first step to take: the cheapest clear one at
+ * searchLimit, else the deepest expanded one; -1 for none, -2 when the
+ * deadline cut the search
+ */
+int VfhStar::lookAhead(
+	double const speed,
+	double const r,
+	int const speedIndex,
+	std::chrono::steady_clock::time_point const deadline)
+{
+	bool const anytime =
+		deadline != std::chrono::steady_clock::time_point::max();
+	this->searchBound.store(
+		std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	auto const later = [this](int const a, int const b) {
+		double const fa = this->nodes[a].f;
+		double const fb = this->nodes[b].f;
+		return (fa > fb) || ((fa == fb) && (a > b));
+	};
+	size_t const capacity = this->nodes.capacity();
+	/*
+	 * children join the open nodes in the order the serial search makes
+	 * them; those the final bound rules out go, however early each thread
+	 * saw it, so the tree does not depend on the threads' timing
+	 */
+	auto const adopt = [&](std::vector<SearchNode> const& children) {
+		double const bound = this->searchBound.load(std::memory_order_relaxed);
+		for (auto const& child: children) {
+			if (this->nodes.size() >= capacity) {
+				return;
+			}
+			if ((child.depth >= this->searchLimit)
+				? (child.f > bound) : (child.f >= bound)) {
+				continue;
+			}
+			this->nodes.push_back(child);
+			this->openNodes.push_back(this->nodes.size() - 1);
+			std::push_heap(
+				this->openNodes.begin(), this->openNodes.end(), later);
+		}
+	};
+	this->nodes.clear();
+	this->openNodes.clear();
+	{
+	SearchNode root;
+	root.x = 0;
+	root.y = 0;
+	root.direction = HPi;
+	root.g = 0;
+	root.f = 0;
+	root.firstDirection = HPi;
+	root.firstSpeed = this->currentMaxSpeed;
+	root.depth = 0;
+	root.parent = -1;
+	this->branch(
+		root,
+		-1,
+		this->desiredDirection,
+		this->lastPickedDirection,
+		this->candidateAngle,
+		this->candidateSpeed,
+		r,
+		this->searchBound,
+		this->batchChildren[0]);
+	adopt(this->batchChildren[0]);
+	}
+	size_t const width = this->batchChildren.size();
+	auto expandTask = [&](uint32_t const i, int const thread) {
+		int const index = this->batch[i];
+		this->batchExpanded[i] = this->expand(
+			this->nodes[index],
+			index,
+			speed,
+			r,
+			this->searchBound,
+			this->searchScratch[thread],
+			this->batchEntry[i],
+			this->batchChildren[i]);
+	};
+	int reached = -1;
+	int deepest = -1;
+	while (!this->openNodes.empty()) {
+		if (anytime && (std::chrono::steady_clock::now() >= deadline)) {
+			reached = -2;
+			break;
+		}
+		std::pop_heap(this->openNodes.begin(), this->openNodes.end(), later);
+		int const index = this->openNodes.back();
+		this->openNodes.pop_back();
+		if (this->nodes[index].depth >= this->searchLimit) {
+			reached = index;/* clear, checked by branch */
+			break;
+		}
+		double const bound = this->searchBound.load(std::memory_order_relaxed);
+		if (this->nodes[index].f >= bound) {
+			continue;/* no cheaper path through it */
+		}
+		/* the next cheapest open nodes, up to one at the last depth */
+		this->batch.clear();
+		this->batch.push_back(index);
+		while ((this->batch.size() < width) && !this->openNodes.empty()) {
+			SearchNode const& next = this->nodes[this->openNodes.front()];
+			if (next.depth >= this->searchLimit) {
+				break;
+			}
+			std::pop_heap(
+				this->openNodes.begin(), this->openNodes.end(), later);
+			if (next.f < bound) {
+				this->batch.push_back(this->openNodes.back());
+			}
+			this->openNodes.pop_back();
+		}
+		if (!this->transpositions.empty()) {
+			for (size_t i = 0; i < this->batch.size(); ++i) {
+				bool hit;
+				this->batchEntry[i] = this->findTransposition(
+					this->nodes[this->batch[i]], speedIndex, hit);
+				++(hit ? hits : misses);
+			}
+		}
+		if (this->searchPool && (this->batch.size() > 1)) {
+			this->searchPool->run(this->batch.size(), expandTask);
+		} else {
+			for (size_t i = 0; i < this->batch.size(); ++i) {
+				expandTask(i, 0);
+			}
+		}
+		for (size_t i = 0; i < this->batch.size(); ++i) {
+			if (!this->batchExpanded[i]) {
+				continue;/* a dead end */
+			}
+			int const expanded = this->batch[i];
+			if ((deepest < 0)
+				|| (this->nodes[expanded].depth > this->nodes[deepest].depth)) {
+				deepest = expanded;
+			}
+			adopt(this->batchChildren[i]);
+		}
+	}
+	YUIWONGVFHEVENT(this->stageStats, EventLookAheadNodes, this->nodes.size());
+	YUIWONGVFHEVENT(this->stageStats, EventTranspositionHit, hits);
+	YUIWONGVFHEVENT(this->stageStats, EventTranspositionMiss, misses);
+	if ((reached == -1) && (deepest >= 0)) {
+		/* the path that got furthest before its dead end */
+		YUIWONGVFHEVENT(this->stageStats, EventLookAheadFallback, 1);
+		reached = deepest;
+	}
+	return reached;
+}
+/**
+ * @brief expand a look-ahead node: its masked histogram, its candidate
+ * directions and the children they lead to
+ * @return false when the node is a dead end
+ * @note safe from several threads at once, for distinct entries
+ */
+bool VfhStar::expand(
+	SearchNode const& node,
+	int const index,
+	double const speed,
+	double const r,
+	std::atomic<double>& bound,
+	SearchScratch& scratch,
+	Transposition* const entry,
+	std::vector<SearchNode>& children) const
+{
+	children.clear();
+	std::vector<double> const* angles = &scratch.angles;
+	std::vector<double> const* speeds = &scratch.speeds;
+	double x, y, heading;
+	this->searchPose(node, x, y, heading);
+	/* the candidates follow the pose of the histogram, not the node's */
+	double const kt = this->targetDirection(x, y, heading);
+	if ((entry != nullptr) && entry->ready) {
+		if (!entry->clear) {
+			return false;
+		}
+		if (entry->candidatesKept) {
+			angles = &entry->angles;
+			speeds = &entry->speeds;
+		} else if (!this->collectCandidates(
+			entry->histogram,
+			heading,
+			kt,
+			scratch.angles,
+			scratch.speeds,
+			scratch.borders)) {
+			scratch.angles.push_back(kt);
+			scratch.speeds.push_back(this->currentMaxSpeed);
+		}
+	} else {
+		std::vector<double>& histogram =
+			entry ? entry->histogram : scratch.histogram;
+		bool const clear =
+			this->projectHistogram(x, y, heading, speed, histogram);
+		if (clear && !this->collectCandidates(
+			histogram,
+			heading,
+			kt,
+			scratch.angles,
+			scratch.speeds,
+			scratch.borders)) {
+			/* nothing ahead: straight to the goal */
+			scratch.angles.push_back(kt);
+			scratch.speeds.push_back(this->currentMaxSpeed);
+		}
+		if (entry != nullptr) {
+			entry->clear = clear;
+			entry->candidatesKept = clear
+				&& (scratch.angles.size() <= entry->angles.capacity());
+			if (entry->candidatesKept) {
+				entry->angles.assign(
+					scratch.angles.begin(), scratch.angles.end());
+				entry->speeds.assign(
+					scratch.speeds.begin(), scratch.speeds.end());
+			}
+			entry->ready = true;
+		}
+		if (!clear) {
+			return false;
+		}
+	}
+	this->branch(
+		node,
+		index,
+		this->targetDirection(node.x, node.y, node.direction),
+		node.direction,
+		*angles,
+		*speeds,
+		r,
+		bound,
+		children);
+	return true;
+}
+/**
+ * @brief the transposition of a node, claimed for it when new
+ * @param[out] hit true when it is ready
+ * @return nullptr without a table, when the probed slots are taken, or
+ * when another node of the batch claimed it
+ */
+VfhStar::Transposition* VfhStar::findTransposition(
+	SearchNode const& node, int const speedIndex, bool& hit)
+{
+	hit = false;
+	if (this->transpositions.empty()) {
+		return nullptr;
+	}
+	uint64_t const key = this->transpositionKey(
+		node.x, node.y, node.direction, speedIndex);
+	size_t const mask = this->transpositions.size() - 1;
+	size_t slot = TranspositionSlot(key, mask);
+	/* a few probes, a full neighbourhood just misses */
+	for (int probe = 0; probe < 8; ++probe, slot = (slot + 1) & mask) {
+		Transposition& t = this->transpositions[slot];
+		if (t.generation != this->transpositionGeneration) {
+			t.key = key;
+			t.generation = this->transpositionGeneration;
+			t.used = this->transpositionGeneration;
+			this->searchPose(node, t.x, t.y, t.heading);
+			t.ready = false;
+			return &t;
+		}
+		if (t.key == key) {
+			hit = t.ready;
+			t.used = this->transpositionGeneration;
+			return t.ready ? &t : nullptr;
+		}
+	}
+	return nullptr;
+}
+/** @brief the table key of a pose quantized to a cell and half a sector */
+uint64_t VfhStar::transpositionKey(
+	double const x,
+	double const y,
+	double const heading,
+	int const speedIndex) const
+{
+	double const halfSector = this->sectorAngle / 2.0;
+	int const qx = static_cast<int>(::rint(x / this->cellWidth));
+	int const qy = static_cast<int>(::rint(y / this->cellWidth));
+	int const qheading = static_cast<int>(::rint(
+		NormalizeAnglePositive(heading) / halfSector))
+		% (2 * this->histogramSize);
+	return static_cast<uint16_t>(qx)
+		| (static_cast<uint64_t>(static_cast<uint16_t>(qy)) << 16)
+		| (static_cast<uint64_t>(static_cast<uint16_t>(qheading)) << 32)
+		| (static_cast<uint64_t>(static_cast<uint16_t>(speedIndex)) << 48);
+}
+/**
+ * @brief carry the entries the last search used over to this update,
+ * moved by the odometry shift, but those near a changed cell: a cell
+ * anywhere in the window around a pose weighs on its histogram
+ * @param goalX this update's goal, in meters
+ * @param goalY
+ * @param previous the last search's generation
+ */
+void VfhStar::reroot(
+	double const goalX, double const goalY, uint32_t const previous)
+{
+	double const c = ::cos(this->shiftTurn);
+	double const s = ::sin(this->shiftTurn);
+	/* the candidates kept lean towards the last goal: it has to stay */
+	double const gx = this->goalX - this->shiftX;
+	double const gy = this->goalY - this->shiftY;
+	bool const sameGoal = DoubleCompare(::hypot(
+		(c * gx) + (s * gy) - goalX,
+		(c * gy) - (s * gx) - goalY), this->cellWidth) <= 0;
+	this->changedCells.clear();
+	if (sameGoal) {
+		this->findChangedCells(c, s);
+	}
+	double const window = this->centerX * this->cellWidth;
+	double const window2 = window * window;
+	uint32_t const generation = this->transpositionGeneration;
+	size_t const mask = this->spareTranspositions.size() - 1;
+	uint64_t kept = 0;
+	uint64_t invalidated = 0;
+	for (auto& t: this->transpositions) {
+		/* what the last search did not reach is not the subtree taken */
+		if ((t.generation != previous) || (t.used != previous) || !t.ready
+			|| (t.clear && !t.candidatesKept)) {
+			continue;
+		}
+		double const dx = t.x - this->shiftX;
+		double const dy = t.y - this->shiftY;
+		double const x = (c * dx) + (s * dy);
+		double const y = (c * dy) - (s * dx);
+		bool changed = !sameGoal;
+		for (size_t i = 0; !changed && (i < this->changedCells.size()); ++i) {
+			double const cx = this->changedCells[i].first - x;
+			double const cy = this->changedCells[i].second - y;
+			changed = ((cx * cx) + (cy * cy)) <= window2;
+		}
+		if (changed) {
+			++invalidated;
+			continue;
+		}
+		double const heading =
+			NormalizeAnglePositive(t.heading - this->shiftTurn);
+		uint64_t const key = this->transpositionKey(
+			x, y, heading, static_cast<int>(t.key >> 48));
+		size_t slot = TranspositionSlot(key, mask);
+		for (int probe = 0; probe < 8; ++probe, slot = (slot + 1) & mask) {
+			Transposition& n = this->spareTranspositions[slot];
+			if (n.generation == generation) {
+				if (n.key == key) {
+					break;/* another pose moved to the same one */
+				}
+				continue;
+			}
+			std::swap(n, t);
+			n.key = key;
+			n.generation = generation;
+			/* carried on only if this search looks it up */
+			n.used = previous;
+			n.x = x;
+			n.y = y;
+			n.heading = heading;
+			for (auto& a: n.angles) {
+				a = NormalizeAnglePositive(a - this->shiftTurn);
+			}
+			++kept;
+			break;
+		}
+	}
+	this->transpositions.swap(this->spareTranspositions);
+	YUIWONGVFHEVENT(this->stageStats, EventRerootKept, kept);
+	YUIWONGVFHEVENT(this->stageStats, EventRerootInvalidated, invalidated);
+}
+/**
+ * @brief the occupied cells that differ from the last search's, in this
+ * update's robot frame, into changedCells. only the rows both scans saw
+ * are compared, and a cell a neighbour away is the same, as the grid's
+ * quantization shifts under the robot
+ * @param c cosine of the odometry turn
+ * @param s its sine
+ */
+void VfhStar::findChangedCells(double const c, double const s)
+{
+	int const w = this->windowDiameter;
+	/* calculateCellsMagnitude fills the rows in front */
+	int const sensed = static_cast<int>(::ceil(w / 2.0));
+	double const cw = this->cellWidth;
+	/* -1 outside the rows sensed, else whether (x, y) is about occupied */
+	auto const near = [&](
+		std::vector<char> const& grid, double const x, double const y) {
+		int const ix = static_cast<int>(::rint(x / cw)) + this->centerX;
+		int const iy = this->centerY - static_cast<int>(::rint(y / cw));
+		if ((ix < 0) || (ix >= w) || (iy < 0) || (iy >= sensed)) {
+			return -1;
+		}
+		for (int i = std::max(0, ix - 1); i <= std::min(w - 1, ix + 1); ++i) {
+			for (int j = std::max(0, iy - 1);
+				j <= std::min(sensed - 1, iy + 1);
+				++j) {
+				if (grid[(w * i) + j] != 0) {
+					return 1;
+				}
+			}
+		}
+		return 0;
+	};
+	/* occupied now, moved into the last search's frame */
+	for (auto const& cell: this->occupiedCells) {
+		double const x = (c * cell.first) - (s * cell.second) + this->shiftX;
+		double const y = (s * cell.first) + (c * cell.second) + this->shiftY;
+		if (near(this->lastOccupancy, x, y) == 0) {
+			this->changedCells.push_back(cell);
+		}
+	}
+	/* and occupied then, moved into this one */
+	for (auto const& cell: this->lastOccupiedCells) {
+		double const dx = cell.first - this->shiftX;
+		double const dy = cell.second - this->shiftY;
+		double const x = (c * dx) + (s * dy);
+		double const y = (c * dy) - (s * dx);
+		if (near(this->occupancy, x, y) == 0) {
+			this->changedCells.push_back(std::make_pair(x, y));
+		}
+	}
+}
+/**
+ * @brief the pose a node's histogram is projected at: with the table,
+ * its own quantized to a cell, for projectWindow, and half a sector
+ */
+void VfhStar::searchPose(
+	SearchNode const& node, double& x, double& y, double& heading) const
+{
+	if (this->transpositions.empty()) {
+		x = node.x;
+		y = node.y;
+		heading = node.direction;
+		return;
+	}
+	double const halfSector = this->sectorAngle / 2.0;
+	x = ::rint(node.x / this->cellWidth) * this->cellWidth;
+	y = ::rint(node.y / this->cellWidth) * this->cellWidth;
+	heading = NormalizeAnglePositive(::rint(
+		NormalizeAnglePositive(node.direction) / halfSector) * halfSector);
+}
+/**
+ * @brief the children of a node, a step along each candidate direction:
+ * g adds the discounted vfh+ cost of the step, h the discounted turn
+ * towards the goal the next step would cost
+ */
+void VfhStar::branch(
+	SearchNode const& node,
+	int const index,
+	double const kt,
+	double const previous,
+	std::vector<double> const& angles,
+	std::vector<double> const& speeds,
+	double const r,
+	std::atomic<double>& bound,
+	std::vector<SearchNode>& children) const
+{
+	children.clear();
+	double const discount = ::pow(this->discountFactor, node.depth);
+	double const nextDiscount = discount * this->discountFactor;
+	for (size_t i = 0; i < angles.size(); ++i) {
+		double const c = angles[i];
+		/*
+		 * a candidate within half a sector of an earlier one is the same
+		 * step, e.g. a just wide opening gives its centre thrice
+		 */
+		bool repeated = false;
+		for (size_t j = 0; (j < i) && !repeated; ++j) {
+			repeated = DoubleCompare(::fabs(DeltaAngle(angles[j], c)),
+				this->sectorAngle / 2.0) < 0;
+		}
+		if (repeated) {
+			continue;
+		}
+		SearchNode child;
+		child.x = node.x + (this->stepDistance * ::cos(c));
+		child.y = node.y + (this->stepDistance * ::sin(c));
+		child.direction = c;
+		child.depth = node.depth + 1;
+		child.parent = index;
+		child.g = node.g + (discount
+			* ((this->desiredDirectionWeight * ::fabs(DeltaAngle(kt, c)))
+			+ (this->currentDirectionWeight
+			* ::fabs(DeltaAngle(previous, c)))));
+		child.f = child.g + (nextDiscount * this->currentDirectionWeight
+			* ::fabs(DeltaAngle(
+			c, this->targetDirection(child.x, child.y, c))));
+		child.firstDirection = (index < 0) ? c : node.firstDirection;
+		child.firstSpeed = (index < 0) ? speeds[i] : node.firstSpeed;
+		double b = bound.load(std::memory_order_relaxed);
+		if (child.depth < this->searchLimit) {
+			if (child.f < b) {
+				children.push_back(child);
+			}
+			continue;
+		}
+		if ((child.f > b) || this->collides(child.x, child.y, r)) {
+			continue;
+		}
+		children.push_back(child);
+		while ((child.f < b) && !bound.compare_exchange_weak(
+			b, child.f, std::memory_order_relaxed)) {
+		}
+	}
+}
+/** @brief the direction to the goal from a pose, heading when at it */
+double VfhStar::targetDirection(
+	double const x, double const y, double const heading) const
+{
+	double const dx = this->goalX - x;
+	double const dy = this->goalY - y;
+	return (DoubleCompare(::hypot(dx, dy), this->goalDistanceTolerance) <= 0)
+		? heading : NormalizeAnglePositive(::atan2(dy, dx));
+}
+/**
+ * @brief the masked histogram at a projected pose, from the occupied
+ * cells of this update
+ * @param x position, in meters, in the robot frame of this update
+ * @param y position, in meters, +y is forward
+ * @param heading radians
+ * @param speed robot speed, m/s
+ * @param[out] histogram 1 blocked, 0 free, histogramSize sectors
+ * @return false when an obstacle is inside the safety distance there
+ */
+bool VfhStar::projectHistogram(
+	double const x,
+	double const y,
+	double const heading,
+	double const speed,
+	std::vector<double>& histogram) const
+{
+	double const px = x / this->cellWidth;
+	double const py = y / this->cellWidth;
+	if ((::fabs(px - ::rint(px)) < 1e-6) && (::fabs(py - ::rint(py)) < 1e-6)) {
+		return this->projectWindow(
+			static_cast<int>(::rint(px)),
+			static_cast<int>(::rint(py)),
+			heading,
+			speed,
+			histogram);
+	}
+	double const r = this->robotRadius + this->getSafetyDistance(speed);
+	double const window = this->centerX * this->cellWidth;
+	double const minTurningRadius =
+		this->minTurningRadius[this->getMinTurningRadiusIndex(speed)];
+	double const blockedRadius = minTurningRadius + r;
+	/* the centres of the circles the dynamics block, either side */
+	double const s = ::sin(heading);
+	double const c = ::cos(heading);
+	double const rightx = x + (minTurningRadius * s);
+	double const righty = y - (minTurningRadius * c);
+	double const leftx = x - (minTurningRadius * s);
+	double const lefty = y + (minTurningRadius * c);
+	double phiRight = NormalizeAnglePositive(heading - HPi);
+	double phiLeft = NormalizeAnglePositive(heading + HPi);
+	std::vector<double>& h = histogram;
+	std::fill(h.begin(), h.end(), 0);
+	int const size = this->histogramSize;
+	double const window2 = window * window;
+	double const blocked2 = blockedRadius * blockedRadius;
+	for (auto const& cell: this->occupiedCells) {
+		double const dx = cell.first - x;
+		double const dy = cell.second - y;
+		double const d2 = (dx * dx) + (dy * dy);
+		if (d2 > window2) {
+			continue;/* outside the window around this pose */
+		}
+		double const d = ::sqrt(d2);
+		if (DoubleCompare(d, r) < 0) {
+			return false;
+		}
+		/* the cell magnitude and enlargement of calculateCellsMagnitude */
+		double const direction = NormalizeAnglePositive(::atan2(dy, dx));
+		double const enlarge = ::asin(r / d);
+		double const m = 3e3 - (d * 1e3);
+		double const mag = (m * m) * (m * m) / 1e8;
+		/* a sector the arc just touches counts, as in cellSector */
+		int const first = static_cast<int>(::ceil(
+			((direction - enlarge) / this->sectorAngle) - 1e-9)) - 1;
+		int const last = static_cast<int>(::floor(
+			((direction + enlarge) / this->sectorAngle) + 1e-9));
+		for (int i = first; i <= last; ++i) {
+			h[((i % size) + size) % size] += mag;
+		}
+		/*
+		 * as buildMaskedPolarHistogram, about heading: only cells inside
+		 * a blocked circle can move phiRight or phiLeft
+		 */
+		double const rx = rightx - cell.first;
+		double const ry = righty - cell.second;
+		double const lx = leftx - cell.first;
+		double const ly = lefty - cell.second;
+		bool const inRight = ((rx * rx) + (ry * ry)) < blocked2;
+		bool const inLeft = ((lx * lx) + (ly * ly)) < blocked2;
+		if (!inRight && !inLeft) {
+			continue;
+		}
+		double const ahead = DeltaAngle(direction, heading);
+		if (DoubleCompare(ahead) > 0) {
+			if (inRight
+				&& (DoubleCompare(DeltaAngle(direction, phiRight)) <= 0)) {
+				phiRight = direction;
+			}
+		} else if (inLeft
+			&& (DoubleCompare(DeltaAngle(direction, phiLeft)) > 0)) {
+			phiLeft = direction;
+		}
+	}
+	this->maskProjection(heading, speed, phiRight, phiLeft, h);
+	return true;
+}
+/**
+ * @brief projectHistogram at a pose on a cell: the occupied cells seen
+ * through the window tables, by their offset from it. the view moves by
+ * its origin alone, nothing but the sectors is computed per cell
+ * @param px cells to the right of the robot's
+ * @param py cells in front of it
+ */
+bool VfhStar::projectWindow(
+	int const px,
+	int const py,
+	double const heading,
+	double const speed,
+	std::vector<double>& histogram) const
+{
+	double const r = this->robotRadius + this->getSafetyDistance(speed);
+	double const window = this->centerX * this->cellWidth;
+	double const minTurningRadius =
+		this->minTurningRadius[this->getMinTurningRadiusIndex(speed)];
+	double const blockedRadius = minTurningRadius + r;
+	/* the circles the dynamics block, from the pose, in cells */
+	double const s = ::sin(heading);
+	double const c = ::cos(heading);
+	double const rightx = minTurningRadius * s / this->cellWidth;
+	double const righty = -minTurningRadius * c / this->cellWidth;
+	double const blocked2 = (blockedRadius * blockedRadius)
+		/ (this->cellWidth * this->cellWidth);
+	double phiRight = NormalizeAnglePositive(heading - HPi);
+	double phiLeft = NormalizeAnglePositive(heading + HPi);
+	std::vector<double>& h = histogram;
+	std::fill(h.begin(), h.end(), 0);
+	int const size = this->histogramSize;
+	int const w = this->windowDiameter;
+	std::pair<int, int> const* const sectors =
+		&this->cellSector[this->getSpeedIndex(speed) * w * w];
+	for (auto const& occupied: this->occupiedCellIndices) {
+		int const dx = occupied.first - px;
+		int const dy = occupied.second - py;
+		int const i = dx + this->centerX;
+		int const j = this->centerY - dy;
+		if ((i < 0) || (i >= w) || (j < 0) || (j >= w)) {
+			continue;
+		}
+		WindowCell const& cell = this->windowCells[(w * i) + j];
+		if (cell.distance > window) {
+			continue;/* outside the window around this pose */
+		}
+		if (DoubleCompare(cell.distance, r) < 0) {
+			return false;
+		}
+		AddSectors(h.data(), size, sectors[(w * i) + j], cell.mag);
+		/* the circles are either side of the pose, mirrored */
+		double const rx = rightx - dx;
+		double const ry = righty - dy;
+		double const lx = -rightx - dx;
+		double const ly = -righty - dy;
+		bool const inRight = ((rx * rx) + (ry * ry)) < blocked2;
+		bool const inLeft = ((lx * lx) + (ly * ly)) < blocked2;
+		if (!inRight && !inLeft) {
+			continue;
+		}
+		double const direction = cell.direction;
+		double const ahead = DeltaAngle(direction, heading);
+		if (DoubleCompare(ahead) > 0) {
+			if (inRight
+				&& (DoubleCompare(DeltaAngle(direction, phiRight)) <= 0)) {
+				phiRight = direction;
+			}
+		} else if (inLeft
+			&& (DoubleCompare(DeltaAngle(direction, phiLeft)) > 0)) {
+			phiLeft = direction;
+		}
+	}
+	this->maskProjection(heading, speed, phiRight, phiLeft, h);
+	return true;
+}
+/**
+ * @brief threshold a projected histogram and mask what the turning
+ * circles block, in place
+ * @param phiRight the right limit of the directions reachable, radians
+ * @param phiLeft the left one
+ */
+void VfhStar::maskProjection(
+	double const heading,
+	double const speed,
+	double const phiRight,
+	double const phiLeft,
+	std::vector<double>& histogram) const
+{
+	std::vector<double>& h = histogram;
+	double const obs = this->getObsBinaryHistogram(speed);
+	double const free = this->getFreeBinaryHistogram(speed);
+	for (int i = 0; i < this->histogramSize; ++i) {
+		/* no last binary histogram here: between the thresholds is blocked */
+		bool const blocked = (DoubleCompare(h[i], obs) > 0)
+			|| (DoubleCompare(h[i], free) >= 0);
+		double const angle = i * this->sectorAngle;
+		bool const inside = ((DoubleCompare(DeltaAngle(angle, phiRight)) <= 0)
+			&& (DoubleCompare(DeltaAngle(angle, heading)) >= 0))
+			|| ((DoubleCompare(DeltaAngle(angle, phiLeft)) >= 0)
+			&& (DoubleCompare(DeltaAngle(angle, heading)) <= 0));
+		h[i] = (!blocked && inside) ? 0 : 1;
+	}
+}
+/** @return true when an obstacle is inside r of (x, y), in meters */
+bool VfhStar::collides(double const x, double const y, double const r) const
+{
+	for (auto const& cell: this->occupiedCells) {
+		if (DoubleCompare(::hypot(cell.first - x, cell.second - y), r) < 0) {
+			return true;
+		}
+	}
+	return false;
+}
+/**
+ * @brief expand the look-ahead nodes on a pool's threads, a batch of the
+ * cheapest open ones at a time
+ * @param pool nullptr to search on the updating thread alone
+ */
+void VfhStar::setSearchPool(VfhWorkPool* const pool)
+{
+	this->searchPool = pool;
+	this->reserveSearch();
+}
+/**
+ * @brief the robot's motion since the last update, as odometry measured
+ * it, for the next update to carry the search over
+ * @param forward in meters, along the heading at the last update
+ * @param left in meters
+ * @param turn radians, anti-clockwise
+ */
+void VfhStar::setOdometry(
+	double const forward, double const left, double const turn)
+{
+	this->odometryForward = forward;
+	this->odometryLeft = left;
+	this->odometryTurn = turn;
+	this->odometryGiven = true;
+}
+/** @brief size the search scratch for searchPool */
+void VfhStar::reserveSearch()
+{
+	int const threads = this->searchPool ? this->searchPool->size() : 1;
+	/* twice the threads, so that stealing evens out unequal expansions */
+	size_t const width = (threads > 1) ? (2 * threads) : 1;
+	int const size = std::max(0, this->histogramSize);
+	this->searchScratch.resize(threads);
+	for (auto& s: this->searchScratch) {
+		s.histogram.assign(size, 0);
+		s.angles.reserve(size * 2);
+		s.speeds.reserve(size * 2);
+		s.borders.reserve(size);
+	}
+	this->batch.reserve(width);
+	this->batchExpanded.assign(width, 0);
+	this->batchEntry.assign(width, nullptr);
+	this->batchChildren.resize(width);
+	for (auto& c: this->batchChildren) {
+		c.reserve(size * 2);
+	}
+}
+/**
+ * @brief sample hardware counters around update() and its stages,
+ * reported by stats(), costs a syscall per stage boundary
+ * @note call from the thread that runs update()
+ * @return false when perf events are unavailable, or the library was
+ * built without YUIWONGVFHIMPL_STATS
+ */
+bool VfhStar::enablePerfCounters()
+{
+#ifdef YUIWONGVFHIMPL_STATS
+	std::unique_ptr<VfhPerfProbe> probe(new VfhPerfProbe());
+	if (!probe->open()) {
+		return false;
+	}
+	this->stageStats.setPerfProbe(probe.get());
+	this->perfProbe = std::move(probe);
+	return true;
+#else
+	return false;
+#endif
+}
+void VfhStar::disablePerfCounters()
+{
+	this->stageStats.setPerfProbe(nullptr);
+	this->perfProbe.reset();
+}
+/**
+ * @brief publish the outcome of this update to readSnapshot
+ * @param stamp as given to update, in seconds
+ * @param chosenLinearX the chosen linear x velocity, in meter/s
+ * @param chosenAngularZ the chosen turn rate, in radian/s
+ */
+void VfhStar::publishSnapshot(
+	double const stamp,
+	double const chosenLinearX,
+	double const chosenAngularZ)
+{
+	this->snapshotFrames.publish([&](
+		VfhSnapshot::Header& header, uint8_t* histogram, uint8_t* cells) {
+		header.stamp = stamp;
+		header.pickedDirection = this->pickedDirection - HPi;
+		header.maxSpeed = this->maxSpeedForPickedDirection;
+		header.chosenLinearX = chosenLinearX;
+		header.chosenAngularZ = chosenAngularZ;
+		header.blockedCircleRadius = this->blockedCircleRadius;
+		for (int i = 0; i < this->histogramSize; ++i) {
+			histogram[i] = (DoubleCompare(this->histogram[i]) != 0) ? 1 : 0;
+		}
+		int const n = this->windowDiameter;
+		for (int x = 0; x < n; ++x) {
+			std::vector<double> const& column = this->cellMag[x];
+			for (int y = 0; y < n; ++y) {
+				cells[(y * n) + x] = (DoubleCompare(column[y]) != 0) ? 1 : 0;
+			}
+		}
+	});
 }
 /**
  * @brief the robot going too fast, such does it overshoot before it can
@@ -765,7 +1996,7 @@ void VfhStar::setMotion(
 		turnrate = mx;
 	} else {
 		double const tmp = DegreeToRadian(75);
-		turnrate = ::rint(((this->pickedDirection - HPi) / tmp) * mx);
+		turnrate = ((this->pickedDirection - HPi) / tmp) * mx;
 		if (DoubleCompare(::fabs(turnrate), mx) > 0) {
 			turnrate = ::copysign(mx, turnrate);
 		}
@@ -778,7 +2009,7 @@ void VfhStar::setMotion(
  */
 int VfhStar::getSpeedIndex(double const speed) const
 {
-	int idx = ::floor(((speed * 1e3) / this->currentMaxSpeed)
+	int idx = ::floor((speed / this->currentMaxSpeed)
 		* this->cellSectorTablesCount);
 	if (idx >= this->cellSectorTablesCount) {
 		idx = this->cellSectorTablesCount - 1;
@@ -794,7 +2025,7 @@ int VfhStar::getMinTurningRadiusIndex(double const speed) const
 	if (idx >= sz) {
 		idx = sz - 1;
 	}
-	return sz;
+	return idx;
 }
 /**
  * @brief calcualte the cells magnitude
@@ -805,6 +2036,7 @@ int VfhStar::getMinTurningRadiusIndex(double const speed) const
 bool VfhStar::calculateCellsMagnitude(
 	std::array<double, 361> const& laserRanges, double const speed)
 {
+	YUIWONGVFHSTAGE(this->stageStats, this->tracer, StageCellsMagnitude);
 	double const safeSpeed = this->getSafetyDistance(speed);
 	double const r = this->robotRadius + safeSpeed;
 	// AB: This is a bit dodgy... Makes it possible to miss really skinny obstacles, since if the
@@ -814,14 +2046,19 @@ bool VfhStar::calculateCellsMagnitude(
 	for (int x = 0; x < this->windowDiameter; ++x) {
 		int const n = ::ceil(this->windowDiameter / 2.0);
 		for (int y = 0; y < n; ++y) {
+			if ((x == this->centerX) && (y == this->centerY)) {
+				/* the robot's own cell, it has no direction */
+				this->cellMag[x][y] = 0.0;
+				continue;
+			}
 			// controllo se il laser passa attraverso la cella
+			// laserRanges go two per degree, in mm
 			int const idx = static_cast<int>(::rint(
-				this->cellDirection[x][y] * 2.0));
+				RadianToDegree(this->cellDirection[x][y]) * 2.0));
 			if (DoubleCompare(
-				this->cellDistance[x][y] + (this->cellWidth / 2.0),
+				(this->cellDistance[x][y] + (this->cellWidth / 2.0)) * 1e3,
 				laserRanges[idx]) > 0) {
-				if ((DoubleCompare(this->cellDistance[x][y], r) < 0)
-					&& !((x == this->centerX) && (y == this->centerY))) {
+				if (DoubleCompare(this->cellDistance[x][y], r) < 0) {
 					// Damn, something got inside our safety_distance...
 					// Short-circuit this process.
 					return false;
@@ -869,6 +2106,7 @@ void VfhStar::selectCandidateAngle()
 		 * we're hemmed in by obstacles -- nowhere to go,
 		 * so brake hard and turn on the spot.
 		 */
+		YUIWONGVFHEVENT(this->stageStats, EventHemmedIn, 1);
 		this->pickedDirection = this->lastPickedDirection;
 		this->maxSpeedForPickedDirection = 0;
 		this->lastPickedDirection = this->pickedDirection;
@@ -876,7 +2114,8 @@ void VfhStar::selectCandidateAngle()
 	}
 	this->pickedDirection = HPi;
 	double minweight = std::numeric_limits<double>::max();
-	for (auto const& ca: this->candidateAngle) {
+	for (size_t i = 0; i < this->candidateAngle.size(); ++i) {
+		double const ca = this->candidateAngle[i];
 		double const weight = this->desiredDirectionWeight * ::fabs(
 			DeltaAngle(this->desiredDirection, ca))
 			+ this->currentDirectionWeight * ::fabs(DeltaAngle(
@@ -884,7 +2123,7 @@ void VfhStar::selectCandidateAngle()
 		if (DoubleCompare(weight, minweight) < 0) {
 			minweight = weight;
 			this->pickedDirection = ca;
-			this->maxSpeedForPickedDirection = ca;
+			this->maxSpeedForPickedDirection = this->candidateSpeed[i];
 		}
 	}
 	this->lastPickedDirection = this->pickedDirection;
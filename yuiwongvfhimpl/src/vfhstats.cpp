@@ -0,0 +1,165 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhstats.hpp"
+#include <algorithm>
+#include <chrono>
+namespace yuiwong
+{
+namespace
+{
+double CalibrateTicks()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+	/* spin 10 ms, enough for a 0.1% estimate */
+	auto const t0 = std::chrono::steady_clock::now();
+	uint64_t const c0 = VfhTicks();
+	std::chrono::steady_clock::time_point t1;
+	do {
+		t1 = std::chrono::steady_clock::now();
+	} while ((t1 - t0) < std::chrono::milliseconds(10));
+	uint64_t const c1 = VfhTicks();
+	double const ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+	return (c1 - c0) / ns;
+#else
+	return 1.0;
+#endif
+}
+}
+/** @brief VfhTicks per nanosecond, calibrated once against the clock */
+double VfhTicksPerNanosecond()
+{
+	static double const ticksPerNs = CalibrateTicks();
+	return ticksPerNs;
+}
+VfhTickHistogram::VfhTickHistogram()
+{
+	for (auto& c: this->counts) {
+		c.store(0, std::memory_order_relaxed);
+	}
+	this->sum.store(0, std::memory_order_relaxed);
+	this->max.store(0, std::memory_order_relaxed);
+}
+/** @brief the smallest value of a bucket */
+uint64_t VfhTickHistogram::bucketLow(int const bucket)
+{
+	if (bucket < (1 << SubBits)) {
+		return bucket;
+	}
+	int const msb = (bucket >> SubBits) + SubBits - 1;
+	uint64_t const sub = bucket & ((1 << SubBits) - 1);
+	return (static_cast<uint64_t>(1) << msb) | (sub << (msb - SubBits));
+}
+/**
+ * @brief count, mean, percentiles and maximum in nanoseconds, safe while
+ * recording
+ * percentiles are the upper edge of their bucket, capped by the maximum
+ */
+VfhStageStats VfhTickHistogram::summarize() const
+{
+	double const ticksPerNs = VfhTicksPerNanosecond();
+	uint64_t counts[Buckets];
+	uint64_t n = 0;
+	for (int b = 0; b < Buckets; ++b) {
+		counts[b] = this->counts[b].load(std::memory_order_relaxed);
+		n += counts[b];
+	}
+	uint64_t const max = this->max.load(std::memory_order_relaxed);
+	VfhStageStats st;
+	st.count = n;
+	st.meanNs = (n > 0)
+		? (this->sum.load(std::memory_order_relaxed) / ticksPerNs / n) : 0;
+	st.maxNs = max / ticksPerNs;
+	double* const out[3] = { &st.p50Ns, &st.p99Ns, &st.p999Ns };
+	double const q[3] = { 0.5, 0.99, 0.999 };
+	for (int k = 0; k < 3; ++k) {
+		uint64_t const rank = static_cast<uint64_t>(q[k] * n);
+		uint64_t seen = 0;
+		*out[k] = 0;
+		for (int b = 0; b < Buckets; ++b) {
+			seen += counts[b];
+			if ((seen > rank) && (counts[b] > 0)) {
+				uint64_t const high = (b + 1 < Buckets)
+					? (bucketLow(b + 1) - 1) : max;
+				*out[k] = std::min(high, max) / ticksPerNs;
+				break;
+			}
+		}
+	}
+	return st;
+}
+char const* VfhStats::eventName(Event const event)
+{
+	switch (event) {
+	case EventSafetyShortCircuit: return "safetyShortCircuit";
+	case EventHemmedIn: return "hemmedIn";
+	case EventNoObstacle: return "noObstacle";
+	case EventHysteresisHold: return "hysteresisHold";
+	case EventCellsReused: return "cellsReused";
+	case EventHistogramsReused: return "histogramsReused";
+	case EventCoarseEnter: return "coarseEnter";
+	case EventCoarseExit: return "coarseExit";
+	case EventCoarseUpdate: return "coarseUpdate";
+	case EventLookAheadNodes: return "lookAheadNodes";
+	case EventLookAheadFallback: return "lookAheadFallback";
+	case EventLookAheadDeadline: return "lookAheadDeadline";
+	case EventTranspositionHit: return "transpositionHit";
+	case EventTranspositionMiss: return "transpositionMiss";
+	case EventRerootKept: return "rerootKept";
+	case EventRerootInvalidated: return "rerootInvalidated";
+	case EventSpeedBandSlower: return "speedBandSlower";
+	default: return "unknown";
+	}
+}
+VfhStats::VfhStats(): probe(nullptr)
+{
+	for (auto& e: this->events) {
+		e.store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < StageCount; ++i) {
+		for (auto& t: this->perfTotals[i]) {
+			t.store(0, std::memory_order_relaxed);
+		}
+		this->perfSamples[i].store(0, std::memory_order_relaxed);
+	}
+}
+/** @brief a consistent enough copy, safe while the planner updates */
+VfhStats::Snapshot VfhStats::snapshot() const
+{
+	Snapshot s;
+#ifdef YUIWONGVFHIMPL_STATS
+	s.enabled = true;
+#else
+	s.enabled = false;
+#endif
+	for (int i = 0; i < StageCount; ++i) {
+		s.stages[i] = this->histograms[i].summarize();
+	}
+	for (int i = 0; i < EventCount; ++i) {
+		s.events[i] = this->events[i].load(std::memory_order_relaxed);
+	}
+	VfhPerfProbe const* const probe = this->perfProbe();
+	s.perfAvailable = (probe != nullptr) ? probe->available() : 0;
+	for (int i = 0; i < StageCount; ++i) {
+		VfhStagePerf& p = s.perf[i];
+		p.samples = this->perfSamples[i].load(std::memory_order_relaxed);
+		for (int k = 0; k < VfhPerfProbe::CounterCount; ++k) {
+			p.mean[k] = (p.samples > 0) ? (static_cast<double>(
+				this->perfTotals[i][k].load(std::memory_order_relaxed))
+				/ p.samples) : 0;
+		}
+	}
+	return s;
+}
+}
@@ -0,0 +1,147 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhtrace.hpp"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <chrono>
+namespace yuiwong
+{
+/** @brief the kernel thread id of the caller, cached per thread */
+uint32_t VfhTraceThreadId()
+{
+	static thread_local uint32_t const tid = ::syscall(SYS_gettid);
+	return tid;
+}
+/** @param capacity events in the ring, rounded up to a power of two */
+VfhTracer::VfhTracer(size_t const capacity):
+	mask(0),
+	head(0),
+	tail(0),
+	droppedEvents(0),
+	running(false),
+	file(nullptr),
+	firstEvent(true),
+	originTicks(0)
+{
+	size_t n = 2;
+	while (n < capacity) {
+		n <<= 1;
+	}
+	this->slots.reset(new Slot[n]);
+	for (size_t i = 0; i < n; ++i) {
+		this->slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	this->mask = n - 1;
+}
+VfhTracer::~VfhTracer()
+{
+	this->stop();
+}
+/**
+ * @brief start the flusher thread writing to path
+ * @param periodMs how often the ring is drained
+ * @return false when the file cannot be created or already started
+ */
+bool VfhTracer::start(std::string const& path, int const periodMs)
+{
+	if (this->file != nullptr) {
+		return false;
+	}
+	this->file = ::fopen(path.c_str(), "w");
+	if (this->file == nullptr) {
+		return false;
+	}
+	/* the JSON array format, a missing "]" after a crash is tolerated */
+	::fputs("[\n", this->file);
+	this->firstEvent = true;
+	this->originTicks = VfhTicks();
+	this->running = true;
+	this->flusher = std::thread(&VfhTracer::run, this, periodMs);
+	return true;
+}
+/** @brief drain what is left, close the file and join the flusher */
+void VfhTracer::stop()
+{
+	if (this->file == nullptr) {
+		return;
+	}
+	{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->running = false;
+	}
+	this->wakeup.notify_all();
+	this->flusher.join();
+	this->flush();
+	::fputs("\n]\n", this->file);
+	::fclose(this->file);
+	this->file = nullptr;
+}
+/**
+ * @brief move the recorded events to out, single consumer: not while
+ * the flusher runs
+ * @return events moved
+ */
+size_t VfhTracer::drain(std::vector<VfhTraceEvent>& out)
+{
+	size_t n = 0;
+	for (;;) {
+		Slot& slot = this->slots[this->tail & this->mask];
+		if (slot.sequence.load(std::memory_order_acquire) != (this->tail + 1)) {
+			return n;
+		}
+		out.push_back(slot.event);
+		/* free for the producer one lap ahead */
+		slot.sequence.store(
+			this->tail + this->mask + 1, std::memory_order_release);
+		++this->tail;
+		++n;
+	}
+}
+void VfhTracer::flush()
+{
+	this->pending.clear();
+	this->drain(this->pending);
+	double const ticksPerUs = VfhTicksPerNanosecond() * 1e3;
+	int const pid = ::getpid();
+	for (auto const& e: this->pending) {
+		/* ticks read before start() clamp to the origin */
+		double const us = (e.ticks > this->originTicks)
+			? ((e.ticks - this->originTicks) / ticksPerUs) : 0.0;
+		::fprintf(
+			this->file,
+			"%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3lf, "
+			"\"pid\": %d, \"tid\": %u%s}",
+			this->firstEvent ? "" : ",\n",
+			e.name,
+			e.phase,
+			us,
+			pid,
+			e.tid,
+			(e.phase == 'i') ? ", \"s\": \"t\"" : "");
+		this->firstEvent = false;
+	}
+	::fflush(this->file);
+}
+void VfhTracer::run(int const periodMs)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (this->running) {
+		this->wakeup.wait_for(lock, std::chrono::milliseconds(periodMs));
+		lock.unlock();
+		this->flush();
+		lock.lock();
+	}
+}
+}
@@ -0,0 +1,210 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+#include "yuiwong/vfhworkpool.hpp"
+#include <algorithm>
+#include "yuiwong/vfhmailbox.hpp"
+namespace yuiwong
+{
+namespace
+{
+/* the most tasks a range word holds */
+uint32_t constexpr MaxBatch = 0xffff;
+inline uint64_t Range(
+	uint32_t const batch, uint32_t const begin, uint32_t const end)
+{
+	return (static_cast<uint64_t>(batch) << 32)
+		| (static_cast<uint64_t>(end) << 16) | begin;
+}
+inline uint32_t Batch(uint64_t const range)
+{
+	return static_cast<uint32_t>(range >> 32);
+}
+inline uint32_t Begin(uint64_t const range)
+{
+	return static_cast<uint32_t>(range & 0xffff);
+}
+inline uint32_t End(uint64_t const range)
+{
+	return static_cast<uint32_t>((range >> 16) & 0xffff);
+}
+}
+VfhWorkPool::VfhWorkPool(int const threads):
+	threads(std::max(1, threads)),
+	queues(new Queue[std::max(1, threads)]),
+	fn(nullptr),
+	context(nullptr),
+	base(0),
+	generation(0),
+	stopping(false),
+	remaining(0),
+	waiting(0)
+{
+	for (int t = 0; t < this->threads; ++t) {
+		this->queues[t].range.store(0, std::memory_order_relaxed);
+	}
+	for (int t = 1; t < this->threads; ++t) {
+		this->workers.emplace_back(&VfhWorkPool::loop, this, t);
+	}
+}
+VfhWorkPool::~VfhWorkPool()
+{
+	this->stopping.store(true, std::memory_order_relaxed);
+	this->generation.fetch_add(1, std::memory_order_release);
+	VfhFutexWake(this->generation, this->threads);
+	for (auto& w: this->workers) {
+		w.join();
+	}
+}
+/**
+ * @brief call fn(context, task, thread) for every task in [0, n), return
+ * once all returned
+ */
+void VfhWorkPool::run(
+	uint32_t const n,
+	void (*fn)(void*, uint32_t, int),
+	void* const context)
+{
+	if (n == 0) {
+		return;
+	}
+	if ((this->threads == 1) || (n == 1)) {
+		for (uint32_t i = 0; i < n; ++i) {
+			fn(context, i, 0);
+		}
+		return;
+	}
+	this->fn.store(fn, std::memory_order_relaxed);
+	this->context.store(context, std::memory_order_relaxed);
+	for (uint32_t base = 0; base < n; base += MaxBatch) {
+		this->runBatch(base, std::min(n - base, MaxBatch));
+	}
+}
+/** @brief one batch of at most MaxBatch tasks, base + [0, n) */
+void VfhWorkPool::runBatch(uint32_t const base, uint32_t const n)
+{
+	this->base.store(base, std::memory_order_relaxed);
+	this->remaining.store(n, std::memory_order_relaxed);
+	/* the ranges of this batch, generation is only changed here */
+	uint32_t const batch =
+		this->generation.load(std::memory_order_relaxed) + 1;
+	/* release: a thread that takes a task sees fn and context */
+	for (int t = 0; t < this->threads; ++t) {
+		uint64_t const begin = (static_cast<uint64_t>(n) * t) / this->threads;
+		uint64_t const end =
+			(static_cast<uint64_t>(n) * (t + 1)) / this->threads;
+		this->queues[t].range.store(
+			Range(batch, begin, end), std::memory_order_release);
+	}
+	this->generation.fetch_add(1, std::memory_order_release);
+	VfhFutexWake(this->generation, this->threads - 1);
+	this->work(0);
+	for (;;) {
+		uint32_t const left = this->remaining.load(std::memory_order_acquire);
+		if (left == 0) {
+			return;
+		}
+		/* seq_cst pairs with the last task's check of waiting */
+		this->waiting.store(1, std::memory_order_seq_cst);
+		if (this->remaining.load(std::memory_order_seq_cst) != 0) {
+			VfhFutexWait(this->remaining, left, -1);
+		}
+		this->waiting.store(0, std::memory_order_relaxed);
+	}
+}
+void VfhWorkPool::loop(int const thread)
+{
+	uint32_t seen = 0;
+	for (;;) {
+		uint32_t g = this->generation.load(std::memory_order_acquire);
+		while (g == seen) {
+			VfhFutexWait(this->generation, seen, -1);
+			g = this->generation.load(std::memory_order_acquire);
+		}
+		seen = g;
+		if (this->stopping.load(std::memory_order_relaxed)) {
+			return;
+		}
+		this->work(thread);
+	}
+}
+/** @brief run tasks, own then stolen ones, until there are none */
+void VfhWorkPool::work(int const thread)
+{
+	uint32_t task;
+	while (this->next(thread, task)) {
+		this->runTask(thread, task);
+	}
+}
+void VfhWorkPool::runTask(int const thread, uint32_t const task)
+{
+	this->fn.load(std::memory_order_relaxed)(
+		this->context.load(std::memory_order_relaxed),
+		this->base.load(std::memory_order_relaxed) + task,
+		thread);
+	if (this->remaining.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+		if (this->waiting.load(std::memory_order_seq_cst) != 0) {
+			VfhFutexWake(this->remaining, 1);
+		}
+	}
+}
+bool VfhWorkPool::next(int const thread, uint32_t& task)
+{
+	Queue& own = this->queues[thread];
+	uint64_t r = own.range.load(std::memory_order_acquire);
+	while (Begin(r) < End(r)) {
+		if (own.range.compare_exchange_weak(
+			r,
+			Range(Batch(r), Begin(r) + 1, End(r)),
+			std::memory_order_acq_rel,
+			std::memory_order_acquire)) {
+			task = Begin(r);
+			return true;
+		}
+	}
+	/*
+	 * own range empty, so no thief touches it: steal the back half of
+	 * another's in the same batch, run its first task and keep the rest.
+	 * a range of a later batch is left to its own thread, which must
+	 * find this one's empty before run can start another batch
+	 */
+	for (int k = 1; k < this->threads; ++k) {
+		Queue& victim = this->queues[(thread + k) % this->threads];
+		uint64_t v = victim.range.load(std::memory_order_acquire);
+		while ((Batch(v) == Batch(r)) && (Begin(v) < End(v))) {
+			uint32_t const middle = End(v) - ((End(v) - Begin(v) + 1) / 2);
+			if (victim.range.compare_exchange_weak(
+				v,
+				Range(Batch(v), Begin(v), middle),
+				std::memory_order_acq_rel,
+				std::memory_order_acquire)) {
+				/*
+				 * the batch cannot end while the stolen tasks are not run,
+				 * so run has not replaced the empty range r
+				 */
+				uint64_t const rest = Range(Batch(v), middle + 1, End(v));
+				if (!own.range.compare_exchange_strong(
+					r, rest, std::memory_order_acq_rel)) {
+					for (uint32_t t = middle + 1; t < End(v); ++t) {
+						this->runTask(thread, t);
+					}
+				}
+				task = middle;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+}
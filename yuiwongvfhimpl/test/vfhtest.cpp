@@ -0,0 +1,578 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * regression tests of VfhPlus and VfhStar, run by ctest.
+ * the scans are synthetic with a fixed seed. prints what failed to stderr
+ * and exits non zero when anything did.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+#include "yuiwong/vfhplus.hpp"
+#include "yuiwong/vfhstar.hpp"
+#include "yuiwong/vfhworkpool.hpp"
+namespace yuiwong
+{
+namespace
+{
+typedef std::array<double, 361> Ranges;
+double Uniform(std::mt19937& rng, double const lo, double const hi)
+{
+	return lo + ((hi - lo) * (rng() / 4294967296.0));
+}
+/**
+ * @brief a scan at a random distance with a few blobs in front of it,
+ * by default all beyond the enlargement of any speed
+ * @param nearest mm, the closest a blob may be
+ */
+Ranges MakeScan(std::mt19937& rng, double const nearest = 600)
+{
+	Ranges ranges;
+	ranges.fill(Uniform(rng, 600, 4000));
+	for (int k = 0; k < 6; ++k) {
+		int const center = static_cast<int>(Uniform(rng, 0, 361));
+		int const halfWidth = static_cast<int>(Uniform(rng, 2, 22));
+		double const distance = Uniform(rng, nearest, 4000);
+		int const lo = std::max(0, center - halfWidth);
+		int const hi = std::min(360, center + halfWidth);
+		for (int i = lo; i <= hi; ++i) {
+			ranges[i] = std::min(ranges[i], distance);
+		}
+	}
+	return ranges;
+}
+/**
+ * @brief whether the closed sector [lo, hi] and the closed arc [a, b]
+ * meet on the circle, all in radians
+ */
+bool Meets(double const lo, double const hi, double const a, double const b)
+{
+	for (int k = -1; k <= 1; ++k) {
+		double const shift = k * 2.0 * M_PI;
+		if ((lo + shift <= b + 1e-9) && (hi + shift >= a - 1e-9)) {
+			return true;
+		}
+	}
+	return false;
+}
+}
+struct VfhTest {
+	/**
+	 * @brief the same planner in both: VfhPlus in mm and degrees, VfhStar
+	 * in m and radians
+	 * @param tables 1 for equal safety distances, else 20 cell sector
+	 * tables
+	 */
+	static VfhPlus::Param PlusParam(int const tables)
+	{
+		VfhPlus::Param p;
+		p.cell_size = 100;
+		p.window_diameter = 60;
+		p.sector_angle = 5;
+		p.safety_dist_0ms = 10;
+		p.safety_dist_1ms = (tables > 1) ? 300 : 10;
+		p.max_speed = 400;
+		p.max_speed_narrow_opening = 50;
+		p.max_speed_wide_opening = 400;
+		p.max_acceleration = 100;
+		p.min_turnrate = 40;
+		p.max_turnrate_0ms = 80;
+		p.max_turnrate_1ms = 40;
+		p.min_turn_radius_safety_factor = 1.0;
+		p.free_space_cutoff_0ms = 4e6;
+		p.obs_cutoff_0ms = 4e6;
+		p.free_space_cutoff_1ms = 2e6;
+		p.obs_cutoff_1ms = 2e6;
+		p.weight_desired_dir = 5.0;
+		p.weight_current_dir = 1.0;
+		return p;
+	}
+	static VfhStar::Param StarParam(int const tables)
+	{
+		VfhStar::Param p;
+		p.cellWidth = 0.1;
+		p.windowDiameter = 60;
+		p.sectorAngle = 5 * M_PI / 180.0;
+		p.maxSpeed = 0.4;
+		p.zeroSafetyDistance = 0.01;
+		p.maxSafetyDistance = (tables > 1) ? 0.3 : 0.01;
+		p.robotRadius = 0.2;
+		return p;
+	}
+	/**
+	 * @brief every cell's arc in VfhStar's cellSector against the sectors
+	 * its enlarged direction meets, worked out one by one
+	 * @return failures
+	 */
+	static int cellSectorArcs(int const tables)
+	{
+		VfhStar star(StarParam(tables));
+		star.init();
+		int failures = 0;
+		if (star.cellSectorTablesCount != tables) {
+			fprintf(stderr, "cellSectorArcs: %d tables, expected %d\n",
+				star.cellSectorTablesCount, tables);
+			return 1;
+		}
+		int const w = star.windowDiameter;
+		int const n = star.histogramSize;
+		for (int t = 0; t < tables; ++t) {
+			double const speed = ((t + 1.0) / tables) * star.maxSpeed;
+			double const r = star.robotRadius + star.getSafetyDistance(speed);
+			for (int x = 0; x < w; ++x) {
+				for (int y = 0; y < w; ++y) {
+					double const d = star.cellDistance[x][y];
+					double const e = (d > 0)
+						? ::asin(std::min(1.0, r / d)) : 0.0;
+					double const dir = star.cellDirection[x][y];
+					std::vector<char> covered(n, 0);
+					for (int i = 0; i < n; ++i) {
+						covered[i] = Meets(
+							i * star.sectorAngle,
+							(i + 1) * star.sectorAngle,
+							dir - e,
+							dir + e) ? 1 : 0;
+					}
+					std::pair<int, int> expected(0, 0);
+					for (int i = 0; i < n; ++i) {
+						if (covered[i] != 0) {
+							++expected.second;
+							if (covered[(i + n - 1) % n] == 0) {
+								expected.first = i;
+							}
+						}
+					}
+					std::pair<int, int> const& arc =
+						star.cellSector[(t * w * w) + (w * x) + y];
+					if ((arc != expected) && (failures++ < 5)) {
+						fprintf(stderr, "cellSectorArcs: table %d cell "
+							"(%d, %d) arc (%d, %d), expected (%d, %d)\n",
+							t, x, y, arc.first, arc.second,
+							expected.first, expected.second);
+					}
+				}
+			}
+		}
+		return failures;
+	}
+	/* where VfhPlus's approximations may move a cell, see slackOf */
+	struct Slack {
+		bool rangeIndex;/* it may read the laser range next to VfhStar's */
+		int sectors[2];/* the sector past each arc end it may reach, or -1 */
+	};
+	/**
+	 * @brief where VfhPlus may put a cell differently from VfhStar:
+	 * VfhPlus turns radians to degrees by 360 / 6.28 and truncates its
+	 * safety distance to whole mm, which moves a direction by up to 0.1
+	 * degree and an enlargement by up to 3 mm
+	 * @param r the enlargement radius of the table, meters
+	 */
+	static Slack slackOf(
+		VfhStar const& star, double const r, int const x, int const y)
+	{
+		int const n = star.histogramSize;
+		double const d = star.cellDistance[x][y];
+		double const dir = star.cellDirection[x][y];
+		double const e = ::asin(std::min(1.0, r / d));
+		double const slack = ((0.1 * M_PI / 180.0)
+			+ (3e-3 / (d * ::cos(e)))) / star.sectorAngle;
+		double const index = dir * 360.0 / M_PI;
+		Slack s;
+		s.rangeIndex = ::fabs(index - ::floor(index) - 0.5) < 0.1;
+		/* sector k - 1 ends and sector k starts at border k */
+		double const ends[2] = {
+			(dir - e) / star.sectorAngle, (dir + e) / star.sectorAngle };
+		for (int k = 0; k < 2; ++k) {
+			int const border = static_cast<int>(::rint(ends[k]));
+			s.sectors[k] = (::fabs(ends[k] - border) < slack)
+				? (((border - 1 + k) % n) + n) % n : -1;
+		}
+		return s;
+	}
+	/**
+	 * @brief a scan of single rays, each kept only when no cell it fills,
+	 * or VfhPlus may fill, is one slackOf may move
+	 */
+	static Ranges MakeCleanScan(
+		std::mt19937& rng, VfhStar const& star, double const r)
+	{
+		/* beyond the corners of the window */
+		double const far = star.windowDiameter * star.cellWidth * 1e3;
+		Ranges ranges;
+		ranges.fill(far);
+		int const w = star.windowDiameter;
+		for (int k = 0; k < 40; ++k) {
+			int const ray = static_cast<int>(Uniform(rng, 0, 361));
+			double const range = Uniform(rng, 600, 2900);
+			if (ranges[ray] < far) {
+				continue;
+			}
+			bool clean = true;
+			for (int x = 0; clean && (x < w); ++x) {
+				for (int y = 0; clean && (y < (w / 2)); ++y) {
+					double const d = star.cellDistance[x][y];
+					double const index =
+						star.cellDirection[x][y] * 360.0 / M_PI;
+					if ((d <= 0) || (::fabs(index - ray) >= 0.6)
+						|| (((d + (star.cellWidth / 2.0)) * 1e3) <= range)) {
+						continue;
+					}
+					Slack const s = slackOf(star, r, x, y);
+					clean = !s.rangeIndex && (s.sectors[0] < 0)
+						&& (s.sectors[1] < 0);
+				}
+			}
+			if (clean) {
+				ranges[ray] = range;
+			}
+		}
+		return ranges;
+	}
+	/**
+	 * @brief VfhStar's primary histogram against VfhPlus's on the same
+	 * scans.
+	 * a cell may fill in one and not the other only when slackOf says it
+	 * may read another laser range, then it adds to all its sectors; a
+	 * cell filled in both may add to the one sector past an arc end slackOf
+	 * says it may reach. any other difference fails
+	 * @param clean on MakeCleanScan scans, which must agree exactly
+	 * @return failures
+	 */
+	static int primaryHistogram(int const tables, bool const clean)
+	{
+		VfhPlus plus(PlusParam(tables));
+		plus.setRobotRadius(200);
+		plus.init();
+		VfhStar star(StarParam(tables));
+		star.init();
+		if ((plus.NUM_CELL_SECTOR_TABLES != tables)
+			|| (star.cellSectorTablesCount != tables)
+			|| (plus.HIST_SIZE != star.histogramSize)) {
+			fprintf(stderr, "primaryHistogram: tables %d and %d, "
+				"sectors %d and %d, expected %d tables\n",
+				plus.NUM_CELL_SECTOR_TABLES, star.cellSectorTablesCount,
+				plus.HIST_SIZE, star.histogramSize, tables);
+			return 1;
+		}
+		std::mt19937 rng(47);
+		int const w = star.windowDiameter;
+		int const n = star.histogramSize;
+		int failures = 0;
+		for (int frame = 0; frame < 200; ++frame) {
+			/* mid table, so mm/s and m/s pick the same one */
+			int const table = static_cast<int>(Uniform(rng, 0, tables));
+			int const speed = static_cast<int>(
+				((table + 0.5) / tables) * plus.MAX_SPEED);
+			double const tableSpeed = ((table + 1.0) / tables) * star.maxSpeed;
+			double const r = star.robotRadius
+				+ star.getSafetyDistance(tableSpeed);
+			Ranges const ranges = clean
+				? MakeCleanScan(rng, star, r) : MakeScan(rng);
+			bool const plusBuilt =
+				plus.buildPrimaryPolarHistogram(ranges, speed) != 0;
+			bool const starBuilt =
+				star.buildPrimaryPolarHistogram(ranges, speed * 1e-3);
+			if (!plusBuilt || !starBuilt) {
+				fprintf(stderr, "primaryHistogram: frame %d short "
+					"circuited, VfhPlus %d VfhStar %d\n",
+					frame, plusBuilt, starBuilt);
+				++failures;
+				continue;
+			}
+			/* the magnitude each sector may differ by */
+			std::vector<double> tolerance(n, 0.0);
+			for (int x = 0; x < w; ++x) {
+				for (int y = 0; y < (w / 2); ++y) {
+					bool const plusFull = plus.Cell_Mag[x][y] != 0;
+					bool const starFull = star.cellMag[x][y] != 0;
+					if ((!plusFull && !starFull)
+						|| (star.cellDistance[x][y] <= 0)) {
+						continue;
+					}
+					Slack const s = slackOf(star, r, x, y);
+					double const mag = star.cellBaseMag[x][y];
+					if (plusFull != starFull) {
+						if (!s.rangeIndex) {
+							if (failures++ < 5) {
+								fprintf(stderr, "primaryHistogram: frame %d "
+									"cell (%d, %d) full in one only\n",
+									frame, x, y);
+							}
+							continue;
+						}
+						std::pair<int, int> const& arc =
+							star.cellSector[(table * w * w) + (w * x) + y];
+						for (int k = 0; k < arc.second; ++k) {
+							tolerance[(arc.first + k) % n] += mag;
+						}
+					}
+					for (int k = 0; k < 2; ++k) {
+						if (s.sectors[k] >= 0) {
+							tolerance[s.sectors[k]] += mag;
+						}
+					}
+				}
+			}
+			for (int i = 0; i < n; ++i) {
+				double const delta = ::fabs(plus.Hist[i] - star.histogram[i]);
+				double const allowed = (clean ? 0.0 : tolerance[i])
+					+ (1e-9 * ::fabs(plus.Hist[i]));
+				if ((delta > allowed) && (failures++ < 5)) {
+					fprintf(stderr, "primaryHistogram: %d tables frame %d "
+						"speed %d sector %d VfhPlus %f VfhStar %f\n",
+						tables, frame, speed, i, plus.Hist[i],
+						star.histogram[i]);
+				}
+			}
+		}
+		return failures;
+	}
+	/**
+	 * @brief VfhPlus's sector scoring picks the goal direction only
+	 * between two open sectors: not in a blocked sector whose upper
+	 * neighbour is open
+	 * @return failures
+	 */
+	static int goalSector()
+	{
+		VfhPlus plus(PlusParam(1));
+		plus.setRobotRadius(200);
+		plus.setSectorScoring(true);
+		plus.init();
+		/* open from 15 to 100deg: sector 2, 10 to 15deg, is blocked */
+		for (int i = 0; i < plus.HIST_SIZE; ++i) {
+			plus.Hist[i] = ((i >= 3) && (i <= 20)) ? 0 : 1;
+		}
+		VfhPlus::SectorTable table;
+		if (!plus.findSectors(table)) {
+			fprintf(stderr, "goalSector: no sectors\n");
+			return 1;
+		}
+		int failures = 0;
+		double const goals[2][2] = { { 12.6, 15.0 }, { 17.5, 17.5 } };
+		for (int k = 0; k < 2; ++k) {
+			double picked = -1;
+			int speed = -1;
+			if (!plus.scoreSectors(
+				table, goals[k][0], 60, plus.U1, plus.U2, picked, speed)
+				|| (::fabs(picked - goals[k][1]) > 1e-9)) {
+				fprintf(stderr, "goalSector: goal %f picked %f, "
+					"expected %f\n", goals[k][0], picked, goals[k][1]);
+				++failures;
+			}
+		}
+		return failures;
+	}
+	/**
+	 * @brief each speed band's masked histogram against
+	 * buildPrimaryPolarHistogram and buildBinaryPolarHistogram at the
+	 * band's speed, then buildMaskedPolarHistogram at the faster of it and
+	 * the current speed, on a planner per band that keeps its hysteresis.
+	 * some scans come inside the safety distance of the current speed,
+	 * which must block every band and brake
+	 * @return failures
+	 */
+	static int speedBands()
+	{
+		int const count = 4;
+		VfhPlus plus(PlusParam(20));
+		plus.setRobotRadius(200);
+		plus.setSpeedBands(count);
+		plus.init();
+		std::unique_ptr<VfhPlus> reference[count];
+		for (int k = 0; k < count; ++k) {
+			reference[k].reset(new VfhPlus(PlusParam(20)));
+			reference[k]->setRobotRadius(200);
+			reference[k]->init();
+		}
+		VfhPlus current(PlusParam(20));
+		current.setRobotRadius(200);
+		current.init();
+		std::mt19937 rng(48);
+		int const n = plus.HIST_SIZE;
+		int failures = 0;
+		int braked = 0;
+		for (int frame = 0; frame < 300; ++frame) {
+			Ranges const ranges = MakeScan(rng, 250);
+			int const speed = static_cast<int>(
+				Uniform(rng, 0, plus.MAX_SPEED + 1));
+			plus.buildSpeedBandHistograms(ranges, speed);
+			plus.decideSpeedBand();
+			if (current.Calculate_Cells_Mag(ranges, speed) == 0) {
+				++braked;
+				bool all = plus.maxSpeedForPickedDirection == 0;
+				for (int k = 0; k < count; ++k) {
+					all = all && plus.bands[k].blocked;
+				}
+				if (!all && (failures++ < 5)) {
+					fprintf(stderr, "speedBands: frame %d speed %d inside "
+						"the safety distance, not braking\n", frame, speed);
+				}
+				continue;
+			}
+			for (int k = 0; k < count; ++k) {
+				VfhPlus::SpeedBand const& band = plus.bands[k];
+				VfhPlus& ref = *reference[k];
+				bool const built =
+					ref.buildPrimaryPolarHistogram(ranges, band.speed) != 0;
+				if (built == band.blocked) {
+					if (failures++ < 5) {
+						fprintf(stderr, "speedBands: frame %d band %d "
+							"blocked %d, expected %d\n",
+							frame, k, band.blocked, !built);
+					}
+					continue;
+				}
+				if (!built) {
+					continue;
+				}
+				ref.buildBinaryPolarHistogram(band.speed);
+				ref.buildMaskedPolarHistogram(std::max(band.speed, speed));
+				double const* const h = &plus.bandHist[k * n];
+				if (!std::equal(h, h + n, ref.Hist) && (failures++ < 5)) {
+					fprintf(stderr, "speedBands: frame %d band %d speed %d "
+						"masked histogram differs\n", frame, k, speed);
+				}
+			}
+		}
+		if (braked == 0) {
+			fprintf(stderr, "speedBands: no scan inside the safety "
+				"distance\n");
+			++failures;
+		}
+		return failures;
+	}
+	/**
+	 * @brief a wall 500 mm round the robot with a gap straight ahead,
+	 * which the obstacles enlarged for the fastest band narrow below the
+	 * 10deg an opening needs, and for the slowest leave wide: a slower band
+	 * drives through it
+	 * @return failures
+	 */
+	static int speedBandGap()
+	{
+		int const count = 4;
+		VfhPlus::Param param = PlusParam(20);
+		/* a sector an enlarged cell reaches is blocked */
+		param.free_space_cutoff_0ms = 1e5;
+		param.obs_cutoff_0ms = 1e5;
+		param.free_space_cutoff_1ms = 1e5;
+		param.obs_cutoff_1ms = 1e5;
+		VfhPlus plus(param);
+		plus.setRobotRadius(200);
+		plus.setSpeedBands(count);
+		plus.init();
+		Ranges ranges;
+		ranges.fill(500);
+		/* 40deg each side of ahead, 0.5deg a reading */
+		for (int i = 100; i <= 260; ++i) {
+			ranges[i] = 4000;
+		}
+		plus.desiredDirection = 90;
+		plus.buildSpeedBandHistograms(ranges, 0);
+		plus.decideSpeedBand();
+		int const n = plus.HIST_SIZE;
+		int failures = 0;
+		/* the open sectors from straight ahead, as wide as the opening */
+		int width[2] = { 0, 0 };
+		for (int b = 0; b < 2; ++b) {
+			double const* const h = &plus.bandHist[(b * (count - 1)) * n];
+			int const ahead = 90 / plus.SECTOR_ANGLE;
+			int i = ahead;
+			while ((i >= 0) && (h[i] == 0)) {
+				--i;
+			}
+			int j = ahead;
+			while ((j < n) && (h[j] == 0)) {
+				++j;
+			}
+			width[b] = (j - i - 2) * plus.SECTOR_ANGLE;
+		}
+		if ((width[0] < 10) || (width[1] >= 10)) {
+			fprintf(stderr, "speedBandGap: the gap %ddeg wide in the "
+				"slowest band, %ddeg in the fastest\n", width[0], width[1]);
+			++failures;
+		}
+		if ((plus.maskedSpeedCap >= plus.bands[count - 1].speed)
+			|| (plus.maxSpeedForPickedDirection <= 0)
+			|| (::fabs(plus.pickedDirection - 90) > 40)) {
+			fprintf(stderr, "speedBandGap: picked %f at %d mm/s in the band "
+				"of %d mm/s, expected ahead in a slower band\n",
+				plus.pickedDirection, plus.maxSpeedForPickedDirection,
+				plus.maskedSpeedCap);
+			++failures;
+		}
+		return failures;
+	}
+	/**
+	 * @brief every task of a VfhWorkPool batch runs once, over many
+	 * batches as wide as VfhStar's, so a thief that read a range in one
+	 * batch races the next, and over one too wide for a range word
+	 * @return failures
+	 */
+	static int workPool()
+	{
+		VfhWorkPool pool(4);
+		uint32_t const wide = 70000;
+		std::unique_ptr<std::atomic<uint32_t>[]> runs(
+			new std::atomic<uint32_t>[wide]);
+		auto count = [&](uint32_t const task, int) {
+			runs[task].fetch_add(1, std::memory_order_relaxed);
+		};
+		int failures = 0;
+		for (int batch = 0; batch < 20001; ++batch) {
+			uint32_t const n = (batch < 20000) ? 8 : wide;
+			for (uint32_t i = 0; i < n; ++i) {
+				runs[i].store(0, std::memory_order_relaxed);
+			}
+			pool.run(n, count);
+			for (uint32_t i = 0; i < n; ++i) {
+				uint32_t const r = runs[i].load(std::memory_order_relaxed);
+				if ((r != 1) && (failures++ < 5)) {
+					fprintf(stderr, "workPool: batch %d task %u ran %u "
+						"times\n", batch, i, r);
+				}
+			}
+		}
+		return failures;
+	}
+};
+}
+int main()
+{
+	int failures = 0;
+	failures += yuiwong::VfhTest::cellSectorArcs(1);
+	failures += yuiwong::VfhTest::cellSectorArcs(20);
+	failures += yuiwong::VfhTest::primaryHistogram(1, false);
+	failures += yuiwong::VfhTest::primaryHistogram(20, false);
+	failures += yuiwong::VfhTest::primaryHistogram(1, true);
+	failures += yuiwong::VfhTest::primaryHistogram(20, true);
+	failures += yuiwong::VfhTest::goalSector();
+	failures += yuiwong::VfhTest::speedBands();
+	failures += yuiwong::VfhTest::speedBandGap();
+	failures += yuiwong::VfhTest::workPool();
+	if (failures > 0) {
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
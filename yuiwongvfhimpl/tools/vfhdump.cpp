@@ -0,0 +1,312 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * decodes a binary grid/histogram dump (see yuiwong/vfhdump.hpp):
+ * - text: the tables as the old VfhPlus::Print_* printed them
+ * - csv: one "name,frame,stamp,x,y,value" row per cell or sector
+ * - pgm: one grey image per grid, and a bar chart per histogram, named
+ * prefix + name + ".pgm"
+ * usage: vfhdump [-f text|csv|pgm] [-n last frames] [-o prefix] dump
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "yuiwong/vfhdump.hpp"
+namespace yuiwong
+{
+namespace
+{
+enum Format {
+	FormatText,
+	FormatCsv,
+	FormatPgm,
+};
+struct Decoder {
+	VfhDumpReader const& reader;
+	Format format;
+	std::string prefix;
+	FILE* out;
+	bool ok;
+	/** @brief cell (x, y) of a grid stored [x][y] */
+	inline double cell(double const* grid, uint32_t x, uint32_t y) const {
+		return grid[(x * this->reader.header().windowDiameter) + y];
+	}
+	void grid(
+		char const* title,
+		char const* name,
+		long const frame,
+		double const stamp,
+		double const* grid) {
+		uint32_t const n = this->reader.header().windowDiameter;
+		switch (this->format) {
+		case FormatText:
+			fprintf(this->out, "\n%s:\n****************\n", title);
+			for (uint32_t y = 0; y < n; ++y) {
+				for (uint32_t x = 0; x < n; ++x) {
+					fprintf(this->out, "%1.1f\t", this->cell(grid, x, y));
+				}
+				fprintf(this->out, "\n");
+			}
+			break;
+		case FormatCsv:
+			for (uint32_t y = 0; y < n; ++y) {
+				for (uint32_t x = 0; x < n; ++x) {
+					fprintf(
+						this->out,
+						"%s,%ld,%.6lf,%u,%u,%.17g\n",
+						name,
+						frame,
+						stamp,
+						x,
+						y,
+						this->cell(grid, x, y));
+				}
+			}
+			break;
+		case FormatPgm: {
+			std::vector<double> v(grid, grid + (n * n));
+			std::vector<uint8_t> image(n * n);
+			auto const range = std::minmax_element(v.begin(), v.end());
+			double const lo = *range.first;
+			double const scale = (*range.second > lo)
+				? (255.0 / (*range.second - lo)) : 0.0;
+			for (uint32_t y = 0; y < n; ++y) {
+				for (uint32_t x = 0; x < n; ++x) {
+					image[(y * n) + x] = static_cast<uint8_t>(
+						((this->cell(grid, x, y) - lo) * scale) + 0.5);
+				}
+			}
+			this->pgm(name, frame, n, n, image);
+			break;
+		}
+		}
+	}
+	void histogram(long const frame, double const stamp, double const* hist) {
+		VfhDumpHeader const& h = this->reader.header();
+		switch (this->format) {
+		case FormatText:
+			fprintf(this->out, "Histogram:\n****************\n");
+			for (uint32_t s = 0; s < h.histogramSize; ++s) {
+				fprintf(this->out, "%u,%1.1f\n", s * h.sectorAngle, hist[s]);
+			}
+			fprintf(this->out, "\n\n");
+			break;
+		case FormatCsv:
+			for (uint32_t s = 0; s < h.histogramSize; ++s) {
+				fprintf(
+					this->out,
+					"histogram,%ld,%.6lf,%u,,%.17g\n",
+					frame,
+					stamp,
+					s * h.sectorAngle,
+					hist[s]);
+			}
+			break;
+		case FormatPgm: {
+			/* a bar per sector, anti-clockwise from the right */
+			uint32_t const height = 100;
+			double const top = *std::max_element(hist, hist + h.histogramSize);
+			std::vector<uint8_t> image(h.histogramSize * height, 0);
+			for (uint32_t s = 0; s < h.histogramSize; ++s) {
+				uint32_t const bar = (top > 0)
+					? static_cast<uint32_t>((hist[s] / top) * height) : 0;
+				for (uint32_t y = height - bar; y < height; ++y) {
+					image[(y * h.histogramSize) + s] = 255;
+				}
+			}
+			this->pgm("histogram", frame, h.histogramSize, height, image);
+			break;
+		}
+		}
+	}
+	void sectors(uint32_t const table) {
+		VfhDumpHeader const& h = this->reader.header();
+		uint32_t const n = h.windowDiameter;
+		switch (this->format) {
+		case FormatText:
+			fprintf(
+				this->out,
+				"\nCell Sectors for table %u:\n"
+				"***************************\n",
+				table);
+			for (uint32_t y = 0; y < n; ++y) {
+				for (uint32_t x = 0; x < n; ++x) {
+					char const* sep = "";
+					for (uint32_t s = 0; s < h.histogramSize; ++s) {
+						if (this->reader.sector(table, x, y, s)) {
+							fprintf(this->out, "%s%u", sep, s);
+							sep = ",";
+						}
+					}
+					fprintf(this->out, "\t\t");
+				}
+				fprintf(this->out, "\n");
+			}
+			break;
+		case FormatCsv:
+			for (uint32_t y = 0; y < n; ++y) {
+				for (uint32_t x = 0; x < n; ++x) {
+					for (uint32_t s = 0; s < h.histogramSize; ++s) {
+						if (this->reader.sector(table, x, y, s)) {
+							fprintf(
+								this->out, "sectors%u,,,%u,%u,%u\n", table, x, y, s);
+						}
+					}
+				}
+			}
+			break;
+		case FormatPgm: {
+			/* how many sectors an obstacle in the cell blocks */
+			std::vector<double> counts(n * n, 0);
+			for (uint32_t x = 0; x < n; ++x) {
+				for (uint32_t y = 0; y < n; ++y) {
+					for (uint32_t s = 0; s < h.histogramSize; ++s) {
+						counts[(x * n) + y] += this->reader.sector(table, x, y, s);
+					}
+				}
+			}
+			char name[32];
+			snprintf(name, sizeof(name), "sectors%u", table);
+			this->grid(nullptr, name, -1, 0, counts.data());
+			break;
+		}
+		}
+	}
+	void pgm(
+		char const* name,
+		long const frame,
+		uint32_t const width,
+		uint32_t const height,
+		std::vector<uint8_t> const& image) {
+		char suffix[64];
+		if (frame < 0) {
+			snprintf(suffix, sizeof(suffix), "%s.pgm", name);
+		} else {
+			snprintf(suffix, sizeof(suffix), "%06ld-%s.pgm", frame, name);
+		}
+		std::string const path = this->prefix + suffix;
+		FILE* const f = fopen(path.c_str(), "wb");
+		if (f == nullptr) {
+			fprintf(stderr, "cannot write %s\n", path.c_str());
+			this->ok = false;
+			return;
+		}
+		fprintf(f, "P5\n%u %u\n255\n", width, height);
+		if (fwrite(image.data(), 1, image.size(), f) != image.size()) {
+			this->ok = false;
+		}
+		fclose(f);
+	}
+};
+}
+}
+int main(int argc, char** argv)
+{
+	using namespace yuiwong;
+	char const* const usage =
+		"usage: %s [-f text|csv|pgm] [-n last frames] [-o prefix] dump\n";
+	Format format = FormatText;
+	long last = -1;
+	std::string prefix("");
+	int opt;
+	while ((opt = ::getopt(argc, argv, "f:n:o:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (::strcmp(optarg, "text") == 0) {
+				format = FormatText;
+			} else if (::strcmp(optarg, "csv") == 0) {
+				format = FormatCsv;
+			} else if (::strcmp(optarg, "pgm") == 0) {
+				format = FormatPgm;
+			} else {
+				fprintf(stderr, usage, argv[0]);
+				return 2;
+			}
+			break;
+		case 'n':
+			last = ::atol(optarg);
+			break;
+		case 'o':
+			prefix = optarg;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return 2;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+	VfhDumpReader reader;
+	if (!reader.open(argv[optind])) {
+		fprintf(stderr, "%s: cannot read dump %s\n", argv[0], argv[optind]);
+		return 2;
+	}
+	VfhDumpHeader const& h = reader.header();
+	Decoder d = { reader, format, prefix, stdout, true };
+	if (format == FormatText) {
+		printf(
+			"window %u cells of %1.1f mm, %u sectors of %u deg, "
+			"robot radius %1.1f mm, %zu frames\n",
+			h.windowDiameter,
+			h.cellWidth,
+			h.histogramSize,
+			h.sectorAngle,
+			h.robotRadius,
+			reader.frameCount());
+	} else if (format == FormatCsv) {
+		printf("name,frame,stamp,x,y,value\n");
+	}
+	char const* const titles[VfhDump::GridCount] = {
+		"Cell Directions", "Cell Distances", "Enlargement Angles" };
+	for (uint32_t g = 0; g < VfhDump::GridCount; ++g) {
+		VfhDump::Grid const grid = static_cast<VfhDump::Grid>(g);
+		d.grid(titles[g], VfhDump::gridName(grid), -1, 0, reader.grid(grid));
+	}
+	for (uint32_t t = 0; t < h.sectorTables; ++t) {
+		d.sectors(t);
+	}
+	size_t const count = reader.frameCount();
+	size_t const first = ((last >= 0) && (static_cast<size_t>(last) < count))
+		? (count - last) : 0;
+	for (size_t i = first; i < count; ++i) {
+		VfhDumpFrame const& f = reader.frame(i);
+		long const frame = f.sequence;
+		if (format == FormatText) {
+			printf(
+				"\nFrame %ld at %.6lf s: desired %1.1f deg, picked %1.1f deg, "
+				"max speed %1.0f mm/s, blocked circle radius %1.1f mm\n",
+				frame,
+				f.stamp,
+				f.desiredDirection,
+				f.pickedDirection,
+				f.maxSpeed,
+				f.blockedCircleRadius);
+		}
+		d.grid(
+			"Cell Magnitudes",
+			"magnitude",
+			frame,
+			f.stamp,
+			f.cellMagnitude());
+		d.histogram(frame, f.stamp, f.histogram(h.windowDiameter));
+	}
+	return d.ok ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * replays a binary scan/decision log (see yuiwong/vfhlog.hpp) through
+ * VfhPlus or VfhStar as fast as possible and diffs the outputs, bit for
+ * bit, against the recorded ones.
+ * usage: vfhreplay [-q] [-n passes] log
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include "yuiwong/vfhlog.hpp"
+namespace yuiwong
+{
+namespace
+{
+struct Result {
+	size_t frames;
+	size_t mismatches;
+	size_t histogramMismatches;
+	double seconds;
+};
+inline double const* HistogramOf(VfhPlus const& vfh) { return vfh.Hist; }
+inline double const* HistogramOf(VfhStar const& vfh)
+{
+	return vfh.getHistogram().data();
+}
+inline bool SameDouble(double const a, double const b)
+{
+	return ::memcmp(&a, &b, sizeof(a)) == 0;
+}
+template <typename Planner>
+Result Replay(VfhLogReader& reader, Planner& vfh, bool const quiet)
+{
+	Result result = { 0, 0, 0, 0 };
+	reader.rewind();
+	auto const begin = std::chrono::steady_clock::now();
+	while (VfhLogRecord const* const r = reader.next()) {
+		double chosenLinearX, chosenAngularZ;
+		vfh.update(
+			r->stamp,
+			r->ranges(),
+			r->currentLinearX,
+			r->goalDirection,
+			r->goalDistance,
+			r->goalDistanceTolerance,
+			chosenLinearX,
+			chosenAngularZ);
+		if (!SameDouble(chosenLinearX, r->chosenLinearX)
+			|| !SameDouble(chosenAngularZ, r->chosenAngularZ)) {
+			if (!quiet && (result.mismatches < 10)) {
+				printf(
+					"frame %zu stamp %.6lf: recorded %.17g %.17g, "
+					"replayed %.17g %.17g\n",
+					result.frames,
+					r->stamp,
+					r->chosenLinearX,
+					r->chosenAngularZ,
+					chosenLinearX,
+					chosenAngularZ);
+			}
+			++result.mismatches;
+		}
+		if (r->histogramSize > 0) {
+			double const* const h = HistogramOf(vfh);
+			uint8_t const* const recorded = r->histogram();
+			for (uint32_t i = 0; i < r->histogramSize; ++i) {
+				if (((h[i] != 0) ? 1 : 0) != recorded[i]) {
+					++result.histogramMismatches;
+					break;
+				}
+			}
+		}
+		++result.frames;
+	}
+	result.seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+	return result;
+}
+template <typename Planner, typename Param>
+Result ReplayPasses(
+	VfhLogReader& reader,
+	Param const& param,
+	int const passes,
+	bool const quiet)
+{
+	Result total = { 0, 0, 0, 0 };
+	for (int pass = 0; pass < passes; ++pass) {
+		/* a fresh planner per pass, so every pass starts from the same state */
+		std::unique_ptr<Planner> vfh(new Planner(param));
+		vfh->setRobotRadius(reader.header().robotRadius);
+		vfh->init();
+		Result const r = Replay(reader, *vfh, quiet || (pass > 0));
+		total.frames += r.frames;
+		total.mismatches += r.mismatches;
+		total.histogramMismatches += r.histogramMismatches;
+		total.seconds += r.seconds;
+	}
+	return total;
+}
+}
+}
+int main(int argc, char** argv)
+{
+	using namespace yuiwong;
+	bool quiet = false;
+	int passes = 1;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "qn:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = true;
+			break;
+		case 'n':
+			passes = ::atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-q] [-n passes] log\n", argv[0]);
+			return 2;
+		}
+	}
+	if ((optind >= argc) || (passes <= 0)) {
+		fprintf(stderr, "usage: %s [-q] [-n passes] log\n", argv[0]);
+		return 2;
+	}
+	VfhLogReader reader;
+	if (!reader.open(argv[optind])) {
+		fprintf(stderr, "%s: cannot read log %s\n", argv[0], argv[optind]);
+		return 2;
+	}
+	Result r;
+	if (reader.header().planner == VfhLog::PlannerVfhPlus) {
+		r = ReplayPasses<VfhPlus>(reader, reader.plusParam(), passes, quiet);
+	} else {
+		r = ReplayPasses<VfhStar>(reader, reader.starParam(), passes, quiet);
+	}
+	printf(
+		"%s: %zu frames in %.3lf s (%.0lf frames/min), "
+		"%zu output mismatches, %zu histogram mismatches\n",
+		(reader.header().planner == VfhLog::PlannerVfhPlus)
+			? "VfhPlus" : "VfhStar",
+		r.frames,
+		r.seconds,
+		(r.seconds > 0) ? (r.frames / r.seconds * 60.0) : 0.0,
+		r.mismatches,
+		r.histogramMismatches);
+	return ((r.mismatches == 0) && (r.histogramMismatches == 0)) ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * a local producer/consumer harness for vfhshmd: spawns the daemon,
+ * sends it synthetic scans at a fixed rate and measures, per command,
+ * the producer-to-command latency and the transport part of it (the
+ * latency less the planner update time the daemon reports).
+ * -p spins is passed to the daemon and used when waiting for commands.
+ * usage: vfhshmbench [-s] [-c scans] [-r rate Hz] [-p spins]
+ * [-d vfhshmd path]
+ */
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "yuiwong/vfhshm.hpp"
+extern char** environ;
+namespace yuiwong
+{
+namespace
+{
+void Report(char const* const name, std::vector<uint64_t>& ns)
+{
+	if (ns.empty()) {
+		printf("%-10s no samples\n", name);
+		return;
+	}
+	std::sort(ns.begin(), ns.end());
+	printf(
+		"%-10s p50 %8.2lf us  p99 %8.2lf us  max %8.2lf us\n",
+		name,
+		ns[ns.size() / 2] / 1e3,
+		ns[(ns.size() * 99) / 100] / 1e3,
+		ns.back() / 1e3);
+}
+/** @brief the daemon's path: as given, else next to this program */
+std::string DaemonPath(char const* const given, char const* const self)
+{
+	if (given != nullptr) {
+		return given;
+	}
+	std::string const s(self);
+	size_t const slash = s.rfind('/');
+	return ((slash == std::string::npos) ? std::string("")
+		: s.substr(0, slash + 1)) + "vfhshmd";
+}
+}
+}
+int main(int argc, char** argv)
+{
+	using namespace yuiwong;
+	char const* const usage = "usage: %s [-s] [-c scans] [-r rate Hz] "
+		"[-p spins] [-d vfhshmd path]\n";
+	bool star = false;
+	int scans = 2000;
+	double rate = 200;
+	int spins = 0;
+	char const* daemon = nullptr;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "sc:r:p:d:")) != -1) {
+		switch (opt) {
+		case 's':
+			star = true;
+			break;
+		case 'c':
+			scans = ::atoi(optarg);
+			break;
+		case 'r':
+			rate = ::atof(optarg);
+			break;
+		case 'p':
+			spins = ::atoi(optarg);
+			break;
+		case 'd':
+			daemon = optarg;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return 2;
+		}
+	}
+	if ((scans <= 0) || (rate <= 0)) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+	std::string const base = "/dev/shm/vfhshmbench-"
+		+ std::to_string(::getpid());
+	std::string const inputPath = base + "-in";
+	std::string const commandPath = base + "-out";
+	std::string const path = DaemonPath(daemon, argv[0]);
+	std::string const spinArg = std::to_string(spins);
+	std::vector<char*> args;
+	args.push_back(const_cast<char*>(path.c_str()));
+	if (star) {
+		args.push_back(const_cast<char*>("-s"));
+	}
+	args.push_back(const_cast<char*>("-p"));
+	args.push_back(const_cast<char*>(spinArg.c_str()));
+	args.push_back(const_cast<char*>(inputPath.c_str()));
+	args.push_back(const_cast<char*>(commandPath.c_str()));
+	args.push_back(nullptr);
+	pid_t pid;
+	if (::posix_spawn(
+		&pid, path.c_str(), nullptr, nullptr, args.data(), environ) != 0) {
+		fprintf(stderr, "%s: cannot spawn %s\n", argv[0], path.c_str());
+		return 2;
+	}
+	/* the daemon creates the command ring, then the input one */
+	VfhShmRing inputs;
+	VfhShmRing commands;
+	for (int i = 0; (i < 5000) && !inputs.isOpen(); ++i) {
+		if (!inputs.attach(inputPath, sizeof(VfhShmInput))) {
+			::usleep(1000);
+		}
+	}
+	if (!inputs.isOpen()
+		|| !commands.attach(commandPath, sizeof(VfhShmCommand))) {
+		fprintf(stderr, "%s: cannot attach to %s\n", argv[0], path.c_str());
+		::kill(pid, SIGTERM);
+		::waitpid(pid, nullptr, 0);
+		return 2;
+	}
+	std::unique_ptr<VfhShmInput> in(new VfhShmInput);
+	::memset(in.get(), 0, sizeof(*in));
+	in->kind = VfhShmInput::KindOdometry;
+	in->currentLinearX = 0.2;
+	in->goalDirection = 1.5707963267948966;
+	in->goalDistance = 2.0;
+	in->goalDistanceTolerance = 0.25;
+	inputs.push(*in);
+	/* a wall 2 m ahead, with a 1 m obstacle to the left of it */
+	in->kind = VfhShmInput::KindScan;
+	for (int i = 0; i < 361; ++i) {
+		in->laserRanges[i] = ((i > 200) && (i < 240)) ? 1000.0 : 2000.0;
+	}
+	std::vector<uint64_t> total;
+	std::vector<uint64_t> transport;
+	std::vector<uint64_t> plan;
+	total.reserve(scans);
+	transport.reserve(scans);
+	plan.reserve(scans);
+	uint64_t const period = static_cast<uint64_t>(1e9 / rate);
+	uint64_t next = VfhMonotonicNs();
+	uint64_t dropped = 0;
+	int lost = 0;
+	for (int i = 0; i < scans; ++i) {
+		next += period;
+		struct timespec const until = {
+			static_cast<time_t>(next / 1000000000ull),
+			static_cast<long>(next % 1000000000ull) };
+		::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+		in->sequence = i + 1;
+		in->stamp = i / rate;
+		in->sentNs = VfhMonotonicNs();
+		if (!inputs.push(*in)) {
+			++lost;
+			continue;
+		}
+		VfhShmCommand command;
+		if (!commands.wait(1000, spins) || !commands.pop(command)) {
+			++lost;
+			continue;
+		}
+		uint64_t const now = VfhMonotonicNs();
+		total.push_back(now - command.scanSentNs);
+		plan.push_back(command.planNs);
+		transport.push_back(now - command.scanSentNs - command.planNs);
+		dropped = command.droppedScans;
+	}
+	in->kind = VfhShmInput::KindStop;
+	inputs.push(*in);
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	::unlink(inputPath.c_str());
+	::unlink(commandPath.c_str());
+	printf(
+		"%s: %zu commands for %d scans at %.0lf Hz, %d lost, "
+		"%llu dropped, spins %d\n",
+		star ? "VfhStar" : "VfhPlus",
+		total.size(),
+		scans,
+		rate,
+		lost,
+		static_cast<unsigned long long>(dropped),
+		spins);
+	Report("total", total);
+	Report("plan", plan);
+	Report("transport", transport);
+	return ((lost == 0) && WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+		? 0 : 1;
+}
@@ -0,0 +1,323 @@
+/* ========================================================================
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ======================================================================== */
+/*
+ * a planner daemon without ROS: creates two shared-memory rings (see
+ * yuiwong/vfhshm.hpp), reads VfhShmInput scans and odometry from the
+ * first, plans with VfhPlus or VfhStar and writes a VfhShmCommand per
+ * planned scan to the second. when it falls behind, it plans only for the
+ * newest scan and counts the older ones dropped.
+ * the config file holds "name = value" lines, named as the demo node's
+ * params for VfhPlus (plus robot_radius) and as the Param fields for
+ * VfhStar; '#' starts a comment.
+ * -p spins the daemon polls the input ring that many times before it
+ * sleeps on the futex, trading a core for the wake-up latency: only
+ * worth it with a core to spare, on a single core it adds latency.
+ * usage: vfhshmd [-s] [-f config] [-n slots] [-p spins] input-ring
+ * command-ring
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include "yuiwong/vfhplus.hpp"
+#include "yuiwong/vfhshm.hpp"
+#include "yuiwong/vfhstar.hpp"
+namespace yuiwong
+{
+namespace
+{
+volatile sig_atomic_t stopping = 0;
+void OnSignal(int)
+{
+	stopping = 1;
+}
+/** @brief a config name and where its value goes */
+struct Field {
+	char const* name;
+	double* real;
+	int* integer;
+};
+bool ReadConfig(char const* const path, Field const* fields, size_t const n)
+{
+	FILE* const f = fopen(path, "r");
+	if (f == nullptr) {
+		return false;
+	}
+	bool ok = true;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr) {
+		if (char* const comment = strchr(line, '#')) {
+			*comment = 0;
+		}
+		char name[64];
+		double value;
+		if (sscanf(line, " %63[A-Za-z0-9_] = %lf", name, &value) != 2) {
+			if (strspn(line, " \t\r\n") != strlen(line)) {
+				fprintf(stderr, "%s: bad line: %s", path, line);
+				ok = false;
+			}
+			continue;
+		}
+		size_t i = 0;
+		while ((i < n) && (strcmp(fields[i].name, name) != 0)) {
+			++i;
+		}
+		if (i >= n) {
+			fprintf(stderr, "%s: unknown name %s\n", path, name);
+			ok = false;
+		} else if (fields[i].real != nullptr) {
+			*fields[i].real = value;
+		} else {
+			*fields[i].integer = static_cast<int>(value);
+		}
+	}
+	fclose(f);
+	return ok;
+}
+/** @brief the demo node's VfhPlus defaults, then the config file */
+std::unique_ptr<VfhPlus> MakeVfhPlus(char const* const config)
+{
+	VfhPlus::Param p;
+	p.cell_size = 100;
+	p.window_diameter = 60;
+	p.sector_angle = 5;
+	p.safety_dist_0ms = 100;
+	p.safety_dist_1ms = 100;
+	p.max_speed = 200;
+	p.max_speed_narrow_opening = 200;
+	p.max_speed_wide_opening = 300;
+	p.max_acceleration = 200;
+	p.min_turnrate = 40;
+	p.max_turnrate_0ms = 40;
+	p.max_turnrate_1ms = 40;
+	p.min_turn_radius_safety_factor = 1.0;
+	p.free_space_cutoff_0ms = 2000000.0;
+	p.obs_cutoff_0ms = 4000000.0;
+	p.free_space_cutoff_1ms = 2000000.0;
+	p.obs_cutoff_1ms = 4000000.0;
+	p.weight_desired_dir = 5.0;
+	p.weight_current_dir = 1.0;
+	double robotRadius = 300.0;
+	Field const fields[] = {
+		{ "safety_dist_0ms", &p.safety_dist_0ms, nullptr },
+		{ "safety_dist_1ms", &p.safety_dist_1ms, nullptr },
+		{ "max_speed", nullptr, &p.max_speed },
+		{ "max_speed_narrow_opening", nullptr, &p.max_speed_narrow_opening },
+		{ "max_speed_wide_opening", nullptr, &p.max_speed_wide_opening },
+		{ "max_acceleration", nullptr, &p.max_acceleration },
+		{ "min_turnrate", nullptr, &p.min_turnrate },
+		{ "max_turnrate_0ms", nullptr, &p.max_turnrate_0ms },
+		{ "max_turnrate_1ms", nullptr, &p.max_turnrate_1ms },
+		{ "free_space_cutoff_0ms", &p.free_space_cutoff_0ms, nullptr },
+		{ "obs_cutoff_0ms", &p.obs_cutoff_0ms, nullptr },
+		{ "free_space_cutoff_1ms", &p.free_space_cutoff_1ms, nullptr },
+		{ "obs_cutoff_1ms", &p.obs_cutoff_1ms, nullptr },
+		{ "weight_desired_dir", &p.weight_desired_dir, nullptr },
+		{ "weight_current_dir", &p.weight_current_dir, nullptr },
+		{ "robot_radius", &robotRadius, nullptr },
+	};
+	if ((config != nullptr) && !ReadConfig(
+		config, fields, sizeof(fields) / sizeof(fields[0]))) {
+		return nullptr;
+	}
+	std::unique_ptr<VfhPlus> vfh(new VfhPlus(p));
+	vfh->setRobotRadius(robotRadius);
+	vfh->init();
+	return vfh;
+}
+/** @brief the VfhStar defaults, then the config file */
+std::unique_ptr<VfhStar> MakeVfhStar(char const* const config)
+{
+	VfhStar::Param p;
+	/* a flag, read as an integer */
+	int reroot = p.rerootSearch ? 1 : 0;
+	Field const fields[] = {
+		{ "cellWidth", &p.cellWidth, nullptr },
+		{ "windowDiameter", nullptr, &p.windowDiameter },
+		{ "sectorAngle", &p.sectorAngle, nullptr },
+		{ "maxSpeed", &p.maxSpeed, nullptr },
+		{ "maxSpeedNarrowOpening", &p.maxSpeedNarrowOpening, nullptr },
+		{ "maxSpeedWideOpening", &p.maxSpeedWideOpening, nullptr },
+		{ "zeroSafetyDistance", &p.zeroSafetyDistance, nullptr },
+		{ "maxSafetyDistance", &p.maxSafetyDistance, nullptr },
+		{ "zeroMaxTurnrate", &p.zeroMaxTurnrate, nullptr },
+		{ "maxMaxTurnrate", &p.maxMaxTurnrate, nullptr },
+		{ "zeroFreeSpaceCutoff", &p.zeroFreeSpaceCutoff, nullptr },
+		{ "maxFreeSpaceCutoff", &p.maxFreeSpaceCutoff, nullptr },
+		{ "zeroObsCutoff", &p.zeroObsCutoff, nullptr },
+		{ "maxObsCutoff", &p.maxObsCutoff, nullptr },
+		{ "maxAcceleration", &p.maxAcceleration, nullptr },
+		{ "desiredDirectionWeight", &p.desiredDirectionWeight, nullptr },
+		{ "currentDirectionWeight", &p.currentDirectionWeight, nullptr },
+		{ "minTurnRadiusSafetyFactor",
+			&p.minTurnRadiusSafetyFactor, nullptr },
+		{ "robotRadius", &p.robotRadius, nullptr },
+		{ "stepDistance", &p.stepDistance, nullptr },
+		{ "processTimes", nullptr, &p.processTimes },
+		{ "discountFactor", &p.discountFactor, nullptr },
+		{ "searchNodes", nullptr, &p.searchNodes },
+		{ "transpositionEntries", nullptr, &p.transpositionEntries },
+		{ "rerootSearch", nullptr, &reroot },
+	};
+	if ((config != nullptr) && !ReadConfig(
+		config, fields, sizeof(fields) / sizeof(fields[0]))) {
+		return nullptr;
+	}
+	p.rerootSearch = reroot != 0;
+	std::unique_ptr<VfhStar> vfh(new VfhStar(p));
+	vfh->init();
+	return vfh;
+}
+template <typename Planner>
+int Serve(
+	Planner& vfh,
+	VfhShmRing& inputs,
+	VfhShmRing& commands,
+	int const spins)
+{
+	VfhShmInput odometry;
+	::memset(&odometry, 0, sizeof(odometry));
+	odometry.goalDistance = 1.0;
+	odometry.goalDistanceTolerance = 0.25;
+	/* one message popped, one pending scan: no copy of a newer scan */
+	std::unique_ptr<VfhShmInput> in(new VfhShmInput);
+	std::unique_ptr<VfhShmInput> scan(new VfhShmInput);
+	std::array<double, 361> ranges;
+	uint64_t droppedScans = 0;
+	uint64_t planned = 0;
+	while (stopping == 0) {
+		if (!inputs.wait(100, spins)) {
+			continue;
+		}
+		bool haveScan = false;
+		bool stop = false;
+		while (inputs.pop(*in)) {
+			switch (in->kind) {
+			case VfhShmInput::KindScan:
+				droppedScans += haveScan ? 1 : 0;
+				haveScan = true;
+				std::swap(in, scan);
+				break;
+			case VfhShmInput::KindOdometry:
+				odometry = *in;
+				break;
+			case VfhShmInput::KindStop:
+				stop = true;
+				break;
+			default:
+				break;
+			}
+		}
+		if (haveScan) {
+			::memcpy(ranges.data(), scan->laserRanges, sizeof(ranges));
+			VfhShmCommand command;
+			uint64_t const begin = VfhMonotonicNs();
+			vfh.update(
+				scan->stamp,
+				ranges,
+				odometry.currentLinearX,
+				odometry.goalDirection,
+				odometry.goalDistance,
+				odometry.goalDistanceTolerance,
+				command.chosenLinearX,
+				command.chosenAngularZ);
+			command.planNs = VfhMonotonicNs() - begin;
+			command.sequence = scan->sequence;
+			command.scanSentNs = scan->sentNs;
+			command.droppedScans = droppedScans;
+			command.stamp = scan->stamp;
+			/* a consumer that stopped reading loses commands, not us time */
+			commands.push(command);
+			++planned;
+		}
+		if (stop) {
+			break;
+		}
+	}
+	fprintf(stderr, "vfhshmd: %llu scans planned, %llu dropped\n",
+		static_cast<unsigned long long>(planned),
+		static_cast<unsigned long long>(droppedScans));
+	return 0;
+}
+}
+}
+int main(int argc, char** argv)
+{
+	using namespace yuiwong;
+	char const* const usage =
+		"usage: %s [-s] [-f config] [-n slots] [-p spins] "
+		"input-ring command-ring\n";
+	bool star = false;
+	char const* config = nullptr;
+	int slots = 64;
+	int spins = 0;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "sf:n:p:")) != -1) {
+		switch (opt) {
+		case 's':
+			star = true;
+			break;
+		case 'f':
+			config = optarg;
+			break;
+		case 'n':
+			slots = ::atoi(optarg);
+			break;
+		case 'p':
+			spins = ::atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return 2;
+		}
+	}
+	if (((optind + 2) != argc) || (slots <= 0)) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+	struct sigaction action;
+	::memset(&action, 0, sizeof(action));
+	action.sa_handler = OnSignal;
+	::sigaction(SIGINT, &action, nullptr);
+	::sigaction(SIGTERM, &action, nullptr);
+	std::unique_ptr<VfhPlus> plus;
+	std::unique_ptr<VfhStar> starPlanner;
+	if (star) {
+		starPlanner = MakeVfhStar(config);
+	} else {
+		plus = MakeVfhPlus(config);
+	}
+	if (!plus && !starPlanner) {
+		fprintf(stderr, "%s: bad config %s\n", argv[0], config);
+		return 2;
+	}
+	/* the command ring first: a client attaches to it after the input one */
+	VfhShmRing commands;
+	VfhShmRing inputs;
+	if (!commands.create(argv[optind + 1], sizeof(VfhShmCommand), slots)
+		|| !inputs.create(argv[optind], sizeof(VfhShmInput), slots)) {
+		fprintf(stderr, "%s: cannot create rings %s %s\n",
+			argv[0], argv[optind], argv[optind + 1]);
+		return 2;
+	}
+	return star
+		? Serve(*starPlanner, inputs, commands, spins)
+		: Serve(*plus, inputs, commands, spins);
+}